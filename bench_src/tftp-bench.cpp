@@ -0,0 +1,1073 @@
+/**
+ * @file tftp-bench.cpp
+ * @brief Loopback throughput benchmark of the TFTP server over a blksize/windowsize/file-size matrix
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-bench.h"
+
+// Datagram buffers of the benchmark client
+static char receiveBuffer[BENCH_MAX_PACKET];
+static char sendBuffer[BENCH_MAX_PACKET];
+
+// Retransmission timeout of the benchmark client, short timeouts keep runs through a lossy proxy fast
+static int benchTimeoutMs = DEFAULT_BENCH_TIMEOUT_MS;
+
+// Local port of the transfers, 0 for an ephemeral port per transfer
+static int benchLocalPort = 0;
+
+// Name of a benchmark file of the given size
+static std::string benchFileName(size_t size)
+{
+    return "bench-" + std::to_string(size) + ".bin";
+}
+
+// Deterministic content of a benchmark file, compresses as badly as real images
+static std::vector<char> benchContent(size_t size)
+{
+    std::vector<char> content(size);
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ size;
+    for (size_t i = 0; i < size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        content[i] = static_cast<char>(state);
+    }
+    return content;
+}
+
+// Returns a loopback UDP port that is free at the moment
+static int freeLoopbackPort()
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    socklen_t addressLength = sizeof(address);
+    int port = -1;
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+        getsockname(fd, (struct sockaddr *)&address, &addressLength) == 0)
+    {
+        port = ntohs(address.sin_port);
+    }
+
+    close(fd);
+    return port;
+}
+
+static sockaddr_in loopbackAddress(int port)
+{
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    return address;
+}
+
+// Opens the socket of one transfer
+static int openBenchSocket()
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int bufferSize = BENCH_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+    // A fixed client address keeps every transfer on the same worker of the server
+    if (benchLocalPort != 0)
+    {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in localAddr = loopbackAddress(benchLocalPort);
+        if (bind(fd, (struct sockaddr *)&localAddr, sizeof(localAddr)) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static bool sendPacket(int fd, const sockaddr_in &address, const char *data, size_t length, uint64_t &packets)
+{
+    packets++;
+    return sendto(fd, data, length, 0, (const struct sockaddr *)&address, sizeof(address)) == static_cast<ssize_t>(length);
+}
+
+// Receives one datagram, returns its length, 0 on timeout or -1 on error
+static ssize_t receivePacket(int fd, sockaddr_in &from, int timeoutMs, uint64_t &packets)
+{
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready <= 0)
+    {
+        return ready;
+    }
+
+    socklen_t fromLength = sizeof(from);
+    ssize_t length = recvfrom(fd, receiveBuffer, sizeof(receiveBuffer), 0, (struct sockaddr *)&from, &fromLength);
+    if (length < 4)
+    {
+        return length < 0 ? -1 : 0;
+    }
+
+    packets++;
+    return length;
+}
+
+static bool sendAckPacket(int fd, const sockaddr_in &address, uint16_t block, uint64_t &packets)
+{
+    char ack[4] = {0, static_cast<char>(BENCH_ACK), static_cast<char>(block >> 8), static_cast<char>(block & 0xFF)};
+    return sendPacket(fd, address, ack, sizeof(ack), packets);
+}
+
+// Builds a request with the blksize, windowsize, (for WRQ) tsize and (with -t) utimeout options
+static size_t buildRequest(uint16_t opcode, const std::string &filename, const TFTPBenchCase &benchCase)
+{
+    std::string request;
+    request.push_back(0);
+    request.push_back(static_cast<char>(opcode));
+    request += filename + '\0' + "octet" + '\0';
+    request += std::string("blksize") + '\0' + std::to_string(benchCase.blksize) + '\0';
+    request += std::string("windowsize") + '\0' + std::to_string(benchCase.windowsize) + '\0';
+    if (opcode == BENCH_WRQ)
+    {
+        request += std::string("tsize") + '\0' + std::to_string(benchCase.fileSize) + '\0';
+    }
+    if (benchTimeoutMs != DEFAULT_BENCH_TIMEOUT_MS)
+    {
+        // The server retransmits and gives up on the same timeout as the client
+        request += std::string("utimeout") + '\0' + std::to_string(benchTimeoutMs * 1000) + '\0';
+    }
+
+    memcpy(sendBuffer, request.data(), request.size());
+    return request.size();
+}
+
+static uint16_t packetOpcode()
+{
+    return (static_cast<uint8_t>(receiveBuffer[0]) << 8) | static_cast<uint8_t>(receiveBuffer[1]);
+}
+
+static uint16_t packetBlock()
+{
+    return (static_cast<uint8_t>(receiveBuffer[2]) << 8) | static_cast<uint8_t>(receiveBuffer[3]);
+}
+
+TFTPBenchTransfer runReadTransfer(int port, const std::string &filename, const TFTPBenchCase &benchCase, const std::vector<char> &content)
+{
+    TFTPBenchTransfer transfer;
+    transfer.success = false;
+    transfer.packets = 0;
+    transfer.seconds = 0;
+
+    int fd = openBenchSocket();
+    if (fd < 0)
+    {
+        return transfer;
+    }
+
+    sockaddr_in serverAddr = loopbackAddress(port);
+    sockaddr_in transferAddr;
+    bool connected = false;
+    size_t requestLength = buildRequest(BENCH_RRQ, filename, benchCase);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    sendPacket(fd, serverAddr, sendBuffer, requestLength, transfer.packets);
+
+    uint64_t expected = 1;   // Index of the next block
+    uint64_t lastAcked = 0;  // Last block acknowledged
+    uint16_t sinceAck = 0;   // Blocks received since lastAcked
+    uint64_t received = 0;   // Bytes received in order
+    int retries = 0;
+    bool done = false;
+
+    while (!done)
+    {
+        sockaddr_in from;
+        ssize_t length = receivePacket(fd, from, benchTimeoutMs, transfer.packets);
+        if (length < 0)
+        {
+            break;
+        }
+        if (length == 0)
+        {
+            // Repeat the request or acknowledge the last block received in order again
+            if (++retries > BENCH_MAX_RETRIES)
+            {
+                break;
+            }
+            if (!connected)
+            {
+                sendPacket(fd, serverAddr, sendBuffer, requestLength, transfer.packets);
+            }
+            else
+            {
+                sendAckPacket(fd, transferAddr, lastAcked & 0xFFFF, transfer.packets);
+            }
+            continue;
+        }
+
+        if (connected && from.sin_port != transferAddr.sin_port)
+        {
+            continue;
+        }
+        transferAddr = from;
+        connected = true;
+
+        uint16_t opcode = packetOpcode();
+        if (opcode == BENCH_ERROR)
+        {
+            break;
+        }
+        if (opcode == BENCH_OACK)
+        {
+            if (expected == 1)
+            {
+                sendAckPacket(fd, transferAddr, 0, transfer.packets);
+            }
+            continue;
+        }
+        if (opcode != BENCH_DATA)
+        {
+            continue;
+        }
+
+        uint16_t block = packetBlock();
+        size_t dataLength = length - 4;
+        if (block != (expected & 0xFFFF))
+        {
+            // A block of the window was lost, the server resends the window after this ACK
+            if (lastAcked != expected - 1)
+            {
+                sendAckPacket(fd, transferAddr, (expected - 1) & 0xFFFF, transfer.packets);
+                lastAcked = expected - 1;
+                sinceAck = 0;
+            }
+            continue;
+        }
+
+        uint64_t offset = (expected - 1) * benchCase.blksize;
+        if (offset + dataLength > content.size() || memcmp(receiveBuffer + 4, content.data() + offset, dataLength) != 0)
+        {
+            break;
+        }
+
+        received += dataLength;
+        retries = 0;
+        sinceAck++;
+
+        bool final = dataLength < benchCase.blksize;
+        if (final || sinceAck >= benchCase.windowsize)
+        {
+            sendAckPacket(fd, transferAddr, block, transfer.packets);
+            lastAcked = expected;
+            sinceAck = 0;
+        }
+        expected++;
+        done = final;
+    }
+
+    transfer.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    transfer.success = done && received == content.size();
+    close(fd);
+    return transfer;
+}
+
+// Sends the DATA blocks first..last of an upload
+static bool sendWindow(int fd, const sockaddr_in &address, const TFTPBenchCase &benchCase, const std::vector<char> &content, uint64_t first, uint64_t last, uint64_t &packets)
+{
+    for (uint64_t block = first; block <= last; block++)
+    {
+        uint64_t offset = (block - 1) * benchCase.blksize;
+        size_t dataLength = std::min<uint64_t>(benchCase.blksize, content.size() - offset);
+
+        sendBuffer[0] = 0;
+        sendBuffer[1] = static_cast<char>(BENCH_DATA);
+        sendBuffer[2] = static_cast<char>((block >> 8) & 0xFF);
+        sendBuffer[3] = static_cast<char>(block & 0xFF);
+        memcpy(sendBuffer + 4, content.data() + offset, dataLength);
+
+        if (!sendPacket(fd, address, sendBuffer, dataLength + 4, packets))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+TFTPBenchTransfer runWriteTransfer(int port, const std::string &filename, const TFTPBenchCase &benchCase, const std::vector<char> &content)
+{
+    TFTPBenchTransfer transfer;
+    transfer.success = false;
+    transfer.packets = 0;
+    transfer.seconds = 0;
+
+    int fd = openBenchSocket();
+    if (fd < 0)
+    {
+        return transfer;
+    }
+
+    sockaddr_in serverAddr = loopbackAddress(port);
+    sockaddr_in transferAddr;
+    bool connected = false;
+    size_t requestLength = buildRequest(BENCH_WRQ, filename, benchCase);
+
+    // The block shorter than blksize (possibly empty) ends the upload
+    uint64_t finalBlock = content.size() / benchCase.blksize + 1;
+    uint64_t windowStart = 1;
+    uint64_t windowEnd = 0;
+    int retries = 0;
+    bool done = false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    sendPacket(fd, serverAddr, sendBuffer, requestLength, transfer.packets);
+
+    while (!done)
+    {
+        sockaddr_in from;
+        ssize_t length = receivePacket(fd, from, benchTimeoutMs, transfer.packets);
+        if (length < 0)
+        {
+            break;
+        }
+        if (length == 0)
+        {
+            // Repeat the request or the unacknowledged window
+            if (++retries > BENCH_MAX_RETRIES)
+            {
+                break;
+            }
+            if (!connected)
+            {
+                buildRequest(BENCH_WRQ, filename, benchCase);
+                sendPacket(fd, serverAddr, sendBuffer, requestLength, transfer.packets);
+            }
+            else if (!sendWindow(fd, transferAddr, benchCase, content, windowStart, windowEnd, transfer.packets))
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (connected && from.sin_port != transferAddr.sin_port)
+        {
+            continue;
+        }
+
+        uint16_t opcode = packetOpcode();
+        if (opcode == BENCH_ERROR)
+        {
+            break;
+        }
+
+        uint64_t acked;
+        if (!connected)
+        {
+            // OACK or ACK 0 of the request
+            if (opcode != BENCH_OACK && !(opcode == BENCH_ACK && packetBlock() == 0))
+            {
+                continue;
+            }
+            transferAddr = from;
+            connected = true;
+            acked = 0;
+        }
+        else
+        {
+            if (opcode != BENCH_ACK)
+            {
+                continue;
+            }
+
+            // Blocks of the window acknowledged by the ACK, duplicates acknowledge none
+            uint16_t distance = packetBlock() - static_cast<uint16_t>((windowStart - 1) & 0xFFFF);
+            if (distance == 0 || windowStart - 1 + distance > windowEnd)
+            {
+                continue;
+            }
+            acked = windowStart - 1 + distance;
+        }
+
+        retries = 0;
+        if (acked == finalBlock)
+        {
+            done = true;
+            break;
+        }
+
+        windowStart = acked + 1;
+        windowEnd = std::min<uint64_t>(windowStart + benchCase.windowsize - 1, finalBlock);
+        if (!sendWindow(fd, transferAddr, benchCase, content, windowStart, windowEnd, transfer.packets))
+        {
+            break;
+        }
+    }
+
+    transfer.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    transfer.success = done;
+    close(fd);
+    return transfer;
+}
+
+// Waits until a request to the port is answered (an ERROR for a missing file)
+static bool waitForAnswer(pid_t pid, int port)
+{
+    int fd = openBenchSocket();
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    sockaddr_in serverAddr = loopbackAddress(port);
+    TFTPBenchCase probe = {BENCH_RRQ, 512, 1, 0, 0};
+    size_t requestLength = buildRequest(BENCH_RRQ, "bench-probe.missing", probe);
+
+    bool ready = false;
+    uint64_t packets = 0;
+    for (int attempt = 0; attempt < 50 && !ready; attempt++)
+    {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            break;
+        }
+
+        sockaddr_in from;
+        sendPacket(fd, serverAddr, sendBuffer, requestLength, packets);
+        ready = receivePacket(fd, from, 100, packets) > 0;
+    }
+
+    close(fd);
+    return ready;
+}
+
+// Starts a program with its arguments and additional space separated arguments, its output is discarded
+// unless a file for the standard output is given
+static pid_t spawnProcess(std::vector<std::string> args, const std::string &extraArgs, const std::string &lastArg, const std::string &outputPath)
+{
+    std::istringstream extra(extraArgs);
+    std::string arg;
+    while (extra >> arg)
+    {
+        args.push_back(arg);
+    }
+    if (!lastArg.empty())
+    {
+        args.push_back(lastArg);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cerr << "Error: Failed to start " << args[0] << ": " << strerror(errno) << std::endl;
+        return pid;
+    }
+    if (pid == 0)
+    {
+        int devNull = open("/dev/null", O_RDWR);
+        dup2(devNull, STDIN_FILENO);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        if (!outputPath.empty())
+        {
+            int output = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(output, STDOUT_FILENO);
+        }
+
+        std::vector<char *> argv;
+        for (std::string &value : args)
+        {
+            argv.push_back(&value[0]);
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+bool startBenchServer(const std::string &serverPath, const std::string &serverArgs, const std::vector<size_t> &fileSizes, bool keepOutput,
+                      TFTPBenchServer &server)
+{
+    server.pid = -1;
+    server.proxyPid = -1;
+
+    char root[] = "/tmp/tftp-bench.XXXXXX";
+    if (mkdtemp(root) == nullptr)
+    {
+        std::cerr << "Error: Failed to create the root directory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    server.root = root;
+
+    for (size_t size : fileSizes)
+    {
+        std::vector<char> content = benchContent(size);
+        std::ofstream file(server.root + "/" + benchFileName(size), std::ios::binary);
+        file.write(content.data(), content.size());
+        if (!file)
+        {
+            std::cerr << "Error: Failed to create " << benchFileName(size) << std::endl;
+            return false;
+        }
+    }
+
+    server.port = freeLoopbackPort();
+    server.transferPort = server.port;
+    if (server.port < 0)
+    {
+        std::cerr << "Error: No free loopback port" << std::endl;
+        return false;
+    }
+
+    // The log is limited to errors, formatting it is not part of the measured work
+    server.pid = spawnProcess({serverPath, "-p", std::to_string(server.port), "-l", "error"}, serverArgs, server.root,
+                              keepOutput ? server.root + "/" + BENCH_SERVER_OUTPUT : "");
+    if (server.pid < 0)
+    {
+        return false;
+    }
+
+    if (!waitForAnswer(server.pid, server.port))
+    {
+        std::cerr << "Error: The server at " << serverPath << " does not answer on port " << server.port << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool startImpairProxy(const std::string &impairPath, const std::string &impairArgs, double loss, TFTPBenchServer &server)
+{
+    int port = freeLoopbackPort();
+    if (port < 0)
+    {
+        std::cerr << "Error: No free loopback port" << std::endl;
+        return false;
+    }
+
+    std::ostringstream lossArg;
+    lossArg << loss;
+    server.proxyPid = spawnProcess({impairPath, "-l", std::to_string(port), "-s", "127.0.0.1:" + std::to_string(server.port), "--loss", lossArg.str()},
+                                   impairArgs, "", "");
+    if (server.proxyPid < 0)
+    {
+        return false;
+    }
+
+    if (!waitForAnswer(server.proxyPid, port))
+    {
+        std::cerr << "Error: The impairment proxy at " << impairPath << " does not answer on port " << port << std::endl;
+        return false;
+    }
+    server.transferPort = port;
+    return true;
+}
+
+void stopImpairProxy(TFTPBenchServer &server)
+{
+    if (server.proxyPid > 0)
+    {
+        kill(server.proxyPid, SIGINT);
+        waitpid(server.proxyPid, nullptr, 0);
+        server.proxyPid = -1;
+    }
+    server.transferPort = server.port;
+}
+
+void stopBenchServer(TFTPBenchServer &server)
+{
+    stopImpairProxy(server);
+    if (server.pid > 0)
+    {
+        kill(server.pid, SIGINT);
+        waitpid(server.pid, nullptr, 0);
+        server.pid = -1;
+    }
+
+    DIR *dir = opendir(server.root.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    while (dirent *entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            unlink((server.root + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(server.root.c_str());
+}
+
+double processCpuSeconds(pid_t pid)
+{
+    // The scheduler statistics of every thread count nanoseconds, /proc/pid/stat only clock ticks
+    std::string taskDir = "/proc/" + std::to_string(pid) + "/task";
+    DIR *dir = opendir(taskDir.c_str());
+    if (dir != nullptr)
+    {
+        double seconds = 0;
+        bool found = false;
+        while (dirent *entry = readdir(dir))
+        {
+            std::ifstream schedstat(taskDir + "/" + entry->d_name + "/schedstat");
+            unsigned long long runNs;
+            if (entry->d_name[0] != '.' && schedstat >> runNs)
+            {
+                seconds += runNs / 1e9;
+                found = true;
+            }
+        }
+        closedir(dir);
+        if (found)
+        {
+            return seconds;
+        }
+    }
+
+    // utime and stime are the 14th and 15th fields, the command name may contain spaces
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    std::getline(stat, line);
+    size_t end = line.rfind(')');
+    if (end == std::string::npos)
+    {
+        return 0;
+    }
+    std::istringstream fields(line.substr(end + 2));
+    std::string field;
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++)
+    {
+        if (i == 14)
+        {
+            utime = std::strtoull(field.c_str(), nullptr, 10);
+        }
+        else if (i == 15)
+        {
+            stime = std::strtoull(field.c_str(), nullptr, 10);
+        }
+    }
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double clientCpuSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+TFTPBenchResult runBenchCase(TFTPBenchServer &server, const TFTPBenchCase &benchCase, int runs, const std::vector<char> &content)
+{
+    TFTPBenchResult result;
+    result.benchCase = benchCase;
+    result.runs = runs;
+    result.failures = 0;
+
+    std::vector<double> times;
+    uint64_t packets = 0;
+    double seconds = 0;
+    double serverCpu = 0;
+    double clientCpu = 0;
+
+    // The first transfer only warms up the page cache and the server
+    for (int run = 0; run <= runs; run++)
+    {
+        std::string filename = benchFileName(benchCase.fileSize);
+        if (benchCase.opcode == BENCH_WRQ)
+        {
+            filename = "upload-" + std::to_string(benchCase.blksize) + "-" + std::to_string(benchCase.windowsize) + "-" + filename;
+        }
+
+        double serverBefore = processCpuSeconds(server.pid);
+        double clientBefore = clientCpuSeconds();
+
+        TFTPBenchTransfer transfer = benchCase.opcode == BENCH_RRQ ? runReadTransfer(server.transferPort, filename, benchCase, content)
+                                                                   : runWriteTransfer(server.transferPort, filename, benchCase, content);
+
+        double clientUsed = clientCpuSeconds() - clientBefore;
+        double serverUsed = processCpuSeconds(server.pid) - serverBefore;
+
+        if (benchCase.opcode == BENCH_WRQ)
+        {
+            // The writer thread renames the upload after the last ACK, the next run replaces it
+            std::string path = server.root + "/" + filename;
+            struct stat fileStat;
+            for (int i = 0; i < 100 && transfer.success && (stat(path.c_str(), &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) != content.size()); i++)
+            {
+                usleep(10000);
+            }
+            serverUsed = processCpuSeconds(server.pid) - serverBefore;
+            unlink(path.c_str());
+        }
+
+        if (run == 0)
+        {
+            continue;
+        }
+        if (!transfer.success)
+        {
+            result.failures++;
+            continue;
+        }
+
+        times.push_back(transfer.seconds);
+        packets += transfer.packets;
+        seconds += transfer.seconds;
+        serverCpu += serverUsed;
+        clientCpu += clientUsed;
+    }
+
+    std::sort(times.begin(), times.end());
+    double gigabytes = static_cast<double>(benchCase.fileSize) * times.size() / 1e9;
+
+    result.mbPerSecond = seconds > 0 ? benchCase.fileSize * times.size() / 1e6 / seconds : 0;
+    result.packetsPerSecond = seconds > 0 ? packets / seconds : 0;
+    result.serverCpuPerGb = gigabytes > 0 ? serverCpu / gigabytes : 0;
+    result.clientCpuPerGb = gigabytes > 0 ? clientCpu / gigabytes : 0;
+    result.p50Ms = percentile(times, 0.5) * 1000;
+    result.p99Ms = percentile(times, 0.99) * 1000;
+    return result;
+}
+
+// Asks the server for its statistics and returns the heap allocations of its next report, -1 if none comes
+static long long serverAllocations(const TFTPBenchServer &server, int &reports)
+{
+    const std::string prefix = "Heap allocations: ";
+    kill(server.pid, SIGUSR1);
+
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        usleep(10000);
+
+        std::ifstream output(server.root + "/" + BENCH_SERVER_OUTPUT);
+        std::string line;
+        int seen = 0;
+        long long count = -1;
+        while (std::getline(output, line))
+        {
+            if (line.compare(0, prefix.size(), prefix) == 0)
+            {
+                seen++;
+                count = std::atoll(line.c_str() + prefix.size());
+            }
+        }
+        if (seen > reports)
+        {
+            reports = seen;
+            return count;
+        }
+    }
+    return -1;
+}
+
+// Runs one transfer of the allocation check, an upload is waited for until it is renamed over its destination
+static bool runAllocTransfer(TFTPBenchServer &server, uint16_t opcode, const std::string &name, const std::vector<char> &content)
+{
+    TFTPBenchCase benchCase = {opcode, 1428, 4, content.size(), 0};
+    if (opcode == BENCH_RRQ)
+    {
+        return runReadTransfer(server.transferPort, name, benchCase, content).success;
+    }
+
+    std::string filename = "upload-" + name;
+    if (!runWriteTransfer(server.transferPort, filename, benchCase, content).success)
+    {
+        return false;
+    }
+
+    std::string path = server.root + "/" + filename;
+    struct stat fileStat;
+    for (int i = 0; i < 100 && (stat(path.c_str(), &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) != content.size()); i++)
+    {
+        usleep(10000);
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool runAllocCheck(TFTPBenchServer &server)
+{
+    // The measured names have the same length, a name that fits into a std::string without allocating would skew the count,
+    // and differ from the warm-up so that no request is taken for a duplicate of the previous one
+    std::vector<char> small = benchContent(ALLOC_CHECK_SMALL_SIZE);
+    std::vector<char> large = benchContent(ALLOC_CHECK_LARGE_SIZE);
+    std::ofstream(server.root + "/alloc-warmup.bin", std::ios::binary).write(small.data(), small.size());
+    std::ofstream(server.root + "/alloc-small.bin", std::ios::binary).write(small.data(), small.size());
+    std::ofstream(server.root + "/alloc-large.bin", std::ios::binary).write(large.data(), large.size());
+
+    // Workers set up their pools on their first transfer, all transfers have to reach the same one
+    benchLocalPort = freeLoopbackPort();
+    if (benchLocalPort < 0)
+    {
+        std::cerr << "Error: No free loopback port" << std::endl;
+        return false;
+    }
+
+    bool passed = true;
+    int reports = 0;
+    for (uint16_t opcode : {BENCH_RRQ, BENCH_WRQ})
+    {
+        // The warm-up sets up the per-thread pools, the writer thread and the statistics of the server
+        bool transferred = runAllocTransfer(server, opcode, "alloc-warmup.bin", small);
+        long long before = serverAllocations(server, reports);
+        transferred = runAllocTransfer(server, opcode, "alloc-small.bin", small) && transferred;
+        long long afterSmall = serverAllocations(server, reports);
+        transferred = runAllocTransfer(server, opcode, "alloc-large.bin", large) && transferred;
+        long long afterLarge = serverAllocations(server, reports);
+
+        if (before < 0 || afterSmall < 0 || afterLarge < 0)
+        {
+            std::cerr << "Error: The server does not report heap allocations, build it with ALLOC_STATS=1" << std::endl;
+            return false;
+        }
+        if (!transferred)
+        {
+            std::cerr << "Error: A transfer of the allocation check failed" << std::endl;
+            return false;
+        }
+
+        long long smallCount = afterSmall - before;
+        long long largeCount = afterLarge - afterSmall;
+        std::cerr << (opcode == BENCH_RRQ ? "rrq" : "wrq") << " allocations: " << ALLOC_CHECK_SMALL_SIZE << " B -> " << smallCount << ", "
+                  << ALLOC_CHECK_LARGE_SIZE << " B -> " << largeCount << (smallCount == largeCount ? " ok" : " FAIL") << std::endl;
+        passed = passed && smallCount == largeCount;
+    }
+    return passed;
+}
+
+// Escapes a string for a JSON string literal
+static std::string jsonString(const std::string &value)
+{
+    std::string escaped = "\"";
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+    }
+    return escaped + "\"";
+}
+
+void writeBenchJson(std::ostream &out, const std::string &serverPath, const std::string &serverArgs, const std::string &impairArgs, int runs,
+                    const std::vector<TFTPBenchResult> &results)
+{
+    out << std::fixed << std::setprecision(3)
+        << "{\n"
+        << "  \"server\": " << jsonString(serverPath) << ",\n"
+        << "  \"server_args\": " << jsonString(serverArgs) << ",\n"
+        << "  \"impair_args\": " << jsonString(impairArgs) << ",\n"
+        << "  \"runs\": " << runs << ",\n"
+        << "  \"timeout_ms\": " << benchTimeoutMs << ",\n"
+        << "  \"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const TFTPBenchResult &result = results[i];
+        out << "    {\"op\": \"" << (result.benchCase.opcode == BENCH_RRQ ? "rrq" : "wrq") << "\""
+            << ", \"loss\": " << std::setprecision(4) << result.benchCase.loss << std::setprecision(3)
+            << ", \"blksize\": " << result.benchCase.blksize
+            << ", \"windowsize\": " << result.benchCase.windowsize
+            << ", \"file_size\": " << result.benchCase.fileSize
+            << ", \"runs\": " << result.runs
+            << ", \"failures\": " << result.failures
+            << ", \"mb_per_s\": " << result.mbPerSecond
+            << ", \"packets_per_s\": " << result.packetsPerSecond
+            << ", \"server_cpu_s_per_gb\": " << result.serverCpuPerGb
+            << ", \"client_cpu_s_per_gb\": " << result.clientCpuPerGb
+            << ", \"p50_ms\": " << result.p50Ms
+            << ", \"p99_ms\": " << result.p99Ms
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n"
+        << "}\n";
+}
+
+static void printBenchUsage()
+{
+    std::cerr << "Usage: tftp-bench [-n runs] [-a \"server arguments\"] [-t timeout_ms] [--quick] [--alloc-check]"
+              << " [-I path/to/tftp-impair -L loss,... [-A \"impair arguments\"]] path/to/tftp-server" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string serverPath;
+    std::string serverArgs;
+    std::string impairPath;
+    std::string impairArgs;
+    std::vector<double> lossRates;
+    int runs = DEFAULT_BENCH_RUNS;
+    bool quick = false;
+    bool allocCheck = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            runs = std::atoi(argv[++i]);
+        }
+        else if (arg == "-a" && i + 1 < argc)
+        {
+            serverArgs = argv[++i];
+        }
+        else if (arg == "-t" && i + 1 < argc && std::atoi(argv[i + 1]) >= 10)
+        {
+            benchTimeoutMs = std::atoi(argv[++i]);
+        }
+        else if (arg == "-I" && i + 1 < argc)
+        {
+            impairPath = argv[++i];
+        }
+        else if (arg == "-A" && i + 1 < argc)
+        {
+            impairArgs = argv[++i];
+        }
+        else if (arg == "-L" && i + 1 < argc)
+        {
+            std::istringstream rates(argv[++i]);
+            std::string rate;
+            while (std::getline(rates, rate, ','))
+            {
+                lossRates.push_back(std::atof(rate.c_str()));
+            }
+        }
+        else if (arg == "--quick")
+        {
+            quick = true;
+        }
+        else if (arg == "--alloc-check")
+        {
+            allocCheck = true;
+        }
+        else if (arg[0] != '-')
+        {
+            serverPath = arg;
+        }
+        else
+        {
+            printBenchUsage();
+            return 1;
+        }
+    }
+
+    if (serverPath.empty() || (impairPath.empty() && (!lossRates.empty() || !impairArgs.empty())))
+    {
+        printBenchUsage();
+        return 1;
+    }
+
+    if (allocCheck)
+    {
+        TFTPBenchServer server;
+        bool passed = startBenchServer(serverPath, serverArgs, std::vector<size_t>(), true, server) && runAllocCheck(server);
+        stopBenchServer(server);
+        return passed ? 0 : 1;
+    }
+
+    // Without the proxy the matrix runs once over plain loopback
+    bool impaired = !impairPath.empty();
+    if (lossRates.empty())
+    {
+        lossRates.push_back(0);
+    }
+
+    // The quick matrix keeps a run under a minute for checking a change
+    std::vector<uint16_t> blockSizes = quick ? std::vector<uint16_t>{512, 1428, 65464} : std::vector<uint16_t>{512, 1428, 8192, 65464};
+    std::vector<uint16_t> windowSizes = quick ? std::vector<uint16_t>{1, 16} : std::vector<uint16_t>{1, 4, 16};
+    std::vector<size_t> fileSizes = quick ? std::vector<size_t>{64 * 1024, 1024 * 1024} : std::vector<size_t>{64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+    TFTPBenchServer server;
+    if (!startBenchServer(serverPath, serverArgs, fileSizes, false, server))
+    {
+        stopBenchServer(server);
+        return 1;
+    }
+
+    std::vector<TFTPBenchResult> results;
+    int failures = 0;
+    for (double loss : lossRates)
+    {
+        if (impaired && !startImpairProxy(impairPath, impairArgs, loss, server))
+        {
+            stopBenchServer(server);
+            return 1;
+        }
+
+        for (uint16_t opcode : {BENCH_RRQ, BENCH_WRQ})
+        {
+            for (size_t fileSize : fileSizes)
+            {
+                std::vector<char> content = benchContent(fileSize);
+                for (uint16_t blksize : blockSizes)
+                {
+                    for (uint16_t windowsize : windowSizes)
+                    {
+                        TFTPBenchCase benchCase = {opcode, blksize, windowsize, fileSize, loss};
+                        TFTPBenchResult result = runBenchCase(server, benchCase, runs, content);
+                        results.push_back(result);
+
+                        // Transfers failed by the impairments are part of the curve, not an error of the server
+                        if (loss == 0)
+                        {
+                            failures += result.failures;
+                        }
+
+                        // Progress goes to the standard error output, the JSON to the standard output
+                        std::cerr << (opcode == BENCH_RRQ ? "rrq" : "wrq");
+                        if (impaired)
+                        {
+                            std::cerr << " loss=" << loss;
+                        }
+                        std::cerr << " size=" << fileSize << " blksize=" << blksize << " windowsize=" << windowsize << " " << std::fixed
+                                  << std::setprecision(1) << result.mbPerSecond << " MB/s p50=" << result.p50Ms << " ms failures=" << result.failures
+                                  << std::defaultfloat << std::endl;
+                    }
+                }
+            }
+        }
+
+        stopImpairProxy(server);
+    }
+
+    stopBenchServer(server);
+    writeBenchJson(std::cout, serverPath, serverArgs, impairArgs, runs, results);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file tftp-bench.h
+ * @brief Declarations for the loopback throughput benchmark of the TFTP server.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_BENCH_H
+#define TFTP_BENCH_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+
+// TFTP operations
+const uint16_t BENCH_RRQ = 1;
+const uint16_t BENCH_WRQ = 2;
+const uint16_t BENCH_DATA = 3;
+const uint16_t BENCH_ACK = 4;
+const uint16_t BENCH_ERROR = 5;
+const uint16_t BENCH_OACK = 6;
+
+// Default retransmission timeout of the benchmark client
+const int DEFAULT_BENCH_TIMEOUT_MS = 1000;
+
+// Retransmissions of one packet before a transfer is counted as failed
+const int BENCH_MAX_RETRIES = 5;
+
+// Measured transfers of every cell of the matrix (one more unmeasured transfer warms the page cache)
+const int DEFAULT_BENCH_RUNS = 5;
+
+// Receive buffer of the benchmark socket, large windows of large blocks must not be dropped by the client
+const int BENCH_SOCKET_BUFFER = 8 * 1024 * 1024;
+
+// Largest datagram of a transfer (maximum blksize + DATA header)
+const size_t BENCH_MAX_PACKET = 65468;
+
+// One cell of the benchmark matrix
+struct TFTPBenchCase
+{
+    uint16_t opcode; // BENCH_RRQ or BENCH_WRQ
+    uint16_t blksize;
+    uint16_t windowsize;
+    size_t fileSize;
+    double loss; // Loss rate of the impairment proxy, 0 without the proxy
+};
+
+// Result of one transfer
+struct TFTPBenchTransfer
+{
+    bool success;
+    double seconds;   // From sending the request to the last packet of the transfer
+    uint64_t packets; // Datagrams sent and received by the client
+};
+
+// Results of one cell of the matrix
+struct TFTPBenchResult
+{
+    TFTPBenchCase benchCase;
+    int runs;
+    int failures;
+    double mbPerSecond;      // File bytes per second of the successful transfers (10^6 bytes)
+    double packetsPerSecond; // Datagrams per second of the successful transfers
+    double serverCpuPerGb;   // CPU seconds of the server per 10^9 transferred bytes
+    double clientCpuPerGb;   // CPU seconds of the benchmark client per 10^9 transferred bytes
+    double p50Ms;            // Median transfer time
+    double p99Ms;            // 99th percentile transfer time (nearest rank)
+};
+
+// Transfer sizes of the allocation check, the heap allocations of the server must not depend on them
+const size_t ALLOC_CHECK_SMALL_SIZE = 1024;
+const size_t ALLOC_CHECK_LARGE_SIZE = 3 * 1024 * 1024;
+
+// Standard output of the server in its root directory, kept by the allocation check
+const std::string BENCH_SERVER_OUTPUT = "server.out";
+
+// Server started by the benchmark
+struct TFTPBenchServer
+{
+    pid_t pid;
+    int port;
+    std::string root;  // Temporary root directory holding the benchmark files
+    pid_t proxyPid;    // Impairment proxy in front of the server, -1 without it
+    int transferPort;  // Port the transfers are sent to (the server or the proxy)
+};
+
+/**
+ * @brief Starts the server on a free loopback port over a new temporary root directory.
+ *
+ * @param serverPath Path to the tftp-server executable.
+ * @param serverArgs Additional arguments of the server (split on spaces).
+ * @param fileSizes Sizes of the files created in the root directory.
+ * @param keepOutput True to write the standard output of the server to BENCH_SERVER_OUTPUT in the root directory, otherwise it is discarded.
+ * @param server Started server.
+ * @return True if the server answers requests, otherwise False.
+ */
+bool startBenchServer(const std::string &serverPath, const std::string &serverArgs, const std::vector<size_t> &fileSizes, bool keepOutput,
+                      TFTPBenchServer &server);
+
+/**
+ * @brief Checks that the heap allocations of the server do not grow with the size of a transfer.
+ *
+ * Downloads and uploads a small and a large file after a warm-up transfer and compares the heap
+ * allocations the server reports on SIGUSR1 (built with ALLOC_STATS=1) for each of them.
+ *
+ * @param server Server started with its standard output kept.
+ * @return True if both sizes cost the server the same number of allocations, otherwise False.
+ */
+bool runAllocCheck(TFTPBenchServer &server);
+
+/**
+ * @brief Stops the server and removes its root directory.
+ *
+ * @param server Started server.
+ */
+void stopBenchServer(TFTPBenchServer &server);
+
+/**
+ * @brief Starts the impairment proxy on a free loopback port in front of the server.
+ *
+ * @param impairPath Path to the tftp-impair executable.
+ * @param impairArgs Additional arguments of the proxy (split on spaces).
+ * @param loss Loss rate of the proxy.
+ * @param server Started server, the transfers are sent to the proxy from now on.
+ * @return True if the proxy passes requests to the server, otherwise False.
+ */
+bool startImpairProxy(const std::string &impairPath, const std::string &impairArgs, double loss, TFTPBenchServer &server);
+
+/**
+ * @brief Stops the impairment proxy, the transfers are sent to the server again.
+ *
+ * @param server Started server.
+ */
+void stopImpairProxy(TFTPBenchServer &server);
+
+/**
+ * @brief Returns the CPU time used so far by all threads of a process.
+ *
+ * @param pid Process ID.
+ * @return CPU time in seconds.
+ */
+double processCpuSeconds(pid_t pid);
+
+/**
+ * @brief Downloads a file and checks its content.
+ *
+ * @param port Listening port of the server.
+ * @param filename Name of the file in the root directory.
+ * @param benchCase Block size and window size of the transfer.
+ * @param content Expected content of the file.
+ * @return Result of the transfer.
+ */
+TFTPBenchTransfer runReadTransfer(int port, const std::string &filename, const TFTPBenchCase &benchCase, const std::vector<char> &content);
+
+/**
+ * @brief Uploads a file.
+ *
+ * @param port Listening port of the server.
+ * @param filename Name of the destination file in the root directory.
+ * @param benchCase Block size and window size of the transfer.
+ * @param content Content of the file.
+ * @return Result of the transfer.
+ */
+TFTPBenchTransfer runWriteTransfer(int port, const std::string &filename, const TFTPBenchCase &benchCase, const std::vector<char> &content);
+
+/**
+ * @brief Runs the transfers of one cell of the matrix and computes its results.
+ *
+ * @param server Started server.
+ * @param benchCase Cell of the matrix.
+ * @param runs Number of measured transfers.
+ * @param content Content of the file of the cell.
+ * @return Results of the cell.
+ */
+TFTPBenchResult runBenchCase(TFTPBenchServer &server, const TFTPBenchCase &benchCase, int runs, const std::vector<char> &content);
+
+/**
+ * @brief Writes the results of the benchmark as JSON.
+ *
+ * @param out Output stream.
+ * @param serverPath Path to the tftp-server executable.
+ * @param serverArgs Additional arguments of the server.
+ * @param impairArgs Additional arguments of the impairment proxy.
+ * @param runs Number of measured transfers per cell.
+ * @param results Results of all cells.
+ */
+void writeBenchJson(std::ostream &out, const std::string &serverPath, const std::string &serverArgs, const std::string &impairArgs, int runs,
+                    const std::vector<TFTPBenchResult> &results);
+
+#endif // TFTP_BENCH_H
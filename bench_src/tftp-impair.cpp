@@ -0,0 +1,417 @@
+/**
+ * @file tftp-impair.cpp
+ * @brief UDP proxy between TFTP clients and a server impairing the packets with a seeded random generator
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-impair.h"
+
+typedef std::chrono::steady_clock ImpairClock;
+typedef std::priority_queue<TFTPImpairPacket, std::vector<TFTPImpairPacket>, std::greater<TFTPImpairPacket>> TFTPImpairQueue;
+
+// Datagram buffer of the proxy
+static char packetBuffer[BENCH_MAX_PACKET];
+
+// Set by SIGINT and SIGTERM
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+bool parseHostPort(const std::string &value, sockaddr_in &address)
+{
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        return false;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *result;
+    if (getaddrinfo(value.substr(0, colon).c_str(), nullptr, &hints, &result) != 0)
+    {
+        return false;
+    }
+    address = *reinterpret_cast<sockaddr_in *>(result->ai_addr);
+    address.sin_port = htons(std::atoi(value.c_str() + colon + 1));
+    freeaddrinfo(result);
+    return address.sin_port != 0;
+}
+
+// Key of a client TID in the flow table
+static uint64_t addressKey(const sockaddr_in &address)
+{
+    return (static_cast<uint64_t>(address.sin_addr.s_addr) << 16) | address.sin_port;
+}
+
+static bool registerEndpoint(int epollFd, int fd, TFTPImpairEndpoint *endpoint)
+{
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = endpoint;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// Opens the sockets of a new client TID
+static TFTPImpairFlow *openFlow(const TFTPImpairConfig &config, const sockaddr_in &clientAddr, int epollFd, std::map<int, TFTPImpairEndpoint> &endpoints)
+{
+    TFTPImpairFlow *flow = new TFTPImpairFlow();
+    flow->clientAddr = clientAddr;
+    flow->serverTid = config.serverAddr;
+    flow->upstreamFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    flow->downstreamFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    flow->lastActivity = ImpairClock::now();
+
+    // The client sees the port of the downstream socket as the TID of the server
+    sockaddr_in downstreamAddr = config.listenAddr;
+    downstreamAddr.sin_port = 0;
+    if (flow->upstreamFd < 0 || flow->downstreamFd < 0 ||
+        bind(flow->downstreamFd, (struct sockaddr *)&downstreamAddr, sizeof(downstreamAddr)) != 0)
+    {
+        std::cerr << "Error: Failed to open the sockets of a flow: " << strerror(errno) << std::endl;
+        close(flow->upstreamFd);
+        close(flow->downstreamFd);
+        delete flow;
+        return nullptr;
+    }
+
+    int bufferSize = BENCH_SOCKET_BUFFER;
+    setsockopt(flow->upstreamFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(flow->downstreamFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    TFTPImpairEndpoint upstream = {flow, IMPAIR_TO_CLIENT};
+    TFTPImpairEndpoint downstream = {flow, IMPAIR_TO_SERVER};
+    endpoints[flow->upstreamFd] = upstream;
+    endpoints[flow->downstreamFd] = downstream;
+    registerEndpoint(epollFd, flow->upstreamFd, &endpoints[flow->upstreamFd]);
+    registerEndpoint(epollFd, flow->downstreamFd, &endpoints[flow->downstreamFd]);
+    return flow;
+}
+
+static void closeFlow(TFTPImpairFlow *flow, std::map<int, TFTPImpairEndpoint> &endpoints)
+{
+    endpoints.erase(flow->upstreamFd);
+    endpoints.erase(flow->downstreamFd);
+    close(flow->upstreamFd);
+    close(flow->downstreamFd);
+    delete flow;
+}
+
+// Random impairment state of the proxy
+struct TFTPImpairRandom
+{
+    std::mt19937 generator;
+    std::uniform_real_distribution<double> uniform;
+    bool inBurst[IMPAIR_DIRECTIONS];
+};
+
+// Decides whether a packet is lost, a burst loses every packet until it ends (mean length burstLength)
+static bool losePacket(const TFTPImpairConfig &config, TFTPImpairRandom &random, TFTPImpairDirection direction, TFTPImpairCounters &counters)
+{
+    double leaveBurst = config.burstLength > 1 ? 1.0 / config.burstLength : 1.0;
+
+    if (random.inBurst[direction] || (config.burstStart > 0 && random.uniform(random.generator) < config.burstStart))
+    {
+        random.inBurst[direction] = random.uniform(random.generator) >= leaveBurst;
+        counters.lost++;
+        counters.burstLost++;
+        return true;
+    }
+    if (config.loss > 0 && random.uniform(random.generator) < config.loss)
+    {
+        counters.lost++;
+        return true;
+    }
+    return false;
+}
+
+// Impairs a packet and sends it now or queues it until its release time
+static void forwardPacket(const TFTPImpairConfig &config, TFTPImpairRandom &random, TFTPImpairQueue &queue, uint64_t &sequence,
+                          TFTPImpairDirection direction, TFTPImpairCounters &counters, int fd, const sockaddr_in &to, size_t length)
+{
+    counters.received++;
+    if (losePacket(config, random, direction, counters))
+    {
+        return;
+    }
+
+    int copies = 1;
+    if (config.duplicate > 0 && random.uniform(random.generator) < config.duplicate)
+    {
+        counters.duplicated++;
+        copies = 2;
+    }
+
+    int delayMs = config.delayMs;
+    if (config.jitterMs > 0)
+    {
+        delayMs += std::uniform_int_distribution<int>(0, config.jitterMs)(random.generator);
+    }
+    if (config.reorder > 0 && random.uniform(random.generator) < config.reorder)
+    {
+        counters.reordered++;
+        delayMs += config.reorderMs;
+    }
+
+    for (int copy = 0; copy < copies; copy++)
+    {
+        counters.sent++;
+        if (delayMs == 0 && queue.empty())
+        {
+            sendto(fd, packetBuffer, length, 0, (const struct sockaddr *)&to, sizeof(to));
+            continue;
+        }
+
+        TFTPImpairPacket packet;
+        packet.release = ImpairClock::now() + std::chrono::milliseconds(delayMs);
+        packet.sequence = sequence++;
+        packet.fd = fd;
+        packet.to = to;
+        packet.data.assign(packetBuffer, length);
+        queue.push(packet);
+    }
+}
+
+bool runImpairProxy(const TFTPImpairConfig &config, TFTPImpairCounters counters[IMPAIR_DIRECTIONS])
+{
+    int listenFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (listenFd < 0 || bind(listenFd, (const struct sockaddr *)&config.listenAddr, sizeof(config.listenAddr)) != 0)
+    {
+        std::cerr << "Error: Failed to bind the listening port: " << strerror(errno) << std::endl;
+        return false;
+    }
+    int bufferSize = BENCH_SOCKET_BUFFER;
+    setsockopt(listenFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    int epollFd = epoll_create1(0);
+    TFTPImpairEndpoint listenEndpoint = {nullptr, IMPAIR_TO_SERVER};
+    if (epollFd < 0 || !registerEndpoint(epollFd, listenFd, &listenEndpoint))
+    {
+        std::cerr << "Error: Failed to create epoll: " << strerror(errno) << std::endl;
+        close(listenFd);
+        return false;
+    }
+
+    TFTPImpairRandom random;
+    random.generator.seed(config.seed);
+    random.inBurst[IMPAIR_TO_SERVER] = false;
+    random.inBurst[IMPAIR_TO_CLIENT] = false;
+
+    std::map<uint64_t, TFTPImpairFlow *> flows;
+    std::map<int, TFTPImpairEndpoint> endpoints;
+    TFTPImpairQueue queue;
+    uint64_t sequence = 0;
+    ImpairClock::time_point nextExpiry = ImpairClock::now() + std::chrono::milliseconds(IMPAIR_IDLE_MS);
+    epoll_event events[64];
+
+    while (!stopRequested)
+    {
+        // Release the packets whose delay has passed
+        ImpairClock::time_point now = ImpairClock::now();
+        while (!queue.empty() && queue.top().release <= now)
+        {
+            const TFTPImpairPacket &packet = queue.top();
+            if (endpoints.count(packet.fd) > 0)
+            {
+                sendto(packet.fd, packet.data.data(), packet.data.size(), 0, (const struct sockaddr *)&packet.to, sizeof(packet.to));
+            }
+            queue.pop();
+        }
+
+        // Close idle flows, the queue never holds packets that old
+        if (now >= nextExpiry)
+        {
+            for (std::map<uint64_t, TFTPImpairFlow *>::iterator it = flows.begin(); it != flows.end();)
+            {
+                if (now - it->second->lastActivity > std::chrono::milliseconds(IMPAIR_IDLE_MS))
+                {
+                    closeFlow(it->second, endpoints);
+                    it = flows.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            nextExpiry = now + std::chrono::milliseconds(IMPAIR_IDLE_MS);
+        }
+
+        int waitMs = 1000;
+        if (!queue.empty())
+        {
+            double untilRelease = std::chrono::duration<double, std::milli>(queue.top().release - now).count();
+            waitMs = std::min(waitMs, static_cast<int>(untilRelease + 0.999));
+        }
+
+        int ready = epoll_wait(epollFd, events, 64, std::max(waitMs, 0));
+        for (int i = 0; i < ready; i++)
+        {
+            TFTPImpairEndpoint *endpoint = static_cast<TFTPImpairEndpoint *>(events[i].data.ptr);
+            int fd = endpoint->flow == nullptr ? listenFd : (endpoint->direction == IMPAIR_TO_CLIENT ? endpoint->flow->upstreamFd : endpoint->flow->downstreamFd);
+
+            while (true)
+            {
+                sockaddr_in from;
+                socklen_t fromLength = sizeof(from);
+                ssize_t length = recvfrom(fd, packetBuffer, sizeof(packetBuffer), 0, (struct sockaddr *)&from, &fromLength);
+                if (length < 0)
+                {
+                    break;
+                }
+
+                if (endpoint->flow == nullptr)
+                {
+                    // A request of a client, every client TID gets its own flow
+                    TFTPImpairFlow *&flow = flows[addressKey(from)];
+                    if (flow == nullptr)
+                    {
+                        flow = openFlow(config, from, epollFd, endpoints);
+                        if (flow == nullptr)
+                        {
+                            flows.erase(addressKey(from));
+                            continue;
+                        }
+                    }
+                    flow->lastActivity = ImpairClock::now();
+                    forwardPacket(config, random, queue, sequence, IMPAIR_TO_SERVER, counters[IMPAIR_TO_SERVER], flow->upstreamFd, config.serverAddr, length);
+                }
+                else if (endpoint->direction == IMPAIR_TO_SERVER)
+                {
+                    TFTPImpairFlow *flow = endpoint->flow;
+                    flow->lastActivity = ImpairClock::now();
+                    forwardPacket(config, random, queue, sequence, IMPAIR_TO_SERVER, counters[IMPAIR_TO_SERVER], flow->upstreamFd, flow->serverTid, length);
+                }
+                else
+                {
+                    // The reply of the server carries the TID of its session
+                    TFTPImpairFlow *flow = endpoint->flow;
+                    flow->serverTid = from;
+                    flow->lastActivity = ImpairClock::now();
+                    forwardPacket(config, random, queue, sequence, IMPAIR_TO_CLIENT, counters[IMPAIR_TO_CLIENT], flow->downstreamFd, flow->clientAddr, length);
+                }
+            }
+        }
+    }
+
+    for (std::map<uint64_t, TFTPImpairFlow *>::iterator it = flows.begin(); it != flows.end(); ++it)
+    {
+        closeFlow(it->second, endpoints);
+    }
+    close(epollFd);
+    close(listenFd);
+    return true;
+}
+
+static void printImpairUsage()
+{
+    std::cerr << "Usage: tftp-impair -l [host:]port -s host:port [--loss P] [--burst P:LENGTH] [--delay MS] [--jitter MS]"
+              << " [--dup P] [--reorder P[:MS]] [--seed N]" << std::endl;
+}
+
+static void printCounters(const char *name, const TFTPImpairCounters &counters)
+{
+    std::cerr << name << ": received=" << counters.received << " lost=" << counters.lost << " (burst " << counters.burstLost << ")"
+              << " duplicated=" << counters.duplicated << " reordered=" << counters.reordered << " sent=" << counters.sent << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    TFTPImpairConfig config;
+    memset(&config.listenAddr, 0, sizeof(config.listenAddr));
+    memset(&config.serverAddr, 0, sizeof(config.serverAddr));
+    config.loss = 0;
+    config.burstStart = 0;
+    config.burstLength = 1;
+    config.delayMs = 0;
+    config.jitterMs = 0;
+    config.duplicate = 0;
+    config.reorder = 0;
+    config.reorderMs = DEFAULT_REORDER_MS;
+    config.seed = 1;
+
+    bool listenSet = false;
+    bool serverSet = false;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if (arg == "-l")
+        {
+            // A bare port listens on the loopback address
+            std::string address = value.find(':') == std::string::npos ? "127.0.0.1:" + value : value;
+            listenSet = parseHostPort(address, config.listenAddr);
+        }
+        else if (arg == "-s")
+        {
+            serverSet = parseHostPort(value, config.serverAddr);
+        }
+        else if (arg == "--loss")
+        {
+            config.loss = std::atof(value.c_str());
+        }
+        else if (arg == "--burst")
+        {
+            size_t colon = value.find(':');
+            config.burstStart = std::atof(value.c_str());
+            config.burstLength = colon == std::string::npos ? 1 : std::atof(value.c_str() + colon + 1);
+        }
+        else if (arg == "--delay")
+        {
+            config.delayMs = std::atoi(value.c_str());
+        }
+        else if (arg == "--jitter")
+        {
+            config.jitterMs = std::atoi(value.c_str());
+        }
+        else if (arg == "--dup")
+        {
+            config.duplicate = std::atof(value.c_str());
+        }
+        else if (arg == "--reorder")
+        {
+            size_t colon = value.find(':');
+            config.reorder = std::atof(value.c_str());
+            if (colon != std::string::npos)
+            {
+                config.reorderMs = std::atoi(value.c_str() + colon + 1);
+            }
+        }
+        else if (arg == "--seed")
+        {
+            config.seed = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        }
+        else
+        {
+            printImpairUsage();
+            return 1;
+        }
+    }
+
+    if (!listenSet || !serverSet || config.loss < 0 || config.loss > 1 || config.burstStart < 0 || config.burstStart > 1 ||
+        config.burstLength < 1 || config.delayMs < 0 || config.jitterMs < 0 || config.duplicate < 0 || config.duplicate > 1 ||
+        config.reorder < 0 || config.reorder > 1 || config.reorderMs < 0)
+    {
+        printImpairUsage();
+        return 1;
+    }
+
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+
+    TFTPImpairCounters counters[IMPAIR_DIRECTIONS];
+    memset(counters, 0, sizeof(counters));
+    if (!runImpairProxy(config, counters))
+    {
+        return 1;
+    }
+
+    printCounters("to server", counters[IMPAIR_TO_SERVER]);
+    printCounters("to client", counters[IMPAIR_TO_CLIENT]);
+    return 0;
+}
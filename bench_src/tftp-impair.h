@@ -0,0 +1,108 @@
+/**
+ * @file tftp-impair.h
+ * @brief Declarations for the UDP proxy impairing TFTP traffic with loss, delay, duplication and reordering.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_IMPAIR_H
+#define TFTP_IMPAIR_H
+
+#include "tftp-bench.h"
+#include <map>
+#include <queue>
+#include <random>
+#include <netdb.h>
+#include <sys/epoll.h>
+
+// Flows without a packet for this long are closed
+const int IMPAIR_IDLE_MS = 10000;
+
+// Default extra delay of a reordered packet
+const int DEFAULT_REORDER_MS = 5;
+
+// Parameters of the impairments, the same for both directions
+struct TFTPImpairConfig
+{
+    sockaddr_in listenAddr;
+    sockaddr_in serverAddr;
+    double loss;        // Probability of losing a packet outside of a burst
+    double burstStart;  // Probability that a packet starts a burst of losses
+    double burstLength; // Mean number of packets lost in a burst
+    int delayMs;        // Constant delay
+    int jitterMs;       // Uniformly distributed extra delay (0 to jitterMs)
+    double duplicate;   // Probability of sending a packet twice
+    double reorder;     // Probability of holding a packet back so that later ones overtake it
+    int reorderMs;      // Extra delay of a reordered packet
+    unsigned seed;      // Seed of all random draws
+};
+
+// Counters of one direction
+struct TFTPImpairCounters
+{
+    uint64_t received;   // Packets received from the sender
+    uint64_t lost;       // Packets dropped (bursts included)
+    uint64_t burstLost;  // Packets dropped in bursts
+    uint64_t duplicated; // Packets sent twice
+    uint64_t reordered;  // Packets held back
+    uint64_t sent;       // Packets passed on (duplicates included)
+};
+
+// Direction of a packet
+enum TFTPImpairDirection
+{
+    IMPAIR_TO_SERVER,
+    IMPAIR_TO_CLIENT,
+    IMPAIR_DIRECTIONS
+};
+
+// One client TID and the server TID it talks to
+struct TFTPImpairFlow
+{
+    sockaddr_in clientAddr;   // TID of the client
+    sockaddr_in serverTid;    // TID of the server session (its listening address until the first reply)
+    int upstreamFd;           // Talks to the server
+    int downstreamFd;         // Talks to the client from the TID the client sees
+    std::chrono::steady_clock::time_point lastActivity;
+};
+
+// Socket of a flow registered in epoll
+struct TFTPImpairEndpoint
+{
+    TFTPImpairFlow *flow;
+    TFTPImpairDirection direction; // Direction of the packets received on the socket
+};
+
+// Packet waiting for its release time
+struct TFTPImpairPacket
+{
+    std::chrono::steady_clock::time_point release;
+    uint64_t sequence; // Keeps packets with the same release time in order
+    int fd;
+    sockaddr_in to;
+    std::string data;
+
+    bool operator>(const TFTPImpairPacket &other) const
+    {
+        return release > other.release || (release == other.release && sequence > other.sequence);
+    }
+};
+
+/**
+ * @brief Parses "host:port" into an IPv4 address.
+ *
+ * @param value Address to parse.
+ * @param address Parsed address.
+ * @return True if the address was resolved, otherwise False.
+ */
+bool parseHostPort(const std::string &value, sockaddr_in &address);
+
+/**
+ * @brief Runs the proxy until SIGINT or SIGTERM.
+ *
+ * @param config Parameters of the impairments.
+ * @param counters Counters of both directions.
+ * @return True if the proxy ran, otherwise False.
+ */
+bool runImpairProxy(const TFTPImpairConfig &config, TFTPImpairCounters counters[IMPAIR_DIRECTIONS]);
+
+#endif // TFTP_IMPAIR_H
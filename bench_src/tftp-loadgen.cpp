@@ -0,0 +1,659 @@
+/**
+ * @file tftp-loadgen.cpp
+ * @brief Load generator simulating thousands of concurrent TFTP clients from one event loop
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-loadgen.h"
+
+typedef std::chrono::steady_clock LoadClock;
+typedef std::priority_queue<TFTPLoadTimer, std::vector<TFTPLoadTimer>, std::greater<TFTPLoadTimer>> TFTPLoadTimers;
+
+// Datagram buffers of the simulated clients
+static char receiveBuffer[BENCH_MAX_PACKET];
+static char requestBuffer[BENCH_MAX_PACKET];
+
+// Set by SIGINT, the run stops and reports what it has measured
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+bool parseFileMix(const std::string &mix, std::vector<TFTPLoadFile> &files)
+{
+    std::istringstream entries(mix);
+    std::string entry;
+    while (std::getline(entries, entry, ','))
+    {
+        TFTPLoadFile file;
+        file.name = entry;
+        file.weight = 1;
+
+        size_t colon = entry.rfind(':');
+        if (colon != std::string::npos)
+        {
+            file.name = entry.substr(0, colon);
+            file.weight = std::atof(entry.c_str() + colon + 1);
+        }
+        if (file.name.empty() || file.weight <= 0)
+        {
+            return false;
+        }
+        files.push_back(file);
+    }
+    return !files.empty();
+}
+
+long processRssKb(pid_t pid)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    return -1;
+}
+
+// Milliseconds between two time points
+static double elapsedMs(LoadClock::time_point from, LoadClock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Exponentially distributed pause with the given mean
+static LoadClock::duration exponentialDelay(std::mt19937 &random, double meanMs)
+{
+    if (meanMs <= 0)
+    {
+        return LoadClock::duration::zero();
+    }
+    std::exponential_distribution<double> distribution(1.0 / meanMs);
+    return std::chrono::duration_cast<LoadClock::duration>(std::chrono::duration<double, std::milli>(distribution(random)));
+}
+
+// Sets a new deadline of a client, the heap keeps at most one entry per client
+static void armClient(TFTPLoadTimers &timers, TFTPLoadClient &client, uint32_t index, LoadClock::time_point deadline)
+{
+    client.deadline = deadline;
+    if (!client.timerQueued)
+    {
+        TFTPLoadTimer timer = {deadline, index};
+        timers.push(timer);
+        client.timerQueued = true;
+    }
+}
+
+static size_t buildLoadRequest(const TFTPLoadConfig &config, const std::string &filename)
+{
+    std::string request;
+    request.push_back(0);
+    request.push_back(static_cast<char>(BENCH_RRQ));
+    request += filename + '\0' + "octet" + '\0';
+    if (config.blksize > 0)
+    {
+        request += std::string("blksize") + '\0' + std::to_string(config.blksize) + '\0';
+    }
+    if (config.windowsize > 1)
+    {
+        request += std::string("windowsize") + '\0' + std::to_string(config.windowsize) + '\0';
+    }
+
+    memcpy(requestBuffer, request.data(), request.size());
+    return request.size();
+}
+
+static void sendLoadAck(const TFTPLoadClient &client, uint16_t block)
+{
+    char ack[4] = {0, static_cast<char>(BENCH_ACK), static_cast<char>(block >> 8), static_cast<char>(block & 0xFF)};
+    sendto(client.fd, ack, sizeof(ack), 0, (const struct sockaddr *)&client.transferAddr, sizeof(client.transferAddr));
+}
+
+// Draws a file of the mix by weight
+static size_t drawFile(const TFTPLoadConfig &config, std::mt19937 &random)
+{
+    std::vector<double> weights;
+    for (const TFTPLoadFile &file : config.files)
+    {
+        weights.push_back(file.weight);
+    }
+    std::discrete_distribution<size_t> distribution(weights.begin(), weights.end());
+    return distribution(random);
+}
+
+// Sends the request of the next download of a client from a new socket (TID)
+static bool startTransfer(const TFTPLoadConfig &config, TFTPLoadStats &stats, std::vector<TFTPLoadClient> &clients, uint32_t index,
+                          int epollFd, TFTPLoadTimers &timers, std::mt19937 &random)
+{
+    TFTPLoadClient &client = clients[index];
+
+    client.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (client.fd < 0)
+    {
+        std::cerr << "Error: Failed to create a client socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    int bufferSize = LOAD_SOCKET_BUFFER;
+    setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = index;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, client.fd, &event);
+
+    client.phase = LOAD_REQUESTED;
+    client.file = drawFile(config, random);
+    client.transferAddr = config.serverAddr;
+    client.expected = 1;
+    client.lastAcked = 0;
+    client.sinceAck = 0;
+    client.bytes = 0;
+    client.retries = 0;
+    client.requestedAt = LoadClock::now();
+    stats.started++;
+
+    size_t length = buildLoadRequest(config, config.files[client.file].name);
+    sendto(client.fd, requestBuffer, length, 0, (const struct sockaddr *)&config.serverAddr, sizeof(config.serverAddr));
+    armClient(timers, client, index, client.requestedAt + std::chrono::milliseconds(config.timeoutMs));
+    return true;
+}
+
+// Ends the current download of a client, the client pauses before its next one or is done
+static void finishTransfer(const TFTPLoadConfig &config, TFTPLoadStats &stats, TFTPLoadClient &client, uint32_t index,
+                           bool completed, TFTPLoadTimers &timers, std::mt19937 &random, uint32_t &finished)
+{
+    close(client.fd);
+    client.fd = -1;
+
+    if (completed)
+    {
+        stats.completed++;
+        stats.bytes += client.bytes;
+        stats.completionMs.push_back(elapsedMs(client.requestedAt, LoadClock::now()));
+    }
+    else
+    {
+        stats.failed++;
+    }
+
+    // A client that failed to boot does not go on
+    if (completed && --client.transfersLeft > 0)
+    {
+        client.phase = LOAD_THINKING;
+        armClient(timers, client, index, LoadClock::now() + exponentialDelay(random, config.thinkMs));
+    }
+    else
+    {
+        client.phase = LOAD_DONE;
+        finished++;
+    }
+}
+
+// Handles the datagrams queued on the socket of a client
+static void handleClientPackets(const TFTPLoadConfig &config, TFTPLoadStats &stats, TFTPLoadClient &client, uint32_t index,
+                                TFTPLoadTimers &timers, std::mt19937 &random, uint32_t &finished)
+{
+    uint16_t blksize = config.blksize > 0 ? config.blksize : 512;
+
+    while (client.phase == LOAD_REQUESTED || client.phase == LOAD_RECEIVING)
+    {
+        sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        ssize_t length = recvfrom(client.fd, receiveBuffer, sizeof(receiveBuffer), 0, (struct sockaddr *)&from, &fromLength);
+        if (length < 0)
+        {
+            return;
+        }
+        if (length < 4)
+        {
+            continue;
+        }
+
+        if (client.phase == LOAD_REQUESTED)
+        {
+            // The first reply establishes the session and its TID
+            client.transferAddr = from;
+            client.phase = LOAD_RECEIVING;
+            stats.establishMs.push_back(elapsedMs(client.requestedAt, LoadClock::now()));
+        }
+        else if (from.sin_port != client.transferAddr.sin_port || from.sin_addr.s_addr != client.transferAddr.sin_addr.s_addr)
+        {
+            continue;
+        }
+
+        uint16_t opcode = (static_cast<uint8_t>(receiveBuffer[0]) << 8) | static_cast<uint8_t>(receiveBuffer[1]);
+        uint16_t block = (static_cast<uint8_t>(receiveBuffer[2]) << 8) | static_cast<uint8_t>(receiveBuffer[3]);
+
+        if (opcode == BENCH_ERROR)
+        {
+            stats.errors++;
+            finishTransfer(config, stats, client, index, false, timers, random, finished);
+            return;
+        }
+        if (opcode == BENCH_OACK && client.expected == 1)
+        {
+            sendLoadAck(client, 0);
+            client.retries = 0;
+            armClient(timers, client, index, LoadClock::now() + std::chrono::milliseconds(config.timeoutMs));
+            continue;
+        }
+        if (opcode != BENCH_DATA)
+        {
+            continue;
+        }
+
+        if (block != (client.expected & 0xFFFF))
+        {
+            // A block of the window was lost, the server resends the window after this ACK
+            if (client.lastAcked != client.expected - 1)
+            {
+                sendLoadAck(client, (client.expected - 1) & 0xFFFF);
+                client.lastAcked = client.expected - 1;
+                client.sinceAck = 0;
+            }
+            continue;
+        }
+
+        size_t dataLength = length - 4;
+        bool final = dataLength < blksize;
+        client.bytes += dataLength;
+        client.retries = 0;
+        client.sinceAck++;
+
+        if (final || client.sinceAck >= config.windowsize)
+        {
+            sendLoadAck(client, block);
+            client.lastAcked = client.expected;
+            client.sinceAck = 0;
+        }
+        client.expected++;
+
+        if (final)
+        {
+            finishTransfer(config, stats, client, index, true, timers, random, finished);
+            return;
+        }
+        armClient(timers, client, index, LoadClock::now() + std::chrono::milliseconds(config.timeoutMs));
+    }
+}
+
+// Handles an expired deadline of a client: the end of a pause or a retransmission timeout
+static bool handleClientTimeout(const TFTPLoadConfig &config, TFTPLoadStats &stats, std::vector<TFTPLoadClient> &clients, uint32_t index,
+                                int epollFd, TFTPLoadTimers &timers, std::mt19937 &random, uint32_t &finished)
+{
+    TFTPLoadClient &client = clients[index];
+
+    if (client.phase == LOAD_THINKING)
+    {
+        return startTransfer(config, stats, clients, index, epollFd, timers, random);
+    }
+    if (client.phase != LOAD_REQUESTED && client.phase != LOAD_RECEIVING)
+    {
+        return true;
+    }
+
+    stats.timeouts++;
+    if (++client.retries > config.maxRetries)
+    {
+        stats.timedOut++;
+        finishTransfer(config, stats, client, index, false, timers, random, finished);
+        return true;
+    }
+
+    // Repeat the request or acknowledge the last block received in order again
+    if (client.phase == LOAD_REQUESTED)
+    {
+        size_t length = buildLoadRequest(config, config.files[client.file].name);
+        sendto(client.fd, requestBuffer, length, 0, (const struct sockaddr *)&config.serverAddr, sizeof(config.serverAddr));
+    }
+    else
+    {
+        sendLoadAck(client, (client.expected - 1) & 0xFFFF);
+        client.lastAcked = client.expected - 1;
+        client.sinceAck = 0;
+    }
+    armClient(timers, client, index, LoadClock::now() + std::chrono::milliseconds(config.timeoutMs));
+    return true;
+}
+
+// Records the server RSS and the progress of the run
+static void takeSample(const TFTPLoadConfig &config, TFTPLoadStats &stats, const std::vector<TFTPLoadClient> &clients, LoadClock::time_point start)
+{
+    TFTPLoadSample sample;
+    sample.seconds = elapsedMs(start, LoadClock::now()) / 1000;
+    sample.rssKb = config.serverPid > 0 ? processRssKb(config.serverPid) : -1;
+    sample.active = 0;
+    sample.completed = stats.completed;
+    sample.failed = stats.failed;
+    for (const TFTPLoadClient &client : clients)
+    {
+        if (client.phase == LOAD_REQUESTED || client.phase == LOAD_RECEIVING)
+        {
+            sample.active++;
+        }
+    }
+    stats.samples.push_back(sample);
+
+    std::cerr << std::fixed << std::setprecision(1) << "t=" << sample.seconds << "s active=" << sample.active
+              << " completed=" << sample.completed << " failed=" << sample.failed;
+    if (sample.rssKb >= 0)
+    {
+        std::cerr << " rss=" << sample.rssKb << " kB";
+    }
+    std::cerr << std::endl;
+}
+
+bool runLoad(const TFTPLoadConfig &config, TFTPLoadStats &stats)
+{
+    stats = TFTPLoadStats();
+
+    // Every client in progress holds a socket
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int epollFd = epoll_create1(0);
+    if (epollFd < 0)
+    {
+        std::cerr << "Error: Failed to create epoll: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<TFTPLoadClient> clients(config.clients);
+    for (TFTPLoadClient &client : clients)
+    {
+        client.fd = -1;
+        client.phase = LOAD_WAITING;
+        client.transfersLeft = config.transfersPerClient;
+        client.timerQueued = false;
+    }
+
+    std::mt19937 random(config.seed);
+    TFTPLoadTimers timers;
+    std::vector<epoll_event> events(256);
+
+    LoadClock::time_point start = LoadClock::now();
+    LoadClock::time_point nextArrival = start;
+    LoadClock::time_point nextSample = start;
+    LoadClock::time_point end = start + std::chrono::seconds(config.durationS);
+    uint32_t arrived = 0;
+    uint32_t finished = 0;
+    bool ok = true;
+
+    while (ok && finished < clients.size() && !stopRequested && (config.durationS == 0 || LoadClock::now() < end))
+    {
+        LoadClock::time_point now = LoadClock::now();
+
+        // Arrivals of new clients
+        while (ok && arrived < clients.size() && nextArrival <= now)
+        {
+            ok = startTransfer(config, stats, clients, arrived, epollFd, timers, random);
+            arrived++;
+            nextArrival += exponentialDelay(random, 1000.0 / config.rate);
+        }
+
+        // Expired deadlines, entries of clients whose deadline moved are queued again
+        while (ok && !timers.empty() && timers.top().deadline <= now)
+        {
+            uint32_t index = timers.top().client;
+            timers.pop();
+
+            TFTPLoadClient &client = clients[index];
+            client.timerQueued = false;
+            if (client.deadline > now)
+            {
+                armClient(timers, client, index, client.deadline);
+            }
+            else
+            {
+                ok = handleClientTimeout(config, stats, clients, index, epollFd, timers, random, finished);
+            }
+        }
+
+        if (now >= nextSample)
+        {
+            takeSample(config, stats, clients, start);
+            nextSample += std::chrono::milliseconds(config.sampleMs);
+        }
+
+        // Sleep until the next arrival, deadline or sample unless a datagram comes first
+        LoadClock::time_point wake = nextSample;
+        if (arrived < clients.size())
+        {
+            wake = std::min(wake, nextArrival);
+        }
+        if (!timers.empty())
+        {
+            wake = std::min(wake, timers.top().deadline);
+        }
+        int waitMs = static_cast<int>(std::max(0.0, std::ceil(elapsedMs(LoadClock::now(), wake))));
+
+        int ready = epoll_wait(epollFd, events.data(), events.size(), waitMs);
+        for (int i = 0; i < ready; i++)
+        {
+            uint32_t index = events[i].data.u32;
+            handleClientPackets(config, stats, clients[index], index, timers, random, finished);
+        }
+    }
+
+    takeSample(config, stats, clients, start);
+    stats.seconds = elapsedMs(start, LoadClock::now()) / 1000;
+
+    for (TFTPLoadClient &client : clients)
+    {
+        if (client.fd >= 0)
+        {
+            close(client.fd);
+        }
+    }
+    close(epollFd);
+    return ok;
+}
+
+// Writes nearest-rank percentiles of values as a JSON object
+static void writePercentiles(std::ostream &out, std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+
+    out << "{\"count\": " << values.size();
+    const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    const char *names[] = {"p50", "p90", "p99", "p999"};
+    for (size_t i = 0; i < 4; i++)
+    {
+        double value = 0;
+        if (!values.empty())
+        {
+            size_t rank = static_cast<size_t>(std::ceil(fractions[i] * values.size()));
+            value = values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+        }
+        out << ", \"" << names[i] << "\": " << value;
+    }
+    out << ", \"max\": " << (values.empty() ? 0 : values.back()) << "}";
+}
+
+void writeLoadJson(std::ostream &out, const TFTPLoadConfig &config, const TFTPLoadStats &stats)
+{
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &config.serverAddr.sin_addr, address, sizeof(address));
+
+    double transfers = stats.started > 0 ? static_cast<double>(stats.started) : 1;
+
+    out << std::fixed << std::setprecision(3)
+        << "{\n"
+        << "  \"server\": \"" << address << ":" << ntohs(config.serverAddr.sin_port) << "\",\n"
+        << "  \"clients\": " << config.clients << ",\n"
+        << "  \"rate\": " << config.rate << ",\n"
+        << "  \"transfers_per_client\": " << config.transfersPerClient << ",\n"
+        << "  \"think_ms\": " << config.thinkMs << ",\n"
+        << "  \"blksize\": " << config.blksize << ",\n"
+        << "  \"windowsize\": " << config.windowsize << ",\n"
+        << "  \"seed\": " << config.seed << ",\n"
+        << "  \"seconds\": " << stats.seconds << ",\n"
+        << "  \"transfers\": {\"started\": " << stats.started << ", \"completed\": " << stats.completed
+        << ", \"failed\": " << stats.failed << ", \"errors\": " << stats.errors << ", \"timed_out\": " << stats.timedOut
+        << ", \"in_progress\": " << stats.started - stats.completed - stats.failed << "},\n"
+        << "  \"failure_rate\": " << stats.failed / transfers << ",\n"
+        << "  \"timeouts\": " << stats.timeouts << ",\n"
+        << "  \"timeouts_per_transfer\": " << stats.timeouts / transfers << ",\n"
+        << "  \"mb_per_s\": " << (stats.seconds > 0 ? stats.bytes / 1e6 / stats.seconds : 0) << ",\n"
+        << "  \"establishment_ms\": ";
+    writePercentiles(out, stats.establishMs);
+    out << ",\n"
+        << "  \"completion_ms\": ";
+    writePercentiles(out, stats.completionMs);
+    out << ",\n"
+        << "  \"samples\": [\n";
+
+    for (size_t i = 0; i < stats.samples.size(); i++)
+    {
+        const TFTPLoadSample &sample = stats.samples[i];
+        out << "    {\"t\": " << sample.seconds << ", \"rss_kb\": " << sample.rssKb << ", \"active\": " << sample.active
+            << ", \"completed\": " << sample.completed << ", \"failed\": " << sample.failed << "}"
+            << (i + 1 < stats.samples.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n"
+        << "}\n";
+}
+
+static void printLoadUsage()
+{
+    std::cerr << "Usage: tftp-loadgen -h hostname [-p port] -f file[:weight],... [-n clients] [-r rate] [-k transfers] [-T think_ms]"
+              << " [-t timeout_ms] [-R retries] [-b blksize] [-W windowsize] [-P server_pid] [-i sample_ms] [-d seconds] [-S seed]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    TFTPLoadConfig config;
+    memset(&config.serverAddr, 0, sizeof(config.serverAddr));
+    config.clients = 1000;
+    config.rate = 100;
+    config.transfersPerClient = 1;
+    config.thinkMs = 0;
+    config.timeoutMs = DEFAULT_LOAD_TIMEOUT_MS;
+    config.maxRetries = BENCH_MAX_RETRIES;
+    config.blksize = DEFAULT_LOAD_BLKSIZE;
+    config.windowsize = 1;
+    config.serverPid = 0;
+    config.sampleMs = DEFAULT_LOAD_SAMPLE_MS;
+    config.durationS = 0;
+    config.seed = 1;
+
+    std::string hostname;
+    int port = 69;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        const char *value = argv[i + 1];
+        if (arg == "-h")
+        {
+            hostname = value;
+        }
+        else if (arg == "-p")
+        {
+            port = std::atoi(value);
+        }
+        else if (arg == "-f")
+        {
+            if (!parseFileMix(value, config.files))
+            {
+                std::cerr << "Error: Invalid file mix " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-n")
+        {
+            config.clients = std::atoi(value);
+        }
+        else if (arg == "-r")
+        {
+            config.rate = std::atof(value);
+        }
+        else if (arg == "-k")
+        {
+            config.transfersPerClient = std::atoi(value);
+        }
+        else if (arg == "-T")
+        {
+            config.thinkMs = std::atoi(value);
+        }
+        else if (arg == "-t")
+        {
+            config.timeoutMs = std::atoi(value);
+        }
+        else if (arg == "-R")
+        {
+            config.maxRetries = std::atoi(value);
+        }
+        else if (arg == "-b")
+        {
+            config.blksize = static_cast<uint16_t>(std::atoi(value));
+        }
+        else if (arg == "-W")
+        {
+            config.windowsize = static_cast<uint16_t>(std::atoi(value));
+        }
+        else if (arg == "-P")
+        {
+            config.serverPid = std::atoi(value);
+        }
+        else if (arg == "-i")
+        {
+            config.sampleMs = std::atoi(value);
+        }
+        else if (arg == "-d")
+        {
+            config.durationS = std::atoi(value);
+        }
+        else if (arg == "-S")
+        {
+            config.seed = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+        }
+        else
+        {
+            printLoadUsage();
+            return 1;
+        }
+    }
+
+    if (hostname.empty() || config.files.empty() || config.clients <= 0 || config.rate <= 0 || config.transfersPerClient <= 0 ||
+        config.timeoutMs <= 0 || config.sampleMs <= 0 || config.windowsize == 0 || (config.blksize != 0 && config.blksize < 8))
+    {
+        printLoadUsage();
+        return 1;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *result;
+    if (getaddrinfo(hostname.c_str(), nullptr, &hints, &result) != 0)
+    {
+        std::cerr << "Error: Failed to resolve " << hostname << std::endl;
+        return 1;
+    }
+    config.serverAddr = *reinterpret_cast<sockaddr_in *>(result->ai_addr);
+    config.serverAddr.sin_port = htons(port);
+    freeaddrinfo(result);
+
+    signal(SIGINT, handleStopSignal);
+
+    TFTPLoadStats stats;
+    if (!runLoad(config, stats))
+    {
+        return 1;
+    }
+
+    writeLoadJson(std::cout, config, stats);
+    return stats.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file tftp-loadgen.h
+ * @brief Declarations for the load generator simulating many concurrent TFTP clients.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_LOADGEN_H
+#define TFTP_LOADGEN_H
+
+#include "tftp-bench.h"
+#include <queue>
+#include <cmath>
+#include <random>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+// Default retransmission timeout of a simulated client
+const int DEFAULT_LOAD_TIMEOUT_MS = 1000;
+
+// Default block size requested by a simulated client (the size PXE firmware commonly asks for)
+const uint16_t DEFAULT_LOAD_BLKSIZE = 1456;
+
+// Receive buffer of a simulated client socket
+const int LOAD_SOCKET_BUFFER = 1024 * 1024;
+
+// Default interval between samples of the server RSS and the transfers in progress
+const int DEFAULT_LOAD_SAMPLE_MS = 1000;
+
+// File of the file mix, drawn with a probability proportional to its weight
+struct TFTPLoadFile
+{
+    std::string name;
+    double weight;
+};
+
+// Parameters of a load run
+struct TFTPLoadConfig
+{
+    sockaddr_in serverAddr;
+    int clients;                     // Simulated clients started in total
+    double rate;                     // Mean client arrivals per second (Poisson)
+    int transfersPerClient;          // Files downloaded by every client one after another
+    int thinkMs;                     // Mean pause between the downloads of a client (exponential)
+    int timeoutMs;                   // Retransmission timeout
+    int maxRetries;                  // Retransmissions before a transfer fails
+    uint16_t blksize;                // Requested block size, 0 does not send the option
+    uint16_t windowsize;             // Requested window size, 1 does not send the option
+    std::vector<TFTPLoadFile> files; // File mix
+    pid_t serverPid;                 // Server sampled for its RSS, 0 for none
+    int sampleMs;                    // Interval between samples
+    int durationS;                   // Longest run, 0 for no limit
+    unsigned seed;                   // Seed of the arrival, file and think time draws
+};
+
+// Phase of a simulated client
+enum TFTPLoadPhase
+{
+    LOAD_WAITING,   // Not arrived yet
+    LOAD_THINKING,  // Pausing between two downloads
+    LOAD_REQUESTED, // Request sent, no reply yet
+    LOAD_RECEIVING, // Receiving DATA
+    LOAD_DONE       // All downloads finished or one failed
+};
+
+// State of one simulated client
+struct TFTPLoadClient
+{
+    int fd;
+    TFTPLoadPhase phase;
+    size_t file;                  // Index into the file mix of the current download
+    int transfersLeft;
+    sockaddr_in transferAddr;     // TID of the server session
+    uint64_t expected;            // Next block in order
+    uint64_t lastAcked;           // Last block acknowledged
+    uint16_t sinceAck;            // Blocks received since lastAcked
+    uint64_t bytes;               // Bytes of the current download
+    int retries;
+    std::chrono::steady_clock::time_point requestedAt;
+    std::chrono::steady_clock::time_point deadline; // Retransmission or end of the pause
+    bool timerQueued;             // The timer heap holds an entry of the client
+};
+
+// Entry of the timer heap, earlier deadlines first
+struct TFTPLoadTimer
+{
+    std::chrono::steady_clock::time_point deadline;
+    uint32_t client;
+
+    bool operator>(const TFTPLoadTimer &other) const
+    {
+        return deadline > other.deadline;
+    }
+};
+
+// Sample taken every sampleMs
+struct TFTPLoadSample
+{
+    double seconds;     // Since the start of the run
+    long rssKb;         // Resident set size of the server, -1 if unknown
+    int active;         // Downloads in progress
+    uint64_t completed; // Downloads completed so far
+    uint64_t failed;    // Downloads failed so far
+};
+
+// Results of a load run
+struct TFTPLoadStats
+{
+    uint64_t started;                 // Downloads requested
+    uint64_t completed;               // Downloads that received the whole file
+    uint64_t failed;                  // Downloads ended by an ERROR or by running out of retries
+    uint64_t errors;                  // ERROR packets received
+    uint64_t timedOut;                // Downloads that ran out of retries
+    uint64_t timeouts;                // Expired retransmission timeouts
+    uint64_t bytes;                   // Bytes of the completed downloads
+    std::vector<double> establishMs;  // From the request to the first reply (OACK or DATA)
+    std::vector<double> completionMs; // From the request to the last block
+    std::vector<TFTPLoadSample> samples;
+    double seconds;                   // Length of the run
+};
+
+/**
+ * @brief Parses a file mix of the form "name[:weight],name[:weight],...".
+ *
+ * @param mix File mix.
+ * @param files Parsed files.
+ * @return True if the mix is valid, otherwise False.
+ */
+bool parseFileMix(const std::string &mix, std::vector<TFTPLoadFile> &files);
+
+/**
+ * @brief Returns the resident set size of a process.
+ *
+ * @param pid Process ID.
+ * @return Resident set size in kB, -1 if the process can not be read.
+ */
+long processRssKb(pid_t pid);
+
+/**
+ * @brief Runs the simulated clients against the server from one event loop.
+ *
+ * @param config Parameters of the run.
+ * @param stats Results of the run.
+ * @return True if the run was carried out, otherwise False.
+ */
+bool runLoad(const TFTPLoadConfig &config, TFTPLoadStats &stats);
+
+/**
+ * @brief Writes the results of a load run as JSON.
+ *
+ * @param out Output stream.
+ * @param config Parameters of the run.
+ * @param stats Results of the run.
+ */
+void writeLoadJson(std::ostream &out, const TFTPLoadConfig &config, const TFTPLoadStats &stats);
+
+#endif // TFTP_LOADGEN_H
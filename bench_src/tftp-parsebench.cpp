@@ -0,0 +1,192 @@
+/**
+ * @file tftp-parsebench.cpp
+ * @brief Microbenchmark of the request parser and OACK encoder of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-parsebench.h"
+#include "tftp-pool.h"
+#include "tftp-alloc-stats.h"
+
+// Results of the measured calls are summed into it so that the compiler cannot leave them out
+static volatile unsigned long long parseSink = 0;
+
+// Builds a request datagram from its opcode and fields, every field gets its null-terminator
+static std::string buildRequest(uint16_t opcode, const std::vector<std::string> &fields)
+{
+    std::string packet;
+    packet += static_cast<char>(opcode >> 8);
+    packet += static_cast<char>(opcode & 0xFF);
+    for (const std::string &field : fields)
+    {
+        packet += field;
+        packet += '\0';
+    }
+    return packet;
+}
+
+// Default parameters of a request, as set by the server before the options are applied
+static void initParams(TFTPOparams &params)
+{
+    memset(&params, 0, sizeof(params));
+    params.blksize = 512;
+    params.timeout = 5;
+    params.windowsize = 1;
+}
+
+// Heap allocations made so far, 0 without allocation counting
+static unsigned long long allocationsSoFar()
+{
+#ifdef TFTP_ALLOC_STATS
+    return allocationCount();
+#else
+    return 0;
+#endif
+}
+
+std::vector<TFTPParseCase> parseCases()
+{
+    std::vector<TFTPParseCase> cases;
+    cases.push_back({"rrq_plain", buildRequest(RRQ, {"pxelinux.0", "octet"})});
+    cases.push_back({"rrq_pxe", buildRequest(RRQ, {"images/vmlinuz", "octet", "tsize", "0", "blksize", "1456"})});
+    cases.push_back({"rrq_all_options", buildRequest(RRQ, {"images/initrd.img", "octet", "blksize", "8192", "timeout", "3", "tsize", "0",
+                                                           "windowsize", "16", "utimeout", "250000", "rollover", "0"})});
+    cases.push_back({"wrq_upper_case", buildRequest(WRQ, {"upload/firmware.bin", "OCTET", "BLKSIZE", "1428", "TSIZE", "1048576", "WindowSize", "4"})});
+    cases.push_back({"rrq_unknown_options", buildRequest(RRQ, {"boot.cfg", "netascii", "x-vendor", "abc", "blksize", "512", "x-client-id", "42"})});
+    return cases;
+}
+
+bool runParseCase(const TFTPParseCase &parseCase, long iterations, TFTPParseResult &result)
+{
+    const uint8_t *packet = reinterpret_cast<const uint8_t *>(parseCase.packet.data());
+    size_t length = parseCase.packet.size();
+
+    result.name = parseCase.name;
+    result.packetSize = length;
+    result.oackSize = 0;
+    result.requestsPerSecond = 0;
+    result.oacksPerSecond = 0;
+    result.allocationsPerRequest = -1;
+
+    // The request is checked once, a rejected request would print its error on every iteration
+    TFTPRequest request;
+    TFTPOparams params;
+    initParams(params);
+    if (!parseRequest(packet, length, request) || !applyOptions(request.options, params))
+    {
+        return false;
+    }
+
+    unsigned long long allocationsBefore = allocationsSoFar();
+    unsigned long long sum = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+    {
+        initParams(params);
+        if (parseRequest(packet, length, request) && applyOptions(request.options, params))
+        {
+            sum += request.filenameLength + request.options.requested + params.blksize;
+        }
+    }
+    double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The OACK is encoded into a buffer of the size the server uses
+    uint8_t oack[CONTROL_PACKET_SIZE];
+    double encodeSeconds = 0;
+    if (request.options.requested != 0)
+    {
+        params.transfersize = 1048576;
+        start = std::chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++)
+        {
+            result.oackSize = encodeOACK(oack, sizeof(oack), request.options, params);
+            sum += oack[result.oackSize - 2];
+        }
+        encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    unsigned long long allocations = allocationsSoFar() - allocationsBefore;
+    parseSink = parseSink + sum;
+
+#ifdef TFTP_ALLOC_STATS
+    result.allocationsPerRequest = static_cast<double>(allocations) / iterations;
+#else
+    (void)allocations;
+#endif
+    result.requestsPerSecond = parseSeconds > 0 ? iterations / parseSeconds : 0;
+    result.oacksPerSecond = encodeSeconds > 0 ? iterations / encodeSeconds : 0;
+    return true;
+}
+
+void writeParseJson(std::ostream &out, long iterations, const std::vector<TFTPParseResult> &results)
+{
+    out << std::fixed << std::setprecision(3)
+        << "{\n"
+        << "  \"iterations\": " << iterations << ",\n"
+        << "  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const TFTPParseResult &result = results[i];
+        out << "    {\"request\": \"" << result.name << "\", \"packet_bytes\": " << result.packetSize << ", \"oack_bytes\": " << result.oackSize
+            << ", \"requests_per_s\": " << std::setprecision(0) << result.requestsPerSecond
+            << ", \"ns_per_request\": " << std::setprecision(1) << (result.requestsPerSecond > 0 ? 1e9 / result.requestsPerSecond : 0)
+            << ", \"oacks_per_s\": " << std::setprecision(0) << result.oacksPerSecond
+            << ", \"allocations_per_request\": " << std::setprecision(3) << result.allocationsPerRequest << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n"
+        << "}" << std::endl;
+}
+
+static void printParseUsage()
+{
+    std::cerr << "Usage: tftp-parsebench [-n iterations]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = DEFAULT_PARSE_ITERATIONS;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        const char *value = argv[i + 1];
+        if (arg == "-n")
+        {
+            iterations = std::atol(value);
+        }
+        else
+        {
+            printParseUsage();
+            return 1;
+        }
+    }
+
+    if (argc % 2 == 0 || iterations <= 0)
+    {
+        printParseUsage();
+        return 1;
+    }
+
+    std::vector<TFTPParseResult> results;
+    bool failed = false;
+    for (const TFTPParseCase &parseCase : parseCases())
+    {
+        TFTPParseResult result;
+        if (!runParseCase(parseCase, iterations, result))
+        {
+            std::cerr << "Error: Request " << parseCase.name << " was rejected" << std::endl;
+            failed = true;
+            continue;
+        }
+
+        std::cerr << result.name << ": " << static_cast<long long>(result.requestsPerSecond) << " requests/s" << std::endl;
+        results.push_back(result);
+    }
+
+    writeParseJson(std::cout, iterations, results);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file tftp-parsebench.h
+ * @brief Declarations for the microbenchmark of the request parser and OACK encoder of the TFTP server.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_PARSEBENCH_H
+#define TFTP_PARSEBENCH_H
+
+#include "tftp-server.h"
+#include <string>
+
+// Default number of times every request is parsed and every OACK encoded
+const long DEFAULT_PARSE_ITERATIONS = 2000000;
+
+// Request datagram measured by the benchmark
+struct TFTPParseCase
+{
+    std::string name;
+    std::string packet; // Opcode, fields and their null-terminators
+};
+
+// Results of one request
+struct TFTPParseResult
+{
+    std::string name;
+    size_t packetSize;
+    size_t oackSize;              // 0 if the request has no options to acknowledge
+    double requestsPerSecond;     // Requests parsed and their options checked per second
+    double oacksPerSecond;        // OACK packets encoded per second
+    double allocationsPerRequest; // Heap allocations of parsing and encoding, -1 without ALLOC_STATS=1
+};
+
+/**
+ * @brief Builds the request datagrams of the benchmark.
+ *
+ * @return Requests of the benchmark.
+ */
+std::vector<TFTPParseCase> parseCases();
+
+/**
+ * @brief Parses a request and encodes its OACK repeatedly.
+ *
+ * @param parseCase Request to measure.
+ * @param iterations Number of times the request is parsed and its OACK encoded.
+ * @param result Measured rates.
+ * @return True if the request was accepted by the parser, otherwise False.
+ */
+bool runParseCase(const TFTPParseCase &parseCase, long iterations, TFTPParseResult &result);
+
+/**
+ * @brief Writes the results of the benchmark as JSON.
+ *
+ * @param out Output stream.
+ * @param iterations Number of iterations of every request.
+ * @param results Results of the requests.
+ */
+void writeParseJson(std::ostream &out, long iterations, const std::vector<TFTPParseResult> &results);
+
+#endif // TFTP_PARSEBENCH_H
@@ -5,6 +5,7 @@
  */
 
 #include "tftp-client.h"
+#include "tftp-alloc-stats.h"
 
 bool isAscii(const std::string &fileName)
 {
@@ -107,7 +108,7 @@ void handleError(int sock, const std::string &hostname, int srcPort, int serverP
         std::cout << "Error: Failed to send ERROR." << std::endl;
     }
 
-    std::cerr << "ERROR " << hostname << ":" << srcPort << ":" << serverPort << " " << errorCode << " \"" << errorMsg << "\"" << std::endl;
+    logLine(LOG_LEVEL_ERROR, "ERROR " + hostname + ":" + std::to_string(srcPort) + ":" + std::to_string(serverPort) + " " + std::to_string(errorCode) + " \"" + errorMsg + "\"");
 }
 
 bool receiveAck(int sock, uint16_t &receivedBlockID, int &serverPort, TFTPOparams &params, std::map<std::string, std::string> &receivedOptions)
@@ -218,7 +219,7 @@ bool receiveAck(int sock, uint16_t &receivedBlockID, int &serverPort, TFTPOparam
 
                 std::string tsize_str = received_options["tsize"];
 
-                int tsize = std::stoi(tsize_str);
+                long long tsize = std::stoll(tsize_str);
 
                 params.transfersize = tsize;
 
@@ -226,7 +227,7 @@ bool receiveAck(int sock, uint16_t &receivedBlockID, int &serverPort, TFTPOparam
                 if (statvfs("/", &stat) == 0)
                 {
                     unsigned long long freeSpace = stat.f_frsize * stat.f_bfree;
-                    if (freeSpace < params.transfersize)
+                    if (freeSpace < static_cast<unsigned long long>(params.transfersize))
                         std::cout << "Free space is: " << freeSpace / (1024 * 1024) << " MB "
                                   << "You need" << receivedOptions["tsize"] << std::endl;
                 }
@@ -236,39 +237,49 @@ bool receiveAck(int sock, uint16_t &receivedBlockID, int &serverPort, TFTPOparam
                     // TODO ERROR SEND
                 }
             }
+            else if (pair.first == "multicast")
+            {
+                receivedOptions["multicast"] = pair.second;
+            }
         }
     }
 
-    std::cerr << (opcode == 4 ? "ACK" : "OACK") << " " << inet_ntoa(senderAddr.sin_addr) << ":" << ntohs(senderAddr.sin_port);
-
     if (opcode == 6)
     {
-        for (const auto &pair : received_options)
+        if (logEnabled(LOG_LEVEL_PACKET))
         {
-            std::cerr << " " << pair.first << "=" << pair.second;
+            std::string line = "OACK ";
+            line += inet_ntoa(senderAddr.sin_addr);
+            line += ":" + std::to_string(ntohs(senderAddr.sin_port));
+            for (const auto &pair : received_options)
+            {
+                line += " " + pair.first + "=" + pair.second;
+            }
+            logLine(LOG_LEVEL_PACKET, line);
         }
-        std::cerr << std::endl;
     }
     else
     {
-        std::cerr << std::endl;
+        logPacket(LOG_EVENT_ACK, senderAddr.sin_addr, ntohs(senderAddr.sin_port), 0, receivedBlockID);
     }
 
     return true;
 }
 
-bool sendData(int sock, const std::string &hostname, int port, const std::string &data)
+bool sendData(int sock, const std::string &hostname, int port, const char *data, size_t dataSize)
 {
     // Increment the block ID for the next data block
     blockID++;
 
-    // Create a buffer for the DATA packet
-    std::vector<uint8_t> dataBuffer;
-    dataBuffer.push_back(0);                     // High byte of opcode (0 for DATA)
-    dataBuffer.push_back(3);                     // Low byte of opcode (3 for DATA)
-    dataBuffer.push_back((blockID >> 8) & 0xFF); // High byte of block ID
-    dataBuffer.push_back(blockID & 0xFF);        // Low byte of block ID
-    dataBuffer.insert(dataBuffer.end(), data.begin(), data.end());
+    // Build the DATA packet in the preallocated send buffer
+    sendPacketBuffer[0] = 0;                     // High byte of opcode (0 for DATA)
+    sendPacketBuffer[1] = 3;                     // Low byte of opcode (3 for DATA)
+    sendPacketBuffer[2] = (blockID >> 8) & 0xFF; // High byte of block ID
+    sendPacketBuffer[3] = blockID & 0xFF;        // Low byte of block ID
+    if (dataSize > 0)
+    {
+        memcpy(sendPacketBuffer + 4, data, dataSize);
+    }
 
     // Create sockaddr_in structure for the remote server (serverAddr)
     sockaddr_in serverAddr;
@@ -278,20 +289,48 @@ bool sendData(int sock, const std::string &hostname, int port, const std::string
     inet_pton(AF_INET, hostname.c_str(), &(serverAddr.sin_addr));
 
     // Send DATA packet
-    ssize_t sentBytes = sendto(sock, dataBuffer.data(), dataBuffer.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    ssize_t sentBytes = sendto(sock, sendPacketBuffer, dataSize + 4, 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
     if (sentBytes == -1)
     {
         std::cout << "Error: Failed to send DATA." << std::endl;
         return false;
     }
     std::cout << std::dec;
+    transferredBytes += dataSize;
 
-    // std::cout << "Sent DATA packet with size: " << dataBuffer.size() << " bytes, block ID: " << blockID << std::endl; // Print the size and block ID
+    // std::cout << "Sent DATA packet with size: " << dataSize + 4 << " bytes, block ID: " << blockID << std::endl; // Print the size and block ID
 
     return true;
 }
 
-int SendFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, const std::string &remoteFilePath, std::string &mode, const std::string &options, TFTPOparams &params)
+size_t readNetasciiBlock(std::istream &stream, TFTPNetasciiReader &reader, char *block, size_t blockSize)
+{
+    size_t produced = 0;
+
+    while (produced < blockSize)
+    {
+        // Refill the buffer once it is translated, a pending pair is completed without input
+        if (reader.position == reader.length && !reader.encoder.pending)
+        {
+            stream.read(reader.buffer.data(), reader.buffer.size());
+            reader.length = stream.gcount();
+            reader.position = 0;
+
+            if (reader.length == 0)
+            {
+                break;
+            }
+        }
+
+        size_t consumed;
+        produced += netasciiEncode(reader.encoder, reader.buffer.data() + reader.position, reader.length - reader.position, consumed, block + produced, blockSize - produced);
+        reader.position += consumed;
+    }
+
+    return produced;
+}
+
+int SendFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, std::string &mode, const std::string &options, TFTPOparams &params)
 {
     // Initialize variables and open the file for reading
     std::istream *inputStream;
@@ -315,8 +354,19 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
 
     inputStream = &file;
 
-    // Determine the transmission mode based on the file content
-    mode = determineMode(remoteFilePath);
+    // Determine the transmission mode based on the name of the uploaded file
+    mode = determineMode(localFilePath);
+
+    // Text files are sent translated to netascii
+    bool netascii = isNetasciiMode(mode);
+    TFTPNetasciiReader reader;
+    if (netascii)
+    {
+        initNetasciiEncoder(reader.encoder);
+        reader.buffer.resize(NETASCII_READ_SIZE);
+        reader.position = 0;
+        reader.length = 0;
+    }
 
     const size_t maxDataSize = params.blksize; // Maximum data size in one DATA packet
     char buffer[maxDataSize];                  // Buffer for reading data from the file or stdin
@@ -357,7 +407,7 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
     int max_retries = 4;
 
     long long totalSize;
-    long long dataReceivedSoFar;
+    long long dataReceivedSoFar = 0;
     double percentageReceived;
 
     bool lastnullpacket = false;
@@ -370,14 +420,22 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
 
     while (!transferComplete)
     {
-        inputStream->read(buffer, maxDataSize);
-        std::streamsize bytesRead = inputStream->gcount();
+        std::streamsize bytesRead;
+        if (netascii)
+        {
+            bytesRead = readNetasciiBlock(*inputStream, reader, buffer, maxDataSize);
+        }
+        else
+        {
+            inputStream->read(buffer, maxDataSize);
+            bytesRead = inputStream->gcount();
+        }
 
         if (bytesRead > 0)
         {
             lastbytesread = bytesRead;
 
-            if (!sendData(sock, hostname, serverPort, std::string(buffer, bytesRead)))
+            if (!sendData(sock, hostname, serverPort, buffer, bytesRead))
             {
                 return 1;
             }; // Send data to the server
@@ -395,7 +453,7 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
                     // If ACK wasn't received in time, retry sending the data packet
                     std::cout << "Warning: ACK not received for block " << blockID << ", retrying..." << std::endl;
 
-                    if (!sendData(sock, hostname, serverPort, std::string(buffer, bytesRead)))
+                    if (!sendData(sock, hostname, serverPort, buffer, bytesRead))
                     {
                         return 1;
                     }
@@ -415,8 +473,8 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
 
             if (option_tsize_used)
             {
-                // Extract the total size (tsize) from the receivedOptions map
-                dataReceivedSoFar = blockID * params.blksize;
+                // Count the sent bytes, block numbers wrap for files larger than 65535 blocks
+                dataReceivedSoFar += bytesRead;
 
                 // Calculate the percentage of data received
                 percentageReceived = ((double)dataReceivedSoFar / totalSize) * 100;
@@ -448,7 +506,7 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
 
     if (lastnullpacket)
     {
-        if (!sendData(sock, hostname, serverPort, ""))
+        if (!sendData(sock, hostname, serverPort, nullptr, 0))
         {
             return 1;
         }
@@ -466,7 +524,7 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
                 // If ACK wasn't received in time, retry sending the last null DATA packet
                 std::cout << "Warning: ACK not received for the last null DATA packet, retrying..." << std::endl;
 
-                if (!sendData(sock, hostname, serverPort, ""))
+                if (!sendData(sock, hostname, serverPort, nullptr, 0))
                 {
                     return 1;
                 }
@@ -495,6 +553,8 @@ int SendFile(int sock, const std::string &hostname, int port, const std::string
 
     // Close the socket
     close(sock);
+
+    return 0;
 }
 
 bool sendTFTPRequest(TFTPRequestType requestType, int sock, const std::string &hostname, int port, const std::string &filepath, const std::string &mode, TFTPOparams &params)
@@ -556,6 +616,15 @@ bool sendTFTPRequest(TFTPRequestType requestType, int sock, const std::string &h
         requestBuffer.push_back(0); // Null-terminate the value
     }
 
+    if (option_multicast_used == true)
+    {
+        // Add "multicast" followed by an empty value (RFC 2090)
+        std::string multicastOption = "multicast";
+        requestBuffer.insert(requestBuffer.end(), multicastOption.begin(), multicastOption.end());
+        requestBuffer.push_back(0); // Null-terminate "multicast"
+        requestBuffer.push_back(0); // Empty value
+    }
+
     // Create sockaddr_in structure for the remote server
     sockaddr_in serverAddr;
     std::memset(&serverAddr, 0, sizeof(serverAddr));
@@ -571,37 +640,45 @@ bool sendTFTPRequest(TFTPRequestType requestType, int sock, const std::string &h
         return false;
     }
 
-    std::cerr << (requestType == READ_REQUEST ? "RRQ " : "WRQ ") << hostname << ":" << port << " \"" << filepath << "\" " << mode;
+    std::ostringstream line;
+    line << (requestType == READ_REQUEST ? "RRQ " : "WRQ ") << hostname << ":" << port << " \"" << filepath << "\" " << mode;
     if (option_timeout_used == true || option_blksize_used == true)
     {
 
         if (option_timeout_used == true)
         {
-            std::cerr << " timeout=" << params.timeout_max;
+            line << " timeout=" << params.timeout_max;
         }
         if (option_blksize_used == true)
         {
-            std::cerr << " blksize=" << params.blksize;
+            line << " blksize=" << params.blksize;
         }
         if (option_tsize_used == true)
         {
-            std::cerr << " tsize=" << params.transfersize;
+            line << " tsize=" << params.transfersize;
         }
     }
-    std::cerr << std::endl;
+    if (option_multicast_used == true)
+    {
+        line << " multicast";
+    }
+    logLine(LOG_LEVEL_SUMMARY, line.str());
+
+    return true;
 }
 
-bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, std::string &data, TFTPOparams &params, const std::string &hostname)
+bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, const char *&data, size_t &dataSize, TFTPOparams &params, const std::string &hostname)
 {
-    // Create a buffer to receive the DATA packet
-    std::vector<uint8_t> dataBuffer(params.blksize + 4); // Max size of a DATA packet with room for header
+    // Receive into the preallocated buffer (max size of a DATA packet with room for header)
+    uint8_t *dataBuffer = receivePacketBuffer;
+    size_t bufferSize = std::min<size_t>(params.blksize + 4, MAX_PACKET_SIZE);
 
     // Create sockaddr_in structure to store the sender's address
     sockaddr_in senderAddr;
     socklen_t senderAddrLen = sizeof(senderAddr);
 
     // Receive the DATA packet and capture the sender's address
-    ssize_t receivedBytes = recvfrom(sock, dataBuffer.data(), dataBuffer.size(), 0, (struct sockaddr *)&senderAddr, &senderAddrLen);
+    ssize_t receivedBytes = recvfrom(sock, dataBuffer, bufferSize, 0, (struct sockaddr *)&senderAddr, &senderAddrLen);
     if (receivedBytes == -1)
     {
         std::cout << "Error: Failed to receive DATA." << std::endl;
@@ -621,20 +698,26 @@ bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, std::stri
     serverPort = ntohs(senderAddr.sin_port);
 
     // Extract the data from the packet (skip the first 4 bytes which are the header)
-    data.assign(dataBuffer.begin() + 4, dataBuffer.begin() + receivedBytes);
+    data = reinterpret_cast<const char *>(dataBuffer + 4);
+    dataSize = receivedBytes - 4;
 
-    std::string srcIP = inet_ntoa(senderAddr.sin_addr);
     uint16_t srcPort = ntohs(senderAddr.sin_port);
 
-    sockaddr_in localAddress;
-    socklen_t addressLength = sizeof(localAddress);
-    getsockname(sock, (struct sockaddr *)&localAddress, &addressLength);
-    uint16_t dstPort = ntohs(localAddress.sin_port);
+    // The local port does not change once the request was sent, it is looked up once per socket
+    static int localSock = -1;
+    static uint16_t dstPort = 0;
+    if (sock != localSock)
+    {
+        sockaddr_in localAddress;
+        socklen_t addressLength = sizeof(localAddress);
+        getsockname(sock, (struct sockaddr *)&localAddress, &addressLength);
+        dstPort = ntohs(localAddress.sin_port);
+        localSock = sock;
+    }
 
     // Print the desired format
-    std::cerr << "DATA " << srcIP << ":" << srcPort << ":" << dstPort << " " << receivedBlockID << std::endl;
-
-    // std::cout << "Sent DATA packet with size: " << dataBuffer.size() << " bytes, block ID: " << blockID << std::endl; // Print the size and block ID
+    logPacket(LOG_EVENT_DATA, senderAddr.sin_addr, srcPort, dstPort, receivedBlockID);
+    transferredBytes += dataSize;
 
     blockID = receivedBlockID + 1;
 
@@ -644,7 +727,7 @@ bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, std::stri
 bool sendAck(int sock, uint16_t blockID, const std::string &hostname, int serverPort, TFTPOparams &params)
 {
     // Create an ACK packet
-    std::vector<uint8_t> ackBuffer(4);
+    uint8_t ackBuffer[4];
     ackBuffer[0] = 0;                     // High byte of opcode (0 for ACK)
     ackBuffer[1] = 4;                     // Low byte of opcode (4 for ACK)
     ackBuffer[2] = (blockID >> 8) & 0xFF; // High byte of block ID
@@ -664,14 +747,14 @@ bool sendAck(int sock, uint16_t blockID, const std::string &hostname, int server
     }
 
     // Send the ACK packet to the server
-    ssize_t sentBytes = sendto(sock, ackBuffer.data(), ackBuffer.size(), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
+    ssize_t sentBytes = sendto(sock, ackBuffer, sizeof(ackBuffer), 0, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
     if (sentBytes == -1)
     {
         std::cout << "Error: Failed to send ACK." << std::endl;
         return false;
     }
 
-    std::cout << "Sent ACK with block ID: " << blockID << " to server port: " << serverPort << std::endl;
+    logPacket(LOG_EVENT_SENT_ACK, serverAddr.sin_addr, serverPort, 0, blockID);
 
     return true;
 }
@@ -706,7 +789,7 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
     bool firstOACK = false;
 
     long long totalSize;
-    long long dataReceivedSoFar;
+    long long dataReceivedSoFar = 0;
     double percentageReceived;
 
     int RequestRetries = 0;
@@ -717,12 +800,20 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
 
     uint16_t blockID = 0; // Initialize the block ID
 
+    // Data of the last received block, points into the receive packet buffer
+    const char *data = nullptr;
+    size_t dataSize = 0;
+
+    // Text files are received in netascii and translated back
+    bool netascii = isNetasciiMode(mode);
+    TFTPNetasciiDecoder decoder;
+    initNetasciiDecoder(decoder);
+
     sendTFTPRequest(READ_REQUEST, sock, hostname, port, remoteFilePath, mode, params);
 
     while (!transferComplete)
     {
         uint16_t receivedBlockID;
-        std::string data;
         std::map<std::string, std::string> receivedOptions;
 
         if (options_used == true && firstOACK == false)
@@ -781,7 +872,7 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
             while (!dataReceived && numRetriesRecvData < 4)
             {
 
-                dataReceived = receiveData(sock, receivedBlockID, serverPort, data, params, hostname);
+                dataReceived = receiveData(sock, receivedBlockID, serverPort, data, dataSize, params, hostname);
                 if (!dataReceived)
                 {
                     // Pokud ACK nebyl přijat včas, pokusit se znovu odeslat datový paket
@@ -815,9 +906,8 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
 
             if (option_tsize_used)
             {
-                // Extract the total size (tsize) from the receivedOptions map
-
-                dataReceivedSoFar = receivedBlockID * params.blksize;
+                // Count the received bytes, block numbers wrap for files larger than 65535 blocks
+                dataReceivedSoFar += dataSize;
 
                 // Calculate the percentage of data received
                 percentageReceived = ((double)dataReceivedSoFar / totalSize) * 100;
@@ -841,7 +931,7 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
             while (!dataReceived && numRetriesRecvData < 4)
             {
 
-                dataReceived = receiveData(sock, receivedBlockID, serverPort, data, params, hostname);
+                dataReceived = receiveData(sock, receivedBlockID, serverPort, data, dataSize, params, hostname);
                 if (!dataReceived && firstDataRecv == true)
                 {
 
@@ -898,7 +988,7 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
         }
 
         // Check if the received block ID is the expected one
-        if (receivedBlockID != blockID + 1)
+        if (receivedBlockID != static_cast<uint16_t>(blockID + 1))
         {
             std::cout << "Error: Received out-of-order block ID." << std::endl;
             close(sock);                   // Close the socket on error
@@ -907,8 +997,16 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
             return 1;
         }
 
-        // Write the received data to the output file
-        if (!outputFile.write(data.data(), data.size()))
+        // Write the received data to the output file, netascii translated back to local text
+        const char *fileData = data;
+        size_t fileDataSize = dataSize;
+        if (netascii)
+        {
+            fileDataSize = netasciiDecode(decoder, data, dataSize, translatedBuffer);
+            fileData = translatedBuffer;
+        }
+
+        if (!outputFile.write(fileData, fileDataSize))
         {
             std::cout << "Error: Failed to write data to the file." << std::endl;
             close(sock);                   // Close the socket on error
@@ -920,7 +1018,7 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
         // Increment the block ID for the next ACK
         blockID = receivedBlockID;
 
-        if (data.size() < params.blksize)
+        if (dataSize < params.blksize)
         {
 
             if (options_used == true)
@@ -938,6 +1036,13 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
         }
     }
 
+    // A CR ending the file has no pair to complete
+    if (netascii)
+    {
+        size_t length = netasciiFinish(decoder, translatedBuffer);
+        outputFile.write(translatedBuffer, length);
+    }
+
     // Close the output file
     outputFile.close();
 
@@ -945,6 +1050,291 @@ int receive_file(int sock, const std::string &hostname, int port, const std::str
     close(sock);
 
     std::cout << "File download complete: " << localFilePath << std::endl;
+
+    return 0;
+}
+
+int joinMulticastGroup(const sockaddr_in &groupAddr, const std::string &hostname)
+{
+    int groupSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (groupSock == -1)
+    {
+        std::cout << "Error: Failed to create multicast socket." << std::endl;
+        return -1;
+    }
+
+    // Every client of this host listening to the group receives its own copy of the DATA
+    int reuse = 1;
+    setsockopt(groupSock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(groupSock, (struct sockaddr *)&groupAddr, sizeof(groupAddr)) < 0)
+    {
+        std::cout << "Error: Failed to bind multicast socket." << std::endl;
+        close(groupSock);
+        return -1;
+    }
+
+    ip_mreq membership;
+    membership.imr_multiaddr = groupAddr.sin_addr;
+    membership.imr_interface.s_addr = INADDR_ANY;
+
+    // Join on the interface leading to the server, connecting a UDP socket only selects the route
+    sockaddr_in serverAddr;
+    std::memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = groupAddr.sin_port;
+    inet_pton(AF_INET, hostname.c_str(), &(serverAddr.sin_addr));
+
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe != -1)
+    {
+        sockaddr_in localAddr;
+        socklen_t localAddrLen = sizeof(localAddr);
+        if (connect(probe, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == 0 &&
+            getsockname(probe, (struct sockaddr *)&localAddr, &localAddrLen) == 0)
+        {
+            membership.imr_interface = localAddr.sin_addr;
+        }
+        close(probe);
+    }
+
+    if (setsockopt(groupSock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+    {
+        std::cout << "Error: Failed to join multicast group." << std::endl;
+        close(groupSock);
+        return -1;
+    }
+
+    return groupSock;
+}
+
+int receiveMulticastFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, const std::string &remoteFilePath, TFTPOparams &params)
+{
+    // Blocks are written at their offsets in the order they arrive, so they cannot be translated from netascii
+    std::string mode = "octet";
+
+    int fd = open(localFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cout << "Error: Failed to open file for writing." << std::endl;
+        close(sock);
+        return 1;
+    }
+
+    // The size of the file tells every member how many blocks it has to collect
+    options_used = true;
+    option_tsize_used = true;
+    params.transfersize = 0;
+
+    setSocketTimeout(sock, params.timeout_max);
+
+    uint16_t receivedBlockID = 0;
+    int serverPort = 0;
+    std::map<std::string, std::string> receivedOptions;
+    bool oackReceived = false;
+
+    // Send RRQ packet with the multicast option and retry up to 4 times if no OACK is received
+    for (int requestRetries = 0; !oackReceived && requestRetries < 4; requestRetries++)
+    {
+        sendTFTPRequest(READ_REQUEST, sock, hostname, port, remoteFilePath, mode, params);
+
+        oackReceived = receiveAck(sock, receivedBlockID, serverPort, params, receivedOptions);
+        if (!oackReceived)
+        {
+            std::cout << "Warning: OACK not received after RRQ, retrying..." << std::endl;
+        }
+    }
+
+    // The OACK announces the group as "address,port,mc" where mc is 1 for the master client
+    char groupAddress[INET_ADDRSTRLEN];
+    int groupPort = 0;
+    int masterClient = 0;
+    if (!oackReceived || receivedOptions.find("tsize") == receivedOptions.end() || receivedOptions.find("multicast") == receivedOptions.end() ||
+        sscanf(receivedOptions["multicast"].c_str(), "%15[0-9.],%d,%d", groupAddress, &groupPort, &masterClient) != 3)
+    {
+        std::cout << "Error: The server did not accept the multicast option." << std::endl;
+        if (oackReceived)
+        {
+            handleError(sock, hostname, port, serverPort, ERROR_UNDEFINED, "Multicast not accepted");
+        }
+        close(fd);
+        remove(localFilePath.c_str());
+        close(sock);
+        return 1;
+    }
+
+    sockaddr_in groupAddr;
+    std::memset(&groupAddr, 0, sizeof(groupAddr));
+    groupAddr.sin_family = AF_INET;
+    groupAddr.sin_port = htons(groupPort);
+    inet_pton(AF_INET, groupAddress, &(groupAddr.sin_addr));
+
+    int groupSock = joinMulticastGroup(groupAddr, hostname);
+    if (groupSock == -1)
+    {
+        handleError(sock, hostname, port, serverPort, ERROR_UNDEFINED, "Cannot join multicast group");
+        close(fd);
+        remove(localFilePath.c_str());
+        close(sock);
+        return 1;
+    }
+
+    std::cout << "Joined multicast group " << groupAddress << ":" << groupPort << (masterClient == 1 ? " as the master client" : "") << std::endl;
+
+    in_addr serverIp;
+    inet_pton(AF_INET, hostname.c_str(), &serverIp);
+
+    // Blocks received so far, a block number never wraps in a multicast transfer
+    uint64_t blockCount = params.transfersize / params.blksize + 1;
+    std::vector<bool> received(blockCount + 1, false);
+    uint64_t receivedCount = 0;
+    uint64_t firstMissing = 1;
+
+    bool isMaster = masterClient == 1;
+    bool failed = false;
+    int retries = 0;
+    int idleTimeouts = 0;
+
+    // The master answers the OACK with the last block it has in order
+    if (isMaster)
+    {
+        sendAck(sock, firstMissing - 1, hostname, serverPort, params);
+    }
+
+    pollfd fds[2];
+    fds[0].fd = groupSock;
+    fds[0].events = POLLIN;
+    fds[1].fd = sock;
+    fds[1].events = POLLIN;
+
+    while (receivedCount < blockCount && !failed)
+    {
+        int ready = poll(fds, 2, params.timeout_max * 1000);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cout << "Error: Failed to wait for DATA." << std::endl;
+            failed = true;
+            break;
+        }
+
+        if (ready == 0)
+        {
+            if (isMaster)
+            {
+                // Request the first missing block again
+                if (++retries >= 4)
+                {
+                    std::cout << "Error: DATA not received after multiple retries, exiting..." << std::endl;
+                    failed = true;
+                    break;
+                }
+                std::cout << "Warning: DATA not received for block " << firstMissing << ", retrying..." << std::endl;
+                sendAck(sock, firstMissing - 1, hostname, serverPort, params);
+            }
+            else if (++idleTimeouts >= MULTICAST_IDLE_TIMEOUTS)
+            {
+                std::cout << "Error: No DATA received from the multicast group, exiting..." << std::endl;
+                failed = true;
+            }
+            continue;
+        }
+        idleTimeouts = 0;
+
+        // The server makes this client the master with another OACK or ends the transfer with an ERROR
+        if (fds[1].revents & POLLIN)
+        {
+            std::map<std::string, std::string> options;
+            int masterPort = 0;
+            if (!receiveAck(sock, receivedBlockID, masterPort, params, options))
+            {
+                std::cout << "Error: Transfer terminated by the server." << std::endl;
+                failed = true;
+                break;
+            }
+
+            if (options.find("multicast") != options.end() &&
+                sscanf(options["multicast"].c_str(), "%15[0-9.],%d,%d", groupAddress, &groupPort, &masterClient) == 3 && masterClient == 1)
+            {
+                std::cout << "Became the master client, requesting block " << firstMissing << std::endl;
+                isMaster = true;
+                serverPort = masterPort;
+                retries = 0;
+                sendAck(sock, firstMissing - 1, hostname, serverPort, params);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            sockaddr_in senderAddr;
+            socklen_t senderAddrLen = sizeof(senderAddr);
+            ssize_t receivedBytes = recvfrom(groupSock, receivePacketBuffer, MAX_PACKET_SIZE, 0, (struct sockaddr *)&senderAddr, &senderAddrLen);
+
+            // Only DATA packets of the server belong to the transfer
+            if (receivedBytes < 4 || senderAddr.sin_addr.s_addr != serverIp.s_addr || receivePacketBuffer[0] != 0 || receivePacketBuffer[1] != 3)
+            {
+                continue;
+            }
+
+            uint16_t block = (receivePacketBuffer[2] << 8) | receivePacketBuffer[3];
+            size_t dataSize = receivedBytes - 4;
+
+            logPacket(LOG_EVENT_DATA, senderAddr.sin_addr, ntohs(senderAddr.sin_port), groupPort, block);
+
+            if (block >= 1 && block <= blockCount && !received[block])
+            {
+                // Store the block at its offset, blocks the master requested earlier may be missing
+                if (pwrite(fd, receivePacketBuffer + 4, dataSize, (block - 1) * params.blksize) != static_cast<ssize_t>(dataSize))
+                {
+                    std::cout << "Error: Failed to write data to the file." << std::endl;
+                    failed = true;
+                    break;
+                }
+
+                received[block] = true;
+                receivedCount++;
+                transferredBytes += dataSize;
+                while (firstMissing <= blockCount && received[firstMissing])
+                {
+                    firstMissing++;
+                }
+
+                std::cout << "Received: " << (receivedCount * 100 / blockCount) << "% of blocks." << std::endl;
+            }
+
+            if (isMaster)
+            {
+                retries = 0;
+                sendAck(sock, firstMissing - 1, hostname, serverPort, params);
+            }
+        }
+    }
+
+    close(groupSock);
+    close(fd);
+
+    if (failed)
+    {
+        handleError(sock, hostname, port, serverPort, ERROR_UNDEFINED, "Multicast transfer failed");
+        remove(localFilePath.c_str()); // Delete the partially downloaded file
+        close(sock);
+        return 1;
+    }
+
+    // The master acknowledged the last block, other members tell the server they have the whole file
+    if (!isMaster)
+    {
+        sendAck(sock, blockCount, hostname, serverPort, params);
+    }
+
+    close(sock);
+
+    std::cout << "File download complete: " << localFilePath << std::endl;
+
+    return 0;
 }
 
 bool parseTFTPParameters(const std::string &Oparamstring, TFTPOparams &Oparams)
@@ -994,7 +1384,7 @@ bool parseTFTPParameters(const std::string &Oparamstring, TFTPOparams &Oparams)
         {
             option_tsize_used = true;
 
-            int transfersize = std::stoi(paramValue);
+            long long transfersize = std::stoll(paramValue);
             if (transfersize >= 0)
             {
                 Oparams.transfersize = transfersize;
@@ -1021,6 +1411,21 @@ bool parseTFTPParameters(const std::string &Oparamstring, TFTPOparams &Oparams)
     return true;
 }
 
+void logTransferSummary(const std::string &hostname, int port, const std::string &filepath, bool completed, std::chrono::steady_clock::time_point startedAt)
+{
+    // The summary log replaces the per-packet lines with one line per transfer
+    if (!logLevelIs(LOG_LEVEL_SUMMARY))
+    {
+        return;
+    }
+
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startedAt;
+    std::ostringstream line;
+    line << "END " << hostname << ":" << port << " \"" << filepath << "\" " << (completed ? "completed" : "failed")
+         << " bytes=" << transferredBytes << " time=" << std::fixed << std::setprecision(3) << duration.count() << "s";
+    logLine(LOG_LEVEL_SUMMARY, line.str());
+}
+
 int main(int argc, char *argv[])
 {
     std::string hostname;
@@ -1056,6 +1461,32 @@ int main(int argc, char *argv[])
         {
             localFilePath = argv[++i];
         }
+        else if (arg == "--multicast")
+        {
+            option_multicast_used = true;
+        }
+        else if (arg == "--log" && i + 1 < argc)
+        {
+            TFTPLogLevel level;
+            if (!parseLogLevel(argv[++i], level))
+            {
+                std::cout << "Error: Invalid log level (error, summary or packet)." << std::endl;
+                return 1;
+            }
+            setLogLevel(level);
+        }
+        else if (arg == "--log-sample" && i + 1 < argc)
+        {
+            int every = std::atoi(argv[++i]);
+            if (every <= 0)
+            {
+                std::cout << "Error: Invalid log sampling interval." << std::endl;
+                return 1;
+            }
+            setLogSampling(LOG_EVENT_ACK, every);
+            setLogSampling(LOG_EVENT_DATA, every);
+            setLogSampling(LOG_EVENT_SENT_ACK, every);
+        }
         else if (arg == "--option" && i + 1 < argc)
         {
             if (!parseTFTPParameters(argv[++i], Oparams))
@@ -1068,7 +1499,7 @@ int main(int argc, char *argv[])
 
     if (hostname.empty() || localFilePath.empty())
     {
-        std::cout << "Usage: tftp-client -h hostname [-p port] [-f filepath] -t dest_filepath [--option]" << std::endl;
+        std::cout << "Usage: tftp-client -h hostname [-p port] [-f filepath] -t dest_filepath [--option] [--multicast] [--log level] [--log-sample N]" << std::endl;
         return 1;
     }
 
@@ -1090,10 +1521,29 @@ int main(int argc, char *argv[])
     serverAddr.sin_port = htons(port);
     inet_pton(AF_INET, hostname.c_str(), &(serverAddr.sin_addr));
 
-    if (remoteFilePath.empty())
+    std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+    const std::string &transferPath = remoteFilePath.empty() ? localFilePath : remoteFilePath;
+
+    if (option_multicast_used && !remoteFilePath.empty())
     {
-        if (SendFile(sock, hostname, port, localFilePath, remoteFilePath, mode, options, Oparams) == 1)
+        // Receive a file together with other clients of a multicast group
+        if (receiveMulticastFile(sock, hostname, port, localFilePath, remoteFilePath, Oparams) == 1)
         {
+            logTransferSummary(hostname, port, transferPath, false, startedAt);
+            return 1;
+        };
+    }
+    else if (option_multicast_used)
+    {
+        std::cout << "Error: The --multicast option can only be used to receive a file." << std::endl;
+        close(sock);
+        return 1;
+    }
+    else if (remoteFilePath.empty())
+    {
+        if (SendFile(sock, hostname, port, localFilePath, mode, options, Oparams) == 1)
+        {
+            logTransferSummary(hostname, port, transferPath, false, startedAt);
             return 1;
         };
     }
@@ -1102,6 +1552,7 @@ int main(int argc, char *argv[])
         // Receive a file from the server
         if (receive_file(sock, hostname, port, localFilePath, remoteFilePath, mode, options, Oparams) == 1)
         {
+            logTransferSummary(hostname, port, transferPath, false, startedAt);
             return 1;
         };
     }
@@ -1112,5 +1563,12 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    logTransferSummary(hostname, port, transferPath, true, startedAt);
+
+#ifdef TFTP_ALLOC_STATS
+    flushLog();
+    std::cerr << "Heap allocations: " << allocationCount() << std::endl;
+#endif
+
     return 0;
 }
\ No newline at end of file
@@ -23,23 +23,56 @@
 #include <iomanip>
 #include <fcntl.h>
 #include <sys/statvfs.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include "tftp-netascii.h"
+#include "tftp-log.h"
 
 // Optional options
 struct TFTPOparams
 {
     uint16_t blksize;
     uint16_t timeout_max;
-    int transfersize;
+    long long transfersize;
 };
 
-// Initial block ID
+// Initial block ID, block numbers wrap from 65535 to 0 (default rollover of the server)
 uint16_t blockID = 0;
 
+// Largest DATA packet (maximum blksize + header)
+const size_t MAX_PACKET_SIZE = 65468;
+
+// Preallocated packet buffers, every DATA packet is built or received in place
+alignas(64) uint8_t sendPacketBuffer[MAX_PACKET_SIZE];
+alignas(64) uint8_t receivePacketBuffer[MAX_PACKET_SIZE];
+
+// Received netascii data translated back to local text (one byte longer for a held back CR)
+alignas(64) char translatedBuffer[MAX_PACKET_SIZE + 1];
+
+// Bytes of a file read at once when it is sent in netascii
+const size_t NETASCII_READ_SIZE = 64 * 1024;
+
+// Local text read from a file and translated to netascii block by block
+struct TFTPNetasciiReader
+{
+    TFTPNetasciiEncoder encoder;
+    std::vector<char> buffer;
+    size_t position; // Next byte of the buffer to translate
+    size_t length;   // Bytes in the buffer
+};
+
 // Flags to identify which options were used
 bool options_used = false;
 bool option_blksize_used = false;
 bool option_timeout_used = false;
 bool option_tsize_used = false;
+bool option_multicast_used = false;
+
+// DATA payload sent or received, reported in the summary log line
+unsigned long long transferredBytes = 0;
+
+// Timeouts without any packet after which a multicast client that is not the master gives up
+const int MULTICAST_IDLE_TIMEOUTS = 8;
 
 // TFTP Error Codes
 const uint16_t ERROR_UNDEFINED = 0;
@@ -141,9 +174,23 @@ bool receiveAck(int sock, uint16_t &receivedBlockID, int &serverPort, TFTPOparam
  * @param hostname The server's hostname.
  * @param port The server's port.
  * @param data The data to be sent.
+ * @param dataSize The size of the data.
  * @return True if the data packet was successfully sent, otherwise False.
  */
-bool sendData(int sock, const std::string &hostname, int port, const std::string &data);
+bool sendData(int sock, const std::string &hostname, int port, const char *data, size_t dataSize);
+
+/**
+ * @brief Function to fill a data block with the next bytes of a file translated to netascii.
+ *
+ * A CR LF or CR NUL pair that does not fit into the block is completed in the next block.
+ *
+ * @param stream The file being sent.
+ * @param reader The translation state of the file.
+ * @param block The block to fill.
+ * @param blockSize The size of the block.
+ * @return The number of bytes in the block, less than blockSize only at the end of the file.
+ */
+size_t readNetasciiBlock(std::istream &stream, TFTPNetasciiReader &reader, char *block, size_t blockSize);
 
 /**
  * @brief Function to send a file to the server or upload from stdin.
@@ -155,13 +202,12 @@ bool sendData(int sock, const std::string &hostname, int port, const std::string
  * @param hostname The server's hostname.
  * @param port The server's port.
  * @param localFilePath The path to the local file to send or stdin to read data from.
- * @param remoteFilePath The remote file path on the server.
  * @param mode The TFTP transfer mode (netascii or octet).
  * @param options Optional parameters for communication with the server.
  * @param params TFTP communication parameters, including block size and timeout.
  * @return 0 if the transfer was successful, otherwise 1.
  */
-int SendFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, const std::string &remoteFilePath, std::string &mode, const std::string &options, TFTPOparams &params);
+int SendFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, std::string &mode, const std::string &options, TFTPOparams &params);
 
 /**
  * @brief Function to send an RRQ (Read Request) packet.
@@ -184,17 +230,19 @@ bool sendTFTPRequest(TFTPRequestType requestType, int sock, const std::string &h
  * @brief Function to receive a data packet.
  *
  * This function receives a data packet from the specified socket and extracts information about
- * the data block and the actual data. The received data is stored in the `data` parameter.
+ * the data block and the actual data. The `data` parameter points to the received data inside
+ * the receive packet buffer and stays valid until the next packet is received.
  *
  * @param sock The communication socket.
  * @param receivedBlockID The ID of the received data block.
  * @param serverPort The server's port.
  * @param data The received data.
+ * @param dataSize The size of the received data.
  * @param params TFTP communication parameters, including block size and timeout.
  * @param hostname The server's hostname.
  * @return True if the data was successfully received, otherwise False.
  */
-bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, std::string &data, TFTPOparams &params, const std::string &hostname);
+bool receiveData(int sock, uint16_t &receivedBlockID, int &serverPort, const char *&data, size_t &dataSize, TFTPOparams &params, const std::string &hostname);
 
 /**
  * @brief Function to send an acknowledgment (ACK) to the server.
@@ -228,6 +276,48 @@ bool sendAck(int sock, uint16_t blockID, const std::string &hostname, int server
  */
 int receive_file(int sock, const std::string &hostname, int port, const std::string &localFilePath, const std::string &remoteFilePath, std::string &mode, const std::string &options, TFTPOparams &params);
 
+/**
+ * @brief Function to join the multicast group announced by the server.
+ *
+ * The returned socket is bound to the group address and port, so several clients on one host
+ * can listen to the same group. The group is joined on the interface leading to the server.
+ *
+ * @param groupAddr The multicast address and port of the group.
+ * @param hostname The server's hostname.
+ * @return The socket receiving the DATA sent to the group, or -1 on failure.
+ */
+int joinMulticastGroup(const sockaddr_in &groupAddr, const std::string &hostname);
+
+/**
+ * @brief Function to receive a file from the server as a member of a multicast group (RFC 2090).
+ *
+ * The client requests the file with the "multicast" and "tsize" options and stores every block
+ * sent to the group at its offset, in whatever order the blocks arrive. While the client is the
+ * master client it acknowledges the blocks it has up to the first missing one. Other clients
+ * listen until the server makes them the master, then they request the blocks they missed.
+ * Blocks arrive out of order, so the file is transferred in octet mode.
+ *
+ * @param sock The communication socket.
+ * @param hostname The server's hostname.
+ * @param port The server's port.
+ * @param localFilePath The path to the local file where the received content should be saved.
+ * @param remoteFilePath The remote file path on the server.
+ * @param params TFTP communication parameters, including block size and timeout.
+ * @return 0 if the transfer was successful, otherwise 1.
+ */
+int receiveMulticastFile(int sock, const std::string &hostname, int port, const std::string &localFilePath, const std::string &remoteFilePath, TFTPOparams &params);
+
+/**
+ * @brief Logs the summary line of a finished transfer (only at the summary log level).
+ *
+ * @param hostname The server's hostname.
+ * @param port The server's port.
+ * @param filepath The remote file path of the transfer.
+ * @param completed True if the whole file was transferred.
+ * @param startedAt Time the transfer was started.
+ */
+void logTransferSummary(const std::string &hostname, int port, const std::string &filepath, bool completed, std::chrono::steady_clock::time_point startedAt);
+
 /**
  * @brief Function to parse optional TFTP parameters.
  *
@@ -0,0 +1,70 @@
+/**
+ * @file tftp-alloc-stats.h
+ * @brief Heap allocation counting of the TFTP client and server (built with ALLOC_STATS=1).
+ * @author xnovos14 - Denis Novosád
+ *
+ * The replacement allocation functions are defined here, the header must be included by
+ * exactly one translation unit of each executable (tftp-client.cpp, tftp-server.cpp).
+ */
+
+#ifndef TFTP_ALLOC_STATS_H
+#define TFTP_ALLOC_STATS_H
+
+#ifdef TFTP_ALLOC_STATS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Number of heap allocations made through operator new since the start of the process
+static std::atomic<unsigned long long> heapAllocations(0);
+
+/**
+ * @brief Returns the number of heap allocations made so far.
+ *
+ * @return Number of calls of operator new.
+ */
+static inline unsigned long long allocationCount()
+{
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void *memory = std::malloc(size > 0 ? size : 1);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+#endif // TFTP_ALLOC_STATS
+
+#endif // TFTP_ALLOC_STATS_H
@@ -0,0 +1,427 @@
+/**
+ * @file tftp-log.h
+ * @brief Asynchronous logging of the TFTP client and server.
+ * @author xnovos14 - Denis Novosád
+ *
+ * DATA and ACK events are stored as binary records in a ring of the calling thread, a background
+ * thread formats them and writes them to the standard outputs. A thread logging a packet never
+ * takes a lock, formats a number or makes a system call; records that do not fit into a full
+ * ring are dropped and counted.
+ */
+
+#ifndef TFTP_LOG_H
+#define TFTP_LOG_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <csignal>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+// Levels of the log, ERROR packets are logged at every level
+enum TFTPLogLevel
+{
+    LOG_LEVEL_ERROR,   // Only ERROR packets
+    LOG_LEVEL_SUMMARY, // Request of every transfer and a summary line when it ends
+    LOG_LEVEL_PACKET   // Requests and every DATA, ACK and OACK (default)
+};
+
+// Events of the log records
+enum TFTPLogEvent
+{
+    LOG_EVENT_ACK,      // "ACK ip:port block" on the standard error output
+    LOG_EVENT_DATA,     // "DATA ip:srcport:dstport block" on the standard error output
+    LOG_EVENT_SENT_ACK, // "Sent ACK with block ID: block to server port: port" on the standard output
+    LOG_EVENT_UNEXPECTED_ACK, // "Received an unexpected ACK for block block" on the standard output
+    LOG_EVENT_OUT_OF_ORDER,   // "Received an out-of-order DATA packet for block block" on the standard output
+    LOG_EVENT_ACK_TIMEOUT,    // "Timeout waiting for ACK packet" on the standard output
+    LOG_EVENT_DATA_TIMEOUT,   // "Timeout waiting for DATA packet" on the standard output
+    LOG_EVENT_TEXT,     // Part of a preformatted line continued in the next record
+    LOG_EVENT_LINE,     // Last part of a preformatted line on the standard error output
+    LOG_EVENT_COUNT
+};
+
+// Text bytes carried by one record of a preformatted line
+const size_t LOG_TEXT_SIZE = 48;
+
+// Records of the ring of every thread (1 MiB)
+const size_t LOG_RING_RECORDS = 16384;
+
+// Interval in which the background thread writes the queued records
+const std::chrono::milliseconds LOG_FLUSH_INTERVAL(10);
+
+// One cache line of the ring, packet events are stored without formatting
+struct TFTPLogRecord
+{
+    uint8_t event;  // TFTPLogEvent
+    uint8_t length; // Text bytes of a LOG_EVENT_TEXT or LOG_EVENT_LINE record
+    uint16_t srcPort;
+    uint16_t dstPort;
+    in_addr address;
+    uint32_t block;
+    char text[LOG_TEXT_SIZE];
+};
+
+// Single-producer ring of one thread, emptied by the background thread
+struct TFTPLogRing
+{
+    std::atomic<uint64_t> head; // Records written by the thread
+    char headPadding[56];
+    std::atomic<uint64_t> tail; // Records written out by the background thread
+    char tailPadding[56];
+    std::atomic<uint64_t> dropped; // Records that did not fit into the ring
+    uint64_t reportedDrops;         // Drops already reported by the background thread
+    uint32_t seen[LOG_EVENT_COUNT]; // Events offered for sampling by the thread
+    TFTPLogRecord records[LOG_RING_RECORDS];
+};
+
+// Settings and rings of the process, never released (threads may log while the process exits)
+struct TFTPLogState
+{
+    std::atomic<int> level;
+    std::atomic<uint32_t> sampling[LOG_EVENT_COUNT]; // Every Nth event is logged, 0 or 1 logs all
+    std::mutex ringsMutex;
+    std::vector<TFTPLogRing *> rings;
+    std::mutex drainMutex;             // Held while the rings are written out
+    std::vector<TFTPLogRing *> drained; // Copy of the rings being written out
+    std::string out;                    // Formatted lines of the standard output
+    std::string err;                    // Formatted lines of the standard error output
+};
+
+/**
+ * @brief Writes out the records queued by all threads.
+ */
+inline void flushLog();
+
+// Background thread writing the rings out
+inline void runLogThread()
+{
+    while (true)
+    {
+        std::this_thread::sleep_for(LOG_FLUSH_INTERVAL);
+        flushLog();
+    }
+}
+
+// Creates the log state and starts the background thread
+inline void startLog(TFTPLogState *&state)
+{
+    state = new TFTPLogState();
+    state->level = LOG_LEVEL_PACKET;
+    for (size_t i = 0; i < LOG_EVENT_COUNT; i++)
+    {
+        state->sampling[i] = 1;
+    }
+
+    // Room for the lines of full rings, writing out does not grow the buffers during a transfer
+    state->out.reserve(LOG_RING_RECORDS * 64);
+    state->err.reserve(LOG_RING_RECORDS * 64);
+
+    // The thread starts with all signals blocked, the handlers run in the workers and in the client
+    sigset_t allSignals;
+    sigset_t previous;
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &previous);
+    std::thread(runLogThread).detach();
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+    // Lines still queued when the process exits are written out
+    std::atexit(flushLog);
+}
+
+/**
+ * @brief Returns the log state of the process, starting the background thread on first use.
+ *
+ * @return Log state.
+ */
+inline TFTPLogState &logState()
+{
+    static TFTPLogState *state = nullptr;
+    static std::once_flag started;
+    std::call_once(started, startLog, std::ref(state));
+    return *state;
+}
+
+/**
+ * @brief Sets the level of the log.
+ *
+ * @param level New level.
+ */
+inline void setLogLevel(TFTPLogLevel level)
+{
+    logState().level.store(level, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Logs only every Nth event of the given type of each thread.
+ *
+ * @param event Sampled packet event.
+ * @param every Interval of the logged events, 1 logs every event.
+ */
+inline void setLogSampling(TFTPLogEvent event, uint32_t every)
+{
+    logState().sampling[event].store(every, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Parses a log level name (error, summary or packet).
+ *
+ * @param name Name of the level.
+ * @param level Parsed level.
+ * @return True if the name is a level, otherwise False.
+ */
+inline bool parseLogLevel(const std::string &name, TFTPLogLevel &level)
+{
+    if (name == "error")
+    {
+        level = LOG_LEVEL_ERROR;
+    }
+    else if (name == "summary")
+    {
+        level = LOG_LEVEL_SUMMARY;
+    }
+    else if (name == "packet")
+    {
+        level = LOG_LEVEL_PACKET;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks whether lines of the given level are logged.
+ *
+ * @param level Level of the line.
+ * @return True if the line is logged, otherwise False.
+ */
+inline bool logEnabled(TFTPLogLevel level)
+{
+    return logState().level.load(std::memory_order_relaxed) >= level;
+}
+
+/**
+ * @brief Checks whether the log is at exactly the given level (summary lines are logged only at LOG_LEVEL_SUMMARY).
+ *
+ * @param level Level of the log.
+ * @return True if the log is at the level, otherwise False.
+ */
+inline bool logLevelIs(TFTPLogLevel level)
+{
+    return logState().level.load(std::memory_order_relaxed) == level;
+}
+
+// Returns the ring of the calling thread, registering it on first use
+inline TFTPLogRing &logRing()
+{
+    static thread_local TFTPLogRing *ring = nullptr;
+    if (ring == nullptr)
+    {
+        TFTPLogState &state = logState();
+
+        // The records are not cleared, the pages of the ring are touched only once it fills
+        ring = new TFTPLogRing;
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->reportedDrops = 0;
+        memset(ring->seen, 0, sizeof(ring->seen));
+
+        std::lock_guard<std::mutex> lock(state.ringsMutex);
+        state.rings.push_back(ring);
+    }
+    return *ring;
+}
+
+// Reserves consecutive records of the ring, nullptr (and a counted drop) if they do not fit
+inline TFTPLogRecord *reserveLogRecords(TFTPLogRing &ring, size_t count, uint64_t &head)
+{
+    head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) + count > LOG_RING_RECORDS)
+    {
+        ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &ring.records[head % LOG_RING_RECORDS];
+}
+
+/**
+ * @brief Logs a packet event, subject to the level and the sampling of the event.
+ *
+ * @param event Packet event (any event except LOG_EVENT_TEXT and LOG_EVENT_LINE).
+ * @param address Address of the peer.
+ * @param srcPort Port of the sender of the packet.
+ * @param dstPort Port of the receiver of the packet (LOG_EVENT_DATA only).
+ * @param block Block number of the packet.
+ */
+inline void logPacket(TFTPLogEvent event, const in_addr &address, uint16_t srcPort, uint16_t dstPort, uint32_t block)
+{
+    TFTPLogState &state = logState();
+    if (state.level.load(std::memory_order_relaxed) < LOG_LEVEL_PACKET)
+    {
+        return;
+    }
+
+    TFTPLogRing &ring = logRing();
+    uint32_t every = state.sampling[event].load(std::memory_order_relaxed);
+    if (every > 1 && ring.seen[event]++ % every != 0)
+    {
+        return;
+    }
+
+    uint64_t head;
+    TFTPLogRecord *record = reserveLogRecords(ring, 1, head);
+    if (record == nullptr)
+    {
+        return;
+    }
+
+    record->event = event;
+    record->length = 0;
+    record->srcPort = srcPort;
+    record->dstPort = dstPort;
+    record->address = address;
+    record->block = block;
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Logs a preformatted line on the standard error output if its level is enabled.
+ *
+ * @param level Level of the line.
+ * @param line Line without the trailing newline.
+ */
+inline void logLine(TFTPLogLevel level, const std::string &line)
+{
+    if (!logEnabled(level))
+    {
+        return;
+    }
+
+    TFTPLogRing &ring = logRing();
+    size_t count = line.empty() ? 1 : (line.size() + LOG_TEXT_SIZE - 1) / LOG_TEXT_SIZE;
+
+    // The parts of a line are published together, a line is never written out partially
+    uint64_t head;
+    if (reserveLogRecords(ring, count, head) == nullptr)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        TFTPLogRecord &record = ring.records[(head + i) % LOG_RING_RECORDS];
+        size_t offset = i * LOG_TEXT_SIZE;
+        size_t length = std::min(LOG_TEXT_SIZE, line.size() - offset);
+
+        record.event = i + 1 < count ? LOG_EVENT_TEXT : LOG_EVENT_LINE;
+        record.length = length;
+        memcpy(record.text, line.data() + offset, length);
+    }
+    ring.head.store(head + count, std::memory_order_release);
+}
+
+// Appends a formatted record to the lines of its output
+inline void formatLogRecord(TFTPLogState &state, const TFTPLogRecord &record)
+{
+    char buffer[128];
+    int length = 0;
+    char address[INET_ADDRSTRLEN];
+
+    switch (record.event)
+    {
+    case LOG_EVENT_ACK:
+        inet_ntop(AF_INET, &record.address, address, sizeof(address));
+        length = snprintf(buffer, sizeof(buffer), "ACK %s:%u %u\n", address, record.srcPort, record.block);
+        state.err.append(buffer, length);
+        break;
+    case LOG_EVENT_DATA:
+        inet_ntop(AF_INET, &record.address, address, sizeof(address));
+        length = snprintf(buffer, sizeof(buffer), "DATA %s:%u:%u %u\n", address, record.srcPort, record.dstPort, record.block);
+        state.err.append(buffer, length);
+        break;
+    case LOG_EVENT_SENT_ACK:
+        length = snprintf(buffer, sizeof(buffer), "Sent ACK with block ID: %u to server port: %u\n", record.block, record.srcPort);
+        state.out.append(buffer, length);
+        break;
+    case LOG_EVENT_UNEXPECTED_ACK:
+        length = snprintf(buffer, sizeof(buffer), "Received an unexpected ACK for block %u\n", record.block);
+        state.out.append(buffer, length);
+        break;
+    case LOG_EVENT_OUT_OF_ORDER:
+        length = snprintf(buffer, sizeof(buffer), "Received an out-of-order DATA packet for block %u\n", record.block);
+        state.out.append(buffer, length);
+        break;
+    case LOG_EVENT_ACK_TIMEOUT:
+        state.out += "Timeout waiting for ACK packet\n";
+        break;
+    case LOG_EVENT_DATA_TIMEOUT:
+        state.out += "Timeout waiting for DATA packet\n";
+        break;
+    case LOG_EVENT_TEXT:
+        state.err.append(record.text, record.length);
+        break;
+    case LOG_EVENT_LINE:
+        state.err.append(record.text, record.length);
+        state.err.push_back('\n');
+        break;
+    }
+}
+
+inline void flushLog()
+{
+    TFTPLogState &state = logState();
+    std::lock_guard<std::mutex> drainLock(state.drainMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(state.ringsMutex);
+        state.drained.assign(state.rings.begin(), state.rings.end());
+    }
+
+    for (TFTPLogRing *ring : state.drained)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; tail++)
+        {
+            formatLogRecord(state, ring->records[tail % LOG_RING_RECORDS]);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+        if (dropped != ring->reportedDrops)
+        {
+            state.err += "Log: " + std::to_string(dropped - ring->reportedDrops) + " records dropped\n";
+            ring->reportedDrops = dropped;
+        }
+    }
+
+    // One write per output, the lines share the stdio buffers of std::cout and std::cerr
+    if (!state.out.empty())
+    {
+        fwrite(state.out.data(), 1, state.out.size(), stdout);
+        fflush(stdout);
+        state.out.clear();
+    }
+    if (!state.err.empty())
+    {
+        fwrite(state.err.data(), 1, state.err.size(), stderr);
+        fflush(stderr);
+        state.err.clear();
+    }
+}
+
+#endif // TFTP_LOG_H
@@ -0,0 +1,346 @@
+/**
+ * @file tftp-netascii.h
+ * @brief Streaming netascii translation shared by the TFTP client and server.
+ * @author xnovos14 - Denis Novosád
+ *
+ * Netascii (RFC 764) sends every end of line as CR LF and a bare CR as CR NUL. The encoder
+ * translates local text into netascii, the decoder translates it back. Both keep the state
+ * of a pair split across two blocks. Runs of ordinary bytes are found with SSE2 or AVX2
+ * (selected at run time) and copied at once, other CPUs use a scalar scan.
+ */
+
+#ifndef TFTP_NETASCII_H
+#define TFTP_NETASCII_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TFTP_NETASCII_X86 1
+#endif
+
+// State of a netascii encoder between two output blocks
+struct TFTPNetasciiEncoder
+{
+    bool pending;     // Second byte of a CR LF or CR NUL pair did not fit into the last block
+    char pendingByte; // The byte to send first in the next block
+};
+
+// State of a netascii decoder between two input blocks
+struct TFTPNetasciiDecoder
+{
+    bool pendingCR; // The last block ended with a CR whose pair continues in the next block
+};
+
+/**
+ * @brief Checks whether a transfer mode is netascii (modes are case-insensitive).
+ *
+ * @param mode Transfer mode of the request.
+ * @return True for netascii, otherwise False.
+ */
+inline bool isNetasciiMode(const std::string &mode)
+{
+    return strcasecmp(mode.c_str(), "netascii") == 0;
+}
+
+inline void initNetasciiEncoder(TFTPNetasciiEncoder &encoder)
+{
+    encoder.pending = false;
+    encoder.pendingByte = 0;
+}
+
+inline void initNetasciiDecoder(TFTPNetasciiDecoder &decoder)
+{
+    decoder.pendingCR = false;
+}
+
+// Scalar scan for the first CR (and LF when encoding)
+inline size_t netasciiScanScalar(const char *data, size_t length, bool lineFeeds)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (data[i] == '\r' || (lineFeeds && data[i] == '\n'))
+        {
+            return i;
+        }
+    }
+    return length;
+}
+
+// Scalar count of CR and LF bytes
+inline uint64_t netasciiCountScalar(const char *data, size_t length)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        count += (data[i] == '\r' || data[i] == '\n');
+    }
+    return count;
+}
+
+#ifdef TFTP_NETASCII_X86
+
+inline size_t netasciiScanSSE2(const char *data, size_t length, bool lineFeeds)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i special = _mm_cmpeq_epi8(bytes, cr);
+        if (lineFeeds)
+        {
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(bytes, lf));
+        }
+
+        unsigned mask = _mm_movemask_epi8(special);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + netasciiScanScalar(data + i, length - i, lineFeeds);
+}
+
+inline uint64_t netasciiCountSSE2(const char *data, size_t length)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(bytes, cr), _mm_cmpeq_epi8(bytes, lf));
+        count += __builtin_popcount(_mm_movemask_epi8(special));
+    }
+
+    return count + netasciiCountScalar(data + i, length - i);
+}
+
+__attribute__((target("avx2"))) inline size_t netasciiScanAVX2(const char *data, size_t length, bool lineFeeds)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i special = _mm256_cmpeq_epi8(bytes, cr);
+        if (lineFeeds)
+        {
+            special = _mm256_or_si256(special, _mm256_cmpeq_epi8(bytes, lf));
+        }
+
+        unsigned mask = _mm256_movemask_epi8(special);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + netasciiScanSSE2(data + i, length - i, lineFeeds);
+}
+
+__attribute__((target("avx2"))) inline uint64_t netasciiCountAVX2(const char *data, size_t length)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, cr), _mm256_cmpeq_epi8(bytes, lf));
+        count += __builtin_popcount(_mm256_movemask_epi8(special));
+    }
+
+    return count + netasciiCountSSE2(data + i, length - i);
+}
+
+// AVX2 is used when the CPU supports it, SSE2 is part of every x86-64 CPU
+inline bool netasciiUseAVX2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif // TFTP_NETASCII_X86
+
+/**
+ * @brief Returns the length of the run of bytes that need no translation.
+ *
+ * @param data Bytes to scan.
+ * @param length Number of bytes.
+ * @param lineFeeds True to stop at LF as well as at CR (encoding), False to stop at CR only (decoding).
+ * @return Index of the first byte to translate, or `length` if there is none.
+ */
+inline size_t netasciiScan(const char *data, size_t length, bool lineFeeds)
+{
+#ifdef TFTP_NETASCII_X86
+    return netasciiUseAVX2() ? netasciiScanAVX2(data, length, lineFeeds) : netasciiScanSSE2(data, length, lineFeeds);
+#else
+    return netasciiScanScalar(data, length, lineFeeds);
+#endif
+}
+
+/**
+ * @brief Returns the size of local text after translation to netascii.
+ *
+ * @param data Local text.
+ * @param length Size of the text.
+ * @return Size of the netascii text (every CR and LF expands to two bytes).
+ */
+inline uint64_t netasciiEncodedLength(const char *data, size_t length)
+{
+#ifdef TFTP_NETASCII_X86
+    uint64_t count = netasciiUseAVX2() ? netasciiCountAVX2(data, length) : netasciiCountSSE2(data, length);
+#else
+    uint64_t count = netasciiCountScalar(data, length);
+#endif
+    return length + count;
+}
+
+/**
+ * @brief Translates local text to netascii until the input is consumed or the output is full.
+ *
+ * A pair that does not fit into the output is completed at the start of the next call.
+ *
+ * @param encoder Encoder state.
+ * @param input Local text.
+ * @param inputLength Size of the local text.
+ * @param consumed Number of input bytes translated.
+ * @param output Output buffer.
+ * @param outputLength Size of the output buffer.
+ * @return Number of bytes written to the output.
+ */
+inline size_t netasciiEncode(TFTPNetasciiEncoder &encoder, const char *input, size_t inputLength, size_t &consumed, char *output, size_t outputLength)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    if (encoder.pending && outputLength > 0)
+    {
+        output[out++] = encoder.pendingByte;
+        encoder.pending = false;
+    }
+
+    while (in < inputLength && out < outputLength && !encoder.pending)
+    {
+        // Copy the bytes up to the next CR or LF at once
+        size_t run = netasciiScan(input + in, std::min(inputLength - in, outputLength - out), true);
+        memcpy(output + out, input + in, run);
+        in += run;
+        out += run;
+
+        if (in == inputLength || out == outputLength)
+        {
+            break;
+        }
+
+        // LF becomes CR LF, CR becomes CR NUL
+        char second = input[in++] == '\n' ? '\n' : '\0';
+        output[out++] = '\r';
+        if (out < outputLength)
+        {
+            output[out++] = second;
+        }
+        else
+        {
+            encoder.pending = true;
+            encoder.pendingByte = second;
+        }
+    }
+
+    consumed = in;
+    return out;
+}
+
+/**
+ * @brief Translates a block of netascii back to local text.
+ *
+ * A CR ending the block is completed by the first byte of the next block.
+ *
+ * @param decoder Decoder state.
+ * @param input Netascii block.
+ * @param inputLength Size of the block.
+ * @param output Output buffer of at least `inputLength + 1` bytes.
+ * @return Number of bytes written to the output.
+ */
+inline size_t netasciiDecode(TFTPNetasciiDecoder &decoder, const char *input, size_t inputLength, char *output)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < inputLength)
+    {
+        if (!decoder.pendingCR)
+        {
+            // Copy the bytes up to the next CR at once
+            size_t run = netasciiScan(input + in, inputLength - in, false);
+            memcpy(output + out, input + in, run);
+            in += run;
+            out += run;
+
+            if (in == inputLength)
+            {
+                break;
+            }
+
+            in++;
+            decoder.pendingCR = true;
+            continue;
+        }
+
+        // CR LF is an end of line, CR NUL a bare CR, a CR followed by anything else is kept as it is
+        decoder.pendingCR = false;
+        if (input[in] == '\n')
+        {
+            output[out++] = '\n';
+            in++;
+        }
+        else if (input[in] == '\0')
+        {
+            output[out++] = '\r';
+            in++;
+        }
+        else
+        {
+            output[out++] = '\r';
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief Completes the decoded text at the end of the transfer.
+ *
+ * @param decoder Decoder state.
+ * @param output Output buffer of at least one byte.
+ * @return Number of bytes written to the output (a CR ending the transfer).
+ */
+inline size_t netasciiFinish(TFTPNetasciiDecoder &decoder, char *output)
+{
+    if (!decoder.pendingCR)
+    {
+        return 0;
+    }
+
+    decoder.pendingCR = false;
+    output[0] = '\r';
+    return 1;
+}
+
+#endif // TFTP_NETASCII_H
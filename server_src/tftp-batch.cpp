@@ -0,0 +1,399 @@
+/**
+ * @file tftp-batch.cpp
+ * @brief Batched, segmented and zero-copy sending and batched receiving of datagrams of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-batch.h"
+
+// Counters shared by all workers
+static std::atomic<uint64_t> sendBatches(0);
+static std::atomic<uint64_t> sendPackets(0);
+static std::atomic<uint64_t> sendFull(0);
+static std::atomic<uint64_t> sendDropped(0);
+static std::atomic<uint64_t> recvBatches(0);
+static std::atomic<uint64_t> recvPackets(0);
+static std::atomic<uint64_t> recvFull(0);
+static std::atomic<uint64_t> gsoSends(0);
+static std::atomic<uint64_t> gsoSegments(0);
+static std::atomic<int> segmentation(SEGMENTATION_OFF);
+static std::atomic<uint64_t> zerocopySends(0);
+static std::atomic<uint64_t> zerocopyBytes(0);
+static std::atomic<uint64_t> copiedBytes(0);
+
+// Builds the DATA headers of all block numbers
+static std::vector<uint16_t> buildDataHeaders()
+{
+    std::vector<uint16_t> headers(0x10000 * 2);
+    for (uint32_t blockNum = 0; blockNum <= 0xFFFF; blockNum++)
+    {
+        headers[blockNum * 2] = htons(DATA);
+        headers[blockNum * 2 + 1] = htons(blockNum);
+    }
+    return headers;
+}
+
+// Returns the DATA header of a block number, the table is shared and never modified
+static const uint16_t *dataHeader(uint16_t blockNum)
+{
+    static const std::vector<uint16_t> headers = buildDataHeaders();
+    return &headers[blockNum * 2];
+}
+
+void initSendBatch(TFTPSendBatch &batch, int sockfd, size_t capacity)
+{
+    batch.sockfd = sockfd;
+    batch.count = 0;
+    batch.messages.assign(capacity, mmsghdr());
+    batch.iovecs.assign(capacity * 2, iovec());
+    batch.headers.assign(capacity * 2, 0);
+    batch.sendFlags = 0;
+    batch.zerocopyPending.clear();
+    batch.zerocopyHead = 0;
+    batch.zerocopyCount = 0;
+}
+
+bool enableZerocopy(TFTPSendBatch &batch)
+{
+    int enable = 1;
+    if (setsockopt(batch.sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0)
+    {
+        return false;
+    }
+
+    batch.sendFlags = MSG_ZEROCOPY;
+    batch.zerocopyPending.assign(ZEROCOPY_MAX_PENDING, 0);
+    return true;
+}
+
+void reapZerocopy(TFTPSendBatch &batch)
+{
+    // Every notification covers a range of consecutive zero-copy sends of the socket
+    while (true)
+    {
+        char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (recvmsg(batch.sockfd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR)
+            {
+                continue;
+            }
+
+            const sock_extended_err *err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            uint64_t bytes = 0;
+            uint32_t completed = err->ee_data - err->ee_info + 1;
+            for (uint32_t i = 0; i < completed && batch.zerocopyCount > 0; i++)
+            {
+                bytes += batch.zerocopyPending[batch.zerocopyHead];
+                batch.zerocopyHead = (batch.zerocopyHead + 1) % ZEROCOPY_MAX_PENDING;
+                batch.zerocopyCount--;
+            }
+
+            // The kernel copies the data when the device cannot send from user pages (e.g. loopback)
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                copiedBytes += bytes;
+            }
+            else
+            {
+                zerocopyBytes += bytes;
+            }
+        }
+    }
+}
+
+bool queueDataPacket(TFTPSendBatch &batch, sockaddr_in &clientAddr, uint16_t blockNum, const char *data, size_t dataSize)
+{
+    size_t i = batch.count;
+
+    // Zero-copy sends take the header from the shared table, the kernel may read it after the batch is reused
+    uint16_t *header = &batch.headers[i * 2];
+    if (batch.sendFlags & MSG_ZEROCOPY)
+    {
+        header = const_cast<uint16_t *>(dataHeader(blockNum));
+    }
+    else
+    {
+        header[0] = htons(DATA);
+        header[1] = htons(blockNum);
+    }
+
+    // Scatter-gather the 4-byte header and the payload into one datagram
+    iovec *iov = &batch.iovecs[i * 2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = 2 * sizeof(uint16_t);
+    iov[1].iov_base = const_cast<char *>(data);
+    iov[1].iov_len = dataSize;
+
+    msghdr &message = batch.messages[i].msg_hdr;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &clientAddr;
+    message.msg_namelen = sizeof(clientAddr);
+    message.msg_iov = iov;
+    message.msg_iovlen = dataSize > 0 ? 2 : 1;
+
+    batch.count++;
+
+    if (batch.count == batch.messages.size())
+    {
+        return flushSendBatch(batch);
+    }
+
+    return true;
+}
+
+bool flushSendBatch(TFTPSendBatch &batch)
+{
+    if (batch.count == 0)
+    {
+        return true;
+    }
+
+    sendBatches++;
+    sendPackets += batch.count;
+    if (batch.count == batch.messages.size())
+    {
+        sendFull++;
+    }
+
+    // Zero-copy sends are tracked in a fixed ring, the batch is copied if the completions lag behind
+    int sendFlags = batch.sendFlags;
+    if ((sendFlags & MSG_ZEROCOPY) && batch.zerocopyCount + batch.count > ZEROCOPY_MAX_PENDING)
+    {
+        reapZerocopy(batch);
+        if (batch.zerocopyCount + batch.count > ZEROCOPY_MAX_PENDING)
+        {
+            sendFlags = 0;
+        }
+    }
+
+    // sendmmsg may send only a part of the batch, continue with the rest
+    size_t done = 0;
+    while (done < batch.count)
+    {
+        int sent = sendmmsg(batch.sockfd, &batch.messages[done], batch.count - done, sendFlags);
+
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            {
+                // Socket buffer is full, the rest of the window is retransmitted after the timeout
+                sendDropped += batch.count - done;
+                break;
+            }
+            if (errno == EMSGSIZE && (sendFlags & MSG_ZEROCOPY))
+            {
+                // The payload spans more pages than one datagram can reference, copy this packet
+                msghdr &message = batch.messages[done].msg_hdr;
+                ssize_t sentBytes = sendmsg(batch.sockfd, &message, 0);
+                if (sentBytes >= 0)
+                {
+                    copiedBytes += sentBytes;
+                }
+                done++;
+                continue;
+            }
+
+            std::cout << "Error sending Data packets" << std::endl;
+            batch.count = 0;
+            return false;
+        }
+
+        // Account the sent bytes, zero-copy bytes once their completion arrives
+        for (int j = 0; j < sent; j++)
+        {
+            uint32_t bytes = batch.messages[done + j].msg_len;
+            if (sendFlags & MSG_ZEROCOPY)
+            {
+                size_t tail = (batch.zerocopyHead + batch.zerocopyCount) % ZEROCOPY_MAX_PENDING;
+                batch.zerocopyPending[tail] = bytes;
+                batch.zerocopyCount++;
+            }
+            else
+            {
+                copiedBytes += bytes;
+            }
+        }
+        if (sendFlags & MSG_ZEROCOPY)
+        {
+            zerocopySends += sent;
+        }
+
+        done += sent;
+    }
+
+    batch.count = 0;
+    return true;
+}
+
+void setSegmentationMode(TFTPSegmentationMode mode)
+{
+    segmentation = mode;
+}
+
+TFTPSegmentationMode segmentationMode()
+{
+    return static_cast<TFTPSegmentationMode>(segmentation.load());
+}
+
+bool sendSegmented(int sockfd, sockaddr_in &clientAddr, const char *buffer, size_t length, uint16_t segmentSize)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(buffer);
+    iov.iov_len = length;
+
+    // The segment size is passed as ancillary data of the send
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &clientAddr;
+    message.msg_namelen = sizeof(clientAddr);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(uint16_t));
+
+    ssize_t sentBytes;
+    do
+    {
+        sentBytes = sendmsg(sockfd, &message, 0);
+    } while (sentBytes < 0 && errno == EINTR);
+
+    uint64_t segments = (length + segmentSize - 1) / segmentSize;
+
+    if (sentBytes < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        {
+            // Socket buffer is full, the window is retransmitted after the timeout
+            sendDropped += segments;
+            return true;
+        }
+        if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+        {
+            std::cout << "UDP segmentation offload rejected by the kernel, sending packets separately" << std::endl;
+            segmentation = SEGMENTATION_FALLBACK;
+            return false;
+        }
+
+        std::cout << "Error sending segmented Data packets" << std::endl;
+        return false;
+    }
+
+    gsoSends++;
+    gsoSegments += segments;
+    copiedBytes += sentBytes;
+    return true;
+}
+
+bool initRecvBatch(TFTPRecvBatch &batch, size_t capacity, size_t packetSize)
+{
+    if (!initPacketPool(batch.buffers, capacity, packetSize))
+    {
+        return false;
+    }
+
+    // Buffers are laid out at a fixed stride, each starting on its own cache line
+    batch.packetSize = batch.buffers.bufferSize;
+    batch.messages.assign(capacity, mmsghdr());
+    batch.iovecs.assign(capacity, iovec());
+    batch.addresses.assign(capacity, sockaddr_in());
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        batch.iovecs[i].iov_base = batch.buffers.memory + i * batch.packetSize;
+        batch.iovecs[i].iov_len = packetSize;
+
+        msghdr &message = batch.messages[i].msg_hdr;
+        message.msg_iov = &batch.iovecs[i];
+        message.msg_iovlen = 1;
+        message.msg_name = &batch.addresses[i];
+    }
+
+    return true;
+}
+
+void freeRecvBatch(TFTPRecvBatch &batch)
+{
+    destroyPacketPool(batch.buffers);
+    batch.messages.clear();
+}
+
+int receiveBatch(int sockfd, TFTPRecvBatch &batch)
+{
+    // The kernel overwrites the address length of every received message
+    for (auto &message : batch.messages)
+    {
+        message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+
+    int received = recvmmsg(sockfd, batch.messages.data(), batch.messages.size(), MSG_DONTWAIT, nullptr);
+
+    if (received < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    if (received > 0)
+    {
+        recvBatches++;
+        recvPackets += received;
+        if (static_cast<size_t>(received) == batch.messages.size())
+        {
+            recvFull++;
+        }
+    }
+
+    return received;
+}
+
+const uint8_t *batchPacket(const TFTPRecvBatch &batch, size_t index)
+{
+    return batch.buffers.memory + index * batch.packetSize;
+}
+
+TFTPBatchStats batchStats()
+{
+    TFTPBatchStats stats;
+    stats.sendBatches = sendBatches;
+    stats.sendPackets = sendPackets;
+    stats.sendFull = sendFull;
+    stats.sendDropped = sendDropped;
+    stats.recvBatches = recvBatches;
+    stats.recvPackets = recvPackets;
+    stats.recvFull = recvFull;
+    stats.segmentation = segmentationMode();
+    stats.gsoSends = gsoSends;
+    stats.gsoSegments = gsoSegments;
+    stats.zerocopySends = zerocopySends;
+    stats.zerocopyBytes = zerocopyBytes;
+    stats.copiedBytes = copiedBytes;
+    return stats;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file tftp-batch.h
+ * @brief Declarations for batched sending and receiving of datagrams (sendmmsg/recvmmsg, UDP GSO, MSG_ZEROCOPY).
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_BATCH_H
+#define TFTP_BATCH_H
+
+#include "tftp-server.h"
+#include "tftp-pool.h"
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+
+// Default and maximum number of datagrams passed to the kernel in one call
+const size_t DEFAULT_BATCH_SIZE = 32;
+const size_t MAX_BATCH_SIZE = 1024;
+
+// Limits of one UDP_SEGMENT send (segments per send, UDP payload of the whole buffer)
+const size_t MAX_GSO_SEGMENTS = 64;
+const size_t MAX_GSO_BYTES = 65507;
+
+// Smallest block sent with MSG_ZEROCOPY, pinning the pages of smaller payloads costs more than copying them
+const uint16_t ZEROCOPY_MIN_BLKSIZE = 8192;
+
+// Zero-copy sends of one socket waiting for their completion, further batches are copied
+const size_t ZEROCOPY_MAX_PENDING = 1024;
+
+// Sending of windows of equal-sized DATA packets
+enum TFTPSegmentationMode
+{
+    SEGMENTATION_OFF,     // Every packet is passed to the kernel separately
+    SEGMENTATION_GSO,     // Consecutive packets are passed in one buffer segmented by the kernel (UDP_SEGMENT)
+    SEGMENTATION_FALLBACK // GSO was requested but rejected by the kernel
+};
+
+// DATA packets queued on one socket and sent with a single sendmmsg call
+struct TFTPSendBatch
+{
+    int sockfd;
+    size_t count;
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;            // Header and payload iovec of every message
+    std::vector<uint16_t> headers;        // Opcode and block number of every message
+    int sendFlags;                         // MSG_ZEROCOPY if the payloads are sent without copying
+    std::vector<uint32_t> zerocopyPending; // Ring of bytes of every zero-copy message waiting for its completion
+    size_t zerocopyHead;                   // Oldest entry of the ring
+    size_t zerocopyCount;                  // Entries of the ring in use
+};
+
+// Buffers for datagrams received from one socket with a single recvmmsg call
+struct TFTPRecvBatch
+{
+    size_t packetSize;
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;
+    std::vector<sockaddr_in> addresses;
+    TFTPPacketPool buffers; // One cache-line aligned buffer per datagram
+};
+
+// Counters of the batched I/O, fill = packets / batches
+struct TFTPBatchStats
+{
+    uint64_t sendBatches;
+    uint64_t sendPackets;
+    uint64_t sendFull;    // Send batches filled up to their capacity
+    uint64_t sendDropped; // Packets dropped because the socket buffer was full
+    uint64_t recvBatches;
+    uint64_t recvPackets;
+    uint64_t recvFull; // Receive batches filled up to their capacity
+    TFTPSegmentationMode segmentation;
+    uint64_t gsoSends;
+    uint64_t gsoSegments;
+    uint64_t zerocopySends;
+    uint64_t zerocopyBytes; // Bytes the kernel sent without copying
+    uint64_t copiedBytes;   // Bytes copied into the kernel (regular sends and zero-copy sends the kernel copied)
+};
+
+/**
+ * @brief Prepares an empty send batch for a socket.
+ *
+ * @param batch Send batch to initialize.
+ * @param sockfd Socket the packets are sent from.
+ * @param capacity Maximum number of packets in one sendmmsg call.
+ */
+void initSendBatch(TFTPSendBatch &batch, int sockfd, size_t capacity);
+
+/**
+ * @brief Sends the packets of the batch with MSG_ZEROCOPY.
+ *
+ * The payloads must stay unchanged until their completion is reaped, DATA headers are taken
+ * from a table that is never modified.
+ *
+ * @param batch Send batch.
+ * @return True if the socket supports zero-copy sends, otherwise False.
+ */
+bool enableZerocopy(TFTPSendBatch &batch);
+
+/**
+ * @brief Reads the zero-copy completions queued on the error queue of the socket.
+ *
+ * @param batch Send batch.
+ */
+void reapZerocopy(TFTPSendBatch &batch);
+
+/**
+ * @brief Queues a data packet, the batch is flushed when it is full.
+ *
+ * The payload is not copied and must stay valid until the batch is flushed.
+ *
+ * @param batch Send batch.
+ * @param clientAddr sockaddr_in structure representing the client.
+ * @param blockNum Block number.
+ * @param data Data to be sent.
+ * @param dataSize Size of the data.
+ * @return True if the packet was queued (or sent), otherwise False.
+ */
+bool queueDataPacket(TFTPSendBatch &batch, sockaddr_in &clientAddr, uint16_t blockNum, const char *data, size_t dataSize);
+
+/**
+ * @brief Sends all queued packets.
+ *
+ * Packets the kernel cannot take because the socket buffer is full are dropped and left to retransmission.
+ *
+ * @param batch Send batch.
+ * @return True if the packets were sent, otherwise False.
+ */
+bool flushSendBatch(TFTPSendBatch &batch);
+
+/**
+ * @brief Selects whether windows are sent with UDP segmentation offload.
+ *
+ * @param mode SEGMENTATION_GSO to request GSO, otherwise SEGMENTATION_OFF.
+ */
+void setSegmentationMode(TFTPSegmentationMode mode);
+
+/**
+ * @brief Returns the current segmentation mode.
+ *
+ * @return Segmentation mode.
+ */
+TFTPSegmentationMode segmentationMode();
+
+/**
+ * @brief Sends consecutive packets of equal size (only the last may be shorter) with a single UDP_SEGMENT send.
+ *
+ * When the kernel rejects the segmentation offload the mode is switched to SEGMENTATION_FALLBACK
+ * for the whole server and the caller sends the packets separately.
+ *
+ * @param sockfd TFTP transmission socket.
+ * @param clientAddr sockaddr_in structure representing the client.
+ * @param buffer Packets laid out back to back.
+ * @param length Size of the buffer.
+ * @param segmentSize Size of every packet but the last one.
+ * @return True if the packets were sent, otherwise False.
+ */
+bool sendSegmented(int sockfd, sockaddr_in &clientAddr, const char *buffer, size_t length, uint16_t segmentSize);
+
+/**
+ * @brief Allocates the buffers of a receive batch.
+ *
+ * @param batch Receive batch to initialize.
+ * @param capacity Maximum number of datagrams in one recvmmsg call.
+ * @param packetSize Size of the buffer of one datagram.
+ * @return True if the buffers were allocated, otherwise False.
+ */
+bool initRecvBatch(TFTPRecvBatch &batch, size_t capacity, size_t packetSize);
+
+/**
+ * @brief Releases the buffers of a receive batch.
+ *
+ * @param batch Receive batch.
+ */
+void freeRecvBatch(TFTPRecvBatch &batch);
+
+/**
+ * @brief Receives up to the batch capacity of datagrams queued on a non-blocking socket.
+ *
+ * @param sockfd Socket to receive from.
+ * @param batch Receive batch.
+ * @return Number of received datagrams, 0 if none are queued or -1 on error.
+ */
+int receiveBatch(int sockfd, TFTPRecvBatch &batch);
+
+/**
+ * @brief Returns the i-th datagram of the last received batch.
+ *
+ * @param batch Receive batch.
+ * @param index Index of the datagram.
+ * @return Pointer to the datagram.
+ */
+const uint8_t *batchPacket(const TFTPRecvBatch &batch, size_t index);
+
+/**
+ * @brief Returns a snapshot of the batched I/O counters.
+ *
+ * @return Batched I/O counters.
+ */
+TFTPBatchStats batchStats();
+
+#endif // TFTP_BATCH_H
@@ -0,0 +1,254 @@
+/**
+ * @file tftp-blocksource.cpp
+ * @brief Memory-mapped and pread block sources of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-blocksource.h"
+
+bool openBlockSource(TFTPBlockSource &source, const std::string &filename, TFTPBlockSourceType type)
+{
+    source.fd = -1;
+    source.type = BLOCK_SOURCE_PREAD;
+    source.size = 0;
+    source.mapping = nullptr;
+    source.content.reset();
+    source.netascii = nullptr;
+    source.stream = nullptr;
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // Only regular files can be served
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    source.fd = fd;
+    source.size = fileStat.st_size;
+
+    // Hot files are shared by all sessions from one in-memory copy
+    if (cacheLookup(filename, fd, fileStat, source.content))
+    {
+        source.mapping = source.content->data();
+        source.type = BLOCK_SOURCE_CACHE;
+        return true;
+    }
+
+    if (type == BLOCK_SOURCE_MMAP && source.size > 0)
+    {
+        void *mapping = mmap(nullptr, source.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            // Blocks are mostly read front to back, let the kernel read ahead
+            madvise(mapping, source.size, MADV_SEQUENTIAL);
+            source.mapping = static_cast<const char *>(mapping);
+            source.type = BLOCK_SOURCE_MMAP;
+        }
+    }
+
+    return true;
+}
+
+// Returns the bytes of the file itself at the given offset
+static const char *fileData(TFTPBlockSource &source, uint64_t offset, size_t length, char *scratch)
+{
+    if (source.type == BLOCK_SOURCE_MMAP || source.type == BLOCK_SOURCE_CACHE)
+    {
+        return source.mapping + offset;
+    }
+
+    // Read the whole range, pread may return fewer bytes than requested
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t bytesRead = pread(source.fd, scratch + done, length - done, offset + done);
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return nullptr;
+        }
+        done += bytesRead;
+    }
+
+    return scratch;
+}
+
+// Translates the next block of the file into its slot of the ring
+static bool translateBlock(TFTPBlockSource &source)
+{
+    TFTPNetasciiSource &netascii = *source.netascii;
+    char *block = &netascii.blocks[(netascii.nextBlock % netascii.blockSlots) * netascii.blockSize];
+    size_t produced = 0;
+
+    // A block is complete when it is full or when the file and a pending pair are exhausted
+    while (produced < netascii.blockSize && (netascii.fileOffset < netascii.fileSize || netascii.encoder.pending))
+    {
+        const char *input = nullptr;
+        size_t available = 0;
+
+        if (netascii.fileOffset < netascii.fileSize)
+        {
+            if (source.mapping != nullptr)
+            {
+                input = source.mapping + netascii.fileOffset;
+                available = netascii.fileSize - netascii.fileOffset;
+            }
+            else
+            {
+                if (netascii.fileOffset >= netascii.inputOffset + netascii.inputLength)
+                {
+                    size_t length = std::min<uint64_t>(NETASCII_READ_SIZE, netascii.fileSize - netascii.fileOffset);
+                    if (fileData(source, netascii.fileOffset, length, netascii.input.data()) == nullptr)
+                    {
+                        return false;
+                    }
+                    netascii.inputOffset = netascii.fileOffset;
+                    netascii.inputLength = length;
+                }
+                input = netascii.input.data() + (netascii.fileOffset - netascii.inputOffset);
+                available = netascii.inputOffset + netascii.inputLength - netascii.fileOffset;
+            }
+        }
+
+        size_t consumed;
+        produced += netasciiEncode(netascii.encoder, input, available, consumed, block + produced, netascii.blockSize - produced);
+        netascii.fileOffset += consumed;
+    }
+
+    netascii.nextBlock++;
+    return true;
+}
+
+bool enableNetascii(TFTPBlockSource &source, size_t blockSize, size_t windowSize)
+{
+    TFTPNetasciiSource *netascii = new TFTPNetasciiSource();
+    initNetasciiEncoder(netascii->encoder);
+    netascii->fileSize = source.size;
+    netascii->fileOffset = 0;
+    netascii->blockSize = blockSize;
+    netascii->blockSlots = windowSize;
+    netascii->nextBlock = 0;
+    netascii->inputOffset = 0;
+    netascii->inputLength = 0;
+
+    // Every CR and LF of the file expands to a pair, the translated size decides the last block
+    uint64_t translatedSize = 0;
+    if (source.mapping != nullptr)
+    {
+        translatedSize = netasciiEncodedLength(source.mapping, source.size);
+    }
+    else
+    {
+        netascii->input.resize(NETASCII_READ_SIZE);
+        for (uint64_t offset = 0; offset < source.size; offset += NETASCII_READ_SIZE)
+        {
+            size_t length = std::min<uint64_t>(NETASCII_READ_SIZE, source.size - offset);
+            if (fileData(source, offset, length, netascii->input.data()) == nullptr)
+            {
+                delete netascii;
+                return false;
+            }
+            translatedSize += netasciiEncodedLength(netascii->input.data(), length);
+        }
+    }
+
+    netascii->blocks.resize(windowSize * blockSize);
+    source.netascii = netascii;
+    source.size = translatedSize;
+    return true;
+}
+
+bool shareReadStream(TFTPBlockSource &source)
+{
+    struct stat fileStat;
+    if (source.type != BLOCK_SOURCE_PREAD || source.netascii != nullptr || fstat(source.fd, &fileStat) < 0)
+    {
+        return false;
+    }
+
+    source.stream = attachReadStream(source.fd, fileStat);
+    return source.stream != nullptr;
+}
+
+const char *blockData(TFTPBlockSource &source, uint64_t offset, size_t length, char *scratch)
+{
+    if (source.netascii == nullptr)
+    {
+        // Sessions reading near each other share the chunks, the session reads on its own when all are in use
+        if (source.stream != nullptr && length > 0)
+        {
+            const char *data = streamData(*source.stream, source.pinnedChunks, offset, length, scratch);
+            if (data != nullptr)
+            {
+                return data;
+            }
+        }
+        return fileData(source, offset, length, scratch);
+    }
+
+    // Blocks are translated in order, only the blocks of the last window are kept
+    TFTPNetasciiSource &netascii = *source.netascii;
+    uint64_t block = offset / netascii.blockSize;
+    if (block + netascii.blockSlots < netascii.nextBlock)
+    {
+        return nullptr;
+    }
+
+    while (netascii.nextBlock <= block)
+    {
+        if (!translateBlock(source))
+        {
+            return nullptr;
+        }
+    }
+
+    return &netascii.blocks[(block % netascii.blockSlots) * netascii.blockSize];
+}
+
+void releaseBlockData(TFTPBlockSource &source)
+{
+    if (source.stream != nullptr)
+    {
+        releaseStreamChunks(*source.stream, source.pinnedChunks);
+    }
+}
+
+void closeBlockSource(TFTPBlockSource &source)
+{
+    if (source.stream != nullptr)
+    {
+        detachReadStream(source.stream, source.pinnedChunks);
+        source.stream = nullptr;
+    }
+
+    // The mapping covers the file, not its translation
+    if (source.netascii != nullptr)
+    {
+        source.size = source.netascii->fileSize;
+        delete source.netascii;
+        source.netascii = nullptr;
+    }
+
+    if (source.type == BLOCK_SOURCE_MMAP && source.mapping != nullptr)
+    {
+        munmap(const_cast<char *>(source.mapping), source.size);
+    }
+    source.mapping = nullptr;
+    source.content.reset();
+
+    if (source.fd >= 0)
+    {
+        close(source.fd);
+        source.fd = -1;
+    }
+}
@@ -0,0 +1,107 @@
+/**
+ * @file tftp-blocksource.h
+ * @brief Declarations for random-access block sources serving RRQ data.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_BLOCKSOURCE_H
+#define TFTP_BLOCKSOURCE_H
+
+#include "tftp-server.h"
+#include "tftp-cache.h"
+#include "tftp-netascii.h"
+#include "tftp-stream.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes of the file read at once by a netascii source over the pread backend
+const size_t NETASCII_READ_SIZE = 64 * 1024;
+
+// Netascii translation of a source, blocks are translated in order into a ring of one window
+struct TFTPNetasciiSource
+{
+    TFTPNetasciiEncoder encoder;
+    uint64_t fileSize;    // Size of the file, the size of the source is the translated size
+    uint64_t fileOffset;  // Next byte of the file to translate
+    size_t blockSize;
+    size_t blockSlots;    // Translated blocks kept for retransmission (window size)
+    uint64_t nextBlock;   // Index of the next block to translate
+    std::vector<char> blocks;
+    std::vector<char> input; // File bytes read by the pread backend
+    uint64_t inputOffset;    // File offset of input[0]
+    size_t inputLength;
+};
+
+// Structure representing an open file whose blocks can be addressed by offset
+struct TFTPBlockSource
+{
+    int fd;
+    TFTPBlockSourceType type;
+    uint64_t size;
+    const char *mapping;        // Read-only mapping (BLOCK_SOURCE_MMAP) or cached content (BLOCK_SOURCE_CACHE) of the whole file
+    TFTPCachedContent content; // Cached content kept alive while the session serves it
+    TFTPNetasciiSource *netascii; // Translation of the file (netascii mode), nullptr for octet
+    TFTPReadStream *stream;       // Chunks shared with other sessions (pread backend), nullptr if not shared
+    std::vector<TFTPStreamChunk *> pinnedChunks; // Chunks holding DATA queued by the session
+};
+
+/**
+ * @brief Opens a regular file as a block source.
+ *
+ * Files found in (or loaded into) the shared content cache are served from it, otherwise
+ * the mmap backend falls back to pread when the file cannot be mapped (e.g. an empty file).
+ *
+ * @param source Block source to initialize.
+ * @param filename Path to the file.
+ * @param type Requested backend.
+ * @return True if the file was opened, otherwise False.
+ */
+bool openBlockSource(TFTPBlockSource &source, const std::string &filename, TFTPBlockSourceType type);
+
+/**
+ * @brief Serves the file translated to netascii, the size of the source becomes the translated size.
+ *
+ * Blocks have to be requested in order of their offsets, except for retransmissions of
+ * at most `windowSize` most recent blocks.
+ *
+ * @param source Open block source.
+ * @param blockSize Size of one block.
+ * @param windowSize Number of blocks that may be retransmitted.
+ * @return True if the translated size was determined, otherwise False (read error).
+ */
+bool enableNetascii(TFTPBlockSource &source, size_t blockSize, size_t windowSize);
+
+/**
+ * @brief Reads the file through the stream shared by all sessions reading the same file (pread backend).
+ *
+ * @param source Open block source.
+ * @return True if the source shares the stream, otherwise False (the source reads on its own).
+ */
+bool shareReadStream(TFTPBlockSource &source);
+
+/**
+ * @brief Returns the bytes of the file at the given offset.
+ *
+ * @param source Open block source.
+ * @param offset Offset of the first byte (a multiple of the block size for netascii sources).
+ * @param length Number of bytes (must not reach past the end of the file).
+ * @param scratch Buffer of at least `length` bytes used by the pread backend.
+ * @return Pointer to the data (into the mapping, a shared chunk or `scratch`), or nullptr on read error.
+ */
+const char *blockData(TFTPBlockSource &source, uint64_t offset, size_t length, char *scratch);
+
+/**
+ * @brief Releases the shared chunks holding the data returned so far, once it was sent.
+ *
+ * @param source Open block source.
+ */
+void releaseBlockData(TFTPBlockSource &source);
+
+/**
+ * @brief Unmaps and closes a block source and releases its cached content.
+ *
+ * @param source Block source to close.
+ */
+void closeBlockSource(TFTPBlockSource &source);
+
+#endif // TFTP_BLOCKSOURCE_H
@@ -0,0 +1,137 @@
+/**
+ * @file tftp-cache.cpp
+ * @brief Server-wide LRU content cache of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-cache.h"
+
+// Structure representing one cached file
+struct TFTPCacheEntry
+{
+    std::string filename;
+    off_t size;
+    struct timespec mtime;
+    TFTPCachedContent content;
+};
+
+// Cache shared by all workers, most recently used entries at the front
+static std::mutex cacheMutex;
+static std::list<TFTPCacheEntry> cacheEntries;
+static std::map<std::string, std::list<TFTPCacheEntry>::iterator> cacheIndex;
+static TFTPCacheStats stats = {0, 0, 0, 0, 0, 0};
+
+void setCacheBudget(uint64_t budget)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    stats.budget = budget;
+}
+
+// Removes an entry from the cache, sessions still holding the content keep it alive
+static void removeEntry(std::list<TFTPCacheEntry>::iterator entry)
+{
+    stats.bytes -= entry->content->size();
+    stats.entries--;
+    cacheIndex.erase(entry->filename);
+    cacheEntries.erase(entry);
+}
+
+// Reads the whole file into memory
+static TFTPCachedContent loadContent(int fd, off_t size)
+{
+    std::shared_ptr<std::vector<char>> content = std::make_shared<std::vector<char>>(size);
+
+    off_t done = 0;
+    while (done < size)
+    {
+        ssize_t bytesRead = pread(fd, content->data() + done, size - done, done);
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return TFTPCachedContent();
+        }
+        done += bytesRead;
+    }
+
+    return content;
+}
+
+bool cacheLookup(const std::string &filename, int fd, const struct stat &fileStat, TFTPCachedContent &content)
+{
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        if (stats.budget == 0 || static_cast<uint64_t>(fileStat.st_size) > stats.budget)
+        {
+            return false;
+        }
+
+        auto it = cacheIndex.find(filename);
+        if (it != cacheIndex.end())
+        {
+            std::list<TFTPCacheEntry>::iterator entry = it->second;
+
+            if (entry->size == fileStat.st_size &&
+                entry->mtime.tv_sec == fileStat.st_mtim.tv_sec &&
+                entry->mtime.tv_nsec == fileStat.st_mtim.tv_nsec)
+            {
+                // Move the entry to the front of the LRU list
+                cacheEntries.splice(cacheEntries.begin(), cacheEntries, entry);
+                content = entry->content;
+                stats.hits++;
+                return true;
+            }
+
+            // The file changed since it was cached
+            removeEntry(entry);
+        }
+
+        stats.misses++;
+    }
+
+    // Read the file without holding the lock, other sessions keep being served
+    TFTPCachedContent loaded = loadContent(fd, fileStat.st_size);
+    if (!loaded)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    // Another session may have loaded the same file meanwhile
+    auto it = cacheIndex.find(filename);
+    if (it != cacheIndex.end())
+    {
+        removeEntry(it->second);
+    }
+
+    // Evict least recently used entries until the file fits into the budget
+    while (!cacheEntries.empty() && stats.bytes + loaded->size() > stats.budget)
+    {
+        removeEntry(std::prev(cacheEntries.end()));
+        stats.evictions++;
+    }
+
+    TFTPCacheEntry entry;
+    entry.filename = filename;
+    entry.size = fileStat.st_size;
+    entry.mtime = fileStat.st_mtim;
+    entry.content = loaded;
+
+    cacheEntries.push_front(entry);
+    cacheIndex[filename] = cacheEntries.begin();
+    stats.bytes += loaded->size();
+    stats.entries++;
+
+    content = loaded;
+    return true;
+}
+
+TFTPCacheStats cacheStats()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return stats;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file tftp-cache.h
+ * @brief Declarations for the server-wide content cache of frequently requested files.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_CACHE_H
+#define TFTP_CACHE_H
+
+#include "tftp-server.h"
+#include <sys/stat.h>
+#include <memory>
+#include <mutex>
+#include <list>
+
+// Read-only file content shared by all sessions serving the file
+typedef std::shared_ptr<const std::vector<char>> TFTPCachedContent;
+
+// Counters of the content cache
+struct TFTPCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t budget;
+};
+
+/**
+ * @brief Sets the byte budget of the content cache, 0 disables the cache.
+ *
+ * @param budget Maximum number of cached bytes.
+ */
+void setCacheBudget(uint64_t budget);
+
+/**
+ * @brief Returns the content of a file from the cache, loading it on a miss.
+ *
+ * Entries are keyed by path and validated against the size and modification time of the file,
+ * the least recently used entries are evicted when the budget is exceeded. Evicted content stays
+ * alive until the last session serving it is closed.
+ *
+ * @param filename Path to the file.
+ * @param fd Open descriptor of the file.
+ * @param fileStat Status of the open file.
+ * @param content Shared content of the file.
+ * @return True if the content is available, False if the cache is disabled or the file does not fit.
+ */
+bool cacheLookup(const std::string &filename, int fd, const struct stat &fileStat, TFTPCachedContent &content);
+
+/**
+ * @brief Returns a snapshot of the content cache counters.
+ *
+ * @return Cache counters.
+ */
+TFTPCacheStats cacheStats();
+
+#endif // TFTP_CACHE_H
@@ -0,0 +1,443 @@
+/**
+ * @file tftp-metrics.cpp
+ * @brief Server metrics and their Prometheus text exposition endpoint
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-metrics.h"
+#include "tftp-cache.h"
+#include "tftp-batch.h"
+#include "tftp-writer.h"
+#include "tftp-stream.h"
+#include "tftp-multicast.h"
+#include "tftp-shaper.h"
+
+// Counters and histogram buckets of one worker, written only by the worker and read by the endpoint
+struct TFTPWorkerMetrics
+{
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    std::atomic<uint64_t> buckets[HISTOGRAM_COUNT][HISTOGRAM_MAX_BOUNDS + 1]; // Last bucket is +Inf
+    std::atomic<uint64_t> observations[HISTOGRAM_COUNT];
+    std::atomic<double> sums[HISTOGRAM_COUNT];
+};
+
+// Name, help text and bucket bounds of a histogram
+struct TFTPHistogramInfo
+{
+    const char *name;
+    const char *help;
+    size_t boundCount;
+    double bounds[HISTOGRAM_MAX_BOUNDS];
+};
+
+static const TFTPHistogramInfo histogramInfo[HISTOGRAM_COUNT] = {
+    {"tftp_negotiated_blksize", "Block size of the sessions.", 11,
+     {512, 1024, 1408, 1428, 1468, 2048, 4096, 8192, 16384, 32768, 65464}},
+    {"tftp_negotiated_windowsize", "Window size of the sessions.", 10,
+     {1, 2, 4, 8, 16, 32, 64, 128, 256, 512}},
+    {"tftp_transfer_duration_seconds", "Time from the request to the release of the sessions.", 12,
+     {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300}},
+    {"tftp_transfer_bytes", "DATA payload sent or received per session.", 9,
+     {512, 4096, 65536, 1048576, 16777216, 134217728, 1073741824, 4294967296.0, 34359738368.0}},
+    {"tftp_transfer_retransmits", "DATA packets sent again per session.", 8,
+     {0, 1, 2, 4, 8, 16, 64, 256}},
+};
+
+// Metrics of all workers, a worker registers its metrics on first use and keeps them until the server exits
+static std::mutex registryMutex;
+static std::vector<TFTPWorkerMetrics *> registry;
+
+static TFTPWorkerMetrics &workerMetrics()
+{
+    static thread_local TFTPWorkerMetrics *metrics = nullptr;
+    if (metrics == nullptr)
+    {
+        metrics = new TFTPWorkerMetrics();
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+        {
+            metrics->counters[i] = 0;
+        }
+        for (size_t i = 0; i < HISTOGRAM_COUNT; i++)
+        {
+            for (size_t j = 0; j <= HISTOGRAM_MAX_BOUNDS; j++)
+            {
+                metrics->buckets[i][j] = 0;
+            }
+            metrics->observations[i] = 0;
+            metrics->sums[i] = 0;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.push_back(metrics);
+    }
+    return *metrics;
+}
+
+// Only the owning worker writes, a relaxed load and store avoids a locked read-modify-write per packet
+static void add(std::atomic<uint64_t> &value, uint64_t amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static void observe(TFTPWorkerMetrics &metrics, TFTPHistogram histogram, double value)
+{
+    const TFTPHistogramInfo &info = histogramInfo[histogram];
+
+    size_t bucket = 0;
+    while (bucket < info.boundCount && value > info.bounds[bucket])
+    {
+        bucket++;
+    }
+
+    add(metrics.buckets[histogram][bucket], 1);
+    add(metrics.observations[histogram], 1);
+    metrics.sums[histogram].store(metrics.sums[histogram].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void countMetric(TFTPCounter counter, uint64_t value)
+{
+    add(workerMetrics().counters[counter], value);
+}
+
+void countSessionStart(TFTPTransferMetrics &transfer, const TFTPOparams &params)
+{
+    transfer.startedAt = std::chrono::steady_clock::now();
+    transfer.bytes = 0;
+    transfer.blocks = 0;
+    transfer.retransmits = 0;
+    transfer.timeouts = 0;
+    transfer.completed = false;
+
+    TFTPWorkerMetrics &metrics = workerMetrics();
+    add(metrics.counters[COUNTER_SESSIONS_STARTED], 1);
+    observe(metrics, HISTOGRAM_BLKSIZE, params.blksize);
+    observe(metrics, HISTOGRAM_WINDOWSIZE, params.windowsize);
+}
+
+void countSessionEnd(const TFTPTransferMetrics &transfer)
+{
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - transfer.startedAt;
+
+    TFTPWorkerMetrics &metrics = workerMetrics();
+    add(metrics.counters[transfer.completed ? COUNTER_SESSIONS_COMPLETED : COUNTER_SESSIONS_FAILED], 1);
+    observe(metrics, HISTOGRAM_DURATION, duration.count());
+    observe(metrics, HISTOGRAM_TRANSFER_BYTES, transfer.bytes);
+    observe(metrics, HISTOGRAM_TRANSFER_RETRANSMITS, transfer.retransmits);
+}
+
+uint64_t metricTotal(TFTPCounter counter)
+{
+    uint64_t total = 0;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (TFTPWorkerMetrics *metrics : registry)
+    {
+        total += metrics->counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// Writes the HELP and TYPE lines of a metric
+static void writeHeader(std::ostringstream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n";
+}
+
+static void writeCounter(std::ostringstream &out, const char *name, const char *help, uint64_t value)
+{
+    writeHeader(out, name, "counter", help);
+    out << name << " " << value << "\n";
+}
+
+std::string formatMetrics()
+{
+    uint64_t counters[COUNTER_COUNT] = {};
+    uint64_t buckets[HISTOGRAM_COUNT][HISTOGRAM_MAX_BOUNDS + 1] = {};
+    uint64_t observations[HISTOGRAM_COUNT] = {};
+    double sums[HISTOGRAM_COUNT] = {};
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (TFTPWorkerMetrics *metrics : registry)
+        {
+            // Ended sessions are read before started ones, the active gauge never goes negative
+            counters[COUNTER_SESSIONS_COMPLETED] += metrics->counters[COUNTER_SESSIONS_COMPLETED].load(std::memory_order_acquire);
+            counters[COUNTER_SESSIONS_FAILED] += metrics->counters[COUNTER_SESSIONS_FAILED].load(std::memory_order_acquire);
+            for (size_t i = 0; i < COUNTER_COUNT; i++)
+            {
+                if (i != COUNTER_SESSIONS_COMPLETED && i != COUNTER_SESSIONS_FAILED)
+                {
+                    counters[i] += metrics->counters[i].load(std::memory_order_acquire);
+                }
+            }
+
+            for (size_t i = 0; i < HISTOGRAM_COUNT; i++)
+            {
+                for (size_t j = 0; j <= HISTOGRAM_MAX_BOUNDS; j++)
+                {
+                    buckets[i][j] += metrics->buckets[i][j].load(std::memory_order_relaxed);
+                }
+                observations[i] += metrics->observations[i].load(std::memory_order_relaxed);
+                sums[i] += metrics->sums[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out << std::setprecision(15);
+
+    // Request rates are derived by the scraper (rate(tftp_requests_total[1m]))
+    writeHeader(out, "tftp_requests_total", "counter", "Requests received on the listening sockets.");
+    out << "tftp_requests_total{type=\"rrq\"} " << counters[COUNTER_RRQ] << "\n"
+        << "tftp_requests_total{type=\"wrq\"} " << counters[COUNTER_WRQ] << "\n";
+
+    uint64_t ended = counters[COUNTER_SESSIONS_COMPLETED] + counters[COUNTER_SESSIONS_FAILED];
+    writeHeader(out, "tftp_sessions_active", "gauge", "Sessions being served.");
+    out << "tftp_sessions_active " << (counters[COUNTER_SESSIONS_STARTED] >= ended ? counters[COUNTER_SESSIONS_STARTED] - ended : 0) << "\n";
+
+    writeHeader(out, "tftp_sessions_total", "counter", "Released sessions by result.");
+    out << "tftp_sessions_total{result=\"completed\"} " << counters[COUNTER_SESSIONS_COMPLETED] << "\n"
+        << "tftp_sessions_total{result=\"failed\"} " << counters[COUNTER_SESSIONS_FAILED] << "\n";
+
+    writeCounter(out, "tftp_sent_bytes_total", "DATA payload sent, retransmissions included.", counters[COUNTER_BYTES_SENT]);
+    writeCounter(out, "tftp_received_bytes_total", "DATA payload received in order.", counters[COUNTER_BYTES_RECEIVED]);
+    writeCounter(out, "tftp_sent_blocks_total", "DATA packets sent, retransmissions included.", counters[COUNTER_BLOCKS_SENT]);
+    writeCounter(out, "tftp_received_blocks_total", "DATA packets received in order.", counters[COUNTER_BLOCKS_RECEIVED]);
+    writeCounter(out, "tftp_retransmits_total", "DATA packets sent again.", counters[COUNTER_RETRANSMITS]);
+    writeCounter(out, "tftp_timeouts_total", "Expired retransmission deadlines.", counters[COUNTER_TIMEOUTS]);
+    writeCounter(out, "tftp_errors_sent_total", "ERROR packets sent.", counters[COUNTER_ERRORS_SENT]);
+    writeCounter(out, "tftp_sessions_reaped_total", "Sessions closed after making no progress for the idle limit.", counters[COUNTER_SESSIONS_REAPED]);
+    writeCounter(out, "tftp_duplicate_requests_total", "Retransmitted requests of running sessions that started no session.", counters[COUNTER_DUPLICATE_REQUESTS]);
+    writeCounter(out, "tftp_duplicate_resends_total", "First packets of sessions sent again for duplicate requests.", counters[COUNTER_DUPLICATE_RESENDS]);
+
+    // Buckets are kept apart per worker and made cumulative here
+    for (size_t i = 0; i < HISTOGRAM_COUNT; i++)
+    {
+        const TFTPHistogramInfo &info = histogramInfo[i];
+        writeHeader(out, info.name, "histogram", info.help);
+
+        uint64_t cumulative = 0;
+        for (size_t j = 0; j < info.boundCount; j++)
+        {
+            cumulative += buckets[i][j];
+            out << info.name << "_bucket{le=\"" << info.bounds[j] << "\"} " << cumulative << "\n";
+        }
+        cumulative += buckets[i][info.boundCount];
+        out << info.name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << info.name << "_sum " << sums[i] << "\n"
+            << info.name << "_count " << observations[i] << "\n";
+    }
+
+    // Counters of the other server modules
+    TFTPCacheStats cache = cacheStats();
+    writeCounter(out, "tftp_cache_hits_total", "Blocks served from the content cache.", cache.hits);
+    writeCounter(out, "tftp_cache_misses_total", "Files loaded into the content cache.", cache.misses);
+    TFTPBatchStats batch = batchStats();
+    writeCounter(out, "tftp_send_dropped_total", "Packets dropped because the socket buffer was full.", batch.sendDropped);
+    TFTPWriterStats writer = writerStats();
+    writeCounter(out, "tftp_writer_bytes_total", "Bytes written to uploaded files.", writer.bytes);
+    writeCounter(out, "tftp_writer_extra_chunks_total", "Upload chunks allocated beyond the preallocated chunks of a worker.", writer.extraChunks);
+    TFTPStreamStats stream = streamStats();
+    writeCounter(out, "tftp_stream_read_bytes_total", "Bytes read by the shared read streams.", stream.bytes);
+    TFTPMulticastStats multicast = multicastStats();
+    writeCounter(out, "tftp_multicast_packets_total", "DATA packets sent to a group address.", multicast.blocks);
+
+    // Classes of the rate limits, the throughput of a class is rate(tftp_shaper_sent_bytes_total[1m])
+    std::vector<TFTPShaperClassStats> shaper = shaperStats();
+    writeHeader(out, "tftp_shaper_sent_bytes_total", "counter", "DATA bytes (headers included) sent through the shaper by client class.");
+    for (const TFTPShaperClassStats &classStats : shaper)
+    {
+        out << "tftp_shaper_sent_bytes_total{class=\"" << classStats.name << "\"} " << classStats.bytes << "\n";
+    }
+    writeHeader(out, "tftp_shaper_waits_total", "counter", "Times a session waited for the tokens of its class or of the global limit.");
+    for (const TFTPShaperClassStats &classStats : shaper)
+    {
+        out << "tftp_shaper_waits_total{class=\"" << classStats.name << "\"} " << classStats.waits << "\n";
+    }
+    writeHeader(out, "tftp_shaper_limit_bytes_per_second", "gauge", "Configured byte rate limits, 0 if a class has none.");
+    out << "tftp_shaper_limit_bytes_per_second{class=\"global\"} " << globalRateLimit() << "\n";
+    for (const TFTPShaperClassStats &classStats : shaper)
+    {
+        out << "tftp_shaper_limit_bytes_per_second{class=\"" << classStats.name << "\"} " << classStats.rate << "\n";
+    }
+
+    return out.str();
+}
+
+// Sends the whole buffer, the scraper may read it in parts
+static bool sendAll(int fd, const std::string &data)
+{
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t sent = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        done += sent;
+    }
+    return true;
+}
+
+// Answers one HTTP request, every path returns the metrics
+static void serveMetricsRequest(int fd)
+{
+    // A stalled scraper must not hold up the next one for long
+    timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            break;
+        }
+        request.append(buffer, received);
+    }
+
+    std::string response;
+    if (request.compare(0, 4, "GET ") == 0)
+    {
+        std::string body = formatMetrics();
+        response = "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "Connection: close\r\n\r\n" + body;
+    }
+    else
+    {
+        response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    sendAll(fd, response);
+}
+
+// Accept loop of the metrics thread
+static void runMetricsServer(int listenfd)
+{
+    // SIGUSR1 has to interrupt a worker, not the metrics thread
+    sigset_t statsSignal;
+    sigemptyset(&statsSignal);
+    sigaddset(&statsSignal, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &statsSignal, nullptr);
+
+    while (true)
+    {
+        int fd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                std::cout << "Error accepting metrics connection: " << strerror(errno) << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        serveMetricsRequest(fd);
+        close(fd);
+    }
+}
+
+// Opens a TCP listening socket on the loopback address, metrics are not exposed to the network
+static int listenTcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Opens a Unix listening socket, a socket left behind by a previous run is replaced
+static int listenUnix(const std::string &path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat pathStat;
+    if (lstat(path.c_str(), &pathStat) == 0 && S_ISSOCK(pathStat.st_mode))
+    {
+        unlink(path.c_str());
+    }
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool startMetricsServer(const std::string &endpoint)
+{
+    bool isPort = !endpoint.empty() && endpoint.find_first_not_of("0123456789") == std::string::npos;
+
+    int fd;
+    if (isPort)
+    {
+        int port = std::atoi(endpoint.c_str());
+        fd = port > 0 && port <= 65535 ? listenTcp(port) : -1;
+    }
+    else
+    {
+        fd = listenUnix(endpoint);
+    }
+
+    if (fd < 0 || listen(fd, 16) < 0)
+    {
+        std::cout << "Error: Failed to open metrics endpoint " << endpoint << ": " << strerror(errno) << std::endl;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    std::thread(runMetricsServer, fd).detach();
+    return true;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file tftp-metrics.h
+ * @brief Declarations for the server metrics and their Prometheus text exposition endpoint.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_METRICS_H
+#define TFTP_METRICS_H
+
+#include "tftp-server.h"
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <sstream>
+
+// Counters of the server, every worker keeps its own copy
+enum TFTPCounter
+{
+    COUNTER_RRQ,                // Read requests received
+    COUNTER_WRQ,                // Write requests received
+    COUNTER_SESSIONS_STARTED,   // Sessions created
+    COUNTER_SESSIONS_COMPLETED, // Sessions that transferred the whole file
+    COUNTER_SESSIONS_FAILED,    // Sessions closed before the end of the file
+    COUNTER_BYTES_SENT,         // DATA payload sent, retransmissions included
+    COUNTER_BYTES_RECEIVED,     // DATA payload received in order
+    COUNTER_BLOCKS_SENT,        // DATA packets sent, retransmissions included
+    COUNTER_BLOCKS_RECEIVED,    // DATA packets received in order
+    COUNTER_RETRANSMITS,        // DATA packets sent again
+    COUNTER_TIMEOUTS,           // Expired retransmission deadlines
+    COUNTER_ERRORS_SENT,        // ERROR packets sent
+    COUNTER_SESSIONS_REAPED,    // Sessions closed after making no progress for the idle limit
+    COUNTER_DUPLICATE_REQUESTS, // Retransmitted requests of running sessions, no session was started for them
+    COUNTER_DUPLICATE_RESENDS,  // First packets (OACK, DATA 1 or ACK 0) sent again for a duplicate request
+    COUNTER_COUNT
+};
+
+// Histograms of the server
+enum TFTPHistogram
+{
+    HISTOGRAM_BLKSIZE,              // Negotiated block size of the sessions
+    HISTOGRAM_WINDOWSIZE,           // Negotiated window size of the sessions
+    HISTOGRAM_DURATION,             // Duration of the sessions in seconds
+    HISTOGRAM_TRANSFER_BYTES,       // Bytes transferred per session
+    HISTOGRAM_TRANSFER_RETRANSMITS, // Retransmitted DATA packets per session
+    HISTOGRAM_COUNT
+};
+
+// Upper bounds of the buckets of the largest histogram (the +Inf bucket is implicit)
+const size_t HISTOGRAM_MAX_BOUNDS = 12;
+
+// Counters of one session, added to the histograms when it is closed
+struct TFTPTransferMetrics
+{
+    std::chrono::steady_clock::time_point startedAt;
+    uint64_t bytes;       // DATA payload sent or received
+    uint64_t blocks;      // DATA packets sent or received
+    uint64_t retransmits; // DATA packets sent again
+    uint64_t timeouts;    // Expired retransmission deadlines
+    bool completed;       // The whole file was transferred
+};
+
+/**
+ * @brief Adds to a counter of the calling worker.
+ *
+ * @param counter Counter to increase.
+ * @param value Amount to add.
+ */
+void countMetric(TFTPCounter counter, uint64_t value = 1);
+
+/**
+ * @brief Counts a new session and its negotiated block and window size.
+ *
+ * @param transfer Counters of the session to initialize.
+ * @param params Negotiated parameters of the session.
+ */
+void countSessionStart(TFTPTransferMetrics &transfer, const TFTPOparams &params);
+
+/**
+ * @brief Counts a closed session and adds its duration, bytes and retransmissions to the histograms.
+ *
+ * @param transfer Counters of the session.
+ */
+void countSessionEnd(const TFTPTransferMetrics &transfer);
+
+/**
+ * @brief Returns the sum of a counter over all workers.
+ *
+ * @param counter Counter to read.
+ * @return Value of the counter.
+ */
+uint64_t metricTotal(TFTPCounter counter);
+
+/**
+ * @brief Formats the metrics of all workers in the Prometheus text exposition format.
+ *
+ * @return Metrics text.
+ */
+std::string formatMetrics();
+
+/**
+ * @brief Starts the thread serving the metrics over HTTP.
+ *
+ * @param endpoint Port on the loopback address (digits only) or path of a Unix socket.
+ * @return True if the endpoint was opened, otherwise False.
+ */
+bool startMetricsServer(const std::string &endpoint);
+
+#endif // TFTP_METRICS_H
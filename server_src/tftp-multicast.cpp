@@ -0,0 +1,173 @@
+/**
+ * @file tftp-multicast.cpp
+ * @brief Multicast groups of the TFTP server (RFC 2090)
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-multicast.h"
+#include "tftp-session.h"
+
+// Counters shared by all workers
+static std::atomic<uint64_t> groups(0);
+static std::atomic<uint64_t> members(0);
+static std::atomic<uint64_t> promotions(0);
+static std::atomic<uint64_t> blocks(0);
+
+// Groups of the calling worker by file, mode and block size
+static std::map<std::string, TFTPMulticastGroup *> &workerGroups()
+{
+    static thread_local std::map<std::string, TFTPMulticastGroup *> groups;
+    return groups;
+}
+
+// Returns the local address the kernel routes packets to the client from
+static in_addr localAddressTowards(const sockaddr_in &clientAddr)
+{
+    in_addr local;
+    local.s_addr = INADDR_ANY;
+
+    // Connecting a UDP socket only selects the route, nothing is sent
+    int probe = socket(AF_INET, SOCK_DGRAM, 0);
+    if (probe < 0)
+    {
+        return local;
+    }
+
+    sockaddr_in address = clientAddr;
+    socklen_t addressLength = sizeof(address);
+    if (connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+        getsockname(probe, (struct sockaddr *)&address, &addressLength) == 0)
+    {
+        local = address.sin_addr;
+    }
+
+    close(probe);
+    return local;
+}
+
+static TFTPMulticastGroup *createGroup(const std::string &key, const in_addr &baseAddr, const sockaddr_in &clientAddr)
+{
+    // Workers share the port range, groups of different files never share a port
+    static std::atomic<uint32_t> nextPort(0);
+
+    TFTPMulticastGroup *group = new TFTPMulticastGroup();
+    group->key = key;
+    memset(&group->groupAddr, 0, sizeof(group->groupAddr));
+    group->groupAddr.sin_family = AF_INET;
+    group->groupAddr.sin_addr = baseAddr;
+    group->groupAddr.sin_port = htons(MULTICAST_BASE_PORT + nextPort++ % MULTICAST_PORTS);
+    group->interfaceAddr = localAddressTowards(clientAddr);
+    group->master = nullptr;
+
+    groups++;
+    return group;
+}
+
+// Removes a member from the list of the group
+static void removeMember(TFTPMulticastGroup &group, TFTPSession &session)
+{
+    group.members.erase(std::remove(group.members.begin(), group.members.end(), &session), group.members.end());
+    session.group = nullptr;
+}
+
+TFTPMulticastGroup *joinMulticastGroup(TFTPSession &session, const in_addr &baseAddr)
+{
+    // Only octet transfers join groups
+    std::string key = session.filename + '\0' + std::to_string(session.params.blksize);
+
+    std::map<std::string, TFTPMulticastGroup *> &registry = workerGroups();
+    auto it = registry.find(key);
+    if (it == registry.end())
+    {
+        it = registry.insert(std::make_pair(key, createGroup(key, baseAddr, session.clientAddr))).first;
+    }
+    TFTPMulticastGroup *group = it->second;
+
+    // A client repeating its request lost the OACK, its previous session is dropped
+    for (size_t i = 0; i < group->members.size(); i++)
+    {
+        TFTPSession *member = group->members[i];
+        if (member->clientAddr.sin_addr.s_addr == session.clientAddr.sin_addr.s_addr && member->clientAddr.sin_port == session.clientAddr.sin_port)
+        {
+            if (group->master == member)
+            {
+                group->master = nullptr;
+            }
+            removeMember(*group, *member);
+            member->state = SESSION_DONE;
+            setSessionDeadline(*member, std::chrono::steady_clock::now());
+            break;
+        }
+    }
+
+    // DATA of the group leaves the transfer socket of its master
+    int ttl = MULTICAST_TTL;
+    setsockopt(session.sockfd, IPPROTO_IP, IP_MULTICAST_IF, &group->interfaceAddr, sizeof(group->interfaceAddr));
+    setsockopt(session.sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+    group->members.push_back(&session);
+    session.group = group;
+    session.dataAddr = group->groupAddr;
+    members++;
+
+    if (group->master == nullptr)
+    {
+        group->master = &session;
+        promotions++;
+    }
+
+    return group;
+}
+
+TFTPSession *leaveMulticastGroup(TFTPSession &session)
+{
+    TFTPMulticastGroup *group = session.group;
+    if (group == nullptr)
+    {
+        return nullptr;
+    }
+
+    bool wasMaster = group->master == &session;
+    removeMember(*group, session);
+
+    if (group->members.empty())
+    {
+        workerGroups().erase(group->key);
+        delete group;
+        return nullptr;
+    }
+
+    if (!wasMaster)
+    {
+        return nullptr;
+    }
+
+    // The member waiting longest fetches the blocks it missed next
+    group->master = nullptr;
+    for (TFTPSession *member : group->members)
+    {
+        if (member->state != SESSION_DONE)
+        {
+            group->master = member;
+            promotions++;
+            break;
+        }
+    }
+
+    return group->master;
+}
+
+void countMulticastBlocks(uint64_t count)
+{
+    blocks += count;
+}
+
+TFTPMulticastStats multicastStats()
+{
+    TFTPMulticastStats stats;
+    stats.groups = groups;
+    stats.members = members;
+    stats.promotions = promotions;
+    stats.blocks = blocks;
+    return stats;
+}
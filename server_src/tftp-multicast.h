@@ -0,0 +1,75 @@
+/**
+ * @file tftp-multicast.h
+ * @brief Declarations for multicast groups of clients downloading the same file (RFC 2090).
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_MULTICAST_H
+#define TFTP_MULTICAST_H
+
+#include "tftp-server.h"
+#include <netinet/in.h>
+
+// First port of the multicast groups (port of the RFC 2090 examples), every group gets its own port
+const uint16_t MULTICAST_BASE_PORT = 1758;
+
+// Number of ports the groups take turns in
+const uint16_t MULTICAST_PORTS = 1024;
+
+// Hop limit of multicast DATA packets, 1 keeps them on the local network
+const int MULTICAST_TTL = 1;
+
+// Clients downloading the same file together, the DATA requested by the master reaches every member
+struct TFTPMulticastGroup
+{
+    std::string key;                    // File, mode and block size the members share
+    sockaddr_in groupAddr;              // Multicast address and port the members listen on
+    in_addr interfaceAddr;              // Local address the DATA packets leave from
+    std::vector<TFTPSession *> members; // Sessions of the members in the order they joined
+    TFTPSession *master;                // Member acknowledging the DATA, nullptr while none is selected
+};
+
+// Counters of the multicast groups
+struct TFTPMulticastStats
+{
+    uint64_t groups;     // Groups created
+    uint64_t members;    // Clients that joined a group
+    uint64_t promotions; // Members made the master
+    uint64_t blocks;     // DATA packets sent to a group address
+};
+
+/**
+ * @brief Adds a session to the group of the worker downloading the same file, creating the group if there is none.
+ *
+ * Groups are kept per worker. A member of the same client (a repeated request) is replaced by the session.
+ * The transfer socket of the session is set up to send to the group.
+ *
+ * @param session Session of the multicast request.
+ * @param baseAddr Multicast address of the server (-M).
+ * @return Group of the session, its master is the session if the group had none.
+ */
+TFTPMulticastGroup *joinMulticastGroup(TFTPSession &session, const in_addr &baseAddr);
+
+/**
+ * @brief Removes a session from its group, the group is released when the last member leaves.
+ *
+ * @param session Member of a group.
+ * @return Member that became the master in place of the session, or nullptr if there is none.
+ */
+TFTPSession *leaveMulticastGroup(TFTPSession &session);
+
+/**
+ * @brief Counts DATA packets sent to a group address.
+ *
+ * @param blocks Number of packets.
+ */
+void countMulticastBlocks(uint64_t blocks);
+
+/**
+ * @brief Returns a snapshot of the multicast counters.
+ *
+ * @return Multicast counters.
+ */
+TFTPMulticastStats multicastStats();
+
+#endif // TFTP_MULTICAST_H
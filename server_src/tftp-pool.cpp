@@ -0,0 +1,80 @@
+/**
+ * @file tftp-pool.cpp
+ * @brief Pools of preallocated packet buffers of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-pool.h"
+
+bool initPacketPool(TFTPPacketPool &pool, size_t bufferCount, size_t bufferSize)
+{
+    pool.bufferSize = (bufferSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    pool.bufferCount = bufferCount;
+    pool.memory = nullptr;
+
+    void *memory = nullptr;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, pool.bufferSize * bufferCount) != 0)
+    {
+        pool.bufferCount = 0;
+        pool.freeBuffers.clear();
+        return false;
+    }
+    pool.memory = static_cast<uint8_t *>(memory);
+
+    // The free list never grows beyond the number of buffers
+    pool.freeBuffers.clear();
+    pool.freeBuffers.reserve(bufferCount);
+    for (size_t i = bufferCount; i > 0; i--)
+    {
+        pool.freeBuffers.push_back(pool.memory + (i - 1) * pool.bufferSize);
+    }
+
+    return true;
+}
+
+uint8_t *acquirePacketBuffer(TFTPPacketPool &pool)
+{
+    if (pool.freeBuffers.empty())
+    {
+        return nullptr;
+    }
+
+    uint8_t *buffer = pool.freeBuffers.back();
+    pool.freeBuffers.pop_back();
+    return buffer;
+}
+
+void releasePacketBuffer(TFTPPacketPool &pool, uint8_t *buffer)
+{
+    pool.freeBuffers.push_back(buffer);
+}
+
+void destroyPacketPool(TFTPPacketPool &pool)
+{
+    free(pool.memory);
+    pool.memory = nullptr;
+    pool.bufferCount = 0;
+    pool.freeBuffers.clear();
+}
+
+// Destroys the pool of a thread when the thread exits
+struct TFTPThreadPacketPool
+{
+    TFTPPacketPool pool;
+
+    TFTPThreadPacketPool()
+    {
+        initPacketPool(pool, CONTROL_PACKET_COUNT, CONTROL_PACKET_SIZE);
+    }
+
+    ~TFTPThreadPacketPool()
+    {
+        destroyPacketPool(pool);
+    }
+};
+
+TFTPPacketPool &controlPacketPool()
+{
+    static thread_local TFTPThreadPacketPool threadPool;
+    return threadPool.pool;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file tftp-pool.h
+ * @brief Declarations for pools of preallocated, cache-line aligned packet buffers.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_POOL_H
+#define TFTP_POOL_H
+
+#include "tftp-server.h"
+
+// Size of a cache line, buffers of a pool never share one
+const size_t CACHE_LINE_SIZE = 64;
+
+// Buffers of the per-thread pool for control packets (OACK, ACK, ERROR)
+const size_t CONTROL_PACKET_SIZE = MAX_DATA_SIZE + 2;
+const size_t CONTROL_PACKET_COUNT = 4;
+
+// Fixed number of equal-sized buffers carved from one aligned allocation
+struct TFTPPacketPool
+{
+    uint8_t *memory;
+    size_t bufferSize; // Rounded up to a multiple of CACHE_LINE_SIZE
+    size_t bufferCount;
+    std::vector<uint8_t *> freeBuffers;
+};
+
+/**
+ * @brief Allocates the memory of a pool, all buffers start free.
+ *
+ * @param pool Pool to initialize.
+ * @param bufferCount Number of buffers.
+ * @param bufferSize Minimum size of one buffer.
+ * @return True if the memory was allocated, otherwise False.
+ */
+bool initPacketPool(TFTPPacketPool &pool, size_t bufferCount, size_t bufferSize);
+
+/**
+ * @brief Takes a free buffer from the pool.
+ *
+ * @param pool Packet pool.
+ * @return Cache-line aligned buffer, or nullptr if all buffers are in use.
+ */
+uint8_t *acquirePacketBuffer(TFTPPacketPool &pool);
+
+/**
+ * @brief Returns a buffer taken from the pool.
+ *
+ * @param pool Packet pool.
+ * @param buffer Buffer returned by acquirePacketBuffer.
+ */
+void releasePacketBuffer(TFTPPacketPool &pool, uint8_t *buffer);
+
+/**
+ * @brief Releases the memory of a pool.
+ *
+ * @param pool Packet pool.
+ */
+void destroyPacketPool(TFTPPacketPool &pool);
+
+/**
+ * @brief Returns the pool of control packet buffers of the calling thread.
+ *
+ * @return Per-thread packet pool, allocated on first use.
+ */
+TFTPPacketPool &controlPacketPool();
+
+#endif // TFTP_POOL_H
@@ -0,0 +1,383 @@
+/**
+ * @file tftp-request.cpp
+ * @brief Parsing of TFTP requests in place and encoding of OACK packets without heap allocations
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-server.h"
+
+// Entry of the option table
+struct TFTPOptionEntry
+{
+    const char *name;  // Lower-case name with its null-terminator, copied into the OACK as it is
+    size_t length;     // Length of the name without the null-terminator
+    bool emptyValue;   // The option is requested with an empty value
+};
+
+static const TFTPOptionEntry OPTION_TABLE[OPTION_COUNT] = {
+    {"blksize", sizeof("blksize") - 1, false},
+    {"timeout", sizeof("timeout") - 1, false},
+    {"tsize", sizeof("tsize") - 1, false},
+    {"windowsize", sizeof("windowsize") - 1, false},
+    {"utimeout", sizeof("utimeout") - 1, false},
+    {"rollover", sizeof("rollover") - 1, false},
+    {"multicast", sizeof("multicast") - 1, true},
+};
+
+// Longest accepted option value, 18 decimal digits cannot overflow a long long
+const size_t MAX_OPTION_DIGITS = 18;
+
+// Reads the null-terminated field at the offset, fails if the datagram ends before its terminator
+static bool readField(const uint8_t *packet, size_t length, size_t &offset, const char *&field, size_t &fieldLength)
+{
+    if (offset >= length)
+    {
+        return false;
+    }
+
+    const uint8_t *end = static_cast<const uint8_t *>(memchr(packet + offset, '\0', length - offset));
+    if (end == nullptr)
+    {
+        return false;
+    }
+
+    field = reinterpret_cast<const char *>(packet + offset);
+    fieldLength = end - (packet + offset);
+    offset += fieldLength + 1;
+    return true;
+}
+
+// Finds an option by its name regardless of case, OPTION_COUNT if the option is unknown
+static TFTPOptionId findOption(const char *name, size_t length)
+{
+    for (int option = 0; option < OPTION_COUNT; option++)
+    {
+        const TFTPOptionEntry &entry = OPTION_TABLE[option];
+        if (entry.length != length)
+        {
+            continue;
+        }
+
+        // The names consist of lower-case letters only, setting bit 5 lowers an upper-case letter
+        size_t i = 0;
+        while (i < length && (name[i] | 0x20) == entry.name[i])
+        {
+            i++;
+        }
+        if (i == length)
+        {
+            return static_cast<TFTPOptionId>(option);
+        }
+    }
+
+    return OPTION_COUNT;
+}
+
+// Parses a non-negative decimal number, no sign, spaces or trailing characters are accepted
+static bool parseDecimal(const char *text, size_t length, long long &value)
+{
+    if (length == 0 || length > MAX_OPTION_DIGITS)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+
+    return true;
+}
+
+const char *optionName(TFTPOptionId option)
+{
+    return OPTION_TABLE[option].name;
+}
+
+bool parseRequest(const uint8_t *packet, size_t length, TFTPRequest &request)
+{
+    if (length < sizeof(uint16_t))
+    {
+        return false;
+    }
+
+    request.opcode = (packet[0] << 8) | packet[1];
+    request.options.requested = 0;
+    size_t offset = sizeof(uint16_t);
+
+    // Extract the filename
+    if (!readField(packet, length, offset, request.filename, request.filenameLength) || request.filenameLength == 0)
+    {
+        std::cout << "Invalid filename in the request packet." << std::endl;
+        return false;
+    }
+
+    // Extract the mode
+    if (!readField(packet, length, offset, request.mode, request.modeLength) || request.modeLength == 0)
+    {
+        std::cout << "Unsupported transfer mode in the request packet." << std::endl;
+        return false;
+    }
+
+    // Option name and value pairs follow until the end of the datagram
+    while (offset < length)
+    {
+        const char *name;
+        size_t nameLength;
+        if (!readField(packet, length, offset, name, nameLength))
+        {
+            std::cout << "Malformed option in the request packet." << std::endl;
+            return false;
+        }
+
+        if (nameLength == 0)
+        {
+            break; // Padding after the last option
+        }
+
+        const char *value;
+        size_t valueLength;
+        if (!readField(packet, length, offset, value, valueLength))
+        {
+            std::cout << "Malformed option in the request packet." << std::endl;
+            return false;
+        }
+
+        // Options the server does not know are left out of the OACK (RFC 2347)
+        TFTPOptionId option = findOption(name, nameLength);
+        if (option == OPTION_COUNT)
+        {
+            continue;
+        }
+
+        if (OPTION_TABLE[option].emptyValue)
+        {
+            request.options.values[option] = 0;
+        }
+        else if (valueLength == 0)
+        {
+            std::cout << "Malformed option in the request packet." << std::endl;
+            return false;
+        }
+        else if (!parseDecimal(value, valueLength, request.options.values[option]))
+        {
+            std::cout << "Invalid option value: " << value << std::endl;
+            return false;
+        }
+
+        request.options.requested |= 1U << option;
+    }
+
+    return true;
+}
+
+uint64_t hashRequest(const uint8_t *packet, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ packet[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool applyOptions(const TFTPOptionSet &options, TFTPOparams &params)
+{
+    // If "blksize" option is requested, use the specified block size (8 to 65464, RFC 2348)
+    if (optionRequested(options, OPTION_BLKSIZE))
+    {
+        long long blksize = options.values[OPTION_BLKSIZE];
+        if (blksize < 8 || blksize > 65464)
+        {
+            std::cout << "Invalid blksize value: " << blksize << std::endl;
+            return false;
+        }
+
+        params.blksize = blksize;
+        params.blocksizeOptionUsed = true;
+    }
+
+    // If "timeout" option is requested, use the specified timeout (1 to 255 seconds, RFC 2349)
+    if (optionRequested(options, OPTION_TIMEOUT))
+    {
+        long long timeout = options.values[OPTION_TIMEOUT];
+        if (timeout < 1 || timeout > 255)
+        {
+            std::cout << "Invalid timeout value: " << timeout << std::endl;
+            return false;
+        }
+
+        params.timeout = timeout;
+        params.timeoutOptionUsed = true;
+    }
+
+    // If "tsize" option is requested, use the announced transfer size
+    if (optionRequested(options, OPTION_TSIZE))
+    {
+        params.transfersize = options.values[OPTION_TSIZE];
+        params.transfersizeOptionUsed = true;
+    }
+
+    // If "windowsize" option is requested, use the specified window size
+    if (optionRequested(options, OPTION_WINDOWSIZE))
+    {
+        long long windowsize = options.values[OPTION_WINDOWSIZE];
+        if (windowsize < 1 || windowsize > 65535)
+        {
+            std::cout << "Invalid windowsize value: " << windowsize << std::endl;
+            return false;
+        }
+
+        // Limit the window so that the blocks kept for retransmission fit into MAX_WINDOW_BYTES
+        size_t maxWindow = MAX_WINDOW_BYTES / (params.blksize > 0 ? params.blksize : 1);
+        params.windowsize = std::min<size_t>(windowsize, std::max<size_t>(maxWindow, 1));
+        params.windowsizeOptionUsed = true;
+    }
+
+    // If "utimeout" option is requested, use the specified timeout in microseconds
+    if (optionRequested(options, OPTION_UTIMEOUT))
+    {
+        long long utimeout = options.values[OPTION_UTIMEOUT];
+        if (utimeout < 10000 || utimeout > 255000000)
+        {
+            std::cout << "Invalid utimeout value: " << utimeout << std::endl;
+            return false;
+        }
+
+        params.utimeout = utimeout;
+        params.utimeoutOptionUsed = true;
+    }
+
+    // If "rollover" option is requested, use the specified block number after 65535
+    if (optionRequested(options, OPTION_ROLLOVER))
+    {
+        long long rollover = options.values[OPTION_ROLLOVER];
+        if (rollover != 0 && rollover != 1)
+        {
+            std::cout << "Invalid rollover value: " << rollover << std::endl;
+            return false;
+        }
+
+        params.rollover = rollover;
+        params.rolloverOptionUsed = true;
+    }
+
+    // If "multicast" option is requested, the client asks to join a multicast group
+    if (optionRequested(options, OPTION_MULTICAST))
+    {
+        params.multicastOptionUsed = true;
+    }
+
+    return true;
+}
+
+// Appends a null-terminated option name from the table, 0 if it does not fit
+static size_t appendName(uint8_t *packet, size_t size, size_t offset, TFTPOptionId option)
+{
+    const TFTPOptionEntry &entry = OPTION_TABLE[option];
+    if (offset == 0 || size - offset < entry.length + 1)
+    {
+        return 0;
+    }
+
+    memcpy(packet + offset, entry.name, entry.length + 1);
+    return offset + entry.length + 1;
+}
+
+// Appends the decimal digits of a value (and optionally a terminator), 0 if they do not fit
+static size_t appendNumber(uint8_t *packet, size_t size, size_t offset, unsigned long long value, char terminator)
+{
+    // Digits are produced from the last one
+    char digits[24];
+    size_t count = 0;
+    do
+    {
+        digits[sizeof(digits) - ++count] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    if (offset == 0 || size - offset < count + 1)
+    {
+        return 0;
+    }
+
+    memcpy(packet + offset, digits + sizeof(digits) - count, count);
+    packet[offset + count] = terminator;
+    return offset + count + 1;
+}
+
+size_t encodeOACK(uint8_t *packet, size_t size, const TFTPOptionSet &options, const TFTPOparams &params)
+{
+    if (size < sizeof(uint16_t))
+    {
+        return 0;
+    }
+
+    packet[0] = OACK >> 8;
+    packet[1] = OACK & 0xFF;
+    size_t offset = sizeof(uint16_t);
+
+    for (int id = 0; id < OPTION_MULTICAST; id++)
+    {
+        TFTPOptionId option = static_cast<TFTPOptionId>(id);
+        if (!optionRequested(options, option))
+        {
+            continue;
+        }
+
+        unsigned long long value = 0;
+        switch (option)
+        {
+        case OPTION_BLKSIZE:
+            value = params.blksize;
+            break;
+        case OPTION_TIMEOUT:
+            value = params.timeout;
+            break;
+        case OPTION_TSIZE:
+            value = params.transfersize;
+            break;
+        case OPTION_WINDOWSIZE:
+            value = params.windowsize;
+            break;
+        case OPTION_UTIMEOUT:
+            value = params.utimeout;
+            break;
+        case OPTION_ROLLOVER:
+            value = params.rollover;
+            break;
+        default:
+            break;
+        }
+
+        offset = appendName(packet, size, offset, option);
+        offset = appendNumber(packet, size, offset, value, '\0');
+    }
+
+    // The "multicast" option of a client that joined a group carries "addr,port,mc" (RFC 2090)
+    if (optionRequested(options, OPTION_MULTICAST))
+    {
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &params.multicastGroup.sin_addr, address, sizeof(address));
+        size_t addressLength = strlen(address);
+
+        offset = appendName(packet, size, offset, OPTION_MULTICAST);
+        if (offset == 0 || size - offset < addressLength + 1)
+        {
+            return 0;
+        }
+        memcpy(packet + offset, address, addressLength);
+        packet[offset + addressLength] = ',';
+        offset += addressLength + 1;
+
+        offset = appendNumber(packet, size, offset, ntohs(params.multicastGroup.sin_port), ',');
+        offset = appendNumber(packet, size, offset, params.multicastMaster ? 1 : 0, '\0');
+    }
+
+    return offset;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file tftp-request.h
+ * @brief Declarations for the allocation-free parser of TFTP requests and the encoder of OACK packets.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_REQUEST_H
+#define TFTP_REQUEST_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Negotiation parameters of a transfer (tftp-server.h)
+struct TFTPOparams;
+
+// Options understood by the server, indexes of the option table
+enum TFTPOptionId
+{
+    OPTION_BLKSIZE,    // RFC 2348
+    OPTION_TIMEOUT,    // RFC 2349
+    OPTION_TSIZE,      // RFC 2349
+    OPTION_WINDOWSIZE, // RFC 7440
+    OPTION_UTIMEOUT,   // Timeout in microseconds
+    OPTION_ROLLOVER,   // Block number following 65535
+    OPTION_MULTICAST,  // RFC 2090, requested with an empty value
+    OPTION_COUNT
+};
+
+// Options requested by a client and their values as received
+struct TFTPOptionSet
+{
+    uint32_t requested;          // Bit N is set if option N was requested
+    long long values[OPTION_COUNT];
+};
+
+// Request parsed in place, the file name and mode point into the received datagram
+struct TFTPRequest
+{
+    uint16_t opcode;
+    const char *filename; // Null-terminated inside the datagram
+    size_t filenameLength;
+    const char *mode;     // Null-terminated inside the datagram
+    size_t modeLength;
+    TFTPOptionSet options;
+};
+
+/**
+ * @brief Checks whether the client requested an option.
+ *
+ * @param options Requested options.
+ * @param option Option to check.
+ * @return True if the option was requested, otherwise False.
+ */
+inline bool optionRequested(const TFTPOptionSet &options, TFTPOptionId option)
+{
+    return (options.requested & (1U << option)) != 0;
+}
+
+/**
+ * @brief Removes an option from the set, it is not acknowledged in the OACK.
+ *
+ * @param options Requested options.
+ * @param option Option to remove.
+ */
+inline void clearOption(TFTPOptionSet &options, TFTPOptionId option)
+{
+    options.requested &= ~(1U << option);
+}
+
+/**
+ * @brief Returns the name of an option as it is sent in the OACK.
+ *
+ * @param option Option.
+ * @return Lower-case name of the option.
+ */
+const char *optionName(TFTPOptionId option);
+
+/**
+ * @brief Parses a RRQ or WRQ datagram without copying it or allocating memory.
+ *
+ * Every field must be null-terminated within the datagram. Option names are matched case-insensitively
+ * (RFC 2347), unknown options are ignored and values must be decimal numbers.
+ *
+ * @param packet Received datagram (opcode included).
+ * @param length Length of the datagram.
+ * @param request Parsed request.
+ * @return True if the request is well-formed, otherwise False.
+ */
+bool parseRequest(const uint8_t *packet, size_t length, TFTPRequest &request);
+
+/**
+ * @brief Hashes a request datagram (64-bit FNV-1a), retransmissions of a request have the same hash.
+ *
+ * @param packet Received datagram (opcode included).
+ * @param length Length of the datagram.
+ * @return Hash of the datagram.
+ */
+uint64_t hashRequest(const uint8_t *packet, size_t length);
+
+/**
+ * @brief Checks the values of the requested options and stores them in the transfer parameters.
+ *
+ * @param options Requested options.
+ * @param params TFTP communication parameters, including block size and timeout.
+ * @return True if all values are acceptable, otherwise False.
+ */
+bool applyOptions(const TFTPOptionSet &options, TFTPOparams &params);
+
+/**
+ * @brief Encodes an OACK packet acknowledging the requested options with their negotiated values.
+ *
+ * @param packet Buffer of the packet.
+ * @param size Size of the buffer.
+ * @param options Requested options.
+ * @param params Negotiated parameters (tsize is taken from transfersize).
+ * @return Length of the packet, or 0 if it does not fit into the buffer.
+ */
+size_t encodeOACK(uint8_t *packet, size_t size, const TFTPOptionSet &options, const TFTPOparams &params);
+
+#endif // TFTP_REQUEST_H
@@ -5,6 +5,17 @@
  */
 
 #include "tftp-server.h"
+#include "tftp-session.h"
+#include "tftp-uring.h"
+#include "tftp-pool.h"
+#include "tftp-alloc-stats.h"
+
+// Set by SIGUSR1, the first worker woken up prints the statistics
+static std::atomic<bool> statsRequested(false);
+
+// Time of the previous statistics and the bytes of the shaper classes at that time
+static std::chrono::steady_clock::time_point statsPrintedAt = std::chrono::steady_clock::now();
+static std::vector<uint64_t> statsShapedBytes;
 
 bool fileExists(const std::string &filepath)
 {
@@ -28,14 +39,14 @@ int handleIncomingPacket(int sockfd, sockaddr_in &clientAddr, int opcode, sockad
     }
 }
 
-uint16_t checkDiskSpace(int size_of_file, const std::string &path)
+uint16_t checkDiskSpace(long long size_of_file, const std::string &path)
 {
     struct statvfs stat;
     if (statvfs("/", &stat) == 0)
     {
         unsigned long long freeSpace = stat.f_frsize * stat.f_bfree;
 
-        if (freeSpace < size_of_file)
+        if (freeSpace < static_cast<unsigned long long>(size_of_file))
         {
             std::cout << "Free space is: " << freeSpace / (1024 * 1024) << " MB "
                       << "You need" << size_of_file << std::endl;
@@ -56,109 +67,49 @@ void sendError(int sockfd, uint16_t errorCode, const std::string &errorMsg, sock
     // error packet create
     TFTPPacket errorPacket;
     errorPacket.opcode = htons(ERROR);
-    memcpy(errorPacket.data, &errorCode, sizeof(uint16_t));
+    uint16_t errorCodeNetwork = htons(errorCode);
+    memcpy(errorPacket.data, &errorCodeNetwork, sizeof(uint16_t));
     strcpy(errorPacket.data + sizeof(uint16_t), errorMsg.c_str());
 
-    // send error packet
-    sendto(sockfd, &errorPacket, sizeof(uint16_t) + errorMsg.size() + 1, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
+    // send error packet (opcode, error code, message and its null-terminator)
+    sendto(sockfd, &errorPacket, sizeof(uint16_t) * 2 + errorMsg.size() + 1, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
+    countMetric(COUNTER_ERRORS_SENT);
 
     // Výpis chybové zprávy na standardní chybový výstup
-    std::cerr << "ERROR "
-              << inet_ntoa(clientAddr.sin_addr) << ":"
-              << ntohs(clientAddr.sin_port) << ":"
-              << ntohs(serverAddr.sin_port) << " "
-              << errorCode << " \"" << errorMsg << "\"" << std::endl;
+    std::string line = "ERROR ";
+    line += inet_ntoa(clientAddr.sin_addr);
+    line += ":" + std::to_string(ntohs(clientAddr.sin_port)) + ":" + std::to_string(ntohs(serverAddr.sin_port)) + " " + std::to_string(errorCode) + " \"" + errorMsg + "\"";
+    logLine(LOG_LEVEL_ERROR, line);
 }
 
-bool sendDataPacket(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum, const char *data, size_t dataSize, uint16_t blockSize)
+bool sendOACK(int sockfd, sockaddr_in &clientAddr, const TFTPOptionSet &options, TFTPOparams &params, std::streampos filesize)
 {
-    uint16_t opcode = htons(DATA);
-    uint16_t blockNumNetwork = htons(blockNum);
-
-    size_t packetSize = sizeof(uint16_t) * 2 + dataSize;
-
-    std::vector<uint8_t> dataPacket(packetSize);
-
-    // Copy the opcode, block number, and data into the packet
-    memcpy(dataPacket.data(), &opcode, sizeof(uint16_t));
-    memcpy(dataPacket.data() + sizeof(uint16_t), &blockNumNetwork, sizeof(uint16_t));
-    memcpy(dataPacket.data() + sizeof(uint16_t) * 2, data, dataSize);
-
-    ssize_t sentBytes = sendto(sockfd, dataPacket.data(), packetSize, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
-
-    if (sentBytes == -1)
+    // The OACK is built in a preallocated buffer of the calling thread
+    TFTPPacketPool &pool = controlPacketPool();
+    uint8_t *oackBuffer = acquirePacketBuffer(pool);
+    if (oackBuffer == nullptr)
     {
-        std::cout << "Error sending Data packet for block " << blockNum << std::endl;
+        std::cout << "Error sending OACK packet" << std::endl;
         return false;
     }
 
-    return true;
-}
-
-bool sendOACK(int sockfd, sockaddr_in &clientAddr, std::map<std::string, int> &options_map, TFTPOparams &params, std::streampos filesize)
-{
-    // Create a vector to hold the OACK packet data
-    std::vector<uint8_t> oackBuffer;
-
-    // Add the opcode to the vector
-    uint16_t opcode = htons(OACK);
-    oackBuffer.insert(oackBuffer.end(), reinterpret_cast<uint8_t *>(&opcode), reinterpret_cast<uint8_t *>(&opcode) + sizeof(uint16_t));
-
-    // Add the "blksize" option if available in options_map
-    auto blksizeIt = options_map.find("blksize");
-    if (blksizeIt != options_map.end())
+    // The "tsize" option announces the size of the file
+    if (optionRequested(options, OPTION_TSIZE))
     {
-        const char *optionName = "blksize";
-
-        // Add the option name (including null-terminator) to the vector
-        oackBuffer.insert(oackBuffer.end(), optionName, optionName + strlen(optionName) + 1);
-
-        // Add the option value (as text) to the vector
-        std::string blockSizeStr = std::to_string(params.blksize);
-        oackBuffer.insert(oackBuffer.end(), blockSizeStr.begin(), blockSizeStr.end());
-
-        // Add a null-terminator after the option value
-        oackBuffer.push_back('\0');
-    }
-
-    // Add the "timeout" option if available in options_map
-    auto timeoutIt = options_map.find("timeout");
-    if (timeoutIt != options_map.end())
-    {
-        const char *optionName = "timeout";
-
-        // Add the option name (including null-terminator) to the vector
-        oackBuffer.insert(oackBuffer.end(), optionName, optionName + strlen(optionName) + 1);
-
-        // Add the option value (as text) to the vector
-        std::string timeoutStr = std::to_string(params.timeout);
-        oackBuffer.insert(oackBuffer.end(), timeoutStr.begin(), timeoutStr.end());
-
-        // Add a null-terminator after the option value
-        oackBuffer.push_back('\0');
+        params.transfersize = filesize;
     }
 
-    // Add the "tsize" option if available in options_map
-    auto tsizeIt = options_map.find("tsize");
-    if (tsizeIt != options_map.end())
+    size_t oackSize = encodeOACK(oackBuffer, CONTROL_PACKET_SIZE, options, params);
+    if (oackSize == 0)
     {
-        // Calculate the transfer size based on the file size
-        params.transfersize = filesize;
-        const char *optionName = "tsize";
-
-        // Add the option name (including null-terminator) to the vector
-        oackBuffer.insert(oackBuffer.end(), optionName, optionName + strlen(optionName) + 1);
-
-        // Add the option value (as text) to the vector
-        std::string tsizeStr = std::to_string(params.transfersize);
-        oackBuffer.insert(oackBuffer.end(), tsizeStr.begin(), tsizeStr.end());
-
-        // Add a null-terminator after the option value
-        oackBuffer.push_back('\0');
+        releasePacketBuffer(pool, oackBuffer);
+        std::cout << "Error sending OACK packet" << std::endl;
+        return false;
     }
 
-    // After creating the vector, send the OACK packet
-    ssize_t sentBytes = sendto(sockfd, oackBuffer.data(), oackBuffer.size(), 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
+    // After creating the packet, send it and return the buffer to the pool
+    ssize_t sentBytes = sendto(sockfd, oackBuffer, oackSize, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
+    releasePacketBuffer(pool, oackBuffer);
 
     // Check for errors while sending
     if (sentBytes == -1)
@@ -170,701 +121,442 @@ bool sendOACK(int sockfd, sockaddr_in &clientAddr, std::map<std::string, int> &o
     return true;
 }
 
-bool sendFileData(int sockfd, sockaddr_in &clientAddr, sockaddr_in &serverAddr, const std::string &filename, std::map<std::string, int> &options_map, TFTPOparams &params)
+bool sendAck(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum)
 {
-    // Open the file for binary reading
-    std::ifstream file;
-    file.open(filename, std::ios::binary);
-
-    if (!file)
-    {
-        // If the file cannot be opened, send an error response and return false
-        sendError(sockfd, ERROR_FILE_NOT_FOUND, "Illegal operation", clientAddr, serverAddr);
-        return false;
-    }
-
-    // Get the file size
-    file.seekg(0, std::ios::end);
-    std::streampos filesize = file.tellg();
-
-    std::cout << "Size of the file: " << filesize << " bytes" << std::endl;
-
-    // Return to the beginning of the file
-    file.seekg(0, std::ios::beg);
-
-    // If optional parameters were found, attempt to set them
-    if (blocksizeOptionUsed || timeoutOptionUsed || transfersizeOptionUsed)
-    {
-        int retries = 0;
-        const int maxRetries = 4; // According to RFC specification
-        bool ackReceived = false;
-
-        // Send an OACK packet with the set optional parameters
-        while (retries < maxRetries)
-        {
-            if (!sendOACK(sockfd, clientAddr, options_map, params, filesize))
-            {
-                continue;
-            }
-
-            // Receive ACK to confirm OACK
-            if (receiveAck(sockfd, 0, clientAddr, serverAddr, params.timeout))
-            {
-                ackReceived = true;
-                break;
-            }
-            else
-            {
-                retries++;
-            }
-        }
-
-        if (!ackReceived)
-        {
-            std::cout << "Failed to receive ACK after multiple retries" << std::endl;
-            file.close();
-            return false;
-        }
-    }
-
-    // Buffer for data
-    std::vector<char> dataBuffer(params.blksize);
-
-    // Block number counter
-    uint16_t blockNum = 1;
-
-    bool lastnullpacket = false;
-    int lastbytesread;
-
-    while (true)
-    {
-        // Read data into the buffer
-        file.read(dataBuffer.data(), params.blksize);
-
-        std::streamsize bytesRead = file.gcount();
-
-        if (bytesRead > 0)
-        {
-            lastbytesread = bytesRead;
-            int retries = 0;
-            const int maxRetries = 4;
-            bool ackReceived = false;
-
-            while (retries < maxRetries)
-            {
-                // Send data packet
-                if (!sendDataPacket(sockfd, clientAddr, blockNum, dataBuffer.data(), bytesRead, bytesRead))
-                {
-                    file.close();
-                    return false;
-                }
-
-                // Wait for ACK for the sent block
-                if (receiveAck(sockfd, blockNum, clientAddr, serverAddr, params.timeout))
-                {
-                    ackReceived = true;
-                    break;
-                }
-                else
-                {
-                    retries++;
-                }
-            }
-
-            if (!ackReceived)
-            {
-                std::cout << "Failed to receive ACK for block " << blockNum << " after multiple retries" << std::endl;
-                file.close();
-                return false;
-            }
-
-            if (bytesRead < params.blksize)
-            {
-                std::cout << "No more data to send" << std::endl;
-            }
-
-            blockNum++;
-        }
-        else
-        {
-            if (bytesRead == 0 && lastbytesread == params.blksize)
-            {
-                lastnullpacket = true; // Set to true if the last data was of size 0
-            }
-            break;
-        }
+    // Create an ACK packet
+    TFTPPacket ackPacket;
+    ackPacket.opcode = htons(ACK);
+    uint16_t blockNumNetwork = htons(blockNum);
+    memcpy(ackPacket.data, &blockNumNetwork, sizeof(uint16_t));
 
-        dataBuffer.clear();
-    }
+    // Send the ACK packet to the client
+    ssize_t sentBytes = sendto(sockfd, &ackPacket, sizeof(uint16_t) * 2, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
 
-    if (lastnullpacket)
+    if (sentBytes == -1)
     {
-        // Send the last empty DATA packet
-        if (!sendDataPacket(sockfd, clientAddr, blockNum, nullptr, 0, 0))
-        {
-            file.close();
-            return false;
-        }
-
-        // Wait for acknowledgment for the last null DATA packet
-        if (!receiveAck(sockfd, blockNum, clientAddr, serverAddr, params.timeout))
-        {
-            std::cout << "Failed to receive ACK for the last null DATA packet" << std::endl;
-            file.close();
-            return false;
-        }
+        std::cout << "Error sending ACK packet for block " << blockNum << std::endl;
+        return false;
     }
 
-    options_map.clear();
-    file.close();
     return true;
 }
 
-bool receiveAck(int sockfd, uint16_t expectedBlockNum, sockaddr_in &clientAddr, sockaddr_in &serverAddr, int timeout)
+// Milliseconds until the timer wheel has to be advanced, -1 if there is no active session
+static int nextTimeout(const TFTPTimerWheel &timers)
 {
-    TFTPPacket ackPacket;
-    memset(&ackPacket, 0, sizeof(TFTPPacket));
-
-    socklen_t clientAddrLen = sizeof(clientAddr);
-
-    // Set timeout for socket
-    struct timeval tv;
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+    std::chrono::steady_clock::time_point earliest;
+    if (!nextTimerWakeup(timers, earliest))
     {
-        std::cout << "Failed to set socket timeout" << std::endl;
-        return false;
+        return -1;
     }
 
-    while (true)
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (earliest <= now)
     {
-        ssize_t bytesReceived = recvfrom(sockfd, &ackPacket, sizeof(ackPacket), 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
-
-        if (bytesReceived < 0)
-        {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                // Handle timeout waiting for ACK packet
-                std::cout << "Timeout waiting for ACK packet" << std::endl;
-                return false;
-            }
-            // Handle error receiving ACK packet
-            std::cout << "Error receiving ACK packet" << std::endl;
-            sendError(sockfd, ERROR_UNDEFINED, "Illegal operation", clientAddr, serverAddr);
-
-            return false;
-        }
-
-        if (bytesReceived < sizeof(uint16_t) * 2)
-        {
-            // Handle invalid ACK packet
-            std::cout << "Received an invalid ACK packet" << std::endl;
-            sendError(sockfd, ERROR_UNDEFINED, "Illegal operation", clientAddr, serverAddr);
-
-            return false;
-        }
+        return 0;
+    }
 
-        uint16_t opcode = ntohs(ackPacket.opcode);
-        if (opcode == ACK)
-        {
-            uint16_t blockNum = ntohs(*(uint16_t *)ackPacket.data);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(earliest - now).count() + 1;
+}
 
-            if (blockNum == expectedBlockNum)
-            {
-                // Handle successful ACK
-                std::cerr << "ACK "
-                          << inet_ntoa(clientAddr.sin_addr) << ":"
-                          << ntohs(clientAddr.sin_port) << " "
-                          << blockNum
-                          << std::endl;
-                return true;
-            }
-            else if (blockNum < expectedBlockNum)
-            {
-                // Received a duplicate ACK (ignore)
-                continue;
-            }
-            else
-            {
-                // Received an out-of-order ACK (unexpected)
-                std::cout << "Received an unexpected ACK for block " << blockNum << std::endl;
-                sendError(sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", clientAddr, serverAddr);
-                return false;
-            }
-        }
-        else
-        {
-            // Received an unexpected packet (not an ACK)
-            std::cout << "Received an unexpected packet with opcode " << opcode << std::endl;
-            sendError(sockfd, ERROR_ILLEGAL_OPERATION, "Illegal operation", clientAddr, serverAddr);
-            return false;
-        }
-    }
+// Removes a finished session from the event loop and releases it
+static void releaseSession(int epollfd, std::map<int, TFTPSession *> &sessions, std::map<int, TFTPSession *>::iterator it)
+{
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, nullptr);
+    closeSession(it->second);
+    sessions.erase(it);
 }
 
-bool receiveDataPacket(int sockfd, sockaddr_in &clientAddr, sockaddr_in &serverAddr, uint16_t expectedBlockNum, std::ofstream &file, TFTPOparams &params)
+TFTPSession *startRequest(const TFTPServerConfig &config, int sockfd, sockaddr_in &serverAddr, const uint8_t *packet, size_t length, sockaddr_in &clientAddr)
 {
-    // Initialize a vector to store the received data packet
-    std::vector<uint8_t> dataPacket;
-    dataPacket.clear();
+    TFTPOparams params;
+    params.blksize = 512;
+    params.timeout = 5;
+    params.transfersize = 0;
+    params.windowsize = 1;
+    params.utimeout = 0;
+    params.rollover = 0; // Block numbers wrap to 0 unless negotiated otherwise
+    params.blocksizeOptionUsed = false;
+    params.timeoutOptionUsed = false;
+    params.transfersizeOptionUsed = false;
+    params.windowsizeOptionUsed = false;
+    params.utimeoutOptionUsed = false;
+    params.rolloverOptionUsed = false;
+    memset(&params.multicastGroup, 0, sizeof(params.multicastGroup));
+    params.multicastMaster = false;
+    params.multicastOptionUsed = false;
 
-    // Get the length of the client address structure
-    socklen_t clientAddrLen = sizeof(clientAddr);
+    uint16_t opcode = length >= sizeof(uint16_t) ? (packet[0] << 8) | packet[1] : 0;
 
-    // Resize the data packet vector with zeros
-    dataPacket.resize(params.blksize + 4, 0);
+    // Handle incoming packet based on its opcode
+    if (handleIncomingPacket(sockfd, clientAddr, opcode, serverAddr) == 1)
+    {
+        return nullptr;
+    }
 
-    // Set the timeout for recvfrom
-    struct timeval tv;
-    tv.tv_sec = params.timeout;
-    tv.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+    // A retransmitted request of a running session gets its first packet again instead of a second transfer
+    uint64_t requestHash = hashRequest(packet, length);
+    TFTPSession *running = findDuplicateRequest(clientAddr, requestHash);
+    if (running != nullptr)
     {
-        std::cout << "Failed to set socket timeout" << std::endl;
-        return false;
+        sessionHandleDuplicateRequest(*running);
+        return nullptr;
     }
 
-    // Receive data from the socket into the data packet vector
-    ssize_t bytesReceived = recvfrom(sockfd, dataPacket.data(), dataPacket.size(), 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
+    // Duplicates are counted only in COUNTER_DUPLICATE_REQUESTS, the request rate counts every request once
+    countMetric(opcode == RRQ ? COUNTER_RRQ : COUNTER_WRQ);
 
-    // Check for errors during data reception
-    if (bytesReceived < 0)
+    // Parse the filename, mode and options in place
+    TFTPRequest request;
+    if (!parseRequest(packet, length, request))
     {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-            std::cout << "Timeout waiting for DATA packet" << std::endl;
-            return false;
-        }
-        std::cout << "Error receiving DATA packet" << std::endl;
-        return false;
+        sendError(sockfd, ERROR_ILLEGAL_OPERATION, "Illegal operation", clientAddr, serverAddr);
+        return nullptr;
     }
 
-    // Check if the received data packet is too small to be valid
-    if (bytesReceived < sizeof(uint16_t) * 2)
+    // An option value out of its range terminates the negotiation (RFC 2347)
+    if (!applyOptions(request.options, params))
     {
-        // Invalid DATA packet
-        std::cout << "Received an invalid DATA packet" << std::endl;
-        return false;
+        sendError(sockfd, ERROR_OPTION_NEGOTIATION, "Option negotiation failed", clientAddr, serverAddr);
+        return nullptr;
     }
 
-    // Extract the opcode from the received data packet
-    uint16_t opcode = ntohs(*reinterpret_cast<uint16_t *>(dataPacket.data()));
-
-    if (opcode == DATA)
+    if (logEnabled(LOG_LEVEL_SUMMARY))
     {
-        // Extract the block number from the received data packet
-        uint16_t blockNum = ntohs(*reinterpret_cast<uint16_t *>(dataPacket.data() + sizeof(uint16_t)));
-
-        if (blockNum == expectedBlockNum)
+        std::string line = opcode == RRQ ? "RRQ " : "WRQ ";
+        line += inet_ntoa(clientAddr.sin_addr);
+        line += ":" + std::to_string(ntohs(clientAddr.sin_port)) + " \"" + request.filename + "\" " + request.mode + " ";
+        for (int option = 0; option < OPTION_COUNT; option++)
         {
-            // Calculate the size of the data portion in this packet
-            uint16_t dataSize = bytesReceived - sizeof(uint16_t) * 2;
-
-            // Write the data to the file
-            file.write(reinterpret_cast<const char *>(dataPacket.data() + sizeof(uint16_t) * 2), dataSize);
-
-            if (dataSize < params.blksize - 2)
+            if (optionRequested(request.options, static_cast<TFTPOptionId>(option)))
             {
-                lastblockfromoutside = true;
+                line += std::string(optionName(static_cast<TFTPOptionId>(option))) + "=" + std::to_string(request.options.values[option]) + " ";
             }
-
-            // Print a log message for the received DATA packet
-            std::cerr << "DATA "
-                      << inet_ntoa(clientAddr.sin_addr) << ":"
-                      << ntohs(clientAddr.sin_port) << ":"
-                      << ntohs(serverAddr.sin_port) << " "
-                      << blockNum
-                      << std::endl;
-
-            return true;
-        }
-        else if (blockNum < expectedBlockNum)
-        {
-            // Received a duplicate DATA packet (ignore)
-            std::cout << "Received a duplicate DATA packet for block " << blockNum << std::endl;
-            sendError(sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", clientAddr, serverAddr);
-            return false;
-        }
-        else
-        {
-            // Received an out-of-order DATA packet (unexpected)
-            std::cout << "Received an unexpected DATA packet for block " << blockNum << std::endl;
-            sendError(sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", clientAddr, serverAddr);
-            return false;
         }
+        logLine(LOG_LEVEL_SUMMARY, line);
     }
-    else
+
+    // The transfer continues on its own socket, the listening socket stays free for other clients
+    TFTPSession *session = createSession(clientAddr, request, params, config);
+    if (session == nullptr)
     {
-        // Received an unexpected packet (not a DATA packet)
-        std::cout << "Received an unexpected packet with opcode " << opcode << std::endl;
-        sendError(sockfd, ERROR_ILLEGAL_OPERATION, "Illegal operation", clientAddr, serverAddr);
-        return false;
+        sendError(sockfd, ERROR_UNDEFINED, "Cannot create transfer", clientAddr, serverAddr);
+        return nullptr;
     }
-}
-
-bool sendAck(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum)
-{
-    // Create an ACK packet
-    TFTPPacket ackPacket;
-    ackPacket.opcode = htons(ACK);
-    uint16_t blockNumNetwork = htons(blockNum);
-    memcpy(ackPacket.data, &blockNumNetwork, sizeof(uint16_t));
-
-    // Send the ACK packet to the client
-    ssize_t sentBytes = sendto(sockfd, &ackPacket, sizeof(uint16_t) * 2, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
 
-    if (sentBytes == -1)
+    if (!startSession(*session))
     {
-        std::cout << "Error sending ACK packet for block " << blockNum << std::endl;
-        return false;
+        closeSession(session);
+        return nullptr;
     }
 
-    return true;
+    registerRequest(*session, requestHash);
+    return session;
 }
 
-bool hasOptions(TFTPPacket &requestPacket, std::string &filename, std::string &mode, std::map<std::string, int> &options_map, TFTPOparams &params)
+// Receives one request from the listening socket and starts its session, returns false when the socket is drained
+static bool acceptRequest(const TFTPServerConfig &config, int sockfd, int epollfd, sockaddr_in &serverAddr, std::map<int, TFTPSession *> &sessions)
 {
-    int optionValue;
-    std::string optionName;
-
-    // Extract the filename
-    char *packetData = requestPacket.data;
-
-    // Find the null terminator after the filename
-    size_t filenameLength = strlen(packetData);
+    uint8_t requestPacket[CONTROL_PACKET_SIZE];
 
-    // Check if the null terminator is found and the filename is not empty
-    if (filenameLength == 0 || filenameLength >= MAX_DATA_SIZE)
-    {
-        std::cout << "Invalid filename in the request packet." << std::endl;
-        return false;
-    }
-
-    filename = packetData;
-    packetData += filenameLength + 1; // Move to the next byte after the filename
-
-    // Extract the mode
-    size_t modeLength = strlen(packetData);
-
-    // Check if the mode is "octet" or "netascii"
-    if (modeLength == 0 || modeLength >= MAX_DATA_SIZE)
-    {
-        std::cout << "Unsupported transfer mode in the request packet." << std::endl;
-        return false;
-    }
-
-    mode = packetData;
+    sockaddr_in clientAddr;
+    socklen_t clientAddrLen = sizeof(clientAddr);
 
-    // Move to the next byte after the mode
-    packetData += modeLength + 1;
+    // Receive a TFTP request packet
+    ssize_t bytesReceived = recvfrom(sockfd, requestPacket, sizeof(requestPacket), 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
 
-    // Check if there are options present
-    while (packetData < requestPacket.data + sizeof(requestPacket.data))
+    if (bytesReceived < 0)
     {
-        // Extract the option name
-        size_t optionNameLength = strnlen(packetData, MAX_DATA_SIZE);
-
-        if (optionNameLength == 0)
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
         {
-            break; // No more options
-        }
-
-        std::string optionName = packetData;
-        packetData += optionNameLength + 1;
-
-        // Extract the option value
-        size_t optionValueLength = strnlen(packetData, MAX_DATA_SIZE);
-
-        if (optionValueLength == 0)
-        {
-            std::cout << "Malformed option in the request packet." << std::endl;
-            return false;
-        }
-
-        std::string optionValueStr = packetData;
-        packetData += optionValueLength + 1;
-
-        try
-        {
-            int optionValue = std::stoi(optionValueStr);
-            options_map[optionName] = optionValue;
-        }
-        catch (const std::exception &e)
-        {
-            std::cout << "Invalid option value: " << optionValueStr << std::endl;
-            return false;
+            std::cout << "Error receiving packet" << std::endl;
         }
+        return false;
     }
 
-    auto blksizeIt = options_map.find("blksize");
-    auto timeoutIt = options_map.find("timeout");
-    auto tsizeIt = options_map.find("tsize");
-
-    // If "blksize" option is found in the map, use the specified block size
-    if (blksizeIt != options_map.end())
-    {
-        params.blksize = blksizeIt->second; // Read the value from the map
-        blocksizeOptionUsed = true;
-    }
-
-    // If "timeout" option is found in the map, use the specified timeout
-    if (timeoutIt != options_map.end())
+    TFTPSession *session = startRequest(config, sockfd, serverAddr, requestPacket, bytesReceived, clientAddr);
+    if (session == nullptr)
     {
-        params.timeout = timeoutIt->second; // Read the value from the map
-        timeoutOptionUsed = true;
+        return true;
     }
 
-    // If "tsize" option is found in the map, use the specified timeout
-    if (tsizeIt != options_map.end())
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = session->sockfd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, session->sockfd, &event) < 0)
     {
-        params.transfersize = tsizeIt->second; // Read the value from the map
-        transfersizeOptionUsed = true;
+        std::cout << "Error registering transfer socket" << std::endl;
+        closeSession(session);
+        return true;
     }
 
-    // Options processed successfully
+    sessions[session->sockfd] = session;
     return true;
 }
 
-void runTFTPServer(int port, const std::string &root_dirpath)
+void runTFTPWorker(const TFTPServerConfig &config, int workerId)
 {
+    // Pin the worker to its own CPU if requested
+    if (config.pinWorkers)
+    {
+        // hardware_concurrency() may report 0 when the number of CPUs is not known
+        unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(workerId % cpus, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        {
+            std::cout << "Worker " << workerId << ": Failed to set CPU affinity" << std::endl;
+        }
+    }
+
     // Create a UDP socket
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0)
     {
-        std::cout << "Error creating socket" << std::endl;
+        std::cout << "Worker " << workerId << ": Error creating socket" << std::endl;
         return;
     }
 
-    // Change to the specified root directory
-    if (chdir(root_dirpath.c_str()) != 0)
+    // Workers bind the same port, the kernel spreads requests among them by client address
+    if (config.workers > 1)
     {
-        std::cout << "Error: Failed to change to root directory: " << root_dirpath << std::endl;
-        return;
+        int reuse = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+        {
+            std::cout << "Worker " << workerId << ": Failed to set SO_REUSEPORT" << std::endl;
+            close(sockfd);
+            return;
+        }
     }
 
-    // Initialize server and client socket addresses
-    struct sockaddr_in serverAddr, clientAddr;
+    // Initialize server socket address
+    struct sockaddr_in serverAddr;
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(port);
+    serverAddr.sin_port = htons(config.port);
 
     // Bind the socket to the server address
     if (bind(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
     {
-        std::cout << "Error binding socket" << std::endl;
+        std::cout << "Worker " << workerId << ": Error binding socket" << std::endl;
         close(sockfd);
         return;
     }
 
-    // Get the current socket timeout settings for restoration
-    struct timeval original_tv;
-    socklen_t len = sizeof(original_tv);
-    getsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &original_tv, &len);
-
-    while (true)
-    {
-        TFTPPacket requestPacket;
-        TFTPOparams params;
-        params.blksize = 512;
-        params.timeout = 5;
-        blocksizeOptionUsed = false;
-        timeoutOptionUsed = false;
-        transfersizeOptionUsed = false;
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
 
-        // Restore the original socket timeout settings
-        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &original_tv, sizeof(original_tv));
+    std::map<int, TFTPSession *> sessions;
 
-        memset(&requestPacket, 0, sizeof(requestPacket));
-
-        socklen_t clientAddrLen = sizeof(clientAddr);
-
-        std::map<std::string, int> options_map;
-
-        // Receive a TFTP request packet
-        ssize_t bytesReceived = recvfrom(sockfd, &requestPacket, sizeof(requestPacket), 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
-
-        if (bytesReceived < 0)
+    // The io_uring engine serves the worker unless the kernel does not support it or keeps rejecting its receives
+    if (config.engine == ENGINE_URING)
+    {
+        if (runUringWorker(config, workerId, sockfd, serverAddr, sessions))
         {
-            std::cout << "Error receiving packet" << std::endl;
-            continue;
+            close(sockfd);
+            return;
         }
+        std::cout << "Worker " << workerId << ": io_uring is not available, falling back to epoll" << std::endl;
+    }
 
-        uint16_t opcode = ntohs(requestPacket.opcode);
-        std::string filename;
-        std::string mode;
-
-        // Parse options and extract filename, mode, and optional parameters
-        hasOptions(requestPacket, filename, mode, options_map, params);
-
-        std::string optionsString = "";
-        for (const auto &pair : options_map)
+    // One epoll instance multiplexes the listening socket and all transfer sockets
+    int epollfd = epoll_create1(0);
+    if (epollfd < 0)
+    {
+        std::cout << "Error creating epoll instance" << std::endl;
+        for (auto &pair : sessions)
         {
-            optionsString += pair.first + "=" + std::to_string(pair.second) + " ";
+            closeSession(pair.second);
         }
+        close(sockfd);
+        return;
+    }
+
+    epoll_event listenEvent;
+    memset(&listenEvent, 0, sizeof(listenEvent));
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = sockfd;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &listenEvent);
 
-        // Handle incoming packet based on its opcode
-        if (handleIncomingPacket(sockfd, clientAddr, opcode, serverAddr) == 1)
+    // Transfers started by the io_uring engine continue on epoll
+    for (auto it = sessions.begin(); it != sessions.end();)
+    {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = it->first;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, it->first, &event) < 0)
         {
+            std::cout << "Error registering transfer socket" << std::endl;
+            closeSession(it->second);
+            it = sessions.erase(it);
             continue;
         }
+        ++it;
+    }
 
-        if (opcode == RRQ)
+    TFTPTimerWheel &timers = workerTimers();
+    TFTPRecvBatch recvBatch;
+    if (!initRecvBatch(recvBatch, config.batchSize, MAX_PACKET_SIZE))
+    {
+        std::cout << "Worker " << workerId << ": Error allocating receive buffers" << std::endl;
+        for (auto &pair : sessions)
         {
-            // Handle Read Request (RRQ) packet
+            closeSession(pair.second);
+        }
+        close(epollfd);
+        close(sockfd);
+        return;
+    }
+    const int maxEvents = 64;
+    epoll_event events[maxEvents];
+
+    while (true)
+    {
+        int readyCount = epoll_wait(epollfd, events, maxEvents, nextTimeout(timers));
 
-            std::cerr << "RRQ "
-                      << inet_ntoa(clientAddr.sin_addr) << ":"
-                      << ntohs(clientAddr.sin_port) << " \""
-                      << filename << "\" "
-                      << mode << " "
-                      << optionsString
-                      << std::endl;
+        handleStatsRequest();
 
-            // Send file data in response to RRQ
-            if (!sendFileData(sockfd, clientAddr, serverAddr, filename, options_map, params))
+        if (readyCount < 0)
+        {
+            if (errno == EINTR)
             {
-                std::cout << "Error sending file data" << std::endl;
+                continue;
             }
+            std::cout << "Worker " << workerId << ": Error waiting for events" << std::endl;
+            break;
         }
-        else if (opcode == WRQ)
-        {
-            // Handle Write Request (WRQ) packet
-
-            std::cerr << "WRQ "
-                      << inet_ntoa(clientAddr.sin_addr) << ":"
-                      << ntohs(clientAddr.sin_port) << " \""
-                      << filename << "\" "
-                      << mode << " "
-                      << optionsString
-                      << std::endl;
 
-            // Check if the file already exists
-            // if (fileExists(filename))
-            // {
-            //     std::cout << "The file " << filename << " exists." << std::endl;
-            //     sendError(sockfd, ERROR_FILE_ALREADY_EXISTS, "File exists", clientAddr, serverAddr);
-            // }
+        for (int i = 0; i < readyCount; i++)
+        {
+            int fd = events[i].data.fd;
 
-            // Check available disk space if transfersize option is used
-            if (transfersizeOptionUsed)
+            if (fd == sockfd)
             {
-                uint16_t diskspace = checkDiskSpace(params.transfersize, filename);
-
-                if (diskspace == ERROR_DISK_FULL)
+                while (acceptRequest(config, sockfd, epollfd, serverAddr, sessions))
                 {
-                    std::cout << "ERROR_DISK_FULL!" << std::endl;
-                    sendError(sockfd, ERROR_DISK_FULL, "Illegal operation", clientAddr, serverAddr);
-                    continue;
                 }
+                continue;
             }
 
-            // Open the file for writing
-            std::ofstream file(filename, std::ios::binary);
-
-            if (!file)
+            auto it = sessions.find(fd);
+            if (it == sessions.end())
             {
-                sendError(sockfd, ERROR_ACCESS_VIOLATION, "Illegal operation", clientAddr, serverAddr);
                 continue;
             }
-            else
+
+            // Drain every datagram queued on the transfer socket, a batch at a time
+            TFTPSession *session = it->second;
+            while (session->state != SESSION_DONE)
             {
-                // Send optional acknowledgement (OACK) if options are present
-                if (!options_map.empty())
-                {
-                    if (!sendOACK(sockfd, clientAddr, options_map, params, params.transfersize))
-                    {
-                        std::cout << "Error sending OACK" << std::endl;
-                        continue;
-                    }
-                }
-                else
+                int receivedCount = receiveBatch(fd, recvBatch);
+
+                for (int j = 0; j < receivedCount && session->state != SESSION_DONE; j++)
                 {
-                    if (!sendAck(sockfd, clientAddr, 0))
-                    {
-                        std::cout << "Error sending initial ACK" << std::endl;
-                        file.close();
-                        continue;
-                    }
+                    sessionHandlePacket(*session, batchPacket(recvBatch, j), recvBatch.messages[j].msg_len, recvBatch.addresses[j]);
                 }
 
-                // Start receiving file data in DATA packets
-                uint16_t blockNum = 1; // Initialize block number to 1
-                bool lastBlockReceived = false;
-                lastblockfromoutside = false;
-
-                while (!lastBlockReceived)
+                // A batch that was not filled up emptied the socket
+                if (receivedCount < static_cast<int>(config.batchSize))
                 {
-                    int retries = 0;
-                    const int maxRetries = 4; // As per RFC specification
-                    bool dataPacketReceived = false;
-
-                    while (retries < maxRetries)
-                    {
-                        if (receiveDataPacket(sockfd, clientAddr, serverAddr, blockNum, file, params))
-                        {
-                            dataPacketReceived = true;
-                            break;
-                        }
-                        else
-                        {
-                            retries++;
-                            if (!options_map.empty() && blockNum == 1)
-                            {
-                                if (!sendOACK(sockfd, clientAddr, options_map, params, params.transfersize))
-                                {
-                                    continue;
-                                }
-                            }
-                            else
-                            {
-                                if (!sendAck(sockfd, clientAddr, blockNum - 1))
-                                {
-                                    std::cout << "Error sending initial ACK" << std::endl;
-                                    file.close();
-                                    continue;
-                                }
-                            }
-                        }
-                    }
-
-                    if (!dataPacketReceived)
-                    {
-                        std::cout << "Failed to receive DATA packet for block " << blockNum << " after multiple retries" << std::endl;
-                        break;
-                    }
-
-                    // Send ACK for the received block
-                    if (!sendAck(sockfd, clientAddr, blockNum))
-                    {
-                        std::cout << "Error sending ACK for block " << blockNum << std::endl;
-                        break;
-                    }
-
-                    // Check if the received block was the last block
-                    if (lastblockfromoutside == true)
-                    {
-                        lastBlockReceived = true;
-                    }
-                    blockNum++;
+                    break;
                 }
+            }
 
-                file.close(); // Close the file when the transfer is complete or encounters an error
+            // Zero-copy completions are signalled as an error condition of the socket
+            if ((events[i].events & EPOLLERR) && session->state != SESSION_DONE)
+            {
+                reapZerocopy(session->batch);
+            }
+
+            if (session->state == SESSION_DONE)
+            {
+                releaseSession(epollfd, sessions, it);
             }
         }
-        else
+
+        // Retransmit, abandon or reap the sessions whose deadline expired
+        advanceTimers(timers, std::chrono::steady_clock::now());
+        while (TFTPTimer *timer = popExpiredTimer(timers))
         {
-            // Handle undefined opcode (unknown operation)
-            sendError(sockfd, ERROR_UNDEFINED, "Illegal operation", clientAddr, serverAddr);
+            TFTPSession *session = timer->session;
+            sessionHandleTimer(*timer);
+            if (session != nullptr && session->state == SESSION_DONE)
+            {
+                auto it = sessions.find(session->sockfd);
+                if (it != sessions.end())
+                {
+                    releaseSession(epollfd, sessions, it);
+                }
+            }
         }
-        memset(&requestPacket, 0, sizeof(requestPacket));
     }
 
-    // Close the socket when the server loop ends
+    // Release all sessions and close the sockets when the server loop ends
+    for (auto &pair : sessions)
+    {
+        closeSession(pair.second);
+    }
+    freeRecvBatch(recvBatch);
+    close(epollfd);
     close(sockfd);
 }
 
+void runTFTPServer(const TFTPServerConfig &config)
+{
+    // The buckets exist before the metrics endpoint reads their counters
+    initShaper(config.globalRate, config.rateClasses);
+
+    // A relative socket path is resolved against the directory the server was started in
+    if (!config.metricsEndpoint.empty() && !startMetricsServer(config.metricsEndpoint))
+    {
+        return;
+    }
+
+    // Change to the specified root directory (shared by all workers)
+    if (chdir(config.root_dirpath.c_str()) != 0)
+    {
+        std::cout << "Error: Failed to change to root directory: " << config.root_dirpath << std::endl;
+        return;
+    }
+
+    setLogLevel(config.logLevel);
+    setLogSampling(LOG_EVENT_ACK, config.logSampling);
+    setLogSampling(LOG_EVENT_DATA, config.logSampling);
+    setLogSampling(LOG_EVENT_UNEXPECTED_ACK, config.logSampling);
+    setLogSampling(LOG_EVENT_OUT_OF_ORDER, config.logSampling);
+    setLogSampling(LOG_EVENT_ACK_TIMEOUT, config.logSampling);
+    setLogSampling(LOG_EVENT_DATA_TIMEOUT, config.logSampling);
+    setCacheBudget(config.cacheBudget);
+    setSegmentationMode(config.segmentationOffload ? SEGMENTATION_GSO : SEGMENTATION_OFF);
+
+    if (config.workers <= 1)
+    {
+        runTFTPWorker(config, 0);
+        return;
+    }
+
+    // Every worker owns its listening socket, epoll instance and a disjoint set of sessions
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.workers; i++)
+    {
+        workers.push_back(std::thread(runTFTPWorker, std::cref(config), i));
+    }
+
+    // SIGUSR1 has to interrupt a worker waiting for events, not the joining thread
+    sigset_t statsSignal;
+    sigemptyset(&statsSignal);
+    sigaddset(&statsSignal, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &statsSignal, nullptr);
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
 void sigintHandler(int signal)
 {
     std::cout << "Received SIGINT (Ctrl+C). Terminating gracefully..." << std::endl;
@@ -872,13 +564,106 @@ void sigintHandler(int signal)
     std::exit(0); // Terminate the program
 }
 
+void sigusr1Handler(int signal)
+{
+    (void)signal;
+    statsRequested = true;
+}
+
+void handleStatsRequest()
+{
+    // SIGUSR1 interrupts the wait of the worker that should print the statistics
+    if (statsRequested.exchange(false))
+    {
+        printServerStats();
+    }
+}
+
+void printServerStats()
+{
+    TFTPCacheStats cache = cacheStats();
+    std::cout << "Cache: hits=" << cache.hits << " misses=" << cache.misses << " evictions=" << cache.evictions
+              << " entries=" << cache.entries << " bytes=" << cache.bytes << "/" << cache.budget << std::endl;
+
+    // Average number of datagrams per sendmmsg/recvmmsg call
+    TFTPBatchStats batch = batchStats();
+    double sendFill = batch.sendBatches > 0 ? static_cast<double>(batch.sendPackets) / batch.sendBatches : 0;
+    double recvFill = batch.recvBatches > 0 ? static_cast<double>(batch.recvPackets) / batch.recvBatches : 0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Send batches: " << batch.sendBatches << " packets=" << batch.sendPackets << " fill=" << sendFill
+              << " full=" << batch.sendFull << " dropped=" << batch.sendDropped << std::endl
+              << "Receive batches: " << batch.recvBatches << " packets=" << batch.recvPackets << " fill=" << recvFill
+              << " full=" << batch.recvFull << std::endl;
+
+    const char *segmentation = batch.segmentation == SEGMENTATION_GSO ? "gso" : batch.segmentation == SEGMENTATION_FALLBACK ? "fallback" : "off";
+    std::cout << "Segmentation offload: " << segmentation << " sends=" << batch.gsoSends << " segments=" << batch.gsoSegments << std::endl
+              << "Zero-copy: sends=" << batch.zerocopySends << " zerocopy_bytes=" << batch.zerocopyBytes
+              << " copied_bytes=" << batch.copiedBytes << std::endl;
+
+    TFTPWriterStats writer = writerStats();
+    uint64_t averageWrite = writer.writes > 0 ? writer.bytes / writer.writes : 0;
+    std::cout << "Writer: writes=" << writer.writes << " bytes=" << writer.bytes << " avg_write=" << averageWrite
+              << " extra_chunks=" << writer.extraChunks << " commits=" << writer.commits << " aborts=" << writer.aborts
+              << " failures=" << writer.failures << std::endl;
+
+    // Bytes read for N concurrent downloads of one file stay close to the size of the file
+    TFTPStreamStats stream = streamStats();
+    std::cout << "Read streams: streams=" << stream.streams << " sessions=" << stream.sessions << " reads=" << stream.reads
+              << " read_bytes=" << stream.bytes << " shared=" << stream.hits << " fallbacks=" << stream.fallbacks << std::endl;
+
+    // Every DATA packet sent to a group reaches all of its members
+    TFTPMulticastStats multicast = multicastStats();
+    std::cout << "Multicast: groups=" << multicast.groups << " members=" << multicast.members
+              << " masters=" << multicast.promotions << " group_packets=" << multicast.blocks << std::endl;
+
+    // Copies of requests whose session was already running
+    std::cout << "Duplicate requests: suppressed=" << metricTotal(COUNTER_DUPLICATE_REQUESTS)
+              << " resent=" << metricTotal(COUNTER_DUPLICATE_RESENDS) << std::endl;
+
+    // Throughput of every class since the previous statistics (or the start of the server)
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - statsPrintedAt).count();
+    std::vector<TFTPShaperClassStats> shaper = shaperStats();
+    statsShapedBytes.resize(shaper.size(), 0);
+    if (shapingEnabled())
+    {
+        std::cout << "Shaper: global_limit=" << globalRateLimit() << " B/s" << std::endl;
+        for (size_t i = 0; i < shaper.size(); i++)
+        {
+            double throughput = elapsed > 0 ? (shaper[i].bytes - statsShapedBytes[i]) / elapsed : 0;
+            std::cout << "Shaper class " << shaper[i].name << ": limit=" << shaper[i].rate << " B/s bytes=" << shaper[i].bytes
+                      << " waits=" << shaper[i].waits << " throughput=" << throughput << " B/s" << std::endl;
+            statsShapedBytes[i] = shaper[i].bytes;
+        }
+    }
+    statsPrintedAt = now;
+#ifdef TFTP_ALLOC_STATS
+    std::cout << "Heap allocations: " << allocationCount() << std::endl;
+#endif
+}
+
 int main(int argc, char *argv[])
 {
     // Register a signal handler for SIGINT (Ctrl+C)
     std::signal(SIGINT, sigintHandler);
-
-    int port = 69;            // Default TFTP port
-    std::string root_dirpath; // Directory path
+    // Register a signal handler for SIGUSR1 (print statistics)
+    std::signal(SIGUSR1, sigusr1Handler);
+
+    TFTPServerConfig config;
+    config.port = 69;          // Default TFTP port
+    config.workers = 1;        // Single event loop by default
+    config.pinWorkers = false; // Workers are not pinned by default
+    config.blockSource = BLOCK_SOURCE_MMAP;
+    config.cacheBudget = 0; // Content cache is disabled by default
+    config.batchSize = DEFAULT_BATCH_SIZE;
+    config.segmentationOffload = false;
+    config.engine = ENGINE_EPOLL;
+    config.zeroCopy = false;
+    config.multicast = false; // Multicast option is ignored unless a group address is given
+    config.metricsEndpoint = ""; // Metrics are not exposed by default
+    config.logLevel = LOG_LEVEL_PACKET; // Every packet is logged by default
+    config.logSampling = 1;
+    config.globalRate = 0; // DATA is not rate limited by default
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++)
@@ -888,7 +673,7 @@ int main(int argc, char *argv[])
             // Check if a custom port is specified
             if (i + 1 < argc)
             {
-                port = std::atoi(argv[i + 1]);
+                config.port = std::atoi(argv[i + 1]);
                 i++; // Skip the next argument
             }
             else
@@ -897,22 +682,187 @@ int main(int argc, char *argv[])
                 return 1;
             }
         }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            // Check if a number of workers is specified
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+            {
+                config.workers = std::atoi(argv[i + 1]);
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-w' option" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            // Check if a block source backend is specified
+            if (i + 1 < argc && (strcmp(argv[i + 1], "mmap") == 0 || strcmp(argv[i + 1], "pread") == 0))
+            {
+                config.blockSource = strcmp(argv[i + 1], "mmap") == 0 ? BLOCK_SOURCE_MMAP : BLOCK_SOURCE_PREAD;
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-b' option (mmap or pread)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-m") == 0)
+        {
+            // Check if a content cache size in megabytes is specified
+            if (i + 1 < argc && std::atoll(argv[i + 1]) >= 0)
+            {
+                config.cacheBudget = static_cast<uint64_t>(std::atoll(argv[i + 1])) * 1024 * 1024;
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-m' option" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            // Check if an event engine is specified
+            if (i + 1 < argc && (strcmp(argv[i + 1], "epoll") == 0 || strcmp(argv[i + 1], "uring") == 0))
+            {
+                config.engine = strcmp(argv[i + 1], "epoll") == 0 ? ENGINE_EPOLL : ENGINE_URING;
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-e' option (epoll or uring)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-B") == 0)
+        {
+            // Check if a batch size is specified
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0 && static_cast<size_t>(std::atoi(argv[i + 1])) <= MAX_BATCH_SIZE)
+            {
+                config.batchSize = std::atoi(argv[i + 1]);
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-B' option (1 - " << MAX_BATCH_SIZE << ")" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-M") == 0)
+        {
+            // Check if a multicast address for the groups is specified
+            if (i + 1 < argc && inet_pton(AF_INET, argv[i + 1], &config.multicastAddr) == 1 && IN_MULTICAST(ntohl(config.multicastAddr.s_addr)))
+            {
+                config.multicast = true;
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-M' option (multicast address)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-x") == 0)
+        {
+            // Check if a metrics endpoint (loopback TCP port or Unix socket path) is specified
+            if (i + 1 < argc && argv[i + 1][0] != '\0')
+            {
+                config.metricsEndpoint = argv[i + 1];
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing value for '-x' option (port or socket path)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            // Check if a log level is specified
+            if (i + 1 < argc && parseLogLevel(argv[i + 1], config.logLevel))
+            {
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-l' option (error, summary or packet)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            // Check if a sampling interval of the packet log is specified
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+            {
+                config.logSampling = std::atoi(argv[i + 1]);
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-s' option" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            // Check if a global byte rate limit is specified
+            if (i + 1 < argc && parseRate(argv[i + 1], config.globalRate))
+            {
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-r' option (bytes per second, e.g. 100M)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-R") == 0)
+        {
+            // Check if a byte rate limit of a client subnet is specified (the option can be repeated)
+            TFTPRateClass rateClass;
+            if (i + 1 < argc && parseRateClass(argv[i + 1], rateClass))
+            {
+                config.rateClasses.push_back(rateClass);
+                i++; // Skip the next argument
+            }
+            else
+            {
+                std::cout << "Error: Missing or invalid value for '-R' option (network/prefix=rate, e.g. 10.0.0.0/8=50M)" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            config.pinWorkers = true;
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+        {
+            config.segmentationOffload = true;
+        }
+        else if (strcmp(argv[i], "-z") == 0)
+        {
+            config.zeroCopy = true;
+        }
         else
         {
             // Assume the argument is the root directory path
-            root_dirpath = argv[i];
+            config.root_dirpath = argv[i];
         }
     }
 
     // Check if the root directory path is provided
-    if (root_dirpath.empty())
+    if (config.root_dirpath.empty())
     {
         std::cout << "Error: root_dirpath must be specified" << std::endl;
         return 1;
     }
 
     // Start the TFTP server with the specified port and root directory
-    runTFTPServer(port, root_dirpath);
+    runTFTPServer(config);
 
     return 0;
 }
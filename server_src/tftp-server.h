@@ -13,17 +13,25 @@
 #include <cstring>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <unistd.h>
 #include <map>
+#include <algorithm>
 #include <iomanip>
 #include <csignal>
 #include <sys/statvfs.h>
 #include <filesystem>
 #include <chrono>
 #include <thread>
-
-// Function for receiving acknowledgment ACK packet
-bool receiveAck(int sockfd, uint16_t expectedBlockNum, sockaddr_in &clientAddr, sockaddr_in &serverAddr, int timeout);
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include "tftp-log.h"
+#include "tftp-request.h"
+#include "tftp-shaper.h"
 
 // TFTP operations
 const uint16_t RRQ = 1;
@@ -48,6 +56,7 @@ const uint16_t ERROR_DISK_FULL = 3;
 const uint16_t ERROR_ILLEGAL_OPERATION = 4;
 const uint16_t ERROR_UNKNOWN_TRANSFER_ID = 5;
 const uint16_t ERROR_FILE_ALREADY_EXISTS = 6;
+const uint16_t ERROR_OPTION_NEGOTIATION = 8; // RFC 2347
 
 // Structure representing a TFTP packet
 struct TFTPPacket
@@ -56,19 +65,71 @@ struct TFTPPacket
     char data[MAX_DATA_SIZE];
 };
 
-bool lastblockfromoutside = false;
-bool blocksizeOptionUsed = false;
-bool timeoutOptionUsed = false;
-bool transfersizeOptionUsed = false;
+// Backends for reading RRQ data blocks
+enum TFTPBlockSourceType
+{
+    BLOCK_SOURCE_MMAP,  // Blocks are sent straight from a read-only mapping of the file
+    BLOCK_SOURCE_PREAD, // Blocks are read by offset into a per-session buffer
+    BLOCK_SOURCE_CACHE  // Blocks are sent from the content cache shared by all sessions
+};
+
+// Event engines driving the workers
+enum TFTPEngineType
+{
+    ENGINE_EPOLL, // Readiness of the sockets is waited for with epoll
+    ENGINE_URING  // Datagrams are received by multishot io_uring receives into provided buffers
+};
+
+// Structure holding the server configuration given on the command line
+struct TFTPServerConfig
+{
+    int port;
+    std::string root_dirpath;
+    int workers;                     // Number of worker threads sharing the port with SO_REUSEPORT
+    bool pinWorkers;                 // Pin worker N to CPU N modulo the number of CPUs
+    TFTPBlockSourceType blockSource; // Backend serving RRQ data
+    uint64_t cacheBudget;            // Byte budget of the shared content cache (0 disables it)
+    size_t batchSize;                // Maximum number of datagrams per sendmmsg/recvmmsg call
+    bool segmentationOffload;        // Send windows with UDP segmentation offload (UDP_SEGMENT)
+    TFTPEngineType engine;           // Event engine of the workers
+    bool zeroCopy;                   // Send large blocks of mapped or cached files with MSG_ZEROCOPY
+    bool multicast;                  // Serve the multicast option (RFC 2090)
+    in_addr multicastAddr;           // Multicast address of the groups
+    std::string metricsEndpoint;     // Loopback TCP port or Unix socket path of the metrics endpoint (empty disables it)
+    TFTPLogLevel logLevel;           // Lines written to the log
+    uint32_t logSampling;            // Every Nth DATA and ACK of a worker is logged
+    uint64_t globalRate;             // Byte rate limit of all DATA sent by the server (0 disables it)
+    std::vector<TFTPRateClass> rateClasses; // Byte rate limits of client subnets
+};
+
+// Transfer session served by a worker (tftp-session.h)
+struct TFTPSession;
 
 // Structure for holding options
 struct TFTPOparams
 {
     uint16_t blksize;
     uint16_t timeout;
-    int transfersize;
+    long long transfersize;
+    uint16_t windowsize;
+    int utimeout;      // Timeout in microseconds (utimeout extension)
+    uint16_t rollover; // Block number following 65535 (rollover extension, 0 or 1)
+    sockaddr_in multicastGroup; // Group address and port announced in the multicast option
+    bool multicastMaster;       // The client is announced as the master client
+
+    // Flags to identify which options the client requested
+    bool blocksizeOptionUsed;
+    bool timeoutOptionUsed;
+    bool transfersizeOptionUsed;
+    bool windowsizeOptionUsed;
+    bool utimeoutOptionUsed;
+    bool rolloverOptionUsed;
+    bool multicastOptionUsed;
 };
 
+// Upper bound of the data a session sends in one window (RFC 7440)
+const size_t MAX_WINDOW_BYTES = 16 * 1024 * 1024;
+
 /**
  * @brief Sends an error packet to the client.
  *
@@ -106,106 +167,80 @@ int handleIncomingPacket(int sockfd, sockaddr_in &clientAddr, int opcode, sockad
  * @param path Path to the file location on disk.
  * @return 0 if there is enough space, otherwise an error code.
  */
-uint16_t checkDiskSpace(int size_of_file, const std::string &path);
-
-/**
- * @brief Sends a data packet to the client.
- *
- * @param sockfd TFTP transmission socket.
- * @param clientAddr sockaddr_in structure representing the client.
- * @param blockNum Block number.
- * @param data Data to be sent.
- * @param dataSize Size of the data.
- * @param blockSize Block size.
- * @return True if the packet was successfully sent, otherwise False.
- */
-bool sendDataPacket(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum, const char *data, size_t dataSize, uint16_t blockSize);
+uint16_t checkDiskSpace(long long size_of_file, const std::string &path);
 
 /**
  * @brief Sends an OACK (Option Acknowledgment) packet to the client with optional parameters.
  *
  * @param sockfd TFTP transmission socket.
  * @param clientAddr sockaddr_in structure representing the client.
- * @param options_map Map of optional parameters.
+ * @param options Options requested by the client.
  * @param params TFTP communication parameters, including block size and timeout.
  * @param filesize File size for transmission.
  * @return True if the OACK packet was successfully sent, otherwise False.
  */
-bool sendOACK(int sockfd, sockaddr_in &clientAddr, std::map<std::string, int> &options_map, TFTPOparams &params, std::streampos filesize);
+bool sendOACK(int sockfd, sockaddr_in &clientAddr, const TFTPOptionSet &options, TFTPOparams &params, std::streampos filesize);
 
 /**
- * @brief Sends file data to the client in DATA packets.
+ * @brief Sends an acknowledgment ACK packet to the client.
  *
  * @param sockfd TFTP transmission socket.
  * @param clientAddr sockaddr_in structure representing the client.
- * @param serverAddr sockaddr_in structure representing the server.
- * @param filename Name of the file to be sent.
- * @param options_map Map of optional parameters.
- * @param params TFTP communication parameters, including block size and timeout.
- * @return True if the data was successfully sent, otherwise False.
+ * @param blockNum Block number to acknowledge.
+ * @return True if the ACK packet was successfully sent, otherwise False.
  */
-bool sendFileData(int sockfd, sockaddr_in &clientAddr, sockaddr_in &serverAddr, const std::string &filename, std::map<std::string, int> &options_map, TFTPOparams &params);
+bool sendAck(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum);
 
 /**
- * @brief Receives an acknowledgment ACK packet from the client.
+ * @brief Parses a request received on the listening socket and starts its session.
  *
- * @param sockfd TFTP transmission socket.
- * @param expectedBlockNum Expected block number.
- * @param clientAddr sockaddr_in structure representing the client.
+ * @param config Server configuration.
+ * @param sockfd Listening socket.
  * @param serverAddr sockaddr_in structure representing the server.
- * @param timeout Timeout for packet reception.
- * @return True if the acknowledgment ACK packet was received, otherwise False.
+ * @param packet Received request datagram, parsed in place.
+ * @param length Length of the datagram.
+ * @param clientAddr sockaddr_in structure representing the client.
+ * @return Started session, or nullptr if the request was rejected or the transfer could not be started.
  */
-bool receiveAck(int sockfd, uint16_t expectedBlockNum, sockaddr_in &clientAddr, sockaddr_in &serverAddr, int timeout);
+TFTPSession *startRequest(const TFTPServerConfig &config, int sockfd, sockaddr_in &serverAddr, const uint8_t *packet, size_t length, sockaddr_in &clientAddr);
 
 /**
- * @brief Receives a DATA packet from the client.
+ * @brief Event loop of one server worker, owning its listening socket and its sessions.
  *
- * @param sockfd TFTP transmission socket.
- * @param clientAddr sockaddr_in structure representing the client.
- * @param serverAddr sockaddr_in structure representing the server.
- * @param expectedBlockNum Expected block number.
- * @param file Open file for writing data.
- * @param params TFTP communication parameters, including block size and timeout.
- * @return True if the data was successfully received, otherwise False.
+ * @param config Server configuration.
+ * @param workerId Index of the worker (0 .. workers - 1).
  */
-bool receiveDataPacket(int sockfd, sockaddr_in &clientAddr, sockaddr_in &serverAddr, uint16_t expectedBlockNum, std::ofstream &file, TFTPOparams &params);
+void runTFTPWorker(const TFTPServerConfig &config, int workerId);
 
 /**
- * @brief Sends an acknowledgment ACK packet to the client.
+ * @brief Main function of the TFTP server, starts the configured number of workers.
  *
- * @param sockfd TFTP transmission socket.
- * @param clientAddr sockaddr_in structure representing the client.
- * @param blockNum Block number to acknowledge.
- * @return True if the ACK packet was successfully sent, otherwise False.
+ * @param config Server configuration (port, root directory, workers).
  */
-bool sendAck(int sockfd, sockaddr_in &clientAddr, uint16_t blockNum);
+void runTFTPServer(const TFTPServerConfig &config);
 
 /**
- * @brief Checks for the presence of optional parameters in the request packet.
+ * @brief Signal handler function for capturing SIGINT signal.
  *
- * @param requestPacket TFTP request packet.
- * @param filename File name from the request packet.
- * @param mode Transfer mode from the request packet.
- * @param options_map Map of optional parameters.
- * @param params TFTP communication parameters, including block size and timeout.
- * @return True if optional parameters were found, otherwise False.
+ * @param signal The signal that was captured (e.g., SIGINT).
  */
-bool hasOptions(TFTPPacket &requestPacket, std::string &filename, std::string &mode, std::map<std::string, int> &options_map, TFTPOparams &params);
+void sigintHandler(int signal);
 
 /**
- * @brief Main function of the TFTP server.
+ * @brief Signal handler function for capturing SIGUSR1 signal, requests printing of the server statistics.
  *
- * @param port Port on which the server is listening.
- * @param root_dirpath Root directory of the server for handling requests.
+ * @param signal The signal that was captured (SIGUSR1).
  */
-void runTFTPServer(int port, const std::string &root_dirpath);
+void sigusr1Handler(int signal);
 
 /**
- * @brief Signal handler function for capturing SIGINT signal.
- *
- * @param signal The signal that was captured (e.g., SIGINT).
+ * @brief Prints the server statistics if they were requested by SIGUSR1.
  */
-void sigintHandler(int signal);
+void handleStatsRequest();
+
+/**
+ * @brief Prints the server statistics (content cache, batched I/O, segmentation offload, zero-copy, writer, read stream and multicast counters) to the standard output.
+ */
+void printServerStats();
 
 #endif // TFTP_SERVER_H
@@ -0,0 +1,1374 @@
+/**
+ * @file tftp-session.cpp
+ * @brief Event-driven RRQ/WRQ transfer sessions of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-session.h"
+
+// Returns the timeout negotiated by the client (timeout or utimeout option)
+static std::chrono::microseconds negotiatedTimeout(TFTPSession &session)
+{
+    if (session.params.utimeoutOptionUsed)
+    {
+        return std::chrono::microseconds(session.params.utimeout);
+    }
+
+    int timeout = session.params.timeout > 0 ? session.params.timeout : 1;
+    return std::chrono::seconds(timeout);
+}
+
+// Time a session may go without progress, long enough for all retransmissions of the negotiated timeout
+static std::chrono::steady_clock::duration idleLimit(TFTPSession &session)
+{
+    return std::max<std::chrono::steady_clock::duration>(SESSION_IDLE_TIMEOUT, negotiatedTimeout(session) * (SESSION_MAX_RETRIES + 2));
+}
+
+// Records progress of the transfer, the retransmissions and the idle limit start over
+static void markProgress(TFTPSession &session)
+{
+    session.retries = 0;
+    session.lastProgress = std::chrono::steady_clock::now();
+}
+
+void setSessionDeadline(TFTPSession &session, std::chrono::steady_clock::time_point deadline)
+{
+    scheduleTimer(workerTimers(), session.retransmitTimer, deadline);
+}
+
+// Sessions of the calling worker by client TID (address and port), SO_REUSEPORT steers every copy of a request to the same worker
+static std::map<uint64_t, TFTPSession *> &workerRequests()
+{
+    static thread_local std::map<uint64_t, TFTPSession *> requests;
+    return requests;
+}
+
+static uint64_t clientKey(const sockaddr_in &clientAddr)
+{
+    return (static_cast<uint64_t>(clientAddr.sin_addr.s_addr) << 16) | clientAddr.sin_port;
+}
+
+// Arms the retransmission deadline of the session
+static void armTimer(TFTPSession &session)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (session.state == SESSION_WAIT_OACK_ACK || session.state == SESSION_SENDING)
+    {
+        // The server retransmits RRQ packets after the adaptive timeout
+        session.sentAt = now;
+        setSessionDeadline(session, now + session.rto);
+    }
+    else
+    {
+        // During WRQ the client drives retransmission, wait for the negotiated timeout
+        setSessionDeadline(session, now + negotiatedTimeout(session));
+    }
+}
+
+// Updates the smoothed round-trip time with a new sample and recomputes the timeout (RFC 6298)
+static void updateRtt(TFTPSession &session, std::chrono::microseconds sample)
+{
+    if (!session.rttMeasured)
+    {
+        session.srtt = sample;
+        session.rttvar = sample / 2;
+        session.rttMeasured = true;
+    }
+    else
+    {
+        std::chrono::microseconds delta = session.srtt > sample ? session.srtt - sample : sample - session.srtt;
+        session.rttvar = (session.rttvar * 3 + delta) / 4;
+        session.srtt = (session.srtt * 7 + sample) / 8;
+    }
+
+    session.rto = session.srtt + std::max<std::chrono::microseconds>(std::chrono::milliseconds(1), session.rttvar * 4);
+    session.rto = std::min<std::chrono::microseconds>(std::max<std::chrono::microseconds>(session.rto, MIN_RTO), MAX_RTO);
+}
+
+// Takes an RTT sample when the ACK confirms packets that were not retransmitted (Karn's algorithm)
+static void sampleRtt(TFTPSession &session)
+{
+    if (session.retries == 0)
+    {
+        updateRtt(session, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - session.sentAt));
+    }
+}
+
+// Returns the block number sent on the wire for a block index
+static uint16_t wireBlock(const TFTPSession &session, uint64_t index)
+{
+    if (index <= 0xFFFF)
+    {
+        return index;
+    }
+
+    // After 65535 the numbering continues from the rollover value
+    uint64_t period = 0x10000 - session.params.rollover;
+    return session.params.rollover + (index - 0x10000) % period;
+}
+
+// Returns the number of blocks from the block index `from` to the next block sent as `wire`
+static uint32_t wireDistance(const TFTPSession &session, uint64_t from, uint16_t wire)
+{
+    uint16_t fromWire = wireBlock(session, from);
+
+    if (session.params.rollover == 0 || from == 0)
+    {
+        return static_cast<uint16_t>(wire - fromWire);
+    }
+
+    // With rollover to 1 the block number 0 is never used again
+    if (wire == 0)
+    {
+        return 0xFFFF;
+    }
+    return (wire + 0xFFFF - fromWire) % 0xFFFF;
+}
+
+// Sends one block of the window to the client
+static bool sendBlock(TFTPSession &session, uint64_t block)
+{
+    uint64_t offset = (block - 1) * session.params.blksize;
+    size_t length = std::min<uint64_t>(session.params.blksize, session.source.size - offset);
+
+    // The pread backend reads every queued block into its own buffer
+    char *scratch = nullptr;
+    if (session.source.type == BLOCK_SOURCE_PREAD)
+    {
+        scratch = session.scratch.data() + session.batch.count * session.params.blksize;
+    }
+
+    const char *data = blockData(session.source, offset, length, scratch);
+    if (data == nullptr)
+    {
+        sendError(session.sockfd, ERROR_UNDEFINED, "Read error", session.clientAddr, session.serverAddr);
+        return false;
+    }
+
+    return queueDataPacket(session.batch, session.dataAddr, wireBlock(session, block), data, length);
+}
+
+// Sends the blocks first..last as consecutive DATA packets segmented by the kernel
+static bool sendSegmentedBlocks(TFTPSession &session, uint64_t first, uint64_t last)
+{
+    size_t length = 0;
+
+    for (uint64_t block = first; block <= last; block++)
+    {
+        uint64_t offset = (block - 1) * session.params.blksize;
+        size_t dataLength = std::min<uint64_t>(session.params.blksize, session.source.size - offset);
+
+        uint16_t header[2];
+        header[0] = htons(DATA);
+        header[1] = htons(wireBlock(session, block));
+
+        char *packet = session.segments.data() + length;
+        memcpy(packet, header, sizeof(header));
+
+        // The pread backend reads straight behind the header, mapped data has to be copied
+        const char *data = blockData(session.source, offset, dataLength, packet + sizeof(header));
+        if (data == nullptr)
+        {
+            sendError(session.sockfd, ERROR_UNDEFINED, "Read error", session.clientAddr, session.serverAddr);
+            return false;
+        }
+        if (data != packet + sizeof(header))
+        {
+            memcpy(packet + sizeof(header), data, dataLength);
+        }
+
+        length += sizeof(header) + dataLength;
+    }
+
+    return sendSegmented(session.sockfd, session.dataAddr, session.segments.data(), length, session.params.blksize + 4);
+}
+
+// Sends the blocks first..last in segmented sends or batches, retransmitted blocks are read again by offset (RFC 7440)
+static bool sendBlocks(TFTPSession &session, uint64_t first, uint64_t last)
+{
+    uint64_t block = first;
+
+    if (session.batch.sendFlags & MSG_ZEROCOPY)
+    {
+        reapZerocopy(session.batch);
+    }
+
+    // Runs of at least two blocks are passed to the kernel as one buffer
+    while (session.segmentBlocks > 1 && segmentationMode() == SEGMENTATION_GSO && block < last)
+    {
+        uint64_t runEnd = std::min<uint64_t>(block + session.segmentBlocks - 1, last);
+
+        if (!sendSegmentedBlocks(session, block, runEnd))
+        {
+            if (segmentationMode() == SEGMENTATION_GSO)
+            {
+                return false;
+            }
+
+            // The kernel rejected segmentation offload, send the rest of the blocks in batches
+            break;
+        }
+
+        block = runEnd + 1;
+    }
+
+    for (; block <= last; block++)
+    {
+        if (!sendBlock(session, block))
+        {
+            return false;
+        }
+    }
+
+    // The queued DATA is sent, the shared chunks it pointed into may be replaced
+    bool flushed = flushSendBatch(session.batch);
+    releaseBlockData(session.source);
+    if (!flushed)
+    {
+        return false;
+    }
+
+    if (session.group != nullptr)
+    {
+        countMulticastBlocks(last - first + 1);
+    }
+
+    // Blocks up to the last one sent before were sent again
+    uint64_t blocks = last - first + 1;
+    uint64_t retransmits = session.blockNum >= first ? std::min(session.blockNum, last) - first + 1 : 0;
+    uint64_t bytes = std::min<uint64_t>(last * session.params.blksize, session.source.size) - (first - 1) * session.params.blksize;
+    session.metrics.blocks += blocks;
+    session.metrics.bytes += bytes;
+    session.metrics.retransmits += retransmits;
+    countMetric(COUNTER_BLOCKS_SENT, blocks);
+    countMetric(COUNTER_BYTES_SENT, bytes);
+    countMetric(COUNTER_RETRANSMITS, retransmits);
+
+    session.blockNum = std::max(session.blockNum, last);
+    return true;
+}
+
+// Bytes a block occupies on the wire, the DATA header included
+static size_t blockCost(const TFTPSession &session, uint64_t block)
+{
+    uint64_t offset = (block - 1) * session.params.blksize;
+    return std::min<uint64_t>(session.params.blksize, session.source.size - offset) + 4;
+}
+
+// Session of the worker whose pacing timer wakes up the shaper, nullptr if none is scheduled
+static TFTPSession *&workerPacingSession()
+{
+    static thread_local TFTPSession *pacingSession = nullptr;
+    return pacingSession;
+}
+
+// Socket and file memory of a released session whose zero-copy sends the kernel has not completed yet
+struct TFTPParkedSend
+{
+    TFTPSendBatch batch;    // Transfer socket and the ring of pending sends
+    TFTPBlockSource source; // Mapping or cached content the pending sends point into
+};
+
+// Released sessions of the worker waiting for their zero-copy completions
+static std::list<TFTPParkedSend> &workerParkedSends()
+{
+    static thread_local std::list<TFTPParkedSend> parkedSends;
+    return parkedSends;
+}
+
+// Timer of the worker that collects the completions of the parked sends
+struct TFTPZerocopyTimer
+{
+    TFTPTimer timer;
+
+    TFTPZerocopyTimer()
+    {
+        initTimer(timer, nullptr, TIMER_ZEROCOPY);
+    }
+};
+
+static TFTPTimer &workerZerocopyTimer()
+{
+    static thread_local TFTPZerocopyTimer zerocopyTimer;
+    return zerocopyTimer.timer;
+}
+
+// Releases the parked sends the kernel completed, polls again later while any are pending
+static void reapParkedSends()
+{
+    std::list<TFTPParkedSend> &parkedSends = workerParkedSends();
+    for (auto it = parkedSends.begin(); it != parkedSends.end();)
+    {
+        reapZerocopy(it->batch);
+        if (it->batch.zerocopyCount > 0)
+        {
+            ++it;
+            continue;
+        }
+
+        closeBlockSource(it->source);
+        close(it->batch.sockfd);
+        it = parkedSends.erase(it);
+    }
+
+    if (!parkedSends.empty())
+    {
+        scheduleTimer(workerTimers(), workerZerocopyTimer(), std::chrono::steady_clock::now() + ZEROCOPY_REAP_INTERVAL);
+    }
+}
+
+// Wakes up the shaper at the deadline, the timer is kept on the first session of the queue
+static void schedulePacing(TFTPSession &session, std::chrono::steady_clock::time_point deadline)
+{
+    TFTPSession *&pacingSession = workerPacingSession();
+    if (pacingSession != nullptr && pacingSession != &session)
+    {
+        cancelTimer(pacingSession->pacingTimer);
+    }
+
+    pacingSession = &session;
+    scheduleTimer(workerTimers(), session.pacingTimer, deadline);
+}
+
+static void dequeueShaper(TFTPSession &session)
+{
+    workerShaperQueue().erase(session.shaperEntry);
+    session.shaperQueued = false;
+    session.shaperTurn = false;
+    session.deficit = 0;
+}
+
+// The whole window was sent, its retransmission deadline starts
+static void finishWindow(TFTPSession &session)
+{
+    session.state = SESSION_SENDING;
+    armTimer(session);
+}
+
+// Sends the windows of the sessions waiting in the shaper queue of the worker in deficit round-robin order,
+// every round a session may send a quantum of bytes as long as the buckets of its class and the global limit hold tokens
+static void serveShaper(std::chrono::steady_clock::time_point now)
+{
+    std::list<TFTPSession *> &queue = workerShaperQueue();
+
+    // Visits in a row that sent nothing, a full pass of them means that all buckets ran dry
+    size_t waiting = 0;
+    std::chrono::steady_clock::time_point wakeAt = std::chrono::steady_clock::time_point::max();
+
+    while (!queue.empty() && waiting < queue.size())
+    {
+        TFTPSession &session = *queue.front();
+
+        if (session.state != SESSION_SENDING)
+        {
+            dequeueShaper(session);
+            continue;
+        }
+
+        if (!session.shaperTurn)
+        {
+            session.deficit += SHAPER_QUANTUM;
+            session.shaperTurn = true;
+        }
+
+        // The rest of the deficit does not cover the next block, the session gets its quantum in the next round
+        uint64_t last = session.shapedNext;
+        size_t cost = blockCost(session, last);
+        if (cost > session.deficit)
+        {
+            session.shaperTurn = false;
+            queue.splice(queue.end(), queue, session.shaperEntry);
+            continue;
+        }
+
+        // Blocks the deficit of the round allows
+        while (last < session.shapedLast && cost + blockCost(session, last + 1) <= session.deficit)
+        {
+            last++;
+            cost += blockCost(session, last);
+        }
+
+        // The blocks the tokens do not cover wait, the tokens of a partial block are returned
+        size_t granted = takeTokens(session.shapingClass, cost, now);
+        size_t used = 0;
+        uint64_t sendLast = session.shapedNext - 1;
+        while (sendLast < last && used + blockCost(session, sendLast + 1) <= granted)
+        {
+            sendLast++;
+            used += blockCost(session, sendLast);
+        }
+        returnTokens(session.shapingClass, granted - used);
+
+        if (sendLast < session.shapedNext)
+        {
+            // The session keeps its deficit and its turn until the tokens are available
+            countShaperWait(session.shapingClass);
+            wakeAt = std::min(wakeAt, tokensAvailableAt(session.shapingClass, blockCost(session, session.shapedNext), now));
+            queue.splice(queue.end(), queue, session.shaperEntry);
+            waiting++;
+            continue;
+        }
+
+        waiting = 0;
+        wakeAt = std::chrono::steady_clock::time_point::max();
+
+        if (!sendBlocks(session, session.shapedNext, sendLast))
+        {
+            // The event loop releases the session at its deadline
+            dequeueShaper(session);
+            session.state = SESSION_DONE;
+            setSessionDeadline(session, now);
+            continue;
+        }
+
+        countShapedBytes(session.shapingClass, used);
+        session.deficit -= used;
+        session.shapedNext = sendLast + 1;
+        session.sentAt = now;
+
+        // Waiting for tokens is not a stalled client
+        session.lastProgress = now;
+
+        if (session.shapedNext > session.shapedLast)
+        {
+            dequeueShaper(session);
+            finishWindow(session);
+            continue;
+        }
+
+        // The round ends when the deficit is spent, otherwise the session waits for tokens with the rest of it
+        if (sendLast == last)
+        {
+            session.shaperTurn = false;
+        }
+        queue.splice(queue.end(), queue, session.shaperEntry);
+    }
+
+    TFTPSession *&pacingSession = workerPacingSession();
+    if (queue.empty())
+    {
+        if (pacingSession != nullptr)
+        {
+            cancelTimer(pacingSession->pacingTimer);
+            pacingSession = nullptr;
+        }
+        return;
+    }
+
+    schedulePacing(*queue.front(), wakeAt);
+}
+
+// Sends the window starting at windowStart, with rate limits the shaper sends it as tokens become available
+static bool sendWindow(TFTPSession &session)
+{
+    uint64_t lastBlock = std::min<uint64_t>(session.windowStart + session.params.windowsize - 1, session.finalBlockNum);
+
+    if (!shapingEnabled())
+    {
+        if (!sendBlocks(session, session.windowStart, lastBlock))
+        {
+            session.state = SESSION_DONE;
+            return false;
+        }
+
+        finishWindow(session);
+        return true;
+    }
+
+    // The retransmission deadline starts once the last block of the window was sent
+    session.shapedNext = session.windowStart;
+    session.shapedLast = lastBlock;
+    session.state = SESSION_SENDING;
+    cancelTimer(session.retransmitTimer);
+
+    if (!session.shaperQueued)
+    {
+        std::list<TFTPSession *> &queue = workerShaperQueue();
+        session.shaperEntry = queue.insert(queue.end(), &session);
+        session.shaperQueued = true;
+    }
+
+    serveShaper(std::chrono::steady_clock::now());
+    return session.state != SESSION_DONE;
+}
+
+// Grows a socket buffer to hold the given number of bytes, beyond net.core.[rw]mem_max only with CAP_NET_ADMIN
+static size_t growSocketBuffer(int sockfd, int option, int forceOption, size_t bytes)
+{
+    // Reported sizes include the bookkeeping the kernel doubles every requested size for
+    int size = 0;
+    socklen_t length = sizeof(size);
+    getsockopt(sockfd, SOL_SOCKET, option, &size, &length);
+
+    if (static_cast<size_t>(size) / 2 < bytes)
+    {
+        int requested = static_cast<int>(bytes);
+        if (setsockopt(sockfd, SOL_SOCKET, forceOption, &requested, sizeof(requested)) < 0)
+        {
+            setsockopt(sockfd, SOL_SOCKET, option, &requested, sizeof(requested));
+        }
+        length = sizeof(size);
+        getsockopt(sockfd, SOL_SOCKET, option, &size, &length);
+    }
+    return static_cast<size_t>(size) / 2;
+}
+
+TFTPSession *createSession(sockaddr_in &clientAddr, const TFTPRequest &request, TFTPOparams &params, const TFTPServerConfig &config)
+{
+    // Every transfer gets its own socket bound to an ephemeral port (RFC 1350 TID)
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0)
+    {
+        std::cout << "Error creating transfer socket" << std::endl;
+        return nullptr;
+    }
+
+    sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = 0;
+
+    socklen_t serverAddrLen = sizeof(serverAddr);
+    if (bind(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0 ||
+        getsockname(sockfd, (struct sockaddr *)&serverAddr, &serverAddrLen) < 0)
+    {
+        std::cout << "Error binding transfer socket" << std::endl;
+        close(sockfd);
+        return nullptr;
+    }
+
+    // The event loop never blocks on a single transfer
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+    // A whole window has to fit into the socket buffer, the default one drops the tail of large windows
+    size_t packetSize = params.blksize + sizeof(uint16_t) * 2;
+    size_t windowBytes = std::min<size_t>(params.windowsize * packetSize, MAX_WINDOW_BYTES);
+    if (request.opcode == WRQ)
+    {
+        // The client sends the window at once, acknowledge only as many blocks as the buffer can hold
+        size_t granted = growSocketBuffer(sockfd, SO_RCVBUF, SO_RCVBUFFORCE, windowBytes);
+        params.windowsize = std::max<size_t>(1, std::min<size_t>(params.windowsize, granted / packetSize));
+    }
+    else
+    {
+        growSocketBuffer(sockfd, SO_SNDBUF, SO_SNDBUFFORCE, windowBytes);
+    }
+
+    TFTPSession *session = new TFTPSession();
+    session->sockfd = sockfd;
+    session->clientAddr = clientAddr;
+    session->serverAddr = serverAddr;
+    session->dataAddr = clientAddr;
+    session->config = &config;
+    session->opcode = request.opcode;
+    session->filename.assign(request.filename, request.filenameLength);
+    session->mode.assign(request.mode, request.modeLength);
+    session->options = request.options;
+    session->params = params;
+    session->requestHash = 0;
+    session->state = SESSION_DONE;
+    session->blockNum = 0;
+    session->retries = 0;
+    session->srtt = std::chrono::microseconds(0);
+    session->rttvar = std::chrono::microseconds(0);
+    session->rto = negotiatedTimeout(*session);
+    session->rttMeasured = false;
+    session->filesize = 0;
+    session->source.fd = -1;
+    session->source.mapping = nullptr;
+    session->source.netascii = nullptr;
+    session->source.stream = nullptr;
+    session->windowStart = 1;
+    session->finalBlockNum = 0;
+    session->group = nullptr;
+    session->detached = false;
+    session->segmentBlocks = 0;
+    session->shapingClass = shapingClass(clientAddr.sin_addr);
+    session->shaperQueued = false;
+    session->deficit = 0;
+    session->shaperTurn = false;
+    session->shapedNext = 1;
+    session->shapedLast = 0;
+    session->upload = nullptr;
+    session->lastBlockReceived = false;
+    session->lastAcked = 0;
+    session->blocksSinceAck = 0;
+    initTimer(session->retransmitTimer, session, TIMER_RETRANSMIT);
+    initTimer(session->idleTimer, session, TIMER_IDLE);
+    initTimer(session->pacingTimer, session, TIMER_PACING);
+    session->lastProgress = std::chrono::steady_clock::now();
+    scheduleTimer(workerTimers(), session->idleTimer, session->lastProgress + idleLimit(*session));
+    countSessionStart(session->metrics, params);
+
+    return session;
+}
+
+// Starts a Read Request transfer: sends OACK or the first DATA block
+static bool startReadSession(TFTPSession &session)
+{
+    // Open the file as a block source
+    if (!openBlockSource(session.source, session.filename, session.config->blockSource))
+    {
+        // If the file cannot be opened, send an error response
+        sendError(session.sockfd, ERROR_FILE_NOT_FOUND, "File not found", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+        return false;
+    }
+
+    // Netascii files are sent translated, blocks and tsize refer to the translated size
+    if (isNetasciiMode(session.mode) && !enableNetascii(session.source, session.params.blksize, session.params.windowsize))
+    {
+        sendError(session.sockfd, ERROR_UNDEFINED, "Read error", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+        return false;
+    }
+
+    // Get the file size
+    session.filesize = session.source.size;
+    session.finalBlockNum = session.source.size / session.params.blksize + 1;
+
+    std::cout << "Size of the file: " << session.filesize << " bytes" << std::endl;
+
+    // Multicast clients share the DATA requested by their master (RFC 2090), a group of a file
+    // larger than 65535 blocks could not tell the wrapped block numbers apart. Netascii blocks are
+    // translated into a ring of one window, a promoted master could not get the early blocks it missed
+    if (session.params.multicastOptionUsed && session.config->multicast && session.finalBlockNum <= 0xFFFF && !isNetasciiMode(session.mode))
+    {
+        joinMulticastGroup(session, session.config->multicastAddr);
+        session.params.multicastGroup = session.group->groupAddr;
+    }
+    else if (session.params.multicastOptionUsed)
+    {
+        session.params.multicastOptionUsed = false;
+        clearOption(session.options, OPTION_MULTICAST);
+    }
+
+    // A batch never holds more than one window
+    size_t batchSize = std::min<size_t>(session.config->batchSize, session.params.windowsize);
+    initSendBatch(session.batch, session.sockfd, batchSize);
+
+    // Concurrent downloads of the file share one stream of reads, the scratch buffers hold blocks
+    // spanning two shared chunks or read by the session itself
+    if (session.source.type == BLOCK_SOURCE_PREAD && session.source.netascii == nullptr)
+    {
+        shareReadStream(session.source);
+        session.scratch.resize(batchSize * session.params.blksize);
+    }
+
+    // Large blocks of mapped or cached files are sent straight from memory that stays unchanged,
+    // translated netascii blocks are overwritten by later windows
+    if (session.config->zeroCopy && session.params.blksize >= ZEROCOPY_MIN_BLKSIZE && session.source.netascii == nullptr &&
+        (session.source.type == BLOCK_SOURCE_MMAP || session.source.type == BLOCK_SOURCE_CACHE))
+    {
+        enableZerocopy(session.batch);
+    }
+
+    // Segmented sends are limited by the number of segments and by the size of one UDP datagram,
+    // the GSO buffer is a copy and is not used for zero-copy sessions
+    if (segmentationMode() == SEGMENTATION_GSO && !(session.batch.sendFlags & MSG_ZEROCOPY))
+    {
+        size_t segmentSize = session.params.blksize + 4;
+        session.segmentBlocks = std::min<size_t>(std::min<size_t>(MAX_GSO_SEGMENTS, MAX_GSO_BYTES / segmentSize), session.params.windowsize);
+        if (session.segmentBlocks > 1)
+        {
+            session.segments.resize(session.segmentBlocks * segmentSize);
+        }
+    }
+
+    // Every member learns its group from the OACK, only the master acknowledges it
+    if (session.group != nullptr)
+    {
+        session.params.multicastMaster = session.group->master == &session;
+        if (!sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.filesize))
+        {
+            session.state = SESSION_DONE;
+            return false;
+        }
+
+        session.state = session.params.multicastMaster ? SESSION_WAIT_OACK_ACK : SESSION_LISTENING;
+        armTimer(session);
+        return true;
+    }
+
+    // If optional parameters were found, confirm them with OACK first
+    if (session.params.blocksizeOptionUsed || session.params.timeoutOptionUsed || session.params.transfersizeOptionUsed ||
+        session.params.windowsizeOptionUsed || session.params.utimeoutOptionUsed || session.params.rolloverOptionUsed)
+    {
+        if (!sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.filesize))
+        {
+            session.state = SESSION_DONE;
+            return false;
+        }
+
+        session.state = SESSION_WAIT_OACK_ACK;
+        armTimer(session);
+        return true;
+    }
+
+    return sendWindow(session);
+}
+
+// Starts a Write Request transfer: sends OACK or ACK of block 0
+static bool startWriteSession(TFTPSession &session)
+{
+    // Check available disk space if transfersize option is used
+    if (session.params.transfersizeOptionUsed)
+    {
+        uint16_t diskspace = checkDiskSpace(session.params.transfersize, session.filename);
+
+        if (diskspace == ERROR_DISK_FULL)
+        {
+            std::cout << "ERROR_DISK_FULL!" << std::endl;
+            sendError(session.sockfd, ERROR_DISK_FULL, "Disk full", session.clientAddr, session.serverAddr);
+            session.state = SESSION_DONE;
+            return false;
+        }
+    }
+
+    // Open the temporary file, preallocated to the announced size
+    uint16_t errorCode;
+    long long preallocate = session.params.transfersizeOptionUsed ? session.params.transfersize : 0;
+    session.upload = openUpload(session.filename, preallocate, isNetasciiMode(session.mode), errorCode);
+
+    if (session.upload == nullptr)
+    {
+        if (errorCode == ERROR_DISK_FULL)
+        {
+            sendError(session.sockfd, ERROR_DISK_FULL, "Disk full", session.clientAddr, session.serverAddr);
+        }
+        else
+        {
+            sendError(session.sockfd, ERROR_ACCESS_VIOLATION, "Access violation", session.clientAddr, session.serverAddr);
+        }
+        session.state = SESSION_DONE;
+        return false;
+    }
+
+    // Send optional acknowledgement (OACK) if options are present
+    bool sent;
+    if (session.options.requested != 0)
+    {
+        sent = sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.params.transfersize);
+    }
+    else
+    {
+        sent = sendAck(session.sockfd, session.clientAddr, 0);
+    }
+
+    if (!sent)
+    {
+        session.state = SESSION_DONE;
+        return false;
+    }
+
+    // Start receiving file data in DATA packets
+    session.blockNum = 1;
+    session.state = SESSION_RECEIVING;
+    armTimer(session);
+    return true;
+}
+
+bool startSession(TFTPSession &session)
+{
+    if (session.opcode == RRQ)
+    {
+        return startReadSession(session);
+    }
+
+    return startWriteSession(session);
+}
+
+// Handles an ACK of a multicast group member, block numbers of a group never wrap
+static void handleMulticastAck(TFTPSession &session, uint16_t blockNum)
+{
+    if (session.state == SESSION_LISTENING)
+    {
+        // A member that received every block leaves the group, other ACKs are not for the master
+        if (blockNum == session.finalBlockNum)
+        {
+            std::cout << "Multicast client received the whole file" << std::endl;
+            session.metrics.completed = true;
+            session.state = SESSION_DONE;
+        }
+        return;
+    }
+
+    if (blockNum > session.finalBlockNum)
+    {
+        logPacket(LOG_EVENT_UNEXPECTED_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+        sendError(session.sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    if (session.state == SESSION_SENDING && blockNum < session.windowStart)
+    {
+        // Received a duplicate ACK (ignore)
+        return;
+    }
+
+    logPacket(LOG_EVENT_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+
+    sampleRtt(session);
+
+    if (blockNum == session.finalBlockNum)
+    {
+        std::cout << "No more data to send" << std::endl;
+        session.metrics.completed = true;
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    // The master acknowledges every block it has up to the first one it is missing, the blocks
+    // following it may have reached the master while another member was the master
+    session.windowStart = blockNum + 1;
+    markProgress(session);
+
+    sendWindow(session);
+}
+
+// Makes a member the master of its group, it answers the OACK with the last block it has in order
+static void promoteMaster(TFTPSession &session)
+{
+    std::cout << "Multicast client " << inet_ntoa(session.clientAddr.sin_addr) << ":" << ntohs(session.clientAddr.sin_port) << " is the master" << std::endl;
+
+    session.params.multicastMaster = true;
+    markProgress(session);
+
+    if (!sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.filesize))
+    {
+        // The event loop releases the session at its deadline
+        session.state = SESSION_DONE;
+        setSessionDeadline(session, std::chrono::steady_clock::now());
+        return;
+    }
+
+    session.state = SESSION_WAIT_OACK_ACK;
+    armTimer(session);
+}
+
+// Handles an ACK packet of a Read Request transfer
+static void handleAck(TFTPSession &session, uint16_t blockNum)
+{
+    if (session.group != nullptr)
+    {
+        handleMulticastAck(session, blockNum);
+        return;
+    }
+
+    if (session.state == SESSION_WAIT_OACK_ACK)
+    {
+        if (blockNum != 0)
+        {
+            // Received an unexpected ACK instead of the OACK confirmation
+            logPacket(LOG_EVENT_UNEXPECTED_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+            sendError(session.sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", session.clientAddr, session.serverAddr);
+            session.state = SESSION_DONE;
+            return;
+        }
+
+        logPacket(LOG_EVENT_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+
+        sampleRtt(session);
+        markProgress(session);
+        sendWindow(session);
+        return;
+    }
+
+    // Number of window blocks acknowledged by this ACK
+    uint32_t acked = wireDistance(session, session.windowStart - 1, blockNum);
+    uint64_t sent = session.blockNum - (session.windowStart - 1);
+
+    if (acked >= 1 && acked <= sent)
+    {
+        // Handle successful ACK
+        logPacket(LOG_EVENT_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+
+        sampleRtt(session);
+
+        if (session.windowStart - 1 + acked == session.finalBlockNum)
+        {
+            std::cout << "No more data to send" << std::endl;
+            session.metrics.completed = true;
+            session.state = SESSION_DONE;
+            return;
+        }
+
+        // Slide the window past the acknowledged blocks and send the next one
+        session.windowStart += acked;
+        markProgress(session);
+
+        sendWindow(session);
+    }
+    else if (acked == 0 || acked >= 0x8000)
+    {
+        // Received a duplicate ACK (ignore)
+    }
+    else
+    {
+        // Received an out-of-order ACK (unexpected)
+        logPacket(LOG_EVENT_UNEXPECTED_ACK, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, blockNum);
+        sendError(session.sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Illegal operation", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+    }
+}
+
+// Acknowledges the last block received in order
+static bool acknowledge(TFTPSession &session)
+{
+    session.lastAcked = session.blockNum - 1;
+    session.blocksSinceAck = 0;
+
+    return sendAck(session.sockfd, session.clientAddr, wireBlock(session, session.lastAcked));
+}
+
+// Handles a DATA packet of a Write Request transfer
+static void handleData(TFTPSession &session, uint16_t blockNum, const uint8_t *data, size_t dataSize)
+{
+    if (session.state == SESSION_RECEIVING && blockNum == wireBlock(session, session.blockNum))
+    {
+        // Hand the data to the writer thread, a failed earlier write is reported now
+        TFTPAppendResult appended = appendUpload(*session.upload, data, dataSize);
+        if (appended == APPEND_FAILED)
+        {
+            sendError(session.sockfd, ERROR_DISK_FULL, "Disk full", session.clientAddr, session.serverAddr);
+            session.state = SESSION_DONE;
+            return;
+        }
+
+        if (dataSize < session.params.blksize)
+        {
+            session.lastBlockReceived = true;
+        }
+
+        // Print a log message for the received DATA packet
+        logPacket(LOG_EVENT_DATA, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), ntohs(session.serverAddr.sin_port), blockNum);
+
+        session.blockNum++;
+        session.blocksSinceAck++;
+        markProgress(session);
+        session.metrics.blocks++;
+        session.metrics.bytes += dataSize;
+        countMetric(COUNTER_BLOCKS_RECEIVED);
+        countMetric(COUNTER_BYTES_RECEIVED, dataSize);
+
+        // The final ACK is sent once the writer thread made the file durable and renamed it over the destination
+        if (session.lastBlockReceived)
+        {
+            if (!commitUpload(session.upload))
+            {
+                session.upload = nullptr;
+                sendError(session.sockfd, ERROR_DISK_FULL, "Disk full", session.clientAddr, session.serverAddr);
+                session.state = SESSION_DONE;
+                return;
+            }
+
+            session.state = SESSION_COMMITTING;
+            setSessionDeadline(session, std::chrono::steady_clock::now() + COMMIT_POLL_INTERVAL);
+            return;
+        }
+
+        // Acknowledge only on window boundaries (RFC 7440)
+        if (session.blocksSinceAck >= session.params.windowsize)
+        {
+            if (!acknowledge(session))
+            {
+                session.state = SESSION_DONE;
+                return;
+            }
+        }
+        armTimer(session);
+    }
+    else if (session.lastAcked != 0 && blockNum == wireBlock(session, session.lastAcked))
+    {
+        // Received a duplicate of the last acknowledged block, our ACK was lost
+        sendAck(session.sockfd, session.clientAddr, blockNum);
+    }
+    else if (session.state == SESSION_RECEIVING && wireDistance(session, session.lastAcked, blockNum) < session.blockNum - session.lastAcked)
+    {
+        // The client timed out before the end of the window and sent again a block received but not yet acknowledged (RFC 7440)
+        acknowledge(session);
+    }
+    else if (session.state == SESSION_RECEIVING && wireDistance(session, session.blockNum, blockNum) < 0x8000)
+    {
+        // A block of the window was lost, acknowledge the last block received in order once
+        if (session.lastAcked != session.blockNum - 1)
+        {
+            logPacket(LOG_EVENT_OUT_OF_ORDER, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), ntohs(session.serverAddr.sin_port), blockNum);
+            acknowledge(session);
+        }
+    }
+    else
+    {
+        // Received an old duplicate DATA packet (ignore)
+    }
+}
+
+void sessionHandlePacket(TFTPSession &session, const uint8_t *packet, ssize_t length, sockaddr_in &fromAddr)
+{
+    // Packets from any other TID do not belong to this transfer
+    if (fromAddr.sin_addr.s_addr != session.clientAddr.sin_addr.s_addr || fromAddr.sin_port != session.clientAddr.sin_port)
+    {
+        sendError(session.sockfd, ERROR_UNKNOWN_TRANSFER_ID, "Unknown transfer ID", fromAddr, session.serverAddr);
+        return;
+    }
+
+    if (length < static_cast<ssize_t>(sizeof(uint16_t) * 2))
+    {
+        std::cout << "Received an invalid packet" << std::endl;
+        return;
+    }
+
+    uint16_t opcode = (packet[0] << 8) | packet[1];
+    uint16_t blockNum = (packet[2] << 8) | packet[3];
+
+    if (opcode == ACK && session.opcode == RRQ)
+    {
+        handleAck(session, blockNum);
+    }
+    else if (opcode == DATA && session.opcode == WRQ)
+    {
+        handleData(session, blockNum, packet + sizeof(uint16_t) * 2, length - sizeof(uint16_t) * 2);
+    }
+    else if (opcode == ERROR)
+    {
+        std::cout << "Client terminated the transfer with error " << blockNum << std::endl;
+        session.state = SESSION_DONE;
+    }
+    else
+    {
+        // Received an unexpected packet
+        std::cout << "Received an unexpected packet with opcode " << opcode << std::endl;
+        sendError(session.sockfd, ERROR_ILLEGAL_OPERATION, "Illegal operation", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+    }
+}
+
+void registerRequest(TFTPSession &session, uint64_t requestHash)
+{
+    session.requestHash = requestHash;
+    workerRequests()[clientKey(session.clientAddr)] = &session;
+}
+
+TFTPSession *findDuplicateRequest(const sockaddr_in &clientAddr, uint64_t requestHash)
+{
+    std::map<uint64_t, TFTPSession *> &requests = workerRequests();
+    auto it = requests.find(clientKey(clientAddr));
+    if (it == requests.end() || it->second->requestHash != requestHash)
+    {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void sessionHandleDuplicateRequest(TFTPSession &session)
+{
+    countMetric(COUNTER_DUPLICATE_REQUESTS);
+
+    // A burst of copies of the request is answered once, each answer may be a whole window
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - session.duplicateResentAt < DUPLICATE_RESEND_INTERVAL)
+    {
+        return;
+    }
+
+    bool sent;
+    if (session.state == SESSION_WAIT_OACK_ACK || session.state == SESSION_LISTENING)
+    {
+        sent = sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.filesize);
+    }
+    else if (session.state == SESSION_SENDING && session.windowStart == 1)
+    {
+        // The DATA sent first is still timed for the RTT, an ACK of the copy must not give a short sample
+        std::chrono::steady_clock::time_point sentAt = session.sentAt;
+        sent = sendWindow(session);
+        session.sentAt = sentAt;
+    }
+    else if (session.state == SESSION_RECEIVING && session.blockNum == 1)
+    {
+        sent = session.options.requested != 0 ? sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.params.transfersize)
+                                              : acknowledge(session);
+    }
+    else
+    {
+        // The client answered the first packet, the request is a late copy
+        return;
+    }
+
+    session.duplicateResentAt = now;
+    countMetric(COUNTER_DUPLICATE_RESENDS);
+
+    if (!sent)
+    {
+        // The event loop releases the session at its deadline
+        session.state = SESSION_DONE;
+        setSessionDeadline(session, now);
+    }
+}
+
+// Sends the final ACK of an upload once the writer thread committed it, a failed commit is reported as a full disk
+static void handleCommit(TFTPSession &session)
+{
+    TFTPCommitState committed = uploadCommitState(*session.upload);
+    if (committed == COMMIT_PENDING)
+    {
+        setSessionDeadline(session, std::chrono::steady_clock::now() + COMMIT_POLL_INTERVAL);
+        return;
+    }
+
+    closeUpload(session.upload);
+    session.upload = nullptr;
+
+    if (committed == COMMIT_FAILED)
+    {
+        sendError(session.sockfd, ERROR_DISK_FULL, "Disk full", session.clientAddr, session.serverAddr);
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    if (!acknowledge(session))
+    {
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    // Linger for one timeout to re-acknowledge a lost final ACK
+    session.metrics.completed = true;
+    session.state = SESSION_DALLY;
+    armTimer(session);
+}
+
+// Handles an expired retransmission deadline, retransmitting or abandoning the transfer
+static void handleTimeout(TFTPSession &session)
+{
+    if (session.state == SESSION_COMMITTING)
+    {
+        handleCommit(session);
+        return;
+    }
+
+    if (session.state == SESSION_DALLY || session.state == SESSION_DONE)
+    {
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    // Members of a multicast group wait until they become the master
+    if (session.state == SESSION_LISTENING)
+    {
+        armTimer(session);
+        return;
+    }
+
+    session.retries++;
+    session.metrics.timeouts++;
+    countMetric(COUNTER_TIMEOUTS);
+
+    // RRQ retransmissions back off exponentially until the negotiated timeout is reached
+    bool backoff = session.state == SESSION_WAIT_OACK_ACK || session.state == SESSION_SENDING;
+    bool exhausted = !backoff || session.rto >= negotiatedTimeout(session);
+
+    if (session.retries >= SESSION_MAX_RETRIES && exhausted)
+    {
+        std::cout << "Failed to receive " << (session.opcode == RRQ ? "ACK" : "DATA packet") << " for block " << wireBlock(session, session.blockNum) << " after multiple retries" << std::endl;
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    if (backoff)
+    {
+        session.rto = std::min<std::chrono::microseconds>(session.rto * 2, MAX_RTO);
+    }
+
+    bool sent;
+    if (session.state == SESSION_WAIT_OACK_ACK)
+    {
+        logPacket(LOG_EVENT_ACK_TIMEOUT, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, wireBlock(session, session.blockNum));
+        sent = sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.filesize);
+    }
+    else if (session.state == SESSION_SENDING)
+    {
+        // Retransmit the whole unacknowledged window
+        logPacket(LOG_EVENT_ACK_TIMEOUT, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, wireBlock(session, session.blockNum));
+        sent = sendWindow(session);
+    }
+    else if (session.options.requested != 0 && session.blockNum == 1)
+    {
+        logPacket(LOG_EVENT_DATA_TIMEOUT, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, wireBlock(session, session.blockNum));
+        sent = sendOACK(session.sockfd, session.clientAddr, session.options, session.params, session.params.transfersize);
+    }
+    else
+    {
+        logPacket(LOG_EVENT_DATA_TIMEOUT, session.clientAddr.sin_addr, ntohs(session.clientAddr.sin_port), 0, wireBlock(session, session.blockNum));
+        sent = acknowledge(session);
+    }
+
+    if (!sent)
+    {
+        session.state = SESSION_DONE;
+        return;
+    }
+
+    // A window waiting for tokens is timed once the shaper sent it
+    if (!session.shaperQueued)
+    {
+        armTimer(session);
+    }
+}
+
+// Reaps a session that has made no progress for its idle limit, multicast members progress with their group
+static void handleIdle(TFTPSession &session)
+{
+    // A finished session is released by the event loop
+    if (session.state == SESSION_DONE)
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (session.state == SESSION_LISTENING)
+    {
+        session.lastProgress = now;
+    }
+
+    std::chrono::steady_clock::time_point reapAt = session.lastProgress + idleLimit(session);
+    if (now < reapAt)
+    {
+        scheduleTimer(workerTimers(), session.idleTimer, reapAt);
+        return;
+    }
+
+    std::cout << "Session of " << inet_ntoa(session.clientAddr.sin_addr) << ":" << ntohs(session.clientAddr.sin_port) << " made no progress for "
+              << std::chrono::duration_cast<std::chrono::seconds>(now - session.lastProgress).count() << " s, closing" << std::endl;
+    countMetric(COUNTER_SESSIONS_REAPED);
+    session.state = SESSION_DONE;
+}
+
+void sessionHandleTimer(TFTPTimer &timer)
+{
+    if (timer.kind == TIMER_IDLE)
+    {
+        handleIdle(*timer.session);
+    }
+    else if (timer.kind == TIMER_PACING)
+    {
+        workerPacingSession() = nullptr;
+        serveShaper(std::chrono::steady_clock::now());
+    }
+    else if (timer.kind == TIMER_ZEROCOPY)
+    {
+        reapParkedSends();
+    }
+    else
+    {
+        handleTimeout(*timer.session);
+    }
+}
+
+void detachSession(TFTPSession *session)
+{
+    if (session->detached)
+    {
+        return;
+    }
+    session->detached = true;
+
+    cancelTimer(session->retransmitTimer);
+    cancelTimer(session->idleTimer);
+
+    // The pacing timer of the shaper moves to the next session of the queue
+    if (session->shaperQueued)
+    {
+        dequeueShaper(*session);
+    }
+    if (workerPacingSession() == session)
+    {
+        cancelTimer(session->pacingTimer);
+        workerPacingSession() = nullptr;
+
+        std::list<TFTPSession *> &queue = workerShaperQueue();
+        if (!queue.empty())
+        {
+            schedulePacing(*queue.front(), session->pacingTimer.deadline);
+        }
+    }
+
+    // A newer request of the client TID may have replaced the session in the request table
+    std::map<uint64_t, TFTPSession *> &requests = workerRequests();
+    auto request = requests.find(clientKey(session->clientAddr));
+    if (request != requests.end() && request->second == session)
+    {
+        requests.erase(request);
+    }
+
+    // Account the completions of the last zero-copy sends, the kernel keeps the sent pages pinned
+    if (session->batch.sendFlags & MSG_ZEROCOPY)
+    {
+        reapZerocopy(session->batch);
+    }
+
+    // The next member of the multicast group takes over as the master
+    if (session->group != nullptr)
+    {
+        TFTPSession *master = leaveMulticastGroup(*session);
+        if (master != nullptr)
+        {
+            promoteMaster(*master);
+        }
+    }
+
+    // Pages the kernel has not sent yet stay mapped until the session is closed
+    if (session->batch.zerocopyCount == 0)
+    {
+        closeBlockSource(session->source);
+    }
+    if (session->upload != nullptr)
+    {
+        abortUpload(session->upload);
+    }
+
+    countSessionEnd(session->metrics);
+
+    // The summary log replaces the per-packet lines with one line per transfer
+    if (logLevelIs(LOG_LEVEL_SUMMARY))
+    {
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - session->metrics.startedAt;
+        std::ostringstream line;
+        line << "END " << inet_ntoa(session->clientAddr.sin_addr) << ":" << ntohs(session->clientAddr.sin_port)
+             << " \"" << session->filename << "\" " << (session->metrics.completed ? "completed" : "failed")
+             << " bytes=" << session->metrics.bytes << " blocks=" << session->metrics.blocks
+             << " retransmits=" << session->metrics.retransmits << " timeouts=" << session->metrics.timeouts
+             << " time=" << std::fixed << std::setprecision(3) << duration.count() << "s";
+        logLine(LOG_LEVEL_SUMMARY, line.str());
+    }
+}
+
+void closeSession(TFTPSession *session)
+{
+    detachSession(session);
+
+    // The kernel may still read the file memory of zero-copy sends, the worker keeps it until their completions arrive
+    if (session->batch.sendFlags & MSG_ZEROCOPY)
+    {
+        reapZerocopy(session->batch);
+    }
+    if (session->batch.zerocopyCount > 0)
+    {
+        std::list<TFTPParkedSend> &parkedSends = workerParkedSends();
+        parkedSends.push_back(TFTPParkedSend());
+        parkedSends.back().batch = std::move(session->batch);
+        parkedSends.back().source = std::move(session->source);
+        if (parkedSends.size() == 1)
+        {
+            scheduleTimer(workerTimers(), workerZerocopyTimer(), std::chrono::steady_clock::now() + ZEROCOPY_REAP_INTERVAL);
+        }
+    }
+    else
+    {
+        closeBlockSource(session->source);
+        close(session->sockfd);
+    }
+    delete session;
+}
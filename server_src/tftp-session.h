@@ -0,0 +1,209 @@
+/**
+ * @file tftp-session.h
+ * @brief Declarations for per-transfer TFTP sessions driven by the server event loop.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_SESSION_H
+#define TFTP_SESSION_H
+
+#include "tftp-server.h"
+#include "tftp-blocksource.h"
+#include "tftp-batch.h"
+#include "tftp-writer.h"
+#include "tftp-multicast.h"
+#include "tftp-metrics.h"
+#include "tftp-timer.h"
+#include "tftp-shaper.h"
+
+// Maximum number of retransmissions of one packet (According to RFC specification)
+const int SESSION_MAX_RETRIES = 4;
+
+// Bounds of the adaptive retransmission timeout
+const std::chrono::milliseconds MIN_RTO(50);
+const std::chrono::seconds MAX_RTO(60);
+
+// Shortest time a session may go without progress before it is reaped
+const std::chrono::seconds SESSION_IDLE_TIMEOUT(60);
+
+// Interval at which a session checks whether the writer thread committed its upload
+const std::chrono::milliseconds COMMIT_POLL_INTERVAL(2);
+
+// Interval at which the zero-copy completions of released sessions are collected
+const std::chrono::milliseconds ZEROCOPY_REAP_INTERVAL(10);
+
+// Shortest interval between two first packets sent again for duplicate requests of a session
+const std::chrono::milliseconds DUPLICATE_RESEND_INTERVAL(50);
+
+// Largest datagram a session can receive (maximum blksize + DATA header)
+const size_t MAX_PACKET_SIZE = 65468;
+
+// Blocks are tracked by 64-bit index, block numbers on the wire wrap after 65535 to params.rollover
+
+// States of a transfer session
+enum TFTPSessionState
+{
+    SESSION_WAIT_OACK_ACK, // RRQ: OACK sent, waiting for ACK of block 0
+    SESSION_SENDING,       // RRQ: window of DATA sent, waiting for its ACK
+    SESSION_RECEIVING,     // WRQ: ACK/OACK sent, waiting for the next DATA
+    SESSION_COMMITTING,    // WRQ: final DATA received, waiting for the writer thread to commit the file
+    SESSION_DALLY,         // WRQ: final ACK sent, re-acknowledging a retransmitted final DATA
+    SESSION_LISTENING,     // RRQ multicast: member receiving the DATA of the master, waiting to become the master
+    SESSION_DONE           // Transfer finished or abandoned, session can be released
+};
+
+// Structure representing one RRQ/WRQ transfer and its own transfer socket (server TID)
+struct TFTPSession
+{
+    int sockfd;
+    sockaddr_in clientAddr;
+    sockaddr_in serverAddr;
+    sockaddr_in dataAddr; // Destination of DATA packets: the client, or the address of its multicast group
+
+    const TFTPServerConfig *config;
+    uint16_t opcode;
+    std::string filename;
+    std::string mode;
+    TFTPOptionSet options; // Options acknowledged in the OACK
+    TFTPOparams params;
+    uint64_t requestHash;  // Hash of the request datagram, its retransmissions start no other session
+    std::chrono::steady_clock::time_point duplicateResentAt; // First packet last sent again for a duplicate request
+
+    TFTPSessionState state;
+    uint64_t blockNum; // Index of the last block sent (RRQ) or of the next block expected (WRQ)
+    int retries;
+    TFTPTimer retransmitTimer; // Retransmission deadline in the timer wheel of the worker
+    TFTPTimer idleTimer;       // Reaping deadline, checked against lastProgress when it expires
+    std::chrono::steady_clock::time_point lastProgress; // Last block acknowledged or received in order
+
+    // Adaptive retransmission timeout measured from DATA to ACK (RFC 6298)
+    std::chrono::microseconds srtt;
+    std::chrono::microseconds rttvar;
+    std::chrono::microseconds rto;
+    bool rttMeasured;
+    std::chrono::steady_clock::time_point sentAt;
+
+    // RRQ source file, every block of the window is addressed by its offset
+    TFTPBlockSource source;
+    std::streampos filesize;
+    std::vector<char> scratch; // Block buffers of the pread backend, one per batched packet
+    TFTPSendBatch batch;       // DATA packets of the window sent with one sendmmsg call
+    std::vector<char> segments; // Consecutive DATA packets sent with UDP segmentation offload
+    size_t segmentBlocks;       // Blocks per segmented send (0 if not used)
+    uint64_t windowStart;      // Oldest unacknowledged block
+    uint64_t finalBlockNum;    // Block shorter than blksize (possibly empty) ending the transfer
+    TFTPMulticastGroup *group; // Multicast group of the session, nullptr for unicast transfers
+    bool detached;             // Released from the worker, only the transfer socket is left to close
+
+    // Rate limiting of the window, its blocks are sent as the tokens of the class and the global limit allow
+    int shapingClass;
+    bool shaperQueued;                               // The session waits in the shaper queue of the worker
+    std::list<TFTPSession *>::iterator shaperEntry;  // Entry of the session in the shaper queue
+    size_t deficit;                                  // Bytes the session may still send in its round (deficit round-robin)
+    bool shaperTurn;                                 // The quantum of the current round was added to the deficit
+    uint64_t shapedNext;                             // Next block of the window to send
+    uint64_t shapedLast;                             // Last block of the window
+    TFTPTimer pacingTimer;                           // Wakeup of the shaper, scheduled on the first session of the queue
+
+    // WRQ destination file, written by the writer thread of the worker
+    TFTPUpload *upload;
+    bool lastBlockReceived;
+    uint64_t lastAcked;      // Last block acknowledged to the client
+    uint16_t blocksSinceAck; // Blocks received since lastAcked
+
+    TFTPTransferMetrics metrics; // Counters of the transfer, added to the server histograms on release
+};
+
+/**
+ * @brief Creates a session for a parsed request together with its ephemeral transfer socket.
+ *
+ * @param clientAddr sockaddr_in structure representing the client.
+ * @param request Parsed request (opcode, file name, mode and options).
+ * @param params TFTP communication parameters, including block size and timeout.
+ * @param config Server configuration.
+ * @return Newly allocated session, or nullptr if the transfer socket could not be created.
+ */
+TFTPSession *createSession(sockaddr_in &clientAddr, const TFTPRequest &request, TFTPOparams &params, const TFTPServerConfig &config);
+
+/**
+ * @brief Records the request of a started session, later copies of it from the same client TID are duplicates.
+ *
+ * @param session Started session.
+ * @param requestHash Hash of the request datagram.
+ */
+void registerRequest(TFTPSession &session, uint64_t requestHash);
+
+/**
+ * @brief Looks up the running session started by an earlier copy of a request.
+ *
+ * @param clientAddr sockaddr_in structure representing the client.
+ * @param requestHash Hash of the request datagram.
+ * @return Session of the request, or nullptr if the request is new.
+ */
+TFTPSession *findDuplicateRequest(const sockaddr_in &clientAddr, uint64_t requestHash);
+
+/**
+ * @brief Answers a duplicate request by sending the first packet of its session again (OACK, DATA 1 or ACK 0).
+ *
+ * Nothing is sent once the client answered the first packet or if the last one was sent again recently.
+ *
+ * @param session Session of the request.
+ */
+void sessionHandleDuplicateRequest(TFTPSession &session);
+
+/**
+ * @brief Opens the requested file and sends the first packet of the transfer (OACK, DATA 1 or ACK 0).
+ *
+ * @param session Session to start.
+ * @return True if the transfer was started, otherwise False (the session is already marked done).
+ */
+bool startSession(TFTPSession &session);
+
+/**
+ * @brief Processes one datagram received on the session's transfer socket.
+ *
+ * @param session Session owning the transfer socket.
+ * @param packet Received datagram.
+ * @param length Size of the received datagram.
+ * @param fromAddr sockaddr_in structure representing the sender of the datagram.
+ */
+void sessionHandlePacket(TFTPSession &session, const uint8_t *packet, ssize_t length, sockaddr_in &fromAddr);
+
+/**
+ * @brief Moves the retransmission deadline of a session, a deadline that has passed releases a done session.
+ *
+ * @param session Session to reschedule.
+ * @param deadline New deadline.
+ */
+void setSessionDeadline(TFTPSession &session, std::chrono::steady_clock::time_point deadline);
+
+/**
+ * @brief Handles an expired timer of a session: retransmits or abandons the transfer, reaps an idle session or resumes the shaper.
+ *
+ * The zero-copy timer of the worker has no session, it collects the completions of released sessions.
+ *
+ * @param timer Expired timer (retransmission, idle, pacing or zero-copy).
+ */
+void sessionHandleTimer(TFTPTimer &timer);
+
+/**
+ * @brief Releases a finished session from the worker without closing its transfer socket.
+ *
+ * Cancels its timers, removes it from the request table, the shaper queue and its multicast group
+ * and closes its files. The io_uring engine closes the socket later, once its receive is cancelled.
+ *
+ * @param session Session to detach.
+ */
+void detachSession(TFTPSession *session);
+
+/**
+ * @brief Detaches a session unless it already was, closes its transfer socket and releases it.
+ *
+ * While the kernel still reads zero-copy sends, the socket and the file memory stay open on the worker
+ * until their completions arrive.
+ *
+ * @param session Session to release.
+ */
+void closeSession(TFTPSession *session);
+
+#endif // TFTP_SESSION_H
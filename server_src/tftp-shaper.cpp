@@ -0,0 +1,265 @@
+/**
+ * @file tftp-shaper.cpp
+ * @brief Token buckets of the global and per-subnet byte rate limits, shared by all workers
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-shaper.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+
+// Bucket of tokens (bytes) refilled at a constant rate, a rate of 0 never runs out
+struct TFTPTokenBucket
+{
+    std::mutex mutex;
+    uint64_t rate;
+    double depth;
+    double tokens;
+    std::chrono::steady_clock::time_point updated;
+
+    // Counters of the clients of the bucket
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> waits;
+};
+
+// Classes of clients, the last one holds the clients outside all subnets
+static std::vector<TFTPRateClass> rateClasses;
+static std::vector<TFTPTokenBucket *> classBuckets;
+static TFTPTokenBucket *globalBucket = nullptr;
+static bool shaping = false;
+
+static TFTPTokenBucket *createBucket(uint64_t rate)
+{
+    TFTPTokenBucket *bucket = new TFTPTokenBucket();
+    bucket->rate = rate;
+    bucket->depth = std::max<double>(rate * std::chrono::duration<double>(SHAPER_BURST).count(), SHAPER_MIN_DEPTH);
+    bucket->tokens = bucket->depth;
+    bucket->updated = std::chrono::steady_clock::now();
+    bucket->bytes = 0;
+    bucket->waits = 0;
+    return bucket;
+}
+
+// Adds the tokens of the time elapsed since the last update, the bucket never holds more than its depth
+static void refill(TFTPTokenBucket &bucket, std::chrono::steady_clock::time_point now)
+{
+    if (now > bucket.updated)
+    {
+        bucket.tokens = std::min(bucket.depth, bucket.tokens + bucket.rate * std::chrono::duration<double>(now - bucket.updated).count());
+        bucket.updated = now;
+    }
+}
+
+// Takes up to the requested tokens from one bucket
+static size_t take(TFTPTokenBucket &bucket, size_t bytes, std::chrono::steady_clock::time_point now)
+{
+    if (bucket.rate == 0)
+    {
+        return bytes;
+    }
+
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    refill(bucket, now);
+    size_t taken = std::min<double>(bytes, std::max(bucket.tokens, 0.0));
+    bucket.tokens -= taken;
+    return taken;
+}
+
+static void giveBack(TFTPTokenBucket &bucket, size_t bytes)
+{
+    if (bucket.rate == 0 || bytes == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    bucket.tokens = std::min(bucket.depth, bucket.tokens + bytes);
+}
+
+// Time at which one bucket holds the requested tokens
+static std::chrono::steady_clock::time_point availableAt(TFTPTokenBucket &bucket, size_t bytes, std::chrono::steady_clock::time_point now)
+{
+    if (bucket.rate == 0)
+    {
+        return now;
+    }
+
+    std::lock_guard<std::mutex> lock(bucket.mutex);
+    refill(bucket, now);
+    if (bucket.tokens >= bytes)
+    {
+        return now;
+    }
+    std::chrono::duration<double> wait((bytes - bucket.tokens) / bucket.rate);
+    return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait) + std::chrono::microseconds(1);
+}
+
+bool parseRate(const char *text, uint64_t &rate)
+{
+    char *end;
+    double value = std::strtod(text, &end);
+    if (end == text || value <= 0)
+    {
+        return false;
+    }
+
+    if (*end == 'K' || *end == 'k')
+    {
+        value *= 1e3;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        value *= 1e6;
+        end++;
+    }
+    else if (*end == 'G' || *end == 'g')
+    {
+        value *= 1e9;
+        end++;
+    }
+
+    if (*end != '\0' || value < 1)
+    {
+        return false;
+    }
+
+    rate = static_cast<uint64_t>(value);
+    return true;
+}
+
+bool parseRateClass(const char *text, TFTPRateClass &rateClass)
+{
+    const char *slash = strchr(text, '/');
+    const char *equals = strchr(text, '=');
+    if (slash == nullptr || equals == nullptr || equals < slash)
+    {
+        return false;
+    }
+
+    std::string network(text, slash - text);
+    std::string prefix(slash + 1, equals - slash - 1);
+    char *end;
+    long prefixLength = std::strtol(prefix.c_str(), &end, 10);
+    if (prefix.empty() || *end != '\0' || prefixLength < 0 || prefixLength > 32)
+    {
+        return false;
+    }
+
+    if (inet_pton(AF_INET, network.c_str(), &rateClass.network) != 1 || !parseRate(equals + 1, rateClass.rate))
+    {
+        return false;
+    }
+
+    rateClass.prefixLength = prefixLength;
+    rateClass.mask = htonl(prefixLength == 0 ? 0 : 0xFFFFFFFFU << (32 - prefixLength));
+    rateClass.network.s_addr &= rateClass.mask;
+    return true;
+}
+
+void initShaper(uint64_t globalRate, const std::vector<TFTPRateClass> &classes)
+{
+    rateClasses = classes;
+    for (const TFTPRateClass &rateClass : classes)
+    {
+        classBuckets.push_back(createBucket(rateClass.rate));
+    }
+    classBuckets.push_back(createBucket(0));
+    globalBucket = createBucket(globalRate);
+    shaping = globalRate > 0 || !classes.empty();
+}
+
+bool shapingEnabled()
+{
+    return shaping;
+}
+
+int shapingClass(const in_addr &address)
+{
+    int found = rateClasses.size();
+    int longest = -1;
+    for (size_t i = 0; i < rateClasses.size(); i++)
+    {
+        const TFTPRateClass &rateClass = rateClasses[i];
+        if ((address.s_addr & rateClass.mask) == rateClass.network.s_addr && rateClass.prefixLength > longest)
+        {
+            found = i;
+            longest = rateClass.prefixLength;
+        }
+    }
+    return found;
+}
+
+size_t takeTokens(int shapingClass, size_t bytes, std::chrono::steady_clock::time_point now)
+{
+    TFTPTokenBucket &classBucket = *classBuckets[shapingClass];
+    size_t taken = take(classBucket, bytes, now);
+    if (taken == 0)
+    {
+        return 0;
+    }
+
+    // The class keeps what the global bucket could not match
+    size_t granted = take(*globalBucket, taken, now);
+    giveBack(classBucket, taken - granted);
+    return granted;
+}
+
+void returnTokens(int shapingClass, size_t bytes)
+{
+    giveBack(*classBuckets[shapingClass], bytes);
+    giveBack(*globalBucket, bytes);
+}
+
+std::chrono::steady_clock::time_point tokensAvailableAt(int shapingClass, size_t bytes, std::chrono::steady_clock::time_point now)
+{
+    return std::max(availableAt(*classBuckets[shapingClass], bytes, now), availableAt(*globalBucket, bytes, now));
+}
+
+void countShapedBytes(int shapingClass, uint64_t bytes)
+{
+    classBuckets[shapingClass]->bytes += bytes;
+}
+
+void countShaperWait(int shapingClass)
+{
+    classBuckets[shapingClass]->waits++;
+}
+
+std::list<TFTPSession *> &workerShaperQueue()
+{
+    static thread_local std::list<TFTPSession *> queue;
+    return queue;
+}
+
+uint64_t globalRateLimit()
+{
+    return globalBucket != nullptr ? globalBucket->rate : 0;
+}
+
+std::vector<TFTPShaperClassStats> shaperStats()
+{
+    std::vector<TFTPShaperClassStats> stats;
+    for (size_t i = 0; i < classBuckets.size(); i++)
+    {
+        TFTPShaperClassStats classStats;
+        if (i < rateClasses.size())
+        {
+            char address[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &rateClasses[i].network, address, sizeof(address));
+            classStats.name = std::string(address) + "/" + std::to_string(rateClasses[i].prefixLength);
+        }
+        else
+        {
+            classStats.name = "other";
+        }
+        classStats.rate = classBuckets[i]->rate;
+        classStats.bytes = classBuckets[i]->bytes.load(std::memory_order_relaxed);
+        classStats.waits = classBuckets[i]->waits.load(std::memory_order_relaxed);
+        stats.push_back(classStats);
+    }
+    return stats;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file tftp-shaper.h
+ * @brief Declarations for the token buckets limiting the byte rate of the DATA sent by the server.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_SHAPER_H
+#define TFTP_SHAPER_H
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+struct TFTPSession;
+
+// Time of traffic a bucket may send at once after being idle
+const std::chrono::milliseconds SHAPER_BURST(20);
+
+// Smallest bucket depth, it holds the largest DATA packet twice
+const size_t SHAPER_MIN_DEPTH = 2 * 65468;
+
+// Bytes a session may send in one round of the deficit round-robin, at least one DATA packet of any size
+const size_t SHAPER_QUANTUM = 65468;
+
+// Byte rate limit shared by the clients of one subnet
+struct TFTPRateClass
+{
+    in_addr network;  // Network address (network byte order)
+    uint32_t mask;    // Netmask (network byte order)
+    int prefixLength;
+    uint64_t rate;    // Bytes per second
+};
+
+// Counters of one class of clients
+struct TFTPShaperClassStats
+{
+    std::string name; // Subnet of the class, "other" for clients outside all subnets
+    uint64_t rate;    // Limit of the class in bytes per second, 0 if only the global limit applies
+    uint64_t bytes;   // DATA bytes (headers included) sent to the clients of the class
+    uint64_t waits;   // Times a session of the class waited for tokens
+};
+
+/**
+ * @brief Parses a byte rate with an optional K, M or G suffix (powers of 1000).
+ *
+ * @param text Rate to parse (e.g. "125M").
+ * @param rate Parsed rate in bytes per second.
+ * @return True if the rate is valid and not zero, otherwise False.
+ */
+bool parseRate(const char *text, uint64_t &rate);
+
+/**
+ * @brief Parses a "network/prefix=rate" class of clients.
+ *
+ * @param text Class to parse (e.g. "10.1.0.0/16=50M").
+ * @param rateClass Parsed class.
+ * @return True if the class is valid, otherwise False.
+ */
+bool parseRateClass(const char *text, TFTPRateClass &rateClass);
+
+/**
+ * @brief Creates the buckets of the global limit and of the classes, shared by all workers.
+ *
+ * @param globalRate Limit of all DATA sent by the server in bytes per second (0 disables it).
+ * @param classes Limits of the subnets.
+ */
+void initShaper(uint64_t globalRate, const std::vector<TFTPRateClass> &classes);
+
+/**
+ * @brief Returns whether DATA has to pass the shaper.
+ *
+ * @return True if a global or a subnet limit is configured, otherwise False.
+ */
+bool shapingEnabled();
+
+/**
+ * @brief Finds the class of a client, the longest matching prefix wins.
+ *
+ * @param address Address of the client.
+ * @return Index of the class, the number of classes for clients outside all subnets.
+ */
+int shapingClass(const in_addr &address);
+
+/**
+ * @brief Takes up to the requested number of tokens from the bucket of a class and from the global bucket.
+ *
+ * @param shapingClass Class of the session.
+ * @param bytes Tokens requested.
+ * @param now Current time.
+ * @return Tokens taken from both buckets.
+ */
+size_t takeTokens(int shapingClass, size_t bytes, std::chrono::steady_clock::time_point now);
+
+/**
+ * @brief Puts back tokens taken but not used.
+ *
+ * @param shapingClass Class of the session.
+ * @param bytes Tokens to return.
+ */
+void returnTokens(int shapingClass, size_t bytes);
+
+/**
+ * @brief Returns the time at which both buckets of a class hold the requested number of tokens.
+ *
+ * @param shapingClass Class of the session.
+ * @param bytes Tokens needed.
+ * @param now Current time.
+ * @return Time the tokens are available at.
+ */
+std::chrono::steady_clock::time_point tokensAvailableAt(int shapingClass, size_t bytes, std::chrono::steady_clock::time_point now);
+
+/**
+ * @brief Counts DATA bytes sent to a client of a class.
+ *
+ * @param shapingClass Class of the session.
+ * @param bytes Bytes sent.
+ */
+void countShapedBytes(int shapingClass, uint64_t bytes);
+
+/**
+ * @brief Counts a session of a class waiting for tokens.
+ *
+ * @param shapingClass Class of the session.
+ */
+void countShaperWait(int shapingClass);
+
+/**
+ * @brief Returns the sessions of the calling worker waiting to send, in deficit round-robin order.
+ *
+ * @return Queue of the worker.
+ */
+std::list<TFTPSession *> &workerShaperQueue();
+
+/**
+ * @brief Returns the global limit in bytes per second (0 if there is none).
+ *
+ * @return Global limit.
+ */
+uint64_t globalRateLimit();
+
+/**
+ * @brief Returns the counters of all classes.
+ *
+ * @return Counters of the subnets followed by the clients outside all subnets.
+ */
+std::vector<TFTPShaperClassStats> shaperStats();
+
+#endif // TFTP_SHAPER_H
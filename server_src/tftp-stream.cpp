@@ -0,0 +1,244 @@
+/**
+ * @file tftp-stream.cpp
+ * @brief Read streams shared by concurrent downloads of the same file
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-stream.h"
+
+// Offset of a chunk that holds no data
+static const uint64_t EMPTY_CHUNK = UINT64_MAX;
+
+// Streams of all workers by file identity
+static std::mutex streamsMutex;
+static std::map<TFTPStreamKey, TFTPReadStream *> streams;
+
+// Counters shared by all workers
+static std::atomic<uint64_t> openedStreams(0);
+static std::atomic<uint64_t> attachedSessions(0);
+static std::atomic<uint64_t> chunkReads(0);
+static std::atomic<uint64_t> readBytes(0);
+static std::atomic<uint64_t> chunkHits(0);
+static std::atomic<uint64_t> fallbacks(0);
+
+TFTPReadStream *attachReadStream(int fd, const struct stat &fileStat)
+{
+    // A modified file gets a new stream, sessions still reading the old one keep it
+    TFTPStreamKey key(fileStat.st_dev, fileStat.st_ino, fileStat.st_size, fileStat.st_mtim.tv_sec, fileStat.st_mtim.tv_nsec);
+
+    std::lock_guard<std::mutex> lock(streamsMutex);
+
+    auto it = streams.find(key);
+    if (it != streams.end())
+    {
+        it->second->sessions++;
+        attachedSessions++;
+        return it->second;
+    }
+
+    // The stream reads through its own descriptor, the session that opened it may finish first
+    int streamFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (streamFd < 0)
+    {
+        return nullptr;
+    }
+    posix_fadvise(streamFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    TFTPReadStream *stream = new TFTPReadStream();
+    stream->key = key;
+    stream->fd = streamFd;
+    stream->size = fileStat.st_size;
+    stream->sessions = 1;
+    stream->useCounter = 0;
+    for (size_t i = 0; i < STREAM_CHUNKS; i++)
+    {
+        stream->chunks[i].offset = EMPTY_CHUNK;
+        stream->chunks[i].length = 0;
+        stream->chunks[i].refs = 0;
+        stream->chunks[i].loading = false;
+        stream->chunks[i].lastUse = 0;
+    }
+
+    streams[key] = stream;
+    openedStreams++;
+    attachedSessions++;
+    return stream;
+}
+
+// Reads a whole chunk, pread may return fewer bytes than requested
+static bool readChunk(int fd, TFTPStreamChunk &chunk)
+{
+    if (chunk.data.empty())
+    {
+        chunk.data.resize(STREAM_CHUNK_SIZE);
+    }
+
+    size_t done = 0;
+    while (done < chunk.length)
+    {
+        ssize_t bytesRead = pread(fd, chunk.data.data() + done, chunk.length - done, chunk.offset + done);
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return false;
+        }
+        done += bytesRead;
+    }
+
+    return true;
+}
+
+// Pins the chunk starting at the given offset for the session, reading it if no session did yet
+static TFTPStreamChunk *pinChunk(TFTPReadStream &stream, std::vector<TFTPStreamChunk *> &pinned, uint64_t chunkOffset)
+{
+    // Consecutive blocks of a window mostly lie in the chunk pinned last, a pinned chunk is never replaced
+    if (!pinned.empty() && pinned.back()->offset == chunkOffset)
+    {
+        return pinned.back();
+    }
+
+    std::unique_lock<std::mutex> lock(stream.mutex);
+
+    while (true)
+    {
+        TFTPStreamChunk *found = nullptr;
+        TFTPStreamChunk *victim = nullptr;
+
+        for (size_t i = 0; i < STREAM_CHUNKS; i++)
+        {
+            TFTPStreamChunk &chunk = stream.chunks[i];
+            if (chunk.offset == chunkOffset)
+            {
+                found = &chunk;
+                break;
+            }
+            if (chunk.refs == 0 && !chunk.loading && (victim == nullptr || chunk.lastUse < victim->lastUse))
+            {
+                victim = &chunk;
+            }
+        }
+
+        if (found != nullptr)
+        {
+            // Another session is reading the chunk, wait for it instead of reading it again
+            if (found->loading)
+            {
+                stream.loaded.wait(lock);
+                continue;
+            }
+
+            found->refs++;
+            found->lastUse = ++stream.useCounter;
+            pinned.push_back(found);
+            chunkHits++;
+            return found;
+        }
+
+        // Every chunk holds DATA queued by some session
+        if (victim == nullptr)
+        {
+            fallbacks++;
+            return nullptr;
+        }
+
+        victim->offset = chunkOffset;
+        victim->length = std::min<uint64_t>(STREAM_CHUNK_SIZE, stream.size - chunkOffset);
+        victim->loading = true;
+        victim->refs = 1;
+        victim->lastUse = ++stream.useCounter;
+
+        // Read without holding the lock, sessions using other chunks are not held up
+        lock.unlock();
+        bool success = readChunk(stream.fd, *victim);
+        lock.lock();
+
+        victim->loading = false;
+        stream.loaded.notify_all();
+
+        if (!success)
+        {
+            victim->offset = EMPTY_CHUNK;
+            victim->refs = 0;
+            return nullptr;
+        }
+
+        chunkReads++;
+        readBytes += victim->length;
+        pinned.push_back(victim);
+        return victim;
+    }
+}
+
+const char *streamData(TFTPReadStream &stream, std::vector<TFTPStreamChunk *> &pinned, uint64_t offset, size_t length, char *scratch)
+{
+    uint64_t first = offset - offset % STREAM_CHUNK_SIZE;
+    uint64_t last = (offset + length - 1) - (offset + length - 1) % STREAM_CHUNK_SIZE;
+
+    TFTPStreamChunk *chunk = pinChunk(stream, pinned, first);
+    if (chunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (first == last)
+    {
+        return chunk->data.data() + (offset - first);
+    }
+
+    // A block spanning two chunks is assembled in the scratch buffer
+    TFTPStreamChunk *next = pinChunk(stream, pinned, last);
+    if (next == nullptr)
+    {
+        return nullptr;
+    }
+
+    size_t head = last - offset;
+    memcpy(scratch, chunk->data.data() + (offset - first), head);
+    memcpy(scratch + head, next->data.data(), length - head);
+    return scratch;
+}
+
+void releaseStreamChunks(TFTPReadStream &stream, std::vector<TFTPStreamChunk *> &pinned)
+{
+    if (pinned.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    for (TFTPStreamChunk *chunk : pinned)
+    {
+        chunk->refs--;
+    }
+    pinned.clear();
+}
+
+void detachReadStream(TFTPReadStream *stream, std::vector<TFTPStreamChunk *> &pinned)
+{
+    releaseStreamChunks(*stream, pinned);
+
+    std::lock_guard<std::mutex> lock(streamsMutex);
+    if (--stream->sessions > 0)
+    {
+        return;
+    }
+
+    streams.erase(stream->key);
+    close(stream->fd);
+    delete stream;
+}
+
+TFTPStreamStats streamStats()
+{
+    TFTPStreamStats stats;
+    stats.streams = openedStreams;
+    stats.sessions = attachedSessions;
+    stats.reads = chunkReads;
+    stats.bytes = readBytes;
+    stats.hits = chunkHits;
+    stats.fallbacks = fallbacks;
+    return stats;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file tftp-stream.h
+ * @brief Declarations for read streams shared by concurrent downloads of the same file.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_STREAM_H
+#define TFTP_STREAM_H
+
+#include "tftp-server.h"
+#include <sys/stat.h>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+
+// Bytes of the file read at once, chunks start at multiples of this size
+const size_t STREAM_CHUNK_SIZE = 128 * 1024;
+
+// Chunks kept per file, sessions within this distance of each other share their reads
+const size_t STREAM_CHUNKS = 32;
+
+// Part of a file read once and served to every session reading it
+struct TFTPStreamChunk
+{
+    uint64_t offset; // File offset of the chunk, UINT64_MAX while empty
+    size_t length;
+    int refs;        // Sessions whose queued DATA points into the chunk
+    bool loading;    // Being read by one session, the others wait for it
+    uint64_t lastUse; // Least recently used free chunk is replaced first
+    std::vector<char> data;
+};
+
+// Identity of an open file: device, inode, size and modification time
+typedef std::tuple<dev_t, ino_t, off_t, time_t, long> TFTPStreamKey;
+
+// Ring of chunks of one file shared by all sessions downloading it with the pread backend
+struct TFTPReadStream
+{
+    TFTPStreamKey key;
+    int fd;
+    uint64_t size;
+    int sessions; // Sessions attached to the stream
+    uint64_t useCounter;
+    std::mutex mutex;
+    std::condition_variable loaded; // Signalled when a chunk finishes loading
+    TFTPStreamChunk chunks[STREAM_CHUNKS];
+};
+
+// Counters of the shared read streams
+struct TFTPStreamStats
+{
+    uint64_t streams;    // Streams opened
+    uint64_t sessions;   // Sessions attached to a stream
+    uint64_t reads;      // Chunks read from the file
+    uint64_t bytes;      // Bytes read from the file
+    uint64_t hits;       // Chunks found already read (by the session itself or another one)
+    uint64_t fallbacks;  // Blocks read by the session itself because every chunk was in use
+};
+
+/**
+ * @brief Attaches an open file to the read stream of all sessions reading the same file.
+ *
+ * @param fd Open descriptor of the file.
+ * @param fileStat Status of the open file.
+ * @return Stream of the file, or nullptr if it could not be created.
+ */
+TFTPReadStream *attachReadStream(int fd, const struct stat &fileStat);
+
+/**
+ * @brief Returns the bytes of the file at the given offset from the shared chunks.
+ *
+ * The chunks holding the bytes stay pinned until they are released with releaseStreamChunks.
+ *
+ * @param stream Read stream of the file.
+ * @param pinned Chunks pinned by the session.
+ * @param offset Offset of the first byte.
+ * @param length Number of bytes (at least one, must not reach past the end of the file).
+ * @param scratch Buffer of at least `length` bytes for a range spanning two chunks.
+ * @return Pointer to the data, or nullptr if the chunks are all in use or could not be read.
+ */
+const char *streamData(TFTPReadStream &stream, std::vector<TFTPStreamChunk *> &pinned, uint64_t offset, size_t length, char *scratch);
+
+/**
+ * @brief Unpins the chunks of a session once its queued DATA was sent.
+ *
+ * @param stream Read stream of the file.
+ * @param pinned Chunks pinned by the session, emptied.
+ */
+void releaseStreamChunks(TFTPReadStream &stream, std::vector<TFTPStreamChunk *> &pinned);
+
+/**
+ * @brief Detaches a session from the stream, the stream is closed when its last session detaches.
+ *
+ * @param stream Read stream of the file.
+ * @param pinned Chunks pinned by the session, emptied.
+ */
+void detachReadStream(TFTPReadStream *stream, std::vector<TFTPStreamChunk *> &pinned);
+
+/**
+ * @brief Returns a snapshot of the read stream counters.
+ *
+ * @return Read stream counters.
+ */
+TFTPStreamStats streamStats();
+
+#endif // TFTP_STREAM_H
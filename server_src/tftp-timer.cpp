@@ -0,0 +1,247 @@
+/**
+ * @file tftp-timer.cpp
+ * @brief Hierarchical timer wheel tracking the retransmission and idle deadlines of the sessions of a worker
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-timer.h"
+
+static void initList(TFTPTimer &head)
+{
+    head.prev = &head;
+    head.next = &head;
+}
+
+static void linkTimer(TFTPTimer &head, TFTPTimer &timer)
+{
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+static void unlinkTimer(TFTPTimer &timer)
+{
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = nullptr;
+    timer.next = nullptr;
+}
+
+// Rotates the occupancy bits of a level so that bit 0 is the given slot
+static uint64_t rotateSlots(uint64_t occupied, int slot)
+{
+    return slot == 0 ? occupied : (occupied >> slot) | (occupied << (TIMER_SLOTS - slot));
+}
+
+// Counts trailing zero bits of a non-zero value
+static int firstSlot(uint64_t rotated)
+{
+    return __builtin_ctzll(rotated);
+}
+
+// Tick of a deadline, rounded up so that a timer never expires early
+static uint64_t deadlineTick(const TFTPTimerWheel &wheel, std::chrono::steady_clock::time_point deadline)
+{
+    if (deadline <= wheel.origin)
+    {
+        return 0;
+    }
+    std::chrono::steady_clock::duration elapsed = deadline - wheel.origin;
+    return (elapsed + TIMER_TICK - std::chrono::steady_clock::duration(1)) / TIMER_TICK;
+}
+
+// Links a timer into the slot of its expiry relative to the current tick
+static void placeTimer(TFTPTimerWheel &wheel, TFTPTimer &timer)
+{
+    if (timer.expiry <= wheel.current)
+    {
+        timer.level = TIMER_LEVELS;
+        linkTimer(wheel.expired, timer);
+        return;
+    }
+
+    // The lowest level whose range covers the distance to the expiry, later ones go to the last slot in range
+    uint64_t delta = timer.expiry - wheel.current;
+    uint64_t slotTick = timer.expiry;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+    if (delta >= (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)))
+    {
+        slotTick = wheel.current + (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+    }
+
+    timer.level = level;
+    timer.slot = (slotTick >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+    linkTimer(wheel.slots[level][timer.slot], timer);
+    wheel.occupied[level] |= 1ULL << timer.slot;
+}
+
+// Moves the timers of a slot one or more levels down (or to the expired list)
+static void cascadeSlot(TFTPTimerWheel &wheel, int level, int slot)
+{
+    TFTPTimer &head = wheel.slots[level][slot];
+    wheel.occupied[level] &= ~(1ULL << slot);
+
+    while (head.next != &head)
+    {
+        TFTPTimer *timer = head.next;
+        unlinkTimer(*timer);
+        placeTimer(wheel, *timer);
+    }
+}
+
+void initTimer(TFTPTimer &timer, TFTPSession *session, TFTPTimerKind kind)
+{
+    timer.prev = nullptr;
+    timer.next = nullptr;
+    timer.wheel = nullptr;
+    timer.level = 0;
+    timer.slot = 0;
+    timer.expiry = 0;
+    timer.session = session;
+    timer.kind = kind;
+}
+
+TFTPTimerWheel &workerTimers()
+{
+    static thread_local TFTPTimerWheel *wheel = nullptr;
+    if (wheel == nullptr)
+    {
+        wheel = new TFTPTimerWheel();
+        wheel->origin = std::chrono::steady_clock::now();
+        wheel->current = 0;
+        wheel->count = 0;
+        for (int level = 0; level < TIMER_LEVELS; level++)
+        {
+            wheel->occupied[level] = 0;
+            for (int slot = 0; slot < TIMER_SLOTS; slot++)
+            {
+                initList(wheel->slots[level][slot]);
+            }
+        }
+        initList(wheel->expired);
+    }
+    return *wheel;
+}
+
+void scheduleTimer(TFTPTimerWheel &wheel, TFTPTimer &timer, std::chrono::steady_clock::time_point deadline)
+{
+    cancelTimer(timer);
+
+    timer.wheel = &wheel;
+    timer.deadline = deadline;
+    timer.expiry = deadlineTick(wheel, deadline);
+    placeTimer(wheel, timer);
+    wheel.count++;
+}
+
+void cancelTimer(TFTPTimer &timer)
+{
+    TFTPTimerWheel *wheel = timer.wheel;
+    if (wheel == nullptr)
+    {
+        return;
+    }
+
+    unlinkTimer(timer);
+    if (timer.level < TIMER_LEVELS)
+    {
+        TFTPTimer &head = wheel->slots[timer.level][timer.slot];
+        if (head.next == &head)
+        {
+            wheel->occupied[timer.level] &= ~(1ULL << timer.slot);
+        }
+    }
+    timer.wheel = nullptr;
+    wheel->count--;
+}
+
+void advanceTimers(TFTPTimerWheel &wheel, std::chrono::steady_clock::time_point now)
+{
+    uint64_t target = (now - wheel.origin) / TIMER_TICK;
+
+    while (wheel.current < target)
+    {
+        // Nothing happens before the next boundary of the lowest non-empty level, skip the empty ticks
+        int level = 0;
+        while (level < TIMER_LEVELS && wheel.occupied[level] == 0)
+        {
+            level++;
+        }
+        if (level == TIMER_LEVELS)
+        {
+            wheel.current = target;
+            break;
+        }
+        if (level > 0)
+        {
+            uint64_t boundary = ((wheel.current >> (TIMER_SLOT_BITS * level)) + 1) << (TIMER_SLOT_BITS * level);
+            wheel.current = std::min(target, boundary - 1);
+            if (wheel.current == target)
+            {
+                break;
+            }
+        }
+
+        wheel.current++;
+
+        // At a boundary of level N the slots of levels N..1 reached by the tick move down
+        int cascaded = 1;
+        while (cascaded < TIMER_LEVELS && (wheel.current & ((1ULL << (TIMER_SLOT_BITS * cascaded)) - 1)) == 0)
+        {
+            cascaded++;
+        }
+        for (int upper = cascaded - 1; upper >= 1; upper--)
+        {
+            cascadeSlot(wheel, upper, (wheel.current >> (TIMER_SLOT_BITS * upper)) & (TIMER_SLOTS - 1));
+        }
+
+        cascadeSlot(wheel, 0, wheel.current & (TIMER_SLOTS - 1));
+    }
+}
+
+TFTPTimer *popExpiredTimer(TFTPTimerWheel &wheel)
+{
+    if (wheel.expired.next == &wheel.expired)
+    {
+        return nullptr;
+    }
+
+    TFTPTimer *timer = wheel.expired.next;
+    cancelTimer(*timer);
+    return timer;
+}
+
+bool nextTimerWakeup(const TFTPTimerWheel &wheel, std::chrono::steady_clock::time_point &wakeup)
+{
+    if (wheel.count == 0)
+    {
+        return false;
+    }
+    if (wheel.expired.next != &wheel.expired)
+    {
+        wakeup = wheel.origin + wheel.current * TIMER_TICK;
+        return true;
+    }
+
+    // Level 0 slots hold exact ticks, upper slots are due when the wheel reaches their start
+    uint64_t earliest = UINT64_MAX;
+    for (int level = 0; level < TIMER_LEVELS; level++)
+    {
+        if (wheel.occupied[level] == 0)
+        {
+            continue;
+        }
+        uint64_t position = wheel.current >> (TIMER_SLOT_BITS * level);
+        int next = (position + 1) & (TIMER_SLOTS - 1);
+        uint64_t tick = (position + 1 + firstSlot(rotateSlots(wheel.occupied[level], next))) << (TIMER_SLOT_BITS * level);
+        earliest = std::min(earliest, tick);
+    }
+
+    wakeup = wheel.origin + earliest * TIMER_TICK;
+    return true;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file tftp-timer.h
+ * @brief Declarations for the hierarchical timer wheel of the session deadlines of a worker.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_TIMER_H
+#define TFTP_TIMER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+struct TFTPSession;
+struct TFTPTimerWheel;
+
+// Resolution of the wheel, deadlines are rounded up to the next tick
+const std::chrono::milliseconds TIMER_TICK(1);
+
+// Levels of the wheel and slots per level, level N covers 64^(N+1) ticks (about 4.6 hours in total)
+const int TIMER_LEVELS = 4;
+const int TIMER_SLOT_BITS = 6;
+const int TIMER_SLOTS = 1 << TIMER_SLOT_BITS;
+
+// Deadlines of a session
+enum TFTPTimerKind
+{
+    TIMER_RETRANSMIT, // Retransmission deadline of the packet in flight
+    TIMER_IDLE,       // Reaping of a session that has not progressed
+    TIMER_PACING,     // Tokens of the rate limits available for the sessions waiting in the shaper
+    TIMER_ZEROCOPY    // Completions of the zero-copy sends of released sessions (timer of the worker, no session)
+};
+
+// Timer linked into a slot of the wheel, its expired list or nowhere
+struct TFTPTimer
+{
+    TFTPTimer *prev;
+    TFTPTimer *next;
+    TFTPTimerWheel *wheel;   // Wheel the timer is linked into, nullptr if not scheduled
+    int level;               // Level of the slot, TIMER_LEVELS for the expired list
+    int slot;
+    uint64_t expiry;         // Tick of the deadline
+    std::chrono::steady_clock::time_point deadline;
+    TFTPSession *session;
+    TFTPTimerKind kind;
+};
+
+// Hierarchical timing wheel: scheduling and cancelling are O(1), expiring is O(1) per timer
+struct TFTPTimerWheel
+{
+    std::chrono::steady_clock::time_point origin; // Time of tick 0
+    uint64_t current;                             // Last tick processed
+    uint64_t occupied[TIMER_LEVELS];              // Non-empty slots of every level
+    TFTPTimer slots[TIMER_LEVELS][TIMER_SLOTS];   // List heads of the slots
+    TFTPTimer expired;                            // List head of the expired timers
+    size_t count;                                 // Timers scheduled or expired
+};
+
+/**
+ * @brief Initializes a timer so that it can be scheduled.
+ *
+ * @param timer Timer to initialize.
+ * @param session Session the timer belongs to, nullptr for a timer of the worker.
+ * @param kind Deadline the timer tracks.
+ */
+void initTimer(TFTPTimer &timer, TFTPSession *session, TFTPTimerKind kind);
+
+/**
+ * @brief Returns the timer wheel of the calling worker thread.
+ *
+ * @return Timer wheel of the worker.
+ */
+TFTPTimerWheel &workerTimers();
+
+/**
+ * @brief Schedules (or reschedules) a timer, a deadline that has passed expires at once.
+ *
+ * @param wheel Timer wheel.
+ * @param timer Timer to schedule.
+ * @param deadline Time at which the timer expires.
+ */
+void scheduleTimer(TFTPTimerWheel &wheel, TFTPTimer &timer, std::chrono::steady_clock::time_point deadline);
+
+/**
+ * @brief Removes a timer from its wheel (nothing happens if it is not scheduled).
+ *
+ * @param timer Timer to cancel.
+ */
+void cancelTimer(TFTPTimer &timer);
+
+/**
+ * @brief Moves the timers whose deadline passed to the expired list of the wheel.
+ *
+ * @param wheel Timer wheel.
+ * @param now Current time.
+ */
+void advanceTimers(TFTPTimerWheel &wheel, std::chrono::steady_clock::time_point now);
+
+/**
+ * @brief Removes the first timer from the expired list.
+ *
+ * @param wheel Timer wheel.
+ * @return Expired timer, or nullptr if no timer expired.
+ */
+TFTPTimer *popExpiredTimer(TFTPTimerWheel &wheel);
+
+/**
+ * @brief Returns the time the event loop has to wake up at to expire the next timer.
+ *
+ * Timers on the upper levels are moved down at the start of their slot, the loop may wake up
+ * before the deadline itself and go to sleep again.
+ *
+ * @param wheel Timer wheel.
+ * @param wakeup Time to wake up at.
+ * @return True if a timer is scheduled, otherwise False.
+ */
+bool nextTimerWakeup(const TFTPTimerWheel &wheel, std::chrono::steady_clock::time_point &wakeup);
+
+#endif // TFTP_TIMER_H
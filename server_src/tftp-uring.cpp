@@ -0,0 +1,555 @@
+/**
+ * @file tftp-uring.cpp
+ * @brief io_uring event engine of the TFTP server workers
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-uring.h"
+
+// System calls of io_uring (the C library has no wrappers)
+static int uringSetup(unsigned entries, io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// Returns a receive buffer to the kernel
+static void recycleBuffer(TFTPUring &ring, uint16_t bufferId)
+{
+    io_uring_buf *bufs = reinterpret_cast<io_uring_buf *>(ring.bufRing);
+    io_uring_buf &buf = bufs[ring.bufTail & (URING_BUFFERS - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(ring.buffers.memory + bufferId * ring.buffers.bufferSize);
+    buf.len = ring.bufferSize;
+    buf.bid = bufferId;
+
+    ring.bufTail++;
+    __atomic_store_n(&ring.bufRing->tail, ring.bufTail, __ATOMIC_RELEASE);
+}
+
+bool setupUring(TFTPUring &ring, size_t bufferSize)
+{
+    ring.fd = -1;
+    ring.sqRing = nullptr;
+    ring.cqRing = nullptr;
+    ring.sqes = nullptr;
+    ring.bufRing = nullptr;
+    ring.pending = 0;
+    ring.bufferSize = bufferSize;
+    ring.buffers.memory = nullptr;
+    ring.bufTail = 0;
+    ring.timerArmed = false;
+    ring.timerGeneration = 0;
+    ring.unarmed.clear();
+    ring.failures = 0;
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.fd = uringSetup(URING_ENTRIES, &params);
+    if (ring.fd < 0)
+    {
+        return false;
+    }
+
+    // Map the submission queue, the completion queue and the submission entries
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    void *sqRing = mmap(nullptr, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    void *cqRing = mmap(nullptr, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+
+    ring.sqRing = sqRing != MAP_FAILED ? sqRing : nullptr;
+    ring.cqRing = cqRing != MAP_FAILED ? cqRing : nullptr;
+    ring.sqes = sqes != MAP_FAILED ? static_cast<io_uring_sqe *>(sqes) : nullptr;
+
+    if (ring.sqRing == nullptr || ring.cqRing == nullptr || ring.sqes == nullptr)
+    {
+        closeUring(ring);
+        return false;
+    }
+
+    char *sq = static_cast<char *>(ring.sqRing);
+    ring.sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    ring.sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    ring.sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    ring.sqEntries = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    ring.sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(ring.cqRing);
+    ring.cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    ring.cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    ring.cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Register the ring of receive buffers the kernel picks from (IORING_REGISTER_PBUF_RING)
+    ring.bufRingSize = URING_BUFFERS * sizeof(io_uring_buf);
+    void *bufRing = mmap(nullptr, ring.bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED)
+    {
+        closeUring(ring);
+        return false;
+    }
+    ring.bufRing = static_cast<io_uring_buf_ring *>(bufRing);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+
+    if (uringRegister(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        closeUring(ring);
+        return false;
+    }
+
+    if (!initPacketPool(ring.buffers, URING_BUFFERS, bufferSize))
+    {
+        closeUring(ring);
+        return false;
+    }
+    for (unsigned i = 0; i < URING_BUFFERS; i++)
+    {
+        recycleBuffer(ring, i);
+    }
+
+    // Every received buffer starts with io_uring_recvmsg_out followed by the source address and the payload
+    memset(&ring.recvHeader, 0, sizeof(ring.recvHeader));
+    ring.recvHeader.msg_namelen = sizeof(sockaddr_in);
+
+    return true;
+}
+
+void closeUring(TFTPUring &ring)
+{
+    if (ring.bufRing != nullptr)
+    {
+        munmap(ring.bufRing, ring.bufRingSize);
+        ring.bufRing = nullptr;
+    }
+    if (ring.sqes != nullptr)
+    {
+        munmap(ring.sqes, ring.sqesSize);
+        ring.sqes = nullptr;
+    }
+    if (ring.cqRing != nullptr)
+    {
+        munmap(ring.cqRing, ring.cqRingSize);
+        ring.cqRing = nullptr;
+    }
+    if (ring.sqRing != nullptr)
+    {
+        munmap(ring.sqRing, ring.sqRingSize);
+        ring.sqRing = nullptr;
+    }
+    if (ring.fd >= 0)
+    {
+        close(ring.fd);
+        ring.fd = -1;
+    }
+    destroyPacketPool(ring.buffers);
+}
+
+// Hands the queued submission entries to the kernel and optionally waits for a completion
+static int submitEntries(TFTPUring &ring, unsigned waitCount)
+{
+    int submitted = uringEnter(ring.fd, ring.pending, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (submitted > 0)
+    {
+        ring.pending -= std::min<unsigned>(submitted, ring.pending);
+    }
+    return submitted;
+}
+
+// Returns a cleared submission entry, or nullptr if the queue is full
+static io_uring_sqe *getEntry(TFTPUring &ring)
+{
+    unsigned tail = *ring.sqTail;
+
+    if (tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= *ring.sqEntries)
+    {
+        // Make room by submitting what is queued
+        submitEntries(ring, 0);
+        if (tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= *ring.sqEntries)
+        {
+            return nullptr;
+        }
+    }
+
+    unsigned index = tail & *ring.sqMask;
+    io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sqArray[index] = index;
+    return sqe;
+}
+
+// Publishes the entry returned by getEntry
+static void pushEntry(TFTPUring &ring)
+{
+    __atomic_store_n(ring.sqTail, *ring.sqTail + 1, __ATOMIC_RELEASE);
+    ring.pending++;
+}
+
+// Starts a multishot receive on a socket, completions carry the socket as user data
+static bool armReceive(TFTPUring &ring, int sockfd)
+{
+    io_uring_sqe *sqe = getEntry(ring);
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sockfd;
+    sqe->addr = reinterpret_cast<uint64_t>(&ring.recvHeader);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = sockfd;
+    pushEntry(ring);
+    return true;
+}
+
+// Starts the receive of a socket, a full submission queue leaves it for the next iteration
+static void queueReceive(TFTPUring &ring, int sockfd)
+{
+    if (!armReceive(ring, sockfd))
+    {
+        ring.unarmed.insert(sockfd);
+    }
+}
+
+// Arms the receives left over by a full submission queue
+static void armPendingReceives(TFTPUring &ring)
+{
+    for (auto it = ring.unarmed.begin(); it != ring.unarmed.end(); it = ring.unarmed.erase(it))
+    {
+        if (!armReceive(ring, *it))
+        {
+            ring.failures++;
+            return;
+        }
+    }
+}
+
+// Cancels the multishot receive of a socket
+static void cancelReceive(TFTPUring &ring, int sockfd)
+{
+    io_uring_sqe *sqe = getEntry(ring);
+    if (sqe == nullptr)
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = sockfd;
+    sqe->user_data = URING_CANCEL_TAG;
+    pushEntry(ring);
+}
+
+// Arms an absolute timeout at the given deadline, or moves the pending one (steady_clock counts CLOCK_MONOTONIC like io_uring)
+static void armTimeout(TFTPUring &ring, std::chrono::steady_clock::time_point deadline)
+{
+    io_uring_sqe *sqe = getEntry(ring);
+    if (sqe == nullptr)
+    {
+        return;
+    }
+
+    // The kernel copies the time when the entry is submitted
+    std::chrono::nanoseconds sinceEpoch = deadline.time_since_epoch();
+    ring.timerSpec.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+    ring.timerSpec.tv_nsec = (sinceEpoch % std::chrono::seconds(1)).count();
+
+    if (ring.timerArmed)
+    {
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = URING_TIMER_TAG | ring.timerGeneration;
+        sqe->addr2 = reinterpret_cast<uint64_t>(&ring.timerSpec);
+        sqe->timeout_flags = IORING_TIMEOUT_UPDATE | IORING_TIMEOUT_ABS;
+        sqe->user_data = URING_UPDATE_TAG | ring.timerGeneration;
+    }
+    else
+    {
+        ring.timerGeneration++;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&ring.timerSpec);
+        sqe->len = 1;
+        sqe->off = 0; // Fire on time only, not after a number of completions
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        sqe->user_data = URING_TIMER_TAG | ring.timerGeneration;
+    }
+    pushEntry(ring);
+
+    ring.timerArmed = true;
+    ring.timerDeadline = deadline;
+}
+
+// Removes a finished session from the loop, its socket is closed once the receive is cancelled
+static void releaseSession(TFTPUring &ring, std::map<int, TFTPSession *> &sessions, std::map<int, TFTPSession *> &closing, std::map<int, TFTPSession *>::iterator it, bool receiveArmed)
+{
+    // A socket still waiting for its receive to be queued has nothing to cancel
+    if (ring.unarmed.erase(it->first) > 0)
+    {
+        receiveArmed = false;
+    }
+
+    if (receiveArmed)
+    {
+        // Only the socket waits for the cancellation, the session leaves its timers, requests and group now
+        detachSession(it->second);
+        cancelReceive(ring, it->first);
+        closing[it->first] = it->second;
+    }
+    else
+    {
+        closeSession(it->second);
+    }
+    sessions.erase(it);
+}
+
+bool runUringWorker(const TFTPServerConfig &config, int workerId, int sockfd, sockaddr_in &serverAddr, std::map<int, TFTPSession *> &sessions)
+{
+    TFTPUring ring;
+    if (!setupUring(ring, sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + MAX_PACKET_SIZE))
+    {
+        return false;
+    }
+
+    // Kernels without multishot receives reject the request right at submission
+    if (!armReceive(ring, sockfd))
+    {
+        closeUring(ring);
+        return false;
+    }
+    submitEntries(ring, 0);
+    if (*ring.cqHead != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE))
+    {
+        io_uring_cqe *cqe = &ring.cqes[*ring.cqHead & *ring.cqMask];
+        if (cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE))
+        {
+            closeUring(ring);
+            return false;
+        }
+    }
+
+    std::map<int, TFTPSession *> closing; // Sessions waiting for the cancellation of their receive
+    TFTPTimerWheel &timers = workerTimers();
+    bool fallback = false;
+
+    while (true)
+    {
+        handleStatsRequest();
+
+        // A kernel rejecting every receive would make the loop re-arm it forever
+        if (ring.failures >= URING_FAILURE_LIMIT)
+        {
+            std::cout << "Worker " << workerId << ": io_uring keeps failing the receives" << std::endl;
+            fallback = true;
+            break;
+        }
+
+        armPendingReceives(ring);
+
+        // Wake up when the timer wheel has to be advanced
+        std::chrono::steady_clock::time_point earliest;
+        if (nextTimerWakeup(timers, earliest))
+        {
+            if (!ring.timerArmed || earliest < ring.timerDeadline)
+            {
+                armTimeout(ring, earliest);
+            }
+        }
+
+        // Do not sleep while a socket has no receive queued, the listening socket could miss its requests
+        if (submitEntries(ring, ring.unarmed.empty() ? 1 : 0) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // A full completion queue refuses submissions until it is drained below
+            if (errno != EBUSY && errno != EAGAIN)
+            {
+                std::cout << "Worker " << workerId << ": Error waiting for completions" << std::endl;
+                break;
+            }
+        }
+
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++)
+        {
+            io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+            uint64_t userData = cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            bool receiveArmed = (flags & IORING_CQE_F_MORE) != 0;
+
+            if (userData & URING_TIMER_TAG)
+            {
+                if ((userData & ~URING_TIMER_TAG) == ring.timerGeneration)
+                {
+                    ring.timerArmed = false;
+                }
+                continue;
+            }
+            if (userData & URING_UPDATE_TAG)
+            {
+                // The timeout fired before it could be moved, the next iteration arms a new one
+                if (result < 0 && (userData & ~URING_UPDATE_TAG) == ring.timerGeneration)
+                {
+                    ring.timerArmed = false;
+                }
+                continue;
+            }
+            if (userData == URING_CANCEL_TAG)
+            {
+                continue;
+            }
+
+            int fd = static_cast<int>(userData);
+
+            // Locate the datagram in the buffer picked by the kernel
+            const uint8_t *packet = nullptr;
+            size_t length = 0;
+            sockaddr_in fromAddr;
+            int bufferId = -1;
+
+            if (result >= 0 && (flags & IORING_CQE_F_BUFFER))
+            {
+                bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+                const uint8_t *buffer = ring.buffers.memory + bufferId * ring.buffers.bufferSize;
+                const io_uring_recvmsg_out *out = reinterpret_cast<const io_uring_recvmsg_out *>(buffer);
+
+                memcpy(&fromAddr, buffer + sizeof(*out), sizeof(fromAddr));
+                packet = buffer + sizeof(*out) + ring.recvHeader.msg_namelen + ring.recvHeader.msg_controllen;
+                length = std::min<size_t>(out->payloadlen, result - (packet - buffer));
+                ring.failures = 0;
+            }
+            else if (result < 0 && result != -ECANCELED)
+            {
+                // -ENOBUFS: every buffer was taken, they are returned before the receive is submitted again
+                // -EINVAL and others: the kernel rejected the receive, repeated failures end the engine
+                if (result != -ENOBUFS)
+                {
+                    std::cout << "Worker " << workerId << ": Error receiving packet" << std::endl;
+                }
+                ring.failures++;
+            }
+
+            if (fd == sockfd)
+            {
+                if (packet != nullptr)
+                {
+                    // The request is parsed straight from the provided buffer
+                    TFTPSession *session = startRequest(config, sockfd, serverAddr, packet, length, fromAddr);
+                    if (session != nullptr)
+                    {
+                        sessions[session->sockfd] = session;
+                        queueReceive(ring, session->sockfd);
+                    }
+                }
+
+                if (!receiveArmed)
+                {
+                    queueReceive(ring, sockfd);
+                }
+            }
+            else
+            {
+                auto it = sessions.find(fd);
+                if (it != sessions.end())
+                {
+                    TFTPSession *session = it->second;
+                    if (packet != nullptr)
+                    {
+                        sessionHandlePacket(*session, packet, length, fromAddr);
+                    }
+
+                    if (session->state == SESSION_DONE)
+                    {
+                        releaseSession(ring, sessions, closing, it, receiveArmed);
+                    }
+                    else if (!receiveArmed)
+                    {
+                        queueReceive(ring, fd);
+                    }
+                }
+                else
+                {
+                    // The last completion of a cancelled receive, the socket can be closed
+                    auto closingIt = closing.find(fd);
+                    if (closingIt != closing.end() && !receiveArmed)
+                    {
+                        closeSession(closingIt->second);
+                        closing.erase(closingIt);
+                    }
+                }
+            }
+
+            if (bufferId >= 0)
+            {
+                recycleBuffer(ring, bufferId);
+            }
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+        // Retransmit, abandon or reap the sessions whose deadline expired
+        advanceTimers(timers, std::chrono::steady_clock::now());
+        while (TFTPTimer *timer = popExpiredTimer(timers))
+        {
+            TFTPSession *session = timer->session;
+            sessionHandleTimer(*timer);
+            if (session != nullptr && session->state == SESSION_DONE)
+            {
+                auto it = sessions.find(session->sockfd);
+                if (it != sessions.end())
+                {
+                    releaseSession(ring, sessions, closing, it, true);
+                }
+            }
+        }
+    }
+
+    // Closing the instance cancels the remaining receives, running transfers continue on epoll
+    if (fallback)
+    {
+        closeUring(ring);
+        for (auto &pair : closing)
+        {
+            closeSession(pair.second);
+        }
+        return false;
+    }
+
+    // Release all sessions when the server loop ends
+    for (auto &pair : sessions)
+    {
+        closeSession(pair.second);
+    }
+    sessions.clear();
+    for (auto &pair : closing)
+    {
+        closeSession(pair.second);
+    }
+    closeUring(ring);
+    return true;
+}
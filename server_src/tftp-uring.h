@@ -0,0 +1,107 @@
+/**
+ * @file tftp-uring.h
+ * @brief Declarations for the io_uring event engine of the server workers.
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_URING_H
+#define TFTP_URING_H
+
+#include "tftp-server.h"
+#include "tftp-session.h"
+#include "tftp-pool.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <set>
+
+// Size of the submission queue and of the provided buffer ring (must be a power of two)
+const unsigned URING_ENTRIES = 256;
+const unsigned URING_BUFFERS = 64;
+
+// Consecutive receives the kernel failed or that could not be queued before the worker falls back to epoll
+const unsigned URING_FAILURE_LIMIT = 16;
+
+// Buffer group of the receive buffers
+const uint16_t URING_BUFFER_GROUP = 1;
+
+// Tags of the completions that do not belong to a receive (receives carry the socket)
+const uint64_t URING_TIMER_TAG = 1ULL << 62;  // Combined with the generation of the timeout
+const uint64_t URING_CANCEL_TAG = 1ULL << 61;
+const uint64_t URING_UPDATE_TAG = 1ULL << 60; // Combined with the generation of the moved timeout
+
+// Structure representing an io_uring instance with its mapped queues and provided receive buffers
+struct TFTPUring
+{
+    int fd;
+
+    // Submission queue
+    void *sqRing;
+    size_t sqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqEntries;
+    unsigned *sqArray;
+    unsigned pending; // Entries queued but not yet submitted
+
+    // Completion queue
+    void *cqRing;
+    size_t cqRingSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    // Receive buffers handed to the kernel through a registered buffer ring
+    io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    TFTPPacketPool buffers; // Cache-line aligned, identified by their index in the pool
+    size_t bufferSize;
+    uint16_t bufTail;
+    msghdr recvHeader; // Layout of the multishot receives (source address, no control data)
+    std::set<int> unarmed; // Sockets whose receive could not be queued, armed again on the next iteration
+    unsigned failures;     // Consecutive failed receives, reset by every received datagram
+
+    // Absolute timeout waking the loop at the earliest session deadline
+    __kernel_timespec timerSpec;
+    bool timerArmed;
+    std::chrono::steady_clock::time_point timerDeadline;
+    uint64_t timerGeneration; // Identifies the pending timeout, a sooner deadline moves it instead of adding another
+};
+
+/**
+ * @brief Creates the io_uring instance, maps its queues and registers the receive buffers.
+ *
+ * @param ring io_uring instance to initialize.
+ * @param bufferSize Size of one receive buffer.
+ * @return True if io_uring is supported and was set up, otherwise False.
+ */
+bool setupUring(TFTPUring &ring, size_t bufferSize);
+
+/**
+ * @brief Unmaps the queues and closes the io_uring instance.
+ *
+ * @param ring io_uring instance.
+ */
+void closeUring(TFTPUring &ring);
+
+/**
+ * @brief Event loop of one server worker driven by io_uring.
+ *
+ * Datagrams of the listening socket and of every transfer socket are received by multishot
+ * receives into provided buffers, retransmission deadlines are driven by timeout requests.
+ * When the kernel keeps rejecting the receives, the running sessions are handed back to the caller.
+ *
+ * @param config Server configuration.
+ * @param workerId Index of the worker.
+ * @param sockfd Bound listening socket.
+ * @param serverAddr sockaddr_in structure representing the server.
+ * @param sessions Filled with the running sessions, keyed by their transfer socket, when the worker falls back.
+ * @return False if io_uring is not supported and the worker should fall back to epoll, otherwise True when the loop ends.
+ */
+bool runUringWorker(const TFTPServerConfig &config, int workerId, int sockfd, sockaddr_in &serverAddr, std::map<int, TFTPSession *> &sessions);
+
+#endif // TFTP_URING_H
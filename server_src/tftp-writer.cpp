@@ -0,0 +1,444 @@
+/**
+ * @file tftp-writer.cpp
+ * @brief Asynchronous write pipeline of uploaded files of the TFTP server
+ * @author xnovos14 - Denis Novosád
+ */
+
+#include "tftp-writer.h"
+
+// Counters shared by all writer threads
+static std::atomic<uint64_t> writes(0);
+static std::atomic<uint64_t> writtenBytes(0);
+static std::atomic<uint64_t> extraChunks(0);
+static std::atomic<uint64_t> commits(0);
+static std::atomic<uint64_t> aborts(0);
+static std::atomic<uint64_t> failures(0);
+
+// Writer thread of one worker with the chunks circulating between them
+struct TFTPWriter
+{
+    std::thread thread;
+    TFTPWriteQueue requests;   // Worker -> writer thread
+    TFTPWriteQueue freeChunks; // Writer thread -> worker
+    sem_t pending;             // Requests waiting in the queue
+    sem_t available;           // Free chunks waiting in the queue
+    TFTPPacketPool chunks;
+};
+
+static void initQueue(TFTPWriteQueue &queue)
+{
+    queue.head = 0;
+    queue.tail = 0;
+}
+
+static bool pushRequest(TFTPWriteQueue &queue, const TFTPWriteRequest &request)
+{
+    size_t tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) == WRITE_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    queue.slots[tail & (WRITE_QUEUE_SIZE - 1)] = request;
+    queue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+static bool popRequest(TFTPWriteQueue &queue, TFTPWriteRequest &request)
+{
+    size_t head = queue.head.load(std::memory_order_relaxed);
+    if (head == queue.tail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    request = queue.slots[head & (WRITE_QUEUE_SIZE - 1)];
+    queue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Waits for a semaphore, restarting when interrupted by a signal
+static void waitSemaphore(sem_t &semaphore)
+{
+    while (sem_wait(&semaphore) < 0 && errno == EINTR)
+    {
+    }
+}
+
+// Writes a whole chunk, pwrite may write only a part of it
+static bool writeChunk(int fd, const char *data, size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+// Makes the upload durable and replaces the destination file with it
+static bool finishUpload(TFTPUpload &upload)
+{
+    if (ftruncate(upload.fd, upload.length) < 0 || fsync(upload.fd) < 0)
+    {
+        return false;
+    }
+    if (close(upload.fd) < 0)
+    {
+        upload.fd = -1;
+        return false;
+    }
+    upload.fd = -1;
+
+    return rename(upload.tempPath.c_str(), upload.path.c_str()) == 0;
+}
+
+// Chunks outside of the pool were allocated when all of its chunks were in use
+static bool pooledChunk(const TFTPWriter &writer, const char *data)
+{
+    const uint8_t *chunk = reinterpret_cast<const uint8_t *>(data);
+    return chunk >= writer.chunks.memory && chunk < writer.chunks.memory + writer.chunks.bufferCount * writer.chunks.bufferSize;
+}
+
+static void releaseUpload(TFTPUpload *upload)
+{
+    if (upload->fd >= 0)
+    {
+        close(upload->fd);
+    }
+    delete upload;
+}
+
+static void runWriter(TFTPWriter *writer)
+{
+    while (true)
+    {
+        waitSemaphore(writer->pending);
+
+        TFTPWriteRequest request;
+        popRequest(writer->requests, request);
+
+        TFTPUpload *upload = request.upload;
+
+        if (request.type == WRITE_STOP)
+        {
+            return;
+        }
+
+        if (request.type == WRITE_DATA && !upload->failed)
+        {
+            if (writeChunk(upload->fd, request.data, request.length, request.offset))
+            {
+                writes++;
+                writtenBytes += request.length;
+            }
+            else
+            {
+                std::cout << "Error writing " << upload->tempPath << ": " << strerror(errno) << std::endl;
+                failures++;
+                upload->failed = true;
+            }
+        }
+        else if (request.type == WRITE_COMMIT)
+        {
+            bool committed = true;
+            if (!upload->failed && writeChunk(upload->fd, upload->tail, upload->tailLength, upload->length - upload->tailLength) &&
+                finishUpload(*upload))
+            {
+                commits++;
+            }
+            else
+            {
+                std::cout << "Error committing " << upload->path << std::endl;
+                failures++;
+                unlink(upload->tempPath.c_str());
+                committed = false;
+            }
+
+            // The session reads the result and releases the upload, unless it was closed in the meantime
+            int pending = COMMIT_PENDING;
+            if (!upload->commitState.compare_exchange_strong(pending, committed ? COMMIT_DONE : COMMIT_FAILED))
+            {
+                releaseUpload(upload);
+            }
+        }
+        else if (request.type == WRITE_ABORT)
+        {
+            aborts++;
+            unlink(upload->tempPath.c_str());
+            releaseUpload(upload);
+        }
+
+        // Hand the chunk back to the worker, there is always room for every preallocated chunk
+        if (request.data != nullptr && !pooledChunk(*writer, request.data))
+        {
+            delete[] request.data;
+        }
+        else if (request.data != nullptr)
+        {
+            TFTPWriteRequest chunk;
+            memset(&chunk, 0, sizeof(chunk));
+            chunk.data = request.data;
+            pushRequest(writer->freeChunks, chunk);
+            sem_post(&writer->available);
+        }
+    }
+}
+
+// Starts the writer thread of the calling worker and stops it when the worker exits
+struct TFTPWorkerWriter
+{
+    TFTPWriter writer;
+
+    TFTPWorkerWriter()
+    {
+        initQueue(writer.requests);
+        initQueue(writer.freeChunks);
+        sem_init(&writer.pending, 0, 0);
+        sem_init(&writer.available, 0, 0);
+
+        if (initPacketPool(writer.chunks, WRITE_CHUNKS, WRITE_CHUNK_SIZE))
+        {
+            for (size_t i = 0; i < WRITE_CHUNKS; i++)
+            {
+                TFTPWriteRequest chunk;
+                memset(&chunk, 0, sizeof(chunk));
+                chunk.data = reinterpret_cast<char *>(acquirePacketBuffer(writer.chunks));
+                pushRequest(writer.freeChunks, chunk);
+                sem_post(&writer.available);
+            }
+        }
+
+        writer.thread = std::thread(runWriter, &writer);
+    }
+
+    ~TFTPWorkerWriter()
+    {
+        TFTPWriteRequest stop;
+        memset(&stop, 0, sizeof(stop));
+        stop.type = WRITE_STOP;
+        while (!pushRequest(writer.requests, stop))
+        {
+            sched_yield();
+        }
+        sem_post(&writer.pending);
+        writer.thread.join();
+
+        destroyPacketPool(writer.chunks);
+        sem_destroy(&writer.pending);
+        sem_destroy(&writer.available);
+    }
+};
+
+static TFTPWriter &workerWriter()
+{
+    static thread_local TFTPWorkerWriter workerWriter;
+    return workerWriter.writer;
+}
+
+// Passes a request to the writer thread, waiting while its queue is full
+static void submitRequest(TFTPWriter &writer, TFTPWriteType type, TFTPUpload *upload, char *data, uint64_t offset, size_t length)
+{
+    TFTPWriteRequest request;
+    request.type = type;
+    request.upload = upload;
+    request.data = data;
+    request.offset = offset;
+    request.length = length;
+
+    while (!pushRequest(writer.requests, request))
+    {
+        sched_yield();
+    }
+    sem_post(&writer.pending);
+}
+
+// Forgets the chunk held by the upload
+static void stopFilling(TFTPUpload &upload)
+{
+    upload.chunk = nullptr;
+    upload.chunkLength = 0;
+}
+
+// Passes the filled chunk of the upload to the writer thread
+static void submitChunk(TFTPWriter &writer, TFTPUpload &upload)
+{
+    submitRequest(writer, WRITE_DATA, &upload, upload.chunk, upload.chunkOffset, upload.chunkLength);
+
+    upload.chunkOffset += upload.chunkLength;
+    stopFilling(upload);
+}
+
+// Takes a free chunk without waiting, a chunk is allocated when all chunks of the pool are filled or queued
+static char *acquireChunk(TFTPWriter &writer)
+{
+    if (sem_trywait(&writer.available) < 0)
+    {
+        // Every upload holds at most one chunk being filled, so the extra chunks are bounded by the running uploads
+        extraChunks++;
+        return new char[WRITE_CHUNK_SIZE];
+    }
+
+    TFTPWriteRequest chunk;
+    popRequest(writer.freeChunks, chunk);
+    return chunk.data;
+}
+
+TFTPUpload *openUpload(const std::string &path, long long preallocate, bool netascii, uint16_t &errorCode)
+{
+    TFTPWriter &writer = workerWriter();
+    if (writer.chunks.memory == nullptr)
+    {
+        errorCode = ERROR_UNDEFINED;
+        return nullptr;
+    }
+
+    // The temporary file lives in the destination directory, rename is atomic only within one file system
+    std::string tempPath = path + ".XXXXXX";
+    int fd = mkstemp(&tempPath[0]);
+    if (fd < 0)
+    {
+        errorCode = (errno == ENOSPC || errno == EDQUOT) ? ERROR_DISK_FULL : ERROR_ACCESS_VIOLATION;
+        return nullptr;
+    }
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    // Reserve the announced size at once, file systems without fallocate allocate while writing
+    if (preallocate > 0 && fallocate(fd, 0, 0, preallocate) < 0 && (errno == ENOSPC || errno == EDQUOT))
+    {
+        close(fd);
+        unlink(tempPath.c_str());
+        errorCode = ERROR_DISK_FULL;
+        return nullptr;
+    }
+
+    TFTPUpload *upload = new TFTPUpload();
+    upload->fd = fd;
+    upload->path = path;
+    upload->tempPath = tempPath;
+    upload->failed = false;
+    upload->commitState = COMMIT_PENDING;
+    upload->committing = false;
+    upload->netascii = netascii;
+    initNetasciiDecoder(upload->decoder);
+    upload->chunk = nullptr;
+    upload->chunkOffset = 0;
+    upload->chunkLength = 0;
+    upload->length = 0;
+    upload->tailLength = 0;
+    return upload;
+}
+
+TFTPAppendResult appendUpload(TFTPUpload &upload, const uint8_t *data, size_t dataSize)
+{
+    if (upload.failed)
+    {
+        return APPEND_FAILED;
+    }
+
+    TFTPWriter &writer = workerWriter();
+
+    // Translation may add the CR held back from the previous block
+    size_t maxLength = upload.netascii ? dataSize + 1 : dataSize;
+    if (upload.chunk != nullptr && upload.chunkLength + maxLength > WRITE_CHUNK_SIZE)
+    {
+        submitChunk(writer, upload);
+    }
+    if (upload.chunk == nullptr)
+    {
+        upload.chunk = acquireChunk(writer);
+    }
+
+    size_t length = dataSize;
+    if (upload.netascii)
+    {
+        length = netasciiDecode(upload.decoder, reinterpret_cast<const char *>(data), dataSize, upload.chunk + upload.chunkLength);
+    }
+    else
+    {
+        memcpy(upload.chunk + upload.chunkLength, data, dataSize);
+    }
+    upload.chunkLength += length;
+    upload.length += length;
+    return APPEND_ACCEPTED;
+}
+
+bool commitUpload(TFTPUpload *upload)
+{
+    TFTPWriter &writer = workerWriter();
+
+    if (upload->failed)
+    {
+        abortUpload(upload);
+        return false;
+    }
+
+    // A CR ending the upload has no pair to complete, it is written with the commit and needs no chunk
+    if (upload->netascii)
+    {
+        upload->tailLength = netasciiFinish(upload->decoder, upload->tail);
+        upload->length += upload->tailLength;
+    }
+
+    if (upload->chunk != nullptr)
+    {
+        submitChunk(writer, *upload);
+    }
+    upload->committing = true;
+    submitRequest(writer, WRITE_COMMIT, upload, nullptr, 0, 0);
+    return true;
+}
+
+TFTPCommitState uploadCommitState(const TFTPUpload &upload)
+{
+    return static_cast<TFTPCommitState>(upload.commitState.load(std::memory_order_acquire));
+}
+
+void closeUpload(TFTPUpload *upload)
+{
+    // The writer thread releases an upload it is still committing
+    int pending = COMMIT_PENDING;
+    if (!upload->commitState.compare_exchange_strong(pending, COMMIT_ABANDONED))
+    {
+        releaseUpload(upload);
+    }
+}
+
+void abortUpload(TFTPUpload *upload)
+{
+    if (upload->committing)
+    {
+        closeUpload(upload);
+        return;
+    }
+
+    // The unwritten chunk travels with the request back to the free chunks
+    TFTPWriter &writer = workerWriter();
+    char *chunk = upload->chunk;
+    stopFilling(*upload);
+    submitRequest(writer, WRITE_ABORT, upload, chunk, 0, 0);
+}
+
+TFTPWriterStats writerStats()
+{
+    TFTPWriterStats stats;
+    stats.writes = writes;
+    stats.bytes = writtenBytes;
+    stats.extraChunks = extraChunks;
+    stats.commits = commits;
+    stats.aborts = aborts;
+    stats.failures = failures;
+    return stats;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file tftp-writer.h
+ * @brief Declarations for the asynchronous write pipeline of uploaded files (WRQ).
+ * @author xnovos14 - Denis Novosád
+ */
+
+#ifndef TFTP_WRITER_H
+#define TFTP_WRITER_H
+
+#include "tftp-server.h"
+#include "tftp-pool.h"
+#include "tftp-netascii.h"
+#include <semaphore.h>
+#include <sys/stat.h>
+
+// Received blocks are coalesced into chunks of this size before they are written
+const size_t WRITE_CHUNK_SIZE = 256 * 1024;
+
+// Preallocated chunks of one worker, more uploads than chunks get chunks allocated for them and freed once written
+const size_t WRITE_CHUNKS = 16;
+
+// Capacity of the queues between a worker and its writer thread (power of two)
+const size_t WRITE_QUEUE_SIZE = 64;
+
+// Progress of the commit of an upload, the party that sees the other's final state releases the upload
+enum TFTPCommitState
+{
+    COMMIT_PENDING,  // Queued to the writer thread or being committed
+    COMMIT_DONE,     // The file is durable and renamed over the destination
+    COMMIT_FAILED,   // A write, the fsync or the rename failed, the temporary file was removed
+    COMMIT_ABANDONED // The session was closed before the writer thread finished the commit
+};
+
+// File being uploaded, written to a temporary file renamed over the destination when complete
+struct TFTPUpload
+{
+    int fd;
+    std::string path;
+    std::string tempPath;
+    std::atomic<bool> failed; // Set by the writer thread when a write fails
+    std::atomic<int> commitState; // TFTPCommitState, set by the writer thread once the commit is done
+    bool committing;              // The commit was queued (used by the worker only)
+    bool netascii;            // Received data is translated from netascii
+    TFTPNetasciiDecoder decoder;
+
+    // Chunk being filled by the worker
+    char *chunk;
+    uint64_t chunkOffset;
+    size_t chunkLength;
+    uint64_t length; // Bytes of the file so far (after translation)
+
+    // CR ending a netascii upload, written by the writer thread before the commit
+    char tail[1];
+    size_t tailLength;
+};
+
+// Result of appending a block to an upload
+enum TFTPAppendResult
+{
+    APPEND_ACCEPTED, // The block was copied into the chunk of the upload
+    APPEND_FAILED    // An earlier write of the upload failed
+};
+
+// Operations passed to the writer thread
+enum TFTPWriteType
+{
+    WRITE_DATA,   // Write a chunk at its offset
+    WRITE_COMMIT, // Truncate to the received length, fsync and rename over the destination
+    WRITE_ABORT,  // Remove the temporary file
+    WRITE_STOP    // Terminate the writer thread
+};
+
+// One operation of the writer thread, the chunk (if any) is handed back once it is written
+struct TFTPWriteRequest
+{
+    TFTPWriteType type;
+    TFTPUpload *upload;
+    char *data;
+    uint64_t offset;
+    size_t length;
+};
+
+// Bounded lock-free queue with one producer and one consumer thread
+struct TFTPWriteQueue
+{
+    TFTPWriteRequest slots[WRITE_QUEUE_SIZE];
+    std::atomic<size_t> head; // Next slot read by the consumer
+    std::atomic<size_t> tail; // Next slot written by the producer
+};
+
+// Counters of the write pipeline, average write = bytes / writes
+struct TFTPWriterStats
+{
+    uint64_t writes;
+    uint64_t bytes;
+    uint64_t extraChunks; // Chunks allocated because all preallocated chunks of the worker were filled or queued
+    uint64_t commits;
+    uint64_t aborts;
+    uint64_t failures; // Failed writes, fsyncs or renames
+};
+
+/**
+ * @brief Creates the temporary file of an upload next to its destination.
+ *
+ * @param path Destination file path.
+ * @param preallocate Announced size of the file (tsize), 0 if unknown.
+ * @param netascii True if the data is translated from netascii.
+ * @param errorCode TFTP error code describing the failure.
+ * @return Newly allocated upload, or nullptr on failure.
+ */
+TFTPUpload *openUpload(const std::string &path, long long preallocate, bool netascii, uint16_t &errorCode);
+
+/**
+ * @brief Appends a received block to the upload, full chunks are passed to the writer thread.
+ *
+ * The worker never waits for a chunk. When all preallocated chunks are filled or queued, a chunk is
+ * allocated for the upload and freed by the writer thread once it is written.
+ *
+ * @param upload Upload of the session.
+ * @param data Block data.
+ * @param dataSize Size of the block data.
+ * @return APPEND_ACCEPTED, or APPEND_FAILED if an earlier write of the upload failed.
+ */
+TFTPAppendResult appendUpload(TFTPUpload &upload, const uint8_t *data, size_t dataSize);
+
+/**
+ * @brief Queues the rest of the upload and its commit (truncate, fsync and rename over the destination).
+ *
+ * The result is read with uploadCommitState and the upload is released with closeUpload.
+ *
+ * @param upload Upload of the session.
+ * @return False if an earlier write of the upload failed (the upload is aborted and released), otherwise True.
+ */
+bool commitUpload(TFTPUpload *upload);
+
+/**
+ * @brief Returns the progress of a queued commit.
+ *
+ * @param upload Upload of the session.
+ * @return COMMIT_PENDING until the writer thread finished, then COMMIT_DONE or COMMIT_FAILED.
+ */
+TFTPCommitState uploadCommitState(const TFTPUpload &upload);
+
+/**
+ * @brief Releases an upload whose commit was queued, an unfinished commit is completed and released by the writer thread.
+ *
+ * @param upload Upload of the session.
+ */
+void closeUpload(TFTPUpload *upload);
+
+/**
+ * @brief Queues the removal of an unfinished upload, the writer thread releases the upload.
+ *
+ * An upload whose commit was already queued is released with closeUpload instead.
+ *
+ * @param upload Upload of the session.
+ */
+void abortUpload(TFTPUpload *upload);
+
+/**
+ * @brief Returns a snapshot of the write pipeline counters.
+ *
+ * @return Write pipeline counters.
+ */
+TFTPWriterStats writerStats();
+
+#endif // TFTP_WRITER_H